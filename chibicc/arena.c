@@ -0,0 +1,133 @@
+#include "chibicc.h"
+
+// Most allocations are much smaller than this, so allocating memory in
+// chunks of this size amortizes the cost of malloc to almost nothing.
+#define CHUNK_SIZE (1024 * 1024)
+
+// Every object is aligned to this, which is enough for long double.
+#define ARENA_ALIGN 16
+
+typedef struct Chunk Chunk;
+struct Chunk {
+  Chunk *next;
+  char *ptr;
+  char *end;
+};
+
+typedef struct {
+  Chunk *chunks;
+  size_t reserved;
+} Arena;
+
+static Arena arenas[NUM_PHASES];
+static MemPhase phase;
+
+static size_t bytes[NUM_PHASES][NUM_MEM_KINDS];
+static long count[NUM_PHASES][NUM_MEM_KINDS];
+static size_t total_bytes;
+
+static char *phase_names[] = {"lex", "parse", "codegen"};
+
+static char *kind_names[] = {
+  "token", "atom", "hideset", "node", "node-ext", "type", "obj", "scope",
+  "member", "initializer", "ir", "asm",
+};
+
+static Chunk *new_chunk(Arena *arena, size_t size) {
+  // The header is rounded up so that the payload stays aligned.
+  size_t hdr = align_to(sizeof(Chunk), ARENA_ALIGN);
+  Chunk *c = calloc(1, hdr + size);
+  if (!c)
+    error("out of memory");
+  c->ptr = (char *)c + hdr;
+  c->end = c->ptr + size;
+  arena->reserved += hdr + size;
+  return c;
+}
+
+// Returns zero-initialized memory that is never freed.
+void *arena_alloc(MemKind kind, size_t size) {
+  size = align_to(size, ARENA_ALIGN);
+  bytes[phase][kind] += size;
+  count[phase][kind]++;
+  total_bytes += size;
+
+  Arena *arena = &arenas[phase];
+  Chunk *c = arena->chunks;
+
+  if (!c || c->end - c->ptr < size) {
+    // An oversized object gets a chunk of its own, which is linked
+    // behind the current chunk so that its free space isn't lost.
+    if (size > CHUNK_SIZE / 4) {
+      Chunk *big = new_chunk(arena, size);
+      if (c) {
+        big->next = c->next;
+        c->next = big;
+      } else {
+        arena->chunks = big;
+      }
+      big->ptr += size;
+      return big->end - size;
+    }
+
+    c = new_chunk(arena, CHUNK_SIZE);
+    c->next = arena->chunks;
+    arena->chunks = c;
+  }
+
+  void *p = c->ptr;
+  c->ptr += size;
+  return p;
+}
+
+void set_mem_phase(MemPhase p) {
+  phase = p;
+}
+
+// Returns the number of bytes allocated from all arenas so far.
+size_t arena_total(void) {
+  return total_bytes;
+}
+
+void print_mem_report(FILE *out) {
+  fprintf(out, "%-17s", "mem:");
+  for (int i = 0; i < NUM_PHASES; i++)
+    fprintf(out, " %12s", phase_names[i]);
+  fprintf(out, " %12s %10s\n", "total", "objects");
+
+  size_t total[NUM_PHASES] = {};
+
+  for (int k = 0; k < NUM_MEM_KINDS; k++) {
+    size_t sum = 0;
+    long n = 0;
+    for (int i = 0; i < NUM_PHASES; i++) {
+      sum += bytes[i][k];
+      n += count[i][k];
+      total[i] += bytes[i][k];
+    }
+    if (n == 0)
+      continue;
+
+    fprintf(out, "mem: %-12s", kind_names[k]);
+    for (int i = 0; i < NUM_PHASES; i++)
+      fprintf(out, " %12zu", bytes[i][k]);
+    fprintf(out, " %12zu %10ld\n", sum, n);
+  }
+
+  size_t sum = 0;
+  size_t reserved = 0;
+
+  fprintf(out, "%-17s", "mem: used");
+  for (int i = 0; i < NUM_PHASES; i++) {
+    fprintf(out, " %12zu", total[i]);
+    sum += total[i];
+  }
+  fprintf(out, " %12zu\n", sum);
+
+  fprintf(out, "%-17s", "mem: chunks");
+  for (int i = 0; i < NUM_PHASES; i++) {
+    fprintf(out, " %12zu", arenas[i].reserved);
+    reserved += arenas[i].reserved;
+  }
+  fprintf(out, " %12zu\n", reserved);
+}
@@ -11,13 +11,22 @@ const c_flags_default = [_][]const u8{
 const c_files = [_][]const u8{
     "main.c",
     "type.c",
+    "arena.c",
+    "timer.c",
     "codegen.c",
+    "emit.c",
+    "peephole.c",
+    "elf.c",
+    "fold.c",
+    "ir.c",
     "unicode.c",
     "strings.c",
     "hashmap.c",
     "tokenize.c",
+    "tokcache.c",
     "parse.c",
     "preprocess.c",
+    "pch.c",
 };
 
 pub fn build(b: *std.Build) void {
@@ -27,9 +27,14 @@
 
 typedef struct Type Type;
 typedef struct Node Node;
+typedef struct NodeExt NodeExt;
 typedef struct Member Member;
 typedef struct Relocation Relocation;
 typedef struct Hideset Hideset;
+typedef struct Macro Macro;
+typedef struct IRFunc IRFunc;
+typedef struct VarScope VarScope;
+typedef struct TagScope TagScope;
 
 //
 // strings.c
@@ -44,6 +49,77 @@ typedef struct {
 void strarray_push(StringArray *arr, char *s);
 char *format(char *fmt, ...) __attribute__((format(printf, 1, 2)));
 
+//
+// arena.c
+//
+
+// Objects that live until the end of compilation are carved out of
+// per-phase bump arenas instead of being allocated one by one.
+typedef enum {
+  PHASE_LEX,     // Tokenizing and preprocessing
+  PHASE_PARSE,   // Parsing
+  PHASE_CODEGEN, // Optimization and code generation
+  NUM_PHASES,
+} MemPhase;
+
+typedef enum {
+  MEM_TOKEN,
+  MEM_ATOM,
+  MEM_HIDESET,
+  MEM_NODE,
+  MEM_NODE_EXT,
+  MEM_TYPE,
+  MEM_OBJ,
+  MEM_SCOPE,
+  MEM_MEMBER,
+  MEM_INITIALIZER,
+  MEM_IR,
+  MEM_ASM,
+  NUM_MEM_KINDS,
+} MemKind;
+
+void *arena_alloc(MemKind kind, size_t size);
+void set_mem_phase(MemPhase phase);
+void print_mem_report(FILE *out);
+size_t arena_total(void);
+
+//
+// timer.c
+//
+
+typedef enum {
+  TV_OTHER,      // Anything not covered below
+  TV_READ,       // Reading source files
+  TV_TOKENIZE,   // Tokenizing source files
+  TV_PREPROCESS, // Preprocessing, excluding reading included files
+  TV_PARSE,      // Parsing and type checking
+  TV_CODEGEN,    // Optimization and code generation
+  TV_ASSEMBLE,   // The integrated assembler
+  TV_OUTPUT,     // Writing the output file
+  TV_CC1,        // cc1 subprocesses run by the driver
+  TV_AS,         // as subprocesses run by the driver
+  TV_LD,         // ld subprocesses run by the driver
+  NUM_TIMERS,
+} TimerVar;
+
+typedef enum {
+  STAT_FILES,            // Source files read
+  STAT_BYTES_READ,       // Bytes of source read
+  STAT_INCLUDES,         // #include directives processed
+  STAT_MACRO_EXPANSIONS, // Macros expanded
+  STAT_OUTPUT_BYTES,     // Bytes of assembly generated
+  NUM_STATS,
+} StatVar;
+
+extern bool opt_time_report;
+extern char *opt_time_report_file;
+extern long stat_count[NUM_STATS];
+
+void timer_init(void);
+TimerVar timer_start(TimerVar tv);
+void timer_resume(TimerVar tv);
+void print_time_report(char *process, char *input);
+
 //
 // tokenize.c
 //
@@ -69,38 +145,190 @@ typedef struct {
   int line_delta;
 } File;
 
+// Identifiers and punctuators are interned, so that tokens can be
+// compared by integer IDs instead of by their spellings. Keywords,
+// punctuators and identifiers that the preprocessor or the parser
+// look for have predefined IDs.
+typedef enum {
+  ATOM_NONE, // Not an identifier or a punctuator
+
+  // Keywords
+  KW_RETURN,
+  KW_IF,
+  KW_ELSE,
+  KW_FOR,
+  KW_WHILE,
+  KW_INT,
+  KW_SIZEOF,
+  KW_CHAR,
+  KW_STRUCT,
+  KW_UNION,
+  KW_SHORT,
+  KW_LONG,
+  KW_VOID,
+  KW_TYPEDEF,
+  KW__BOOL,
+  KW_ENUM,
+  KW_STATIC,
+  KW_GOTO,
+  KW_BREAK,
+  KW_CONTINUE,
+  KW_SWITCH,
+  KW_CASE,
+  KW_DEFAULT,
+  KW_EXTERN,
+  KW__ALIGNOF,
+  KW__ALIGNAS,
+  KW_DO,
+  KW_SIGNED,
+  KW_UNSIGNED,
+  KW_CONST,
+  KW_VOLATILE,
+  KW_AUTO,
+  KW_REGISTER,
+  KW_RESTRICT,
+  KW___RESTRICT,
+  KW___RESTRICT__,
+  KW__NORETURN,
+  KW_FLOAT,
+  KW_DOUBLE,
+  KW_TYPEOF,
+  KW_ASM,
+  KW__THREAD_LOCAL,
+  KW___THREAD,
+  KW__ATOMIC,
+  KW___ATTRIBUTE__,
+  KW_LAST = KW___ATTRIBUTE__,
+
+  // Punctuators
+  P_LPAREN,     // (
+  P_RPAREN,     // )
+  P_LBRACE,     // {
+  P_RBRACE,     // }
+  P_LBRACKET,   // [
+  P_RBRACKET,   // ]
+  P_COMMA,      // ,
+  P_SEMICOLON,  // ;
+  P_DOT,        // .
+  P_ARROW,      // ->
+  P_ELLIPSIS,   // ...
+  P_COLON,      // :
+  P_QUESTION,   // ?
+  P_ASSIGN,     // =
+  P_ADD_ASSIGN, // +=
+  P_SUB_ASSIGN, // -=
+  P_MUL_ASSIGN, // *=
+  P_DIV_ASSIGN, // /=
+  P_MOD_ASSIGN, // %=
+  P_AND_ASSIGN, // &=
+  P_OR_ASSIGN,  // |=
+  P_XOR_ASSIGN, // ^=
+  P_SHL_ASSIGN, // <<=
+  P_SHR_ASSIGN, // >>=
+  P_PLUS,       // +
+  P_MINUS,      // -
+  P_STAR,       // *
+  P_SLASH,      // /
+  P_PERCENT,    // %
+  P_AMP,        // &
+  P_PIPE,       // |
+  P_CARET,      // ^
+  P_TILDE,      // ~
+  P_NOT,        // !
+  P_SHL,        // <<
+  P_SHR,        // >>
+  P_INC,        // ++
+  P_DEC,        // --
+  P_LOGAND,     // &&
+  P_LOGOR,      // ||
+  P_EQ,         // ==
+  P_NE,         // !=
+  P_LT,         // <
+  P_LE,         // <=
+  P_GT,         // >
+  P_GE,         // >=
+  P_HASH,       // #
+  P_HASHHASH,   // ##
+
+  // Identifiers that have a special meaning in some context
+  ID_INLINE,
+  ID__GENERIC,
+  ID___BUILTIN_TYPES_COMPATIBLE_P,
+  ID___BUILTIN_REG_CLASS,
+  ID___BUILTIN_COMPARE_AND_SWAP,
+  ID___BUILTIN_ATOMIC_EXCHANGE,
+  ID_PACKED,
+  ID_ALIGNED,
+  ID_DEFINED,
+  ID_DEFINE,
+  ID_UNDEF,
+  ID_INCLUDE,
+  ID_INCLUDE_NEXT,
+  ID_IFDEF,
+  ID_IFNDEF,
+  ID_ELIF,
+  ID_ENDIF,
+  ID_LINE,
+  ID_PRAGMA,
+  ID_ONCE,
+  ID_ERROR,
+  ID___VA_ARGS__,
+  ID___VA_OPT__,
+
+  NUM_PREDEFINED_ATOMS,
+} AtomId;
+
+// There is only one atom for each distinct spelling.
+typedef struct {
+  char *name;
+  int len;
+  int id;        // AtomId, or a unique number for other atoms
+  uint64_t hash; // Hash value of the name
+  Macro *macro;  // Macro of this name if defined
+  VarScope *var; // Innermost visible declaration of this name
+  TagScope *tag; // Innermost visible struct/union/enum tag
+} Atom;
+
 // Token type
 typedef struct Token Token;
 struct Token {
   TokenKind kind;   // Token kind
+  int len;          // Token length
+  int line_no;      // Line number
+  int line_delta;   // Line number
+  bool at_bol;      // True if this token is at beginning of line
+  bool has_space;   // True if this token follows a space character
   Token *next;      // Next token
-  int64_t val;      // If kind is TK_NUM, its value
-  long double fval; // If kind is TK_NUM, its value
   char *loc;        // Token location
-  int len;          // Token length
+  Atom *atom;       // Interned spelling if TK_IDENT, TK_KEYWORD or TK_PUNCT
   Type *ty;         // Used if TK_NUM or TK_STR
   char *str;        // String literal contents including terminating '\0'
 
   File *file;       // Source location
   char *filename;   // Filename
-  int line_no;      // Line number
-  int line_delta;   // Line number
-  bool at_bol;      // True if this token is at beginning of line
-  bool has_space;   // True if this token follows a space character
   Hideset *hideset; // For macro expansion
   Token *origin;    // If this is expanded from a macro, the original token
+
+  // If kind is TK_NUM, its value. Which one is used depends on ty.
+  union {
+    int64_t val;
+    long double fval;
+  };
 };
 
 noreturn void error(char *fmt, ...) __attribute__((format(printf, 1, 2)));
 noreturn void error_at(char *loc, char *fmt, ...) __attribute__((format(printf, 2, 3)));
 noreturn void error_tok(Token *tok, char *fmt, ...) __attribute__((format(printf, 2, 3)));
 void warn_tok(Token *tok, char *fmt, ...) __attribute__((format(printf, 2, 3)));
-bool equal(Token *tok, char *op);
-Token *skip(Token *tok, char *op);
-bool consume(Token **rest, Token *tok, char *str);
+Atom *intern(char *name, int len);
+Atom *get_atom(AtomId id);
+bool equal(Token *tok, AtomId id);
+Token *skip(Token *tok, AtomId id);
+bool consume(Token **rest, Token *tok, AtomId id);
 void convert_pp_tokens(Token *tok);
 File **get_input_files(void);
 File *new_file(char *name, int file_no, char *contents);
+File *add_input_file(char *path, char *contents);
 Token *tokenize_string_literal(Token *tok, Type *basety);
 Token *tokenize(File *file);
 Token *tokenize_file(char *filename);
@@ -108,16 +336,51 @@ Token *tokenize_file(char *filename);
 #define unreachable() \
   error("internal error at %s:%d", __FILE__, __LINE__)
 
+//
+// tokcache.c
+//
+
+Token *load_cached_header(char *path, Atom **guard);
+void save_cached_header(char *path, Token *tok, Atom *guard);
+
 //
 // preprocess.c
 //
 
+typedef struct MacroParam MacroParam;
+struct MacroParam {
+  MacroParam *next;
+  Atom *name;
+};
+
+typedef Token *macro_handler_fn(Token *);
+
+struct Macro {
+  Atom *name;
+  bool is_objlike; // Object-like or function-like
+  MacroParam *params;
+  Atom *va_args_name;
+  Token *body;
+  macro_handler_fn *handler;
+};
+
 char *search_include_paths(char *filename);
 void init_macros(void);
 void define_macro(char *name, char *buf);
 void undef_macro(char *name);
+void record_macro_changes(void);
+Atom **get_macro_changes(int *len);
+bool is_pragma_once(char *path);
+void set_pragma_once(char *path);
 Token *preprocess(Token *tok);
 
+//
+// pch.c
+//
+
+void write_pch(char *path, Token *tok, char *signature);
+Token *read_pch(char *path, char *signature);
+
 //
 // parse.c
 //
@@ -134,6 +397,7 @@ struct Obj {
 
   // Local variable
   int offset;
+  int reg; // Register assigned by codegen, or 0 if it lives in memory
 
   // Global variable or function
   bool is_function;
@@ -154,8 +418,9 @@ struct Obj {
   Obj *va_area;
   Obj *alloca_bottom;
   int stack_size;
+  IRFunc *ir; // Lowered IR, or NULL if the function is compiled from the AST
 
-  // Static inline function
+  // Static function
   bool is_live;
   bool is_root;
   StringArray refs;
@@ -224,15 +489,54 @@ typedef enum {
   ND_EXCH,      // Atomic exchange
 } NodeKind;
 
+// Fields of rarely used node kinds are kept in a separate struct
+// so that they don't make every node bigger. Only one of the members
+// of the union is used by a node.
+struct NodeExt {
+  union {
+    // Function call
+    struct {
+      Type *func_ty;
+      Node *args;
+      Obj *ret_buffer;
+    };
+
+    // Goto or labeled statement, labels-as-values, switch or case
+    struct {
+      char *label;
+      char *unique_label;
+      Node *goto_next;
+      Node *case_next;
+      Node *default_case;
+      long begin;
+      long end;
+    };
+
+    // "asm" string literal
+    char *asm_str;
+
+    // Atomic compare-and-swap
+    struct {
+      Node *cas_addr;
+      Node *cas_old;
+      Node *cas_new;
+    };
+
+    // Floating-point literal
+    long double fval;
+  };
+};
+
 // AST node type
 struct Node {
-  NodeKind kind; // Node kind
-  Node *next;    // Next node
-  Type *ty;      // Type, e.g. int or pointer to int
-  Token *tok;    // Representative token
+  NodeKind kind;      // Node kind
+  bool pass_by_stack; // If this is a function argument, true if passed on stack
+  Node *next;         // Next node
+  Type *ty;           // Type, e.g. int or pointer to int
+  Token *tok;         // Representative token
 
-  Node *lhs;     // Left-hand side
-  Node *rhs;     // Right-hand side
+  Node *lhs;          // Left-hand side
+  Node *rhs;          // Right-hand side
 
   // "if" or "for" statement
   Node *cond;
@@ -251,43 +555,17 @@ struct Node {
   // Struct member access
   Member *member;
 
-  // Function call
-  Type *func_ty;
-  Node *args;
-  bool pass_by_stack;
-  Obj *ret_buffer;
-
-  // Goto or labeled statement, or labels-as-values
-  char *label;
-  char *unique_label;
-  Node *goto_next;
-
-  // Switch
-  Node *case_next;
-  Node *default_case;
-
-  // Case
-  long begin;
-  long end;
-
-  // "asm" string literal
-  char *asm_str;
-
-  // Atomic compare-and-swap
-  Node *cas_addr;
-  Node *cas_old;
-  Node *cas_new;
-
-  // Atomic op= operators
-  Obj *atomic_addr;
-  Node *atomic_expr;
-
-  // Variable
+  // Variable, or a variable declared by this statement
   Obj *var;
 
   // Numeric literal
   int64_t val;
-  long double fval;
+
+  // Fields used by only a few kinds of nodes
+  NodeExt *ext;
+
+  // Cached results of need_regs() in codegen.c plus one, or 0
+  int regs_needed[2];
 };
 
 Node *new_cast(Node *expr, Type *ty);
@@ -323,6 +601,7 @@ struct Type {
   int align;          // alignment
   bool is_unsigned;   // unsigned or signed
   bool is_atomic;     // true if _Atomic
+  bool is_volatile;   // true if volatile
   Type *origin;       // for type compatibility check
 
   // Pointer-to or array-of type. We intentionally use the same member
@@ -404,12 +683,96 @@ Type *enum_type(void);
 Type *struct_type(void);
 void add_type(Node *node);
 
+//
+// fold.c
+//
+
+void fold_function(Obj *fn);
+
+//
+// emit.c
+//
+
+// A growing buffer of output text. The contents are always
+// terminated by '\0'.
+typedef struct {
+  char *data;
+  long len;
+  long cap;
+} OutBuf;
+
+void out_reserve(OutBuf *out, long n);
+void out_add(OutBuf *out, char *s, long len);
+void out_str(OutBuf *out, char *s);
+void out_char(OutBuf *out, int c);
+void out_vformat(OutBuf *out, char *fmt, va_list *ap);
+void out_vprintf(OutBuf *out, char *fmt, va_list ap);
+void out_printf(OutBuf *out, char *fmt, ...);
+void out_write(OutBuf *out, char *path);
+void emit_bench(char *path);
+
 //
 // codegen.c
 //
 
-void codegen(Obj *prog, FILE *out);
+// A case label of a switch statement. `lo` and `hi` are the bounds
+// biased so that they order as unsigned numbers the same way the
+// values compare at runtime.
+typedef struct {
+  long begin;
+  long end;
+  uint64_t lo;
+  uint64_t hi;
+  char *label;
+} SwitchCase;
+
+typedef enum {
+  SW_LINEAR, // A chain of comparisons
+  SW_TREE,   // A balanced binary search over sorted cases
+  SW_TABLE,  // An indirect jump through a table in .rodata
+} SwitchKind;
+
+void codegen(Obj *prog, OutBuf *out);
 int align_to(int n, int align);
+bool is_setjmp(Node *node);
+Type *switch_type(Type *ty);
+SwitchKind switch_cases(Node *node, SwitchCase **cases, int *len);
+
+//
+// peephole.c
+//
+
+typedef enum {
+  AL_INSN,  // Instruction
+  AL_LABEL, // Label
+  AL_LOC,   // .loc directive
+  AL_RAW,   // Anything else, e.g. other directives or inline assembly
+} AsmLineKind;
+
+// A line of assembly
+typedef struct AsmLine AsmLine;
+struct AsmLine {
+  AsmLineKind kind;
+  AsmLine *next;
+  AsmLine *prev;
+
+  char *op;      // Mnemonic, label name, or the whole line if not AL_INSN
+  char *args[3]; // Operands
+  int nargs;
+  char *comment; // Trailing comment of an instruction, or NULL
+};
+
+AsmLine *new_asm_line(char *fmt, va_list *ap);
+AsmLine *new_raw_asm_line(char *text);
+void print_asm_lines(AsmLine *line, OutBuf *out);
+AsmLine *peephole(AsmLine *lines);
+void print_peephole_stats(FILE *out);
+
+//
+// elf.c
+//
+
+bool assemble_elf(char *text, char *path);
 
 //
 // unicode.c
@@ -428,6 +791,7 @@ int display_width(char *p, int len);
 typedef struct {
   char *key;
   int keylen;
+  uint32_t hash; // Low 32 bits of the hash value of the key
   void *val;
 } HashEntry;
 
@@ -443,7 +807,102 @@ void hashmap_put(HashMap *map, char *key, void *val);
 void hashmap_put2(HashMap *map, char *key, int keylen, void *val);
 void hashmap_delete(HashMap *map, char *key);
 void hashmap_delete2(HashMap *map, char *key, int keylen);
+void *hashmap_get_atom(HashMap *map, Atom *atom);
+void hashmap_put_atom(HashMap *map, Atom *atom, void *val);
+void hashmap_reserve(HashMap *map, int n);
+uint64_t hash_bytes(char *s, int len);
 void hashmap_test(void);
+void hashmap_bench(char *path);
+
+//
+// ir.c
+//
+
+typedef struct BasicBlock BasicBlock;
+typedef struct IRInsn IRInsn;
+
+// IR instructions. d, a and b are virtual registers. A binary
+// instruction whose b is 0 takes `imm` as its right-hand side.
+typedef enum {
+  IR_IMM,     // d = imm
+  IR_MOV,     // d = a
+  IR_PARAM,   // d = imm'th parameter
+  IR_LVAR,    // d = address of local variable `var`
+  IR_GADDR,   // d = address of global variable or function `var`
+  IR_LOAD,    // d = *a
+  IR_STORE,   // *a = b
+  IR_EXT,     // d = a, truncated and extended as if stored and reloaded
+  IR_CAST,    // d = a, converted from `from` to `ty`
+  IR_ADD,     // d = a + b
+  IR_SUB,     // d = a - b
+  IR_MUL,     // d = a * b
+  IR_DIV,     // d = a / b
+  IR_MOD,     // d = a % b
+  IR_BITAND,  // d = a & b
+  IR_BITOR,   // d = a | b
+  IR_BITXOR,  // d = a ^ b
+  IR_SHL,     // d = a << b
+  IR_SHR,     // d = a >> b
+  IR_EQ,      // d = a == b
+  IR_NE,      // d = a != b
+  IR_LT,      // d = a < b
+  IR_LE,      // d = a <= b
+  IR_NEG,     // d = -a
+  IR_BITNOT,  // d = ~a
+  IR_MEMZERO, // Zero-clear `var`
+  IR_CALL,    // d = a(args...)
+  IR_JMP,     // goto then
+  IR_BR,      // if (a) goto then; else goto els
+  IR_SWITCH,  // goto targets[a - imm] if it is in range; else goto then
+  IR_RET,     // return a
+} IROp;
+
+struct IRInsn {
+  IRInsn *next;
+  IROp op;
+  int d, a, b;
+  int64_t imm;
+  Type *ty;   // Operand type, or the type to convert to
+  Type *from; // Type to convert from
+  Obj *var;
+  Token *tok;
+  bool dead;
+
+  // Function call
+  int *args;
+  int nargs;
+
+  // Jump targets
+  BasicBlock *then;
+  BasicBlock *els;
+  BasicBlock **targets;
+  int ntargets;
+};
+
+struct BasicBlock {
+  BasicBlock *next;
+  int id;
+  IRInsn *insns;
+  bool reachable;
+  int npreds;
+};
+
+struct IRFunc {
+  Obj *fn;
+  BasicBlock *bbs; // The first one is the entry block
+  BasicBlock *last;
+  int nbbs;
+  int nregs;       // Virtual registers are numbered from 1
+  HashMap escaped; // Local variables whose addresses escape
+};
+
+#define IR_MAX_USES 8
+
+IRFunc *lower_function(Obj *fn);
+void optimize_ir(IRFunc *fn);
+void inline_functions(Obj *prog);
+void dump_ir(IRFunc *fn, FILE *out);
+int ir_uses(IRInsn *insn, int **uses);
 
 //
 // main.c
@@ -454,4 +913,9 @@ bool file_exists(char *path);
 extern StringArray include_paths;
 extern bool opt_fpic;
 extern bool opt_fcommon;
+extern int opt_O;
+extern bool opt_dump_ir;
+extern bool opt_peephole;
+extern bool opt_peephole_stats;
+extern char *opt_header_cache;
 extern char *base_file;
@@ -3,7 +3,7 @@
 #define GP_MAX 6
 #define FP_MAX 8
 
-static FILE *output_file;
+static OutBuf *output;
 static int depth;
 static char *argreg8[] = {"%dil", "%sil", "%dl", "%cl", "%r8b", "%r9b"};
 static char *argreg16[] = {"%di", "%si", "%dx", "%cx", "%r8w", "%r9w"};
@@ -11,16 +11,145 @@ static char *argreg32[] = {"%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d"};
 static char *argreg64[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
 static Obj *current_fn;
 
+// Registers handed out by the register allocator. %rbx and %r12-%r15
+// are callee-saved, so values kept in them survive function calls.
+// %r11 and %xmm8-%xmm15 are caller-saved and not otherwise used by
+// the code generator, so they can hold a value as long as no function
+// is called while the value is live.
+enum {
+  REG_NONE,
+  REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15,
+  REG_R11,
+  REG_XMM8, REG_XMM9, REG_XMM10, REG_XMM11,
+  REG_XMM12, REG_XMM13, REG_XMM14, REG_XMM15,
+  REG_END,
+};
+
+#define CALLEE_SAVED \
+  (1 << REG_RBX | 1 << REG_R12 | 1 << REG_R13 | 1 << REG_R14 | 1 << REG_R15)
+
+// %xmm8-%xmm11 hold local variables and %xmm12-%xmm15 temporaries.
+#define XMM_LOCALS \
+  (1 << REG_XMM8 | 1 << REG_XMM9 | 1 << REG_XMM10 | 1 << REG_XMM11)
+
+static char *regname64[] = {
+  NULL, "%rbx", "%r12", "%r13", "%r14", "%r15", "%r11",
+  "%xmm8", "%xmm9", "%xmm10", "%xmm11", "%xmm12", "%xmm13", "%xmm14", "%xmm15",
+};
+
+static char *regname32[] = {
+  NULL, "%ebx", "%r12d", "%r13d", "%r14d", "%r15d", "%r11d",
+};
+
+static int tmp_pool;  // Callee-saved registers usable for temporaries
+static int tmp_busy;  // Temporary registers currently holding a value
+static int regs_used; // Callee-saved registers the function touches
+
 static void gen_expr(Node *node);
 static void gen_stmt(Node *node);
 
+// While the text of a function is generated, it is held back so that
+// the prologue can be emitted before it. If the peephole optimizer is
+// going to run, lines are collected in a list so that it can rewrite
+// them. Otherwise the text is kept as is in fn_text.
+static bool buffering;
+static AsmLine *buf_head;
+static AsmLine *buf_tail;
+static OutBuf fn_text;
+
+// Where println() appends text: output or fn_text
+static OutBuf *cur_out;
+
+// Appends lines first..last to the buffer.
+static void buffer_lines(AsmLine *first, AsmLine *last) {
+  if (!first)
+    return;
+  first->prev = buf_tail;
+  if (buf_tail)
+    buf_tail->next = first;
+  else
+    buf_head = first;
+  buf_tail = last;
+}
+
 __attribute__((format(printf, 1, 2)))
 static void println(char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  vfprintf(output_file, fmt, ap);
+
+  if (!buffering) {
+    out_vprintf(cur_out, fmt, ap);
+    va_end(ap);
+    out_char(cur_out, '\n');
+    return;
+  }
+
+  AsmLine *l = new_asm_line(fmt, &ap);
   va_end(ap);
-  fprintf(output_file, "\n");
+  buffer_lines(l, l);
+}
+
+// Emits a line of inline assembly, which the peephole optimizer
+// leaves alone.
+static void println_raw(char *text) {
+  if (!buffering) {
+    println("  %s", text);
+    return;
+  }
+
+  AsmLine *l = new_raw_asm_line(format("  %s", text));
+  buffer_lines(l, l);
+}
+
+// Emits an indented line that has no conversions. The most frequent
+// lines are kept as complete strings, so that they can be copied out
+// without going through the formatter.
+static void emit_line(char *line) {
+  if (!buffering) {
+    out_str(cur_out, line);
+    out_char(cur_out, '\n');
+    return;
+  }
+  println("  %s", line + 2);
+}
+
+static void begin_buffering(void) {
+  if (opt_peephole) {
+    buffering = true;
+    buf_head = buf_tail = NULL;
+    return;
+  }
+  fn_text.len = 0;
+  cur_out = &fn_text;
+}
+
+// Starts emitting text before what has been buffered so far.
+// The held-back text is appended by release_buffer().
+static void hold_buffer(AsmLine **head, AsmLine **tail) {
+  *head = buf_head;
+  *tail = buf_tail;
+  buf_head = buf_tail = NULL;
+  cur_out = output;
+}
+
+static void release_buffer(AsmLine *head, AsmLine *tail) {
+  if (buffering)
+    buffer_lines(head, tail);
+  else
+    out_add(output, fn_text.data, fn_text.len);
+}
+
+// Optimizes the buffered lines and writes them out.
+static void flush_buffer(void) {
+  if (!buffering) {
+    if (cur_out == &fn_text)
+      out_add(output, fn_text.data, fn_text.len);
+    cur_out = output;
+    return;
+  }
+
+  buffering = false;
+  print_asm_lines(peephole(buf_head), output);
 }
 
 static int count(void) {
@@ -29,7 +158,7 @@ static int count(void) {
 }
 
 static void push(void) {
-  println("  push %%rax");
+  emit_line("  push %rax");
   depth++;
 }
 
@@ -50,6 +179,71 @@ static void popf(int reg) {
   depth--;
 }
 
+// Save %rax until the matching pop_tmp(). Unlike push(), which is
+// also used to pass arguments, this keeps the value in a free
+// callee-saved register if there is one.
+static int push_tmp(void) {
+  for (int r = REG_RBX; r <= REG_R15; r++) {
+    if ((tmp_pool & (1 << r)) && !(tmp_busy & (1 << r))) {
+      tmp_busy |= 1 << r;
+      regs_used |= 1 << r;
+      println("  mov %%rax, %s", regname64[r]);
+      return r;
+    }
+  }
+
+  push();
+  return REG_NONE;
+}
+
+static void pop_tmp(int r, char *arg) {
+  if (r == REG_NONE) {
+    pop(arg);
+    return;
+  }
+
+  println("  mov %s, %s", regname64[r], arg);
+  tmp_busy &= ~(1 << r);
+}
+
+// Read a value saved by push_tmp() without releasing it.
+static void peek_tmp(int r, char *arg) {
+  if (r == REG_NONE)
+    println("  mov (%%rsp), %s", arg);
+  else
+    println("  mov %s, %s", regname64[r], arg);
+}
+
+static bool has_call(Node *node);
+
+// Save %xmm0 until the matching popf_tmp(). All XMM registers are
+// caller-saved, so a spare one is used only if `clobber`, which is
+// evaluated while the value is held, does not call a function.
+static int pushf_tmp(Node *clobber) {
+  if (!has_call(clobber)) {
+    for (int r = REG_XMM12; r <= REG_XMM15; r++) {
+      if (!(tmp_busy & (1 << r))) {
+        tmp_busy |= 1 << r;
+        println("  movaps %%xmm0, %s", regname64[r]);
+        return r;
+      }
+    }
+  }
+
+  pushf();
+  return REG_NONE;
+}
+
+static void popf_tmp(int r, int reg) {
+  if (r == REG_NONE) {
+    popf(reg);
+    return;
+  }
+
+  println("  movaps %s, %%xmm%d", regname64[r], reg);
+  tmp_busy &= ~(1 << r);
+}
+
 // Round up `n` to the nearest multiple of `align`. For instance,
 // align_to(5, 8) returns 8 and align_to(11, 8) returns 16.
 int align_to(int n, int align) {
@@ -76,6 +270,152 @@ static char *reg_ax(int sz) {
   unreachable();
 }
 
+static char *reg_r8(int sz) {
+  switch (sz) {
+  case 1: return "%r8b";
+  case 2: return "%r8w";
+  case 4: return "%r8d";
+  case 8: return "%r8";
+  }
+  unreachable();
+}
+
+// Blocks larger than this are copied or cleared with `rep movsb` or
+// `rep stosb`, whose startup cost is paid off by then.
+#define REP_THRESHOLD 256
+
+// Returns the width of the next move of a block whose first `*pos`
+// bytes are done. The last move is widened to overlap with the
+// previous one if that saves instructions, in which case `*pos` is
+// moved back.
+static int next_move(int *pos, int size) {
+  int rem = size - *pos;
+  int sz = 1;
+  while (sz < rem && sz < 16)
+    sz *= 2;
+  if (sz > size)
+    return sz / 2;
+  if (sz > rem)
+    *pos = size - sz;
+  return sz;
+}
+
+// Copy `size` bytes from (src) to (dst) using the widest moves that
+// fit, through %r8 and %xmm1. Large blocks use `rep movsb`, which
+// clobbers %rsi, %rdi and %rcx.
+static void copy_mem(char *src, char *dst, int size) {
+  if (size > REP_THRESHOLD) {
+    println("  mov %s, %%rsi", src);
+    if (strcmp(dst, "%rdi"))
+      println("  mov %s, %%rdi", dst);
+    println("  mov $%d, %%rcx", size);
+    println("  rep movsb");
+    return;
+  }
+
+  for (int i = 0; i < size;) {
+    int sz = next_move(&i, size);
+    if (sz == 16) {
+      println("  movups %d(%s), %%xmm1", i, src);
+      println("  movups %%xmm1, %d(%s)", i, dst);
+    } else {
+      println("  mov %d(%s), %s", i, src, reg_r8(sz));
+      println("  mov %s, %d(%s)", reg_r8(sz), i, dst);
+    }
+    i += sz;
+  }
+}
+
+// Zero-clear `size` bytes at `offset(%rbp)`. Large blocks use
+// `rep stosb`, which clobbers %rax, %rdi and %rcx.
+static void zero_mem(int offset, int size) {
+  if (size > REP_THRESHOLD) {
+    // `rep stosb` is equivalent to `memset(%rdi, %al, %rcx)`.
+    println("  mov $%d, %%rcx", size);
+    println("  lea %d(%%rbp), %%rdi", offset);
+    println("  mov $0, %%al");
+    println("  rep stosb");
+    return;
+  }
+
+  bool xmm_zero = false, gp_zero = false;
+  for (int i = 0; i < size;) {
+    int sz = next_move(&i, size);
+    if (sz == 16) {
+      if (!xmm_zero)
+        println("  xorps %%xmm1, %%xmm1");
+      xmm_zero = true;
+      println("  movups %%xmm1, %d(%%rbp)", offset + i);
+    } else {
+      if (!gp_zero)
+        println("  xor %%r8d, %%r8d");
+      gp_zero = true;
+      println("  mov %s, %d(%%rbp)", reg_r8(sz), offset + i);
+    }
+    i += sz;
+  }
+}
+
+// Compute the address of a global variable or a function.
+static void gen_global_addr(Obj *var) {
+  if (opt_fpic) {
+    // Thread-local variable
+    if (var->is_tls) {
+      println("  data16 lea %s@tlsgd(%%rip), %%rdi", var->name);
+      println("  .value 0x6666");
+      println("  rex64");
+      println("  call __tls_get_addr@PLT");
+      return;
+    }
+
+    // Function or global variable
+    println("  mov %s@GOTPCREL(%%rip), %%rax", var->name);
+    return;
+  }
+
+  // Thread-local variable
+  if (var->is_tls) {
+    println("  mov %%fs:0, %%rax");
+    println("  add $%s@tpoff, %%rax", var->name);
+    return;
+  }
+
+  // Here, we generate an absolute address of a function or a global
+  // variable. Even though they exist at a certain address at runtime,
+  // their addresses are not known at link-time for the following
+  // two reasons.
+  //
+  //  - Address randomization: Executables are loaded to memory as a
+  //    whole but it is not known what address they are loaded to.
+  //    Therefore, at link-time, relative address in the same
+  //    exectuable (i.e. the distance between two functions in the
+  //    same executable) is known, but the absolute address is not
+  //    known.
+  //
+  //  - Dynamic linking: Dynamic shared objects (DSOs) or .so files
+  //    are loaded to memory alongside an executable at runtime and
+  //    linked by the runtime loader in memory. We know nothing
+  //    about addresses of global stuff that may be defined by DSOs
+  //    until the runtime relocation is complete.
+  //
+  // In order to deal with the former case, we use RIP-relative
+  // addressing, denoted by `(%rip)`. For the latter, we obtain an
+  // address of a stuff that may be in a shared object file from the
+  // Global Offset Table using `@GOTPCREL(%rip)` notation.
+
+  // Function
+  if (var->ty->kind == TY_FUNC) {
+    if (var->is_definition)
+      println("  lea %s(%%rip), %%rax", var->name);
+    else
+      println("  mov %s@GOTPCREL(%%rip), %%rax", var->name);
+    return;
+  }
+
+  // Global variable
+  println("  lea %s(%%rip), %%rax", var->name);
+}
+
 // Compute the absolute address of a given node.
 // It's an error if a given node does not reside in memory.
 static void gen_addr(Node *node) {
@@ -93,62 +433,7 @@ static void gen_addr(Node *node) {
       return;
     }
 
-    if (opt_fpic) {
-      // Thread-local variable
-      if (node->var->is_tls) {
-        println("  data16 lea %s@tlsgd(%%rip), %%rdi", node->var->name);
-        println("  .value 0x6666");
-        println("  rex64");
-        println("  call __tls_get_addr@PLT");
-        return;
-      }
-
-      // Function or global variable
-      println("  mov %s@GOTPCREL(%%rip), %%rax", node->var->name);
-      return;
-    }
-
-    // Thread-local variable
-    if (node->var->is_tls) {
-      println("  mov %%fs:0, %%rax");
-      println("  add $%s@tpoff, %%rax", node->var->name);
-      return;
-    }
-
-    // Here, we generate an absolute address of a function or a global
-    // variable. Even though they exist at a certain address at runtime,
-    // their addresses are not known at link-time for the following
-    // two reasons.
-    //
-    //  - Address randomization: Executables are loaded to memory as a
-    //    whole but it is not known what address they are loaded to.
-    //    Therefore, at link-time, relative address in the same
-    //    exectuable (i.e. the distance between two functions in the
-    //    same executable) is known, but the absolute address is not
-    //    known.
-    //
-    //  - Dynamic linking: Dynamic shared objects (DSOs) or .so files
-    //    are loaded to memory alongside an executable at runtime and
-    //    linked by the runtime loader in memory. We know nothing
-    //    about addresses of global stuff that may be defined by DSOs
-    //    until the runtime relocation is complete.
-    //
-    // In order to deal with the former case, we use RIP-relative
-    // addressing, denoted by `(%rip)`. For the latter, we obtain an
-    // address of a stuff that may be in a shared object file from the
-    // Global Offset Table using `@GOTPCREL(%rip)` notation.
-
-    // Function
-    if (node->ty->kind == TY_FUNC) {
-      if (node->var->is_definition)
-        println("  lea %s(%%rip), %%rax", node->var->name);
-      else
-        println("  mov %s@GOTPCREL(%%rip), %%rax", node->var->name);
-      return;
-    }
-
-    // Global variable
-    println("  lea %s(%%rip), %%rax", node->var->name);
+    gen_global_addr(node->var);
     return;
   case ND_DEREF:
     gen_expr(node->lhs);
@@ -162,7 +447,7 @@ static void gen_addr(Node *node) {
     println("  add $%d, %%rax", node->member->offset);
     return;
   case ND_FUNCALL:
-    if (node->ret_buffer) {
+    if (node->ext->ret_buffer) {
       gen_expr(node);
       return;
     }
@@ -182,6 +467,22 @@ static void gen_addr(Node *node) {
   error_tok(node->tok, "not an lvalue");
 }
 
+// Instructions to load a scalar, indexed by size and signedness
+static char *load_insn[9][2] = {
+  [1] = {"  movsbl (%rax), %eax", "  movzbl (%rax), %eax"},
+  [2] = {"  movswl (%rax), %eax", "  movzwl (%rax), %eax"},
+  [4] = {"  movsxd (%rax), %rax", "  movsxd (%rax), %rax"},
+  [8] = {"  mov (%rax), %rax", "  mov (%rax), %rax"},
+};
+
+// Instructions to store %rax, indexed by size
+static char *store_insn[9] = {
+  [1] = "  mov %al, (%rdi)",
+  [2] = "  mov %ax, (%rdi)",
+  [4] = "  mov %eax, (%rdi)",
+  [8] = "  mov %rax, (%rdi)",
+};
+
 // Load a value from where %rax is pointing to.
 static void load(Type *ty) {
   switch (ty->kind) {
@@ -208,34 +509,22 @@ static void load(Type *ty) {
     return;
   }
 
-  char *insn = ty->is_unsigned ? "movz" : "movs";
-
   // When we load a char or a short value to a register, we always
   // extend them to the size of int, so we can assume the lower half of
   // a register always contains a valid value. The upper half of a
   // register for char, short and int may contain garbage. When we load
   // a long value to a register, it simply occupies the entire register.
-  if (ty->size == 1)
-    println("  %sbl (%%rax), %%eax", insn);
-  else if (ty->size == 2)
-    println("  %swl (%%rax), %%eax", insn);
-  else if (ty->size == 4)
-    println("  movsxd (%%rax), %%rax");
-  else
-    println("  mov (%%rax), %%rax");
+  emit_line(load_insn[ty->size][ty->is_unsigned]);
 }
 
-// Store %rax to an address that the stack top is pointing to.
-static void store(Type *ty) {
-  pop("%rdi");
+// Store %rax to an address saved by push_tmp().
+static void store(Type *ty, int tmp) {
+  pop_tmp(tmp, "%rdi");
 
   switch (ty->kind) {
   case TY_STRUCT:
   case TY_UNION:
-    for (int i = 0; i < ty->size; i++) {
-      println("  mov %d(%%rax), %%r8b", i);
-      println("  mov %%r8b, %d(%%rdi)", i);
-    }
+    copy_mem("%rax", "%rdi", ty->size);
     return;
   case TY_FLOAT:
     println("  movss %%xmm0, (%%rdi)");
@@ -248,14 +537,43 @@ static void store(Type *ty) {
     return;
   }
 
+  emit_line(store_insn[ty->size]);
+}
+
+static bool is_reg_var(Node *node) {
+  return node->kind == ND_VAR && node->var->reg;
+}
+
+// Load a register-allocated local variable to %rax or %xmm0.
+static void load_reg(Obj *var) {
+  if (is_flonum(var->ty))
+    println("  movaps %s, %%xmm0", regname64[var->reg]);
+  else
+    println("  mov %s, %%rax", regname64[var->reg]);
+}
+
+// Store %rax or %xmm0 to a register-allocated local variable. The
+// value is extended in the same way as load() would extend it after
+// a round trip through memory.
+static void store_reg(Obj *var) {
+  Type *ty = var->ty;
+  int r = var->reg;
+
+  if (is_flonum(ty)) {
+    println("  movaps %%xmm0, %s", regname64[r]);
+    return;
+  }
+
+  char *insn = ty->is_unsigned ? "movz" : "movs";
+
   if (ty->size == 1)
-    println("  mov %%al, (%%rdi)");
+    println("  %sbl %%al, %s", insn, regname32[r]);
   else if (ty->size == 2)
-    println("  mov %%ax, (%%rdi)");
+    println("  %swl %%ax, %s", insn, regname32[r]);
   else if (ty->size == 4)
-    println("  mov %%eax, (%%rdi)");
+    println("  movsxd %%eax, %s", regname64[r]);
   else
-    println("  mov %%rax, (%%rdi)");
+    println("  mov %%rax, %s", regname64[r]);
 }
 
 static void cmp_zero(Type *ty) {
@@ -404,6 +722,372 @@ static void cast(Type *from, Type *to) {
     println("  %s", cast_table[t1][t2]);
 }
 
+// Returns true if cast() emits no instruction for a given conversion.
+static bool is_nop_cast(Type *from, Type *to) {
+  if (to->kind == TY_VOID || to->kind == TY_BOOL)
+    return false;
+
+  bool from_int = is_integer(from) || from->kind == TY_PTR;
+  bool to_int = is_integer(to) || to->kind == TY_PTR;
+  if (from_int != to_int)
+    return false;
+  if (!from_int && (from->kind != to->kind || from->kind == TY_LDOUBLE))
+    return false;
+  return !cast_table[getTypeId(from)][getTypeId(to)];
+}
+
+static Node *skip_nop_casts(Node *node) {
+  while (node->kind == ND_CAST && is_nop_cast(node->lhs->ty, node->ty))
+    node = node->lhs;
+  return node;
+}
+
+// If `node` is an integer constant, possibly wrapped in integer casts,
+// computes its value.
+static bool int_const(Node *node, int64_t *val) {
+  if (node->kind == ND_NUM && is_integer(node->ty)) {
+    *val = node->val;
+    return true;
+  }
+
+  if (node->kind != ND_CAST || !is_integer(node->lhs->ty) ||
+      !(is_integer(node->ty) || node->ty->kind == TY_PTR) ||
+      node->ty->kind == TY_BOOL || !int_const(node->lhs, val))
+    return false;
+
+  switch (node->ty->size) {
+  case 1: *val = node->ty->is_unsigned ? (uint8_t)*val : (int8_t)*val; break;
+  case 2: *val = node->ty->is_unsigned ? (uint16_t)*val : (int16_t)*val; break;
+  case 4: *val = node->ty->is_unsigned ? (uint32_t)*val : (int32_t)*val; break;
+  }
+  return true;
+}
+
+// Divides the 128-bit unsigned integer hi:lo by d. hi must be less
+// than d so that the quotient fits in 64 bits.
+static uint64_t udiv128(uint64_t hi, uint64_t lo, uint64_t d, uint64_t *rem) {
+  uint64_t q = 0;
+  for (int i = 0; i < 64; i++) {
+    bool carry = hi >> 63;
+    hi = hi << 1 | lo >> 63;
+    lo <<= 1;
+    q <<= 1;
+    if (carry || hi >= d) {
+      hi -= d;
+      q |= 1;
+    }
+  }
+  *rem = hi;
+  return q;
+}
+
+// Computes the multiplier that replaces division of a `bits`-bit
+// integer by `d`, which must not be a power of two, as described in
+// Granlund and Montgomery, "Division by Invariant Integers using
+// Multiplication". If the multiplier needs one bit more than the word,
+// only its lower bits are returned and `add` is set, in which case the
+// dividend has to be added to the upper half of the product.
+static uint64_t div_magic(uint64_t d, int bits, bool is_signed, int *shift, bool *add) {
+  int lg = 63;
+  while (!(d >> lg))
+    lg--;
+
+  int p = is_signed ? lg - 1 : lg;
+  uint64_t rem;
+  uint64_t m;
+  if (bits == 64)
+    m = udiv128((uint64_t)1 << p, 0, d, &rem);
+  else
+    m = udiv128(0, (uint64_t)1 << (p + 32), d, &rem);
+
+  if (d - rem < ((uint64_t)1 << lg)) {
+    *shift = p;
+    *add = false;
+  } else {
+    m += m;
+    uint64_t rem2 = rem + rem;
+    if (rem2 >= d || rem2 < rem)
+      m++;
+    *shift = lg;
+    *add = true;
+  }
+
+  m++;
+  return bits == 64 ? m : (uint32_t)m;
+}
+
+static int log2_of(uint64_t val) {
+  if (!val || (val & (val - 1)))
+    return -1;
+
+  int n = 0;
+  while (val >>= 1)
+    n++;
+  return n;
+}
+
+// Divides %rax by a constant without a `div` instruction, leaving the
+// quotient or, if `is_mod`, the remainder in %rax. Clobbers %rdi and
+// %rdx. Returns false if the divisor is zero.
+static bool gen_div_const(int64_t val, bool is64, bool is_unsigned, bool is_mod) {
+  int bits = is64 ? 64 : 32;
+  char *ax = is64 ? "%rax" : "%eax";
+  char *di = is64 ? "%rdi" : "%edi";
+  char *dx = is64 ? "%rdx" : "%edx";
+
+  if (!is64 && is_unsigned)
+    val = (uint32_t)val;
+  else if (!is64)
+    val = (int32_t)val;
+  if (val == 0)
+    return false;
+
+  uint64_t d = val;
+  if (!is_unsigned && val < 0)
+    d = -(uint64_t)val;
+  if (!is64)
+    d = (uint32_t)d;
+
+  // The remainder is computed from the quotient as x - q * d.
+  println("  mov %s, %s", ax, di);
+
+  int k = log2_of(d);
+  if (k == 0) {
+    if (!is_unsigned && val < 0)
+      println("  neg %s", ax);
+  } else if (k > 0 && is_unsigned) {
+    println("  shr $%d, %s", k, ax);
+  } else if (k > 0) {
+    // Round toward zero by adding d - 1 to a negative dividend.
+    println("  mov %s, %s", ax, dx);
+    if (k > 1)
+      println("  sar $%d, %s", bits - 1, dx);
+    println("  shr $%d, %s", bits - k, dx);
+    println("  add %s, %s", dx, ax);
+    println("  sar $%d, %s", k, ax);
+    if (val < 0)
+      println("  neg %s", ax);
+  } else {
+    int shift;
+    bool add;
+    uint64_t magic = div_magic(d, bits, !is_unsigned, &shift, &add);
+    if (!is_unsigned && val < 0)
+      magic = is64 ? -magic : (uint32_t)-magic;
+
+    // Compute the upper half of the product of the dividend and the
+    // multiplier.
+    if (is64) {
+      println("  mov $%ld, %%rdx", magic);
+      println("  %s %%rdx", is_unsigned ? "mul" : "imul");
+      println("  mov %%rdx, %%rax");
+    } else if (is_unsigned) {
+      println("  mov $%lu, %%eax", magic);
+      println("  imul %%rdi, %%rax");
+      println("  shr $32, %%rax");
+    } else {
+      println("  movsxd %%edi, %%rax");
+      println("  imul $%d, %%rax", (int32_t)magic);
+      println("  sar $32, %%rax");
+    }
+
+    if (is_unsigned) {
+      if (add) {
+        println("  mov %s, %s", di, dx);
+        println("  sub %s, %s", ax, dx);
+        println("  shr $1, %s", dx);
+        println("  add %s, %s", dx, ax);
+      }
+      if (shift)
+        println("  shr $%d, %s", shift, ax);
+    } else {
+      if (add)
+        println("  %s %s, %s", val < 0 ? "sub" : "add", di, ax);
+      if (shift)
+        println("  sar $%d, %s", shift, ax);
+      println("  mov %s, %s", ax, dx);
+      println("  shr $%d, %s", bits - 1, dx);
+      println("  add %s, %s", dx, ax);
+    }
+  }
+
+  if (is_mod) {
+    if (!is64 || val == (int32_t)val) {
+      println("  imul $%d, %s", (int32_t)val, ax);
+    } else {
+      println("  mov $%ld, %%rdx", val);
+      println("  imul %%rdx, %%rax");
+    }
+    println("  sub %s, %s", ax, di);
+    println("  mov %s, %s", di, ax);
+  }
+  return true;
+}
+
+// Multiplication by 3, 5 or 9 can be done by `lea`, which is faster
+// than `imul`. Returns false for other multipliers.
+static bool gen_mul_lea(int64_t val, char *reg64, char *dst) {
+  if (val != 3 && val != 5 && val != 9)
+    return false;
+  println("  lea (%s,%s,%ld), %s", reg64, reg64, val - 1, dst);
+  return true;
+}
+
+// If true, need_regs() assumes that every scalar local variable lives
+// in a register. Used to estimate register pressure before allocation.
+static bool assume_reg_vars;
+
+// If `node` is a small integer constant or a local variable living in
+// a general-purpose register, returns a string that can be used as the
+// source operand of an ALU instruction as is, so that the operand does
+// not have to be evaluated into a register. Otherwise, returns NULL.
+static char *direct_operand(Node *node, bool is64) {
+  int64_t val;
+  if (int_const(node, &val)) {
+    if (is64 && val != (int32_t)val)
+      return NULL;
+    return format("$%d", (int32_t)val);
+  }
+
+  node = skip_nop_casts(node);
+  if (node->kind != ND_VAR)
+    return NULL;
+
+  if (assume_reg_vars)
+    return (node->var->is_local && is_integer(node->var->ty)) ? "" : NULL;
+
+  int r = node->var->reg;
+  if (!r || is_flonum(node->var->ty))
+    return NULL;
+  return is64 ? regname64[r] : regname32[r];
+}
+
+static bool is_int_binary(Node *node) {
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_MOD:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+  case ND_SHL:
+  case ND_SHR:
+    return !is_flonum(node->lhs->ty);
+  }
+  return false;
+}
+
+static bool is64_op(Node *node) {
+  return node->lhs->ty->kind == TY_LONG || node->lhs->ty->base;
+}
+
+static int max_need(Node *node, int n);
+static int need_regs2(Node *node);
+
+// Returns the Sethi-Ullman number of an expression, i.e. the number of
+// temporaries that have to be live at the same time to evaluate it.
+// For a binary operator whose operands need l and r temporaries, it is
+// max(l, r) if l != r, because we can evaluate the more demanding
+// operand first, and l + 1 otherwise.
+static int need_regs(Node *node) {
+  if (!node)
+    return 0;
+
+  // The number is asked for at every binary operator, and a subtree
+  // may be shared by several nodes, so it is cached to avoid quadratic
+  // or even exponential time. The estimate made before register
+  // allocation is cached separately.
+  int *cache = &node->regs_needed[assume_reg_vars];
+  if (!*cache)
+    *cache = need_regs2(node) + 1;
+  return *cache - 1;
+}
+
+static int need_regs2(Node *node) {
+
+  if (is_int_binary(node)) {
+    int l = need_regs(node->lhs);
+    if (direct_operand(node->rhs, is64_op(node)))
+      return l;
+    int r = need_regs(node->rhs);
+    return (l == r) ? l + 1 : MAX(l, r);
+  }
+
+  switch (node->kind) {
+  case ND_ASSIGN:
+    if (is_reg_var(node->lhs))
+      return need_regs(node->rhs);
+    return MAX(need_regs(node->lhs), need_regs(node->rhs) + 1);
+  case ND_CAS:
+    return MAX(need_regs(node->ext->cas_addr),
+               MAX(need_regs(node->ext->cas_new) + 1, need_regs(node->ext->cas_old) + 2));
+  case ND_EXCH:
+    return MAX(need_regs(node->lhs), need_regs(node->rhs) + 1);
+  }
+
+  int n = 0;
+  n = MAX(n, need_regs(node->lhs));
+  n = MAX(n, need_regs(node->rhs));
+  n = MAX(n, need_regs(node->cond));
+  n = MAX(n, need_regs(node->then));
+  n = MAX(n, need_regs(node->els));
+  n = MAX(n, need_regs(node->init));
+  n = MAX(n, need_regs(node->inc));
+  n = max_need(node->body, n);
+  if (node->kind == ND_FUNCALL)
+    n = max_need(node->ext->args, n);
+  return n;
+}
+
+static int max_need(Node *node, int n) {
+  for (; node; node = node->next)
+    n = MAX(n, need_regs(node));
+  return n;
+}
+
+static bool has_call_list(Node *node) {
+  for (; node; node = node->next)
+    if (has_call(node))
+      return true;
+  return false;
+}
+
+// Returns true if evaluating a given node may call a function.
+static bool has_call(Node *node) {
+  if (!node)
+    return false;
+
+  switch (node->kind) {
+  case ND_FUNCALL:
+    return true;
+  case ND_VAR:
+    // Accessing a thread-local variable in PIC calls __tls_get_addr().
+    return opt_fpic && node->var->is_tls;
+  case ND_CAS:
+    return has_call(node->ext->cas_addr) || has_call(node->ext->cas_old) ||
+           has_call(node->ext->cas_new);
+  }
+
+  return has_call(node->lhs) || has_call(node->rhs) ||
+         has_call(node->cond) || has_call(node->then) ||
+         has_call(node->els) || has_call(node->init) ||
+         has_call(node->inc) || has_call_list(node->body);
+}
+
+// Returns a float local variable living in an XMM register if `node`
+// refers to one.
+static Obj *xmm_operand(Node *node) {
+  node = skip_nop_casts(node);
+  if (node->kind == ND_VAR && node->var->reg && is_flonum(node->var->ty))
+    return node->var;
+  return NULL;
+}
+
 // Structs or unions equal or smaller than 16 bytes are passed
 // using up to two registers.
 //
@@ -446,11 +1130,7 @@ static void push_struct(Type *ty) {
   int sz = align_to(ty->size, 8);
   println("  sub $%d, %%rsp", sz);
   depth += sz / 8;
-
-  for (int i = 0; i < ty->size; i++) {
-    println("  mov %d(%%rax), %%r10b", i);
-    println("  mov %%r10b, %d(%%rsp)", i);
-  }
+  copy_mem("%rax", "%rsp", ty->size);
 }
 
 static void push_args2(Node *args, bool first_pass) {
@@ -506,11 +1186,11 @@ static int push_args(Node *node) {
 
   // If the return type is a large struct/union, the caller passes
   // a pointer to a buffer as if it were the first argument.
-  if (node->ret_buffer && node->ty->size > 16)
+  if (node->ext->ret_buffer && node->ty->size > 16)
     gp++;
 
   // Load as many arguments to the registers as possible.
-  for (Node *arg = node->args; arg; arg = arg->next) {
+  for (Node *arg = node->ext->args; arg; arg = arg->next) {
     Type *ty = arg->ty;
 
     switch (ty->kind) {
@@ -557,19 +1237,59 @@ static int push_args(Node *node) {
     stack++;
   }
 
-  push_args2(node->args, true);
-  push_args2(node->args, false);
+  push_args2(node->ext->args, true);
+  push_args2(node->ext->args, false);
 
   // If the return type is a large struct/union, the caller passes
   // a pointer to a buffer as if it were the first argument.
-  if (node->ret_buffer && node->ty->size > 16) {
-    println("  lea %d(%%rbp), %%rax", node->ret_buffer->offset);
+  if (node->ext->ret_buffer && node->ty->size > 16) {
+    println("  lea %d(%%rbp), %%rax", node->ext->ret_buffer->offset);
     push();
   }
 
   return stack;
 }
 
+// Store the low `size` bytes of a register to `offset(%rbp)`, widest
+// piece first. `reg` names the register for a given width.
+static void store_bytes(char *(*reg)(int), int size, int offset) {
+  for (int i = 0; i < size;) {
+    int sz = 8;
+    while (sz > size - i)
+      sz /= 2;
+    println("  mov %s, %d(%%rbp)", reg(sz), offset + i);
+    i += sz;
+    if (i < size)
+      println("  shr $%d, %s", sz * 8, reg(8));
+  }
+}
+
+// Load `size` bytes at `offset(%rdi)` to a register, zero-extended.
+// Odd sizes are assembled byte by byte so as not to read past the
+// end of the object.
+static void load_bytes(char *(*reg)(int), int size, int offset) {
+  switch (size) {
+  case 1:
+    println("  movzbl %d(%%rdi), %s", offset, reg(4));
+    return;
+  case 2:
+    println("  movzwl %d(%%rdi), %s", offset, reg(4));
+    return;
+  case 4:
+    println("  mov %d(%%rdi), %s", offset, reg(4));
+    return;
+  case 8:
+    println("  mov %d(%%rdi), %s", offset, reg(8));
+    return;
+  }
+
+  println("  mov $0, %s", reg(8));
+  for (int i = size - 1; i >= 0; i--) {
+    println("  shl $8, %s", reg(8));
+    println("  mov %d(%%rdi), %s", offset + i, reg(1));
+  }
+}
+
 static void copy_ret_buffer(Obj *var) {
   Type *ty = var->ty;
   int gp = 0, fp = 0;
@@ -582,10 +1302,7 @@ static void copy_ret_buffer(Obj *var) {
       println("  movsd %%xmm0, %d(%%rbp)", var->offset);
     fp++;
   } else {
-    for (int i = 0; i < MIN(8, ty->size); i++) {
-      println("  mov %%al, %d(%%rbp)", var->offset + i);
-      println("  shr $8, %%rax");
-    }
+    store_bytes(reg_ax, MIN(8, ty->size), var->offset);
     gp++;
   }
 
@@ -597,12 +1314,7 @@ static void copy_ret_buffer(Obj *var) {
       else
         println("  movsd %%xmm%d, %d(%%rbp)", fp, var->offset + 8);
     } else {
-      char *reg1 = (gp == 0) ? "%al" : "%dl";
-      char *reg2 = (gp == 0) ? "%rax" : "%rdx";
-      for (int i = 8; i < MIN(16, ty->size); i++) {
-        println("  mov %s, %d(%%rbp)", reg1, var->offset + i);
-        println("  shr $8, %s", reg2);
-      }
+      store_bytes((gp == 0) ? reg_ax : reg_dx, MIN(16, ty->size) - 8, var->offset + 8);
     }
   }
 }
@@ -621,11 +1333,7 @@ static void copy_struct_reg(void) {
       println("  movsd (%%rdi), %%xmm0");
     fp++;
   } else {
-    println("  mov $0, %%rax");
-    for (int i = MIN(8, ty->size) - 1; i >= 0; i--) {
-      println("  shl $8, %%rax");
-      println("  mov %d(%%rdi), %%al", i);
-    }
+    load_bytes(reg_ax, MIN(8, ty->size), 0);
     gp++;
   }
 
@@ -637,13 +1345,7 @@ static void copy_struct_reg(void) {
       else
         println("  movsd 8(%%rdi), %%xmm%d", fp);
     } else {
-      char *reg1 = (gp == 0) ? "%al" : "%dl";
-      char *reg2 = (gp == 0) ? "%rax" : "%rdx";
-      println("  mov $0, %s", reg2);
-      for (int i = MIN(16, ty->size) - 1; i >= 8; i--) {
-        println("  shl $8, %s", reg2);
-        println("  mov %d(%%rdi), %s", i, reg1);
-      }
+      load_bytes((gp == 0) ? reg_ax : reg_dx, MIN(16, ty->size) - 8, 8);
     }
   }
 }
@@ -653,11 +1355,11 @@ static void copy_struct_mem(void) {
   Obj *var = current_fn->params;
 
   println("  mov %d(%%rbp), %%rdi", var->offset);
+  copy_mem("%rax", "%rdi", ty->size);
 
-  for (int i = 0; i < ty->size; i++) {
-    println("  mov %d(%%rax), %%dl", i);
-    println("  mov %%dl, %d(%%rdi)", i);
-  }
+  // The caller may expect the address of the buffer in %rax.
+  // Reload it, since copy_mem() may have advanced %rdi.
+  println("  mov %d(%%rbp), %%rax", var->offset);
 }
 
 static void builtin_alloca(void) {
@@ -698,22 +1400,22 @@ static void gen_expr(Node *node) {
   case ND_NUM: {
     switch (node->ty->kind) {
     case TY_FLOAT: {
-      union { float f32; uint32_t u32; } u = { node->fval };
-      println("  mov $%u, %%eax  # float %Lf", u.u32, node->fval);
+      union { float f32; uint32_t u32; } u = { node->ext->fval };
+      println("  mov $%u, %%eax  # float %Lf", u.u32, node->ext->fval);
       println("  movq %%rax, %%xmm0");
       return;
     }
     case TY_DOUBLE: {
-      union { double f64; uint64_t u64; } u = { node->fval };
-      println("  mov $%lu, %%rax  # double %Lf", u.u64, node->fval);
+      union { double f64; uint64_t u64; } u = { node->ext->fval };
+      println("  mov $%lu, %%rax  # double %Lf", u.u64, node->ext->fval);
       println("  movq %%rax, %%xmm0");
       return;
     }
     case TY_LDOUBLE: {
       union { long double f80; uint64_t u64[2]; } u;
       memset(&u, 0, sizeof(u));
-      u.f80 = node->fval;
-      println("  mov $%lu, %%rax  # long double %Lf", u.u64[0], node->fval);
+      u.f80 = node->ext->fval;
+      println("  mov $%lu, %%rax  # long double %Lf", u.u64[0], node->ext->fval);
       println("  mov %%rax, -16(%%rsp)");
       println("  mov $%lu, %%rax", u.u64[1]);
       println("  mov %%rax, -8(%%rsp)");
@@ -749,6 +1451,10 @@ static void gen_expr(Node *node) {
     println("  neg %%rax");
     return;
   case ND_VAR:
+    if (node->var->reg) {
+      load_reg(node->var);
+      return;
+    }
     gen_addr(node);
     load(node->ty);
     return;
@@ -773,9 +1479,15 @@ static void gen_expr(Node *node) {
   case ND_ADDR:
     gen_addr(node->lhs);
     return;
-  case ND_ASSIGN:
+  case ND_ASSIGN: {
+    if (is_reg_var(node->lhs)) {
+      gen_expr(node->rhs);
+      store_reg(node->lhs->var);
+      return;
+    }
+
     gen_addr(node->lhs);
-    push();
+    int t = push_tmp();
     gen_expr(node->rhs);
 
     if (node->lhs->kind == ND_MEMBER && node->lhs->member->is_bitfield) {
@@ -788,20 +1500,21 @@ static void gen_expr(Node *node) {
       println("  and $%ld, %%rdi", (1L << mem->bit_width) - 1);
       println("  shl $%d, %%rdi", mem->bit_offset);
 
-      println("  mov (%%rsp), %%rax");
+      peek_tmp(t, "%rax");
       load(mem->ty);
 
       long mask = ((1L << mem->bit_width) - 1) << mem->bit_offset;
       println("  mov $%ld, %%r9", ~mask);
       println("  and %%r9, %%rax");
       println("  or %%rdi, %%rax");
-      store(node->ty);
+      store(node->ty, t);
       println("  mov %%r8, %%rax");
       return;
     }
 
-    store(node->ty);
+    store(node->ty, t);
     return;
+  }
   case ND_STMT_EXPR:
     for (Node *n = node->body; n; n = n->next)
       gen_stmt(n);
@@ -815,11 +1528,15 @@ static void gen_expr(Node *node) {
     cast(node->lhs->ty, node->ty);
     return;
   case ND_MEMZERO:
-    // `rep stosb` is equivalent to `memset(%rdi, %al, %rcx)`.
-    println("  mov $%d, %%rcx", node->var->ty->size);
-    println("  lea %d(%%rbp), %%rdi", node->var->offset);
-    println("  mov $0, %%al");
-    println("  rep stosb");
+    if (node->var->reg) {
+      if (is_flonum(node->var->ty))
+        println("  xorps %s, %s", regname64[node->var->reg], regname64[node->var->reg]);
+      else
+        println("  xor %s, %s", regname32[node->var->reg], regname32[node->var->reg]);
+      return;
+    }
+
+    zero_mem(node->var->offset, node->var->ty->size);
     return;
   case ND_COND: {
     int c = count();
@@ -875,7 +1592,7 @@ static void gen_expr(Node *node) {
   }
   case ND_FUNCALL: {
     if (node->lhs->kind == ND_VAR && !strcmp(node->lhs->var->name, "alloca")) {
-      gen_expr(node->args);
+      gen_expr(node->ext->args);
       println("  mov %%rax, %%rdi");
       builtin_alloca();
       return;
@@ -888,10 +1605,10 @@ static void gen_expr(Node *node) {
 
     // If the return type is a large struct/union, the caller passes
     // a pointer to a buffer as if it were the first argument.
-    if (node->ret_buffer && node->ty->size > 16)
+    if (node->ext->ret_buffer && node->ty->size > 16)
       pop(argreg64[gp++]);
 
-    for (Node *arg = node->args; arg; arg = arg->next) {
+    for (Node *arg = node->ext->args; arg; arg = arg->next) {
       Type *ty = arg->ty;
 
       switch (ty->kind) {
@@ -959,29 +1676,32 @@ static void gen_expr(Node *node) {
     }
 
     // If the return type is a small struct, a value is returned
-    // using up to two registers.
-    if (node->ret_buffer && node->ty->size <= 16) {
-      copy_ret_buffer(node->ret_buffer);
-      println("  lea %d(%%rbp), %%rax", node->ret_buffer->offset);
+    // using up to two registers. A large one is in our own buffer;
+    // don't rely on %rax, which the callee may have left pointing
+    // into its dead frame.
+    if (node->ext->ret_buffer) {
+      if (node->ty->size <= 16)
+        copy_ret_buffer(node->ext->ret_buffer);
+      println("  lea %d(%%rbp), %%rax", node->ext->ret_buffer->offset);
     }
 
     return;
   }
   case ND_LABEL_VAL:
-    println("  lea %s(%%rip), %%rax", node->unique_label);
+    println("  lea %s(%%rip), %%rax", node->ext->unique_label);
     return;
   case ND_CAS: {
-    gen_expr(node->cas_addr);
-    push();
-    gen_expr(node->cas_new);
-    push();
-    gen_expr(node->cas_old);
+    gen_expr(node->ext->cas_addr);
+    int t1 = push_tmp();
+    gen_expr(node->ext->cas_new);
+    int t2 = push_tmp();
+    gen_expr(node->ext->cas_old);
     println("  mov %%rax, %%r8");
-    load(node->cas_old->ty->base);
-    pop("%rdx"); // new
-    pop("%rdi"); // addr
+    load(node->ext->cas_old->ty->base);
+    pop_tmp(t2, "%rdx"); // new
+    pop_tmp(t1, "%rdi"); // addr
 
-    int sz = node->cas_addr->ty->base->size;
+    int sz = node->ext->cas_addr->ty->base->size;
     println("  lock cmpxchg %s, (%%rdi)", reg_dx(sz));
     println("  sete %%cl");
     println("  je 1f");
@@ -992,9 +1712,9 @@ static void gen_expr(Node *node) {
   }
   case ND_EXCH: {
     gen_expr(node->lhs);
-    push();
+    int t = push_tmp();
     gen_expr(node->rhs);
-    pop("%rdi");
+    pop_tmp(t, "%rdi");
 
     int sz = node->lhs->ty->base->size;
     println("  xchg %s, (%%rdi)", reg_ax(sz));
@@ -1005,10 +1725,16 @@ static void gen_expr(Node *node) {
   switch (node->lhs->ty->kind) {
   case TY_FLOAT:
   case TY_DOUBLE: {
-    gen_expr(node->rhs);
-    pushf();
-    gen_expr(node->lhs);
-    popf(1);
+    Obj *var = xmm_operand(node->rhs);
+    if (var) {
+      gen_expr(node->lhs);
+      println("  movaps %s, %%xmm1", regname64[var->reg]);
+    } else {
+      gen_expr(node->rhs);
+      int t = pushf_tmp(node->lhs);
+      gen_expr(node->lhs);
+      popf_tmp(t, 1);
+    }
 
     char *sz = (node->lhs->ty->kind == TY_FLOAT) ? "ss" : "sd";
 
@@ -1093,63 +1819,97 @@ static void gen_expr(Node *node) {
   }
   }
 
-  gen_expr(node->rhs);
-  push();
-  gen_expr(node->lhs);
-  pop("%rdi");
-
-  char *ax, *di, *dx;
+  bool is64 = is64_op(node);
+  char *ax, *di, *dx, *cx;
 
-  if (node->lhs->ty->kind == TY_LONG || node->lhs->ty->base) {
+  if (is64) {
     ax = "%rax";
     di = "%rdi";
     dx = "%rdx";
+    cx = "%rcx";
   } else {
     ax = "%eax";
     di = "%edi";
     dx = "%edx";
+    cx = "%ecx";
+  }
+
+  // `src` is the right-hand side operand. If it is a constant or a
+  // variable in a register, we use it as is. Otherwise, we evaluate
+  // the operand that needs more registers first so that fewer
+  // temporaries are live at once.
+  char *src = direct_operand(node->rhs, is64);
+  if (src) {
+    gen_expr(node->lhs);
+  } else if (need_regs(node->lhs) > need_regs(node->rhs)) {
+    gen_expr(node->lhs);
+    int t = push_tmp();
+    gen_expr(node->rhs);
+    println("  mov %%rax, %%rdi");
+    pop_tmp(t, "%rax");
+    src = di;
+  } else {
+    gen_expr(node->rhs);
+    int t = push_tmp();
+    gen_expr(node->lhs);
+    pop_tmp(t, "%rdi");
+    src = di;
   }
 
   switch (node->kind) {
   case ND_ADD:
-    println("  add %s, %s", di, ax);
+    println("  add %s, %s", src, ax);
     return;
   case ND_SUB:
-    println("  sub %s, %s", di, ax);
+    println("  sub %s, %s", src, ax);
     return;
   case ND_MUL:
-    println("  imul %s, %s", di, ax);
+    if (opt_O && src[0] == '$' && gen_mul_lea(atoi(src + 1), "%rax", ax))
+      return;
+    println("  imul %s, %s", src, ax);
     return;
   case ND_DIV:
   case ND_MOD:
+    // At -O1 and above, division by a constant is done by
+    // multiplication.
+    if (opt_O && src[0] == '$' &&
+        gen_div_const(atoi(src + 1), is64, node->ty->is_unsigned, node->kind == ND_MOD))
+      return;
+
+    // `div` and `idiv` don't take an immediate operand.
+    if (src[0] == '$') {
+      println("  mov %s, %s", src, di);
+      src = di;
+    }
+
     if (node->ty->is_unsigned) {
       println("  mov $0, %s", dx);
-      println("  div %s", di);
+      println("  div %s", src);
     } else {
       if (node->lhs->ty->size == 8)
         println("  cqo");
       else
         println("  cdq");
-      println("  idiv %s", di);
+      println("  idiv %s", src);
     }
 
     if (node->kind == ND_MOD)
       println("  mov %%rdx, %%rax");
     return;
   case ND_BITAND:
-    println("  and %s, %s", di, ax);
+    println("  and %s, %s", src, ax);
     return;
   case ND_BITOR:
-    println("  or %s, %s", di, ax);
+    println("  or %s, %s", src, ax);
     return;
   case ND_BITXOR:
-    println("  xor %s, %s", di, ax);
+    println("  xor %s, %s", src, ax);
     return;
   case ND_EQ:
   case ND_NE:
   case ND_LT:
   case ND_LE:
-    println("  cmp %s, %s", di, ax);
+    println("  cmp %s, %s", src, ax);
 
     if (node->kind == ND_EQ) {
       println("  sete %%al");
@@ -1170,21 +1930,166 @@ static void gen_expr(Node *node) {
     println("  movzb %%al, %%rax");
     return;
   case ND_SHL:
-    println("  mov %%rdi, %%rcx");
-    println("  shl %%cl, %s", ax);
-    return;
-  case ND_SHR:
-    println("  mov %%rdi, %%rcx");
-    if (node->lhs->ty->is_unsigned)
-      println("  shr %%cl, %s", ax);
+  case ND_SHR: {
+    // The CPU masks a shift count to 6 bits, so we can do the same
+    // to a constant count to make it fit in an 8-bit immediate.
+    char *cnt = "%cl";
+    if (src[0] == '$')
+      cnt = format("$%d", atoi(src + 1) & 63);
     else
-      println("  sar %%cl, %s", ax);
+      println("  mov %s, %s", src, cx);
+
+    if (node->kind == ND_SHL)
+      println("  shl %s, %s", cnt, ax);
+    else if (node->lhs->ty->is_unsigned)
+      println("  shr %s, %s", cnt, ax);
+    else
+      println("  sar %s, %s", cnt, ax);
     return;
   }
+  }
 
   error_tok(node->tok, "invalid expression");
 }
 
+// A switch compares its value after the integer promotions, so char
+// and short values are compared as 32-bit values.
+Type *switch_type(Type *ty) {
+  if (ty->size == 8)
+    return ty->is_unsigned ? ty_ulong : ty_long;
+  return ty->is_unsigned ? ty_uint : ty_int;
+}
+
+static uint64_t case_key(Type *ty, long val) {
+  uint64_t key = val;
+  if (ty->size == 4)
+    key = (uint32_t)val;
+  if (!ty->is_unsigned)
+    key ^= 1UL << (ty->size * 8 - 1);
+  return key;
+}
+
+static int case_cmp(const void *x, const void *y) {
+  uint64_t a = ((SwitchCase *)x)->lo;
+  uint64_t b = ((SwitchCase *)y)->lo;
+  return (a > b) - (a < b);
+}
+
+// Collects the cases of a switch statement sorted by value and picks
+// how to dispatch on them. A handful of cases are tested one by one.
+// If the cases cover at least a quarter of the values between the
+// smallest and the largest one, a jump table is used; otherwise the
+// cases are searched by bisection.
+SwitchKind switch_cases(Node *node, SwitchCase **cases, int *len) {
+  Type *ty = switch_type(node->cond->ty);
+  int n = 0;
+  for (Node *c = node->ext->case_next; c; c = c->ext->case_next)
+    n++;
+
+  SwitchCase *arr = calloc(n, sizeof(SwitchCase));
+  int i = 0;
+  for (Node *c = node->ext->case_next; c; c = c->ext->case_next, i++) {
+    arr[i].begin = c->ext->begin;
+    arr[i].end = c->ext->end;
+    arr[i].lo = case_key(ty, c->ext->begin);
+    arr[i].hi = case_key(ty, c->ext->end);
+    arr[i].label = c->ext->label;
+  }
+  *cases = arr;
+  *len = n;
+
+  if (n < 4)
+    return SW_LINEAR;
+
+  // A range such as `case -1 ... 1` on an unsigned value wraps around
+  // and has no place in the sorted order.
+  for (int i = 0; i < n; i++)
+    if (arr[i].lo > arr[i].hi)
+      return SW_LINEAR;
+
+  qsort(arr, n, sizeof(SwitchCase), case_cmp);
+
+  // Overlapping cases are left to the linear chain, which tests
+  // them in a well-defined order.
+  uint64_t covered = 0;
+  for (int i = 0; i < n; i++) {
+    if (i > 0 && arr[i].lo <= arr[i - 1].hi)
+      return SW_LINEAR;
+    covered += arr[i].hi - arr[i].lo + 1;
+  }
+
+  uint64_t span = arr[n - 1].hi - arr[0].lo;
+  if (span < 4096 && span < covered * 4)
+    return SW_TABLE;
+  return SW_TREE;
+}
+
+// Jump to `label` if %rax matches a case.
+static void gen_case_test(Type *ty, long begin, long end, char *label) {
+  char *ax = (ty->size == 8) ? "%rax" : "%eax";
+  char *di = (ty->size == 8) ? "%rdi" : "%edi";
+
+  if (begin == end) {
+    println("  cmp $%ld, %s", begin, ax);
+    println("  je %s", label);
+    return;
+  }
+
+  // [GNU] Case ranges
+  println("  mov %s, %s", ax, di);
+  println("  sub $%ld, %s", begin, di);
+  println("  cmp $%ld, %s", end - begin, di);
+  println("  jbe %s", label);
+}
+
+static void gen_case_tree(Type *ty, SwitchCase *cases, int len, char *dflt) {
+  if (len <= 3) {
+    for (int i = 0; i < len; i++)
+      gen_case_test(ty, cases[i].begin, cases[i].end, cases[i].label);
+    println("  jmp %s", dflt);
+    return;
+  }
+
+  int mid = len / 2;
+  int c = count();
+  println("  cmp $%ld, %s", cases[mid].begin, (ty->size == 8) ? "%rax" : "%eax");
+  println("  %s .L.case.%d", ty->is_unsigned ? "jb" : "jl", c);
+  gen_case_tree(ty, cases + mid, len - mid, dflt);
+  println(".L.case.%d:", c);
+  gen_case_tree(ty, cases, mid, dflt);
+}
+
+// Each table entry is the offset of a case label from the table, so
+// that the table needs no dynamic relocations in a PIE.
+static void gen_jump_table(Type *ty, SwitchCase *cases, int len, char *dflt) {
+  char *ax = (ty->size == 8) ? "%rax" : "%eax";
+  char *di = (ty->size == 8) ? "%rdi" : "%edi";
+  uint64_t size = cases[len - 1].hi - cases[0].lo + 1;
+  int c = count();
+
+  println("  mov %s, %s", ax, di);
+  if (cases[0].begin)
+    println("  sub $%ld, %s", cases[0].begin, di);
+  println("  cmp $%lu, %s", size - 1, di);
+  println("  ja %s", dflt);
+  println("  lea .L.jtab.%d(%%rip), %%rdx", c);
+  println("  movslq (%%rdx,%%rdi,4), %%rdi");
+  println("  add %%rdx, %%rdi");
+  println("  jmp *%%rdi");
+
+  println("  .pushsection .rodata");
+  println("  .align 4");
+  println(".L.jtab.%d:", c);
+  int j = 0;
+  for (uint64_t i = 0; i < size; i++) {
+    if (i > cases[j].hi - cases[0].lo)
+      j++;
+    char *label = (i < cases[j].lo - cases[0].lo) ? dflt : cases[j].label;
+    println("  .long %s-.L.jtab.%d", label, c);
+  }
+  println("  .popsection");
+}
+
 static void gen_stmt(Node *node) {
   println("  .loc %d %d", node->tok->file->file_no, node->tok->line_no);
 
@@ -1193,7 +2098,7 @@ static void gen_stmt(Node *node) {
     int c = count();
     gen_expr(node->cond);
     cmp_zero(node->cond->ty);
-    println("  je  .L.else.%d", c);
+    println("  je .L.else.%d", c);
     gen_stmt(node->then);
     println("  jmp .L.end.%d", c);
     println(".L.else.%d:", c);
@@ -1231,35 +2136,36 @@ static void gen_stmt(Node *node) {
     println("%s:", node->brk_label);
     return;
   }
-  case ND_SWITCH:
+  case ND_SWITCH: {
     gen_expr(node->cond);
 
-    for (Node *n = node->case_next; n; n = n->case_next) {
-      char *ax = (node->cond->ty->size == 8) ? "%rax" : "%eax";
-      char *di = (node->cond->ty->size == 8) ? "%rdi" : "%edi";
-
-      if (n->begin == n->end) {
-        println("  cmp $%ld, %s", n->begin, ax);
-        println("  je %s", n->label);
-        continue;
-      }
-
-      // [GNU] Case ranges
-      println("  mov %s, %s", ax, di);
-      println("  sub $%ld, %s", n->begin, di);
-      println("  cmp $%ld, %s", n->end - n->begin, di);
-      println("  jbe %s", n->label);
+    Type *ty = switch_type(node->cond->ty);
+    char *dflt = node->brk_label;
+    if (node->ext->default_case)
+      dflt = node->ext->default_case->ext->label;
+
+    SwitchCase *cases;
+    int len;
+    switch (switch_cases(node, &cases, &len)) {
+    case SW_LINEAR:
+      for (Node *n = node->ext->case_next; n; n = n->ext->case_next)
+        gen_case_test(ty, n->ext->begin, n->ext->end, n->ext->label);
+      println("  jmp %s", dflt);
+      break;
+    case SW_TREE:
+      gen_case_tree(ty, cases, len, dflt);
+      break;
+    case SW_TABLE:
+      gen_jump_table(ty, cases, len, dflt);
+      break;
     }
 
-    if (node->default_case)
-      println("  jmp %s", node->default_case->label);
-
-    println("  jmp %s", node->brk_label);
     gen_stmt(node->then);
     println("%s:", node->brk_label);
     return;
+  }
   case ND_CASE:
-    println("%s:", node->label);
+    println("%s:", node->ext->label);
     gen_stmt(node->lhs);
     return;
   case ND_BLOCK:
@@ -1267,14 +2173,14 @@ static void gen_stmt(Node *node) {
       gen_stmt(n);
     return;
   case ND_GOTO:
-    println("  jmp %s", node->unique_label);
+    println("  jmp %s", node->ext->unique_label);
     return;
   case ND_GOTO_EXPR:
     gen_expr(node->lhs);
     println("  jmp *%%rax");
     return;
   case ND_LABEL:
-    println("%s:", node->unique_label);
+    println("%s:", node->ext->unique_label);
     gen_stmt(node->lhs);
     return;
   case ND_RETURN:
@@ -1299,13 +2205,455 @@ static void gen_stmt(Node *node) {
     gen_expr(node->lhs);
     return;
   case ND_ASM:
-    println("  %s", node->asm_str);
+    println_raw(node->ext->asm_str);
     return;
   }
 
   error_tok(node->tok, "invalid statement");
 }
 
+//
+// Register allocation
+//
+// Scalar local variables whose addresses are never taken are kept in
+// registers. We compute a live range for each such variable and run
+// the linear scan algorithm over them.
+//
+// A position is assigned to each full expression in the order in
+// which code is emitted. Operands within an expression may be
+// evaluated in any order, so all variables that appear in the same
+// full expression interfere with each other. Loops are the only
+// backward jumps in a function without labels, so a variable that is
+// used in a loop but is declared outside of it has to be kept alive
+// throughout the loop.
+//
+
+typedef struct LiveRange LiveRange;
+struct LiveRange {
+  LiveRange *next;
+  Obj *var;
+  int start;
+  int end;
+  int decl_depth;  // Loop nesting depth at the variable's declaration
+  int ext_loop;    // Loop whose end the range has to be extended to
+  bool addr_taken;
+};
+
+typedef struct LoopInfo LoopInfo;
+struct LoopInfo {
+  int id;
+  int start;
+};
+
+static HashMap live_ranges;
+static LiveRange *range_list;
+static LoopInfo loop_stack[64];
+static int loop_depth;
+static int loop_count;
+static int scan_pos;
+static int expr_depth;
+static bool has_labels;   // Control may jump backward arbitrarily
+static bool no_regs;      // Registers can't be used at all
+static char *call_at;     // call_at[i] is true if a call is made at position i
+static int call_cap;
+static int scan_max_need;
+
+static LiveRange *get_range(Obj *var) {
+  LiveRange *range = hashmap_get2(&live_ranges, (char *)&var, sizeof(var));
+  if (range)
+    return range;
+
+  range = calloc(1, sizeof(LiveRange));
+  range->var = var;
+  range->start = scan_pos;
+  range->end = scan_pos;
+  range->ext_loop = -1;
+  range->next = range_list;
+  range_list = range;
+  hashmap_put2(&live_ranges, (char *)&range->var, sizeof(var), range);
+  return range;
+}
+
+// Mark a variable whose address is computed by gen_addr().
+static void mark_addr(Node *node) {
+  switch (node->kind) {
+  case ND_VAR:
+    if (node->var->is_local)
+      get_range(node->var)->addr_taken = true;
+    return;
+  case ND_COMMA:
+    mark_addr(node->rhs);
+    return;
+  case ND_MEMBER:
+    mark_addr(node->lhs);
+    return;
+  }
+}
+
+static void use_var(Obj *var) {
+  if (!var->is_local)
+    return;
+
+  LiveRange *range = get_range(var);
+  range->start = MIN(range->start, scan_pos);
+  range->end = MAX(range->end, scan_pos);
+
+  // If the variable is declared outside of the current loop, its
+  // value may be carried to the next iteration.
+  if (range->decl_depth < loop_depth) {
+    LoopInfo *loop = &loop_stack[range->decl_depth];
+    range->start = MIN(range->start, loop->start);
+    if (range->ext_loop < loop->id)
+      range->ext_loop = loop->id;
+  }
+}
+
+static void scan_stmt(Node *node);
+static void scan_node(Node *node);
+
+static void scan_list(Node *node) {
+  for (; node; node = node->next)
+    scan_node(node);
+}
+
+// Returns true if `node` names a function that may return twice.
+bool is_setjmp(Node *node) {
+  static char *names[] = {
+    "setjmp", "_setjmp", "sigsetjmp", "__sigsetjmp", "savectx",
+    "vfork", "getcontext",
+  };
+
+  if (node->kind != ND_VAR)
+    return false;
+  for (int i = 0; i < sizeof(names) / sizeof(*names); i++)
+    if (!strcmp(node->var->name, names[i]))
+      return true;
+  return false;
+}
+
+static void scan_node(Node *node) {
+  if (!node)
+    return;
+
+  switch (node->kind) {
+  case ND_VAR:
+    use_var(node->var);
+    return;
+  case ND_MEMZERO:
+    use_var(node->var);
+    return;
+  case ND_ADDR:
+  case ND_MEMBER:
+    mark_addr(node->lhs);
+    break;
+  case ND_ASSIGN:
+    if (node->lhs->kind != ND_VAR)
+      mark_addr(node->lhs);
+    break;
+  case ND_FUNCALL:
+    if (is_setjmp(node->lhs))
+      no_regs = true;
+    break;
+  case ND_LABEL:
+  case ND_GOTO_EXPR:
+  case ND_LABEL_VAL:
+    has_labels = true;
+    break;
+  case ND_ASM:
+    no_regs = true;
+    break;
+  case ND_STMT_EXPR:
+    expr_depth++;
+    for (Node *n = node->body; n; n = n->next)
+      scan_stmt(n);
+    expr_depth--;
+    return;
+  }
+
+  scan_node(node->lhs);
+  scan_node(node->rhs);
+  scan_node(node->cond);
+  scan_node(node->then);
+  scan_node(node->els);
+  scan_node(node->init);
+  scan_node(node->inc);
+  scan_list(node->body);
+
+  if (node->kind == ND_CAS) {
+    scan_node(node->ext->cas_addr);
+    scan_node(node->ext->cas_old);
+    scan_node(node->ext->cas_new);
+  }
+
+  if (node->kind == ND_FUNCALL)
+    scan_list(node->ext->args);
+}
+
+// Visit a full expression.
+static void scan_expr(Node *node) {
+  if (!node)
+    return;
+
+  if (expr_depth == 0) {
+    scan_pos++;
+
+    if (scan_pos >= call_cap) {
+      call_cap = call_cap * 2 + 64;
+      call_at = realloc(call_at, call_cap);
+    }
+    call_at[scan_pos] = has_call(node);
+
+    assume_reg_vars = true;
+    scan_max_need = MAX(scan_max_need, need_regs(node));
+    assume_reg_vars = false;
+  }
+
+  expr_depth++;
+  scan_node(node);
+  expr_depth--;
+}
+
+static void begin_loop(void) {
+  if (loop_depth == sizeof(loop_stack) / sizeof(*loop_stack)) {
+    // Too deeply nested. Give up allocating registers rather than
+    // tracking loops precisely.
+    no_regs = true;
+    loop_depth++;
+    return;
+  }
+
+  LoopInfo *loop = &loop_stack[loop_depth++];
+  loop->id = loop_count++;
+  loop->start = scan_pos + 1;
+}
+
+static void end_loop(void) {
+  if (--loop_depth >= sizeof(loop_stack) / sizeof(*loop_stack))
+    return;
+
+  int id = loop_stack[loop_depth].id;
+  for (LiveRange *r = range_list; r; r = r->next) {
+    if (r->ext_loop == id) {
+      r->end = MAX(r->end, scan_pos);
+      r->ext_loop = -1;
+    }
+  }
+}
+
+static void scan_stmt(Node *node) {
+  if (!node)
+    return;
+
+  switch (node->kind) {
+  case ND_IF:
+    scan_expr(node->cond);
+    scan_stmt(node->then);
+    scan_stmt(node->els);
+    return;
+  case ND_FOR:
+    scan_stmt(node->init);
+    begin_loop();
+    scan_expr(node->cond);
+    scan_stmt(node->then);
+    scan_expr(node->inc);
+    end_loop();
+    return;
+  case ND_DO:
+    begin_loop();
+    scan_stmt(node->then);
+    scan_expr(node->cond);
+    end_loop();
+    return;
+  case ND_SWITCH:
+    scan_expr(node->cond);
+    scan_stmt(node->then);
+    return;
+  case ND_CASE:
+    scan_stmt(node->lhs);
+    return;
+  case ND_BLOCK:
+    for (Node *n = node->body; n; n = n->next)
+      scan_stmt(n);
+    return;
+  case ND_GOTO_EXPR:
+    has_labels = true;
+    scan_expr(node->lhs);
+    return;
+  case ND_LABEL:
+    has_labels = true;
+    scan_stmt(node->lhs);
+    return;
+  case ND_RETURN:
+    scan_expr(node->lhs);
+    return;
+  case ND_EXPR_STMT:
+    if (node->var && node->var->is_local) {
+      LiveRange *range = get_range(node->var);
+      range->decl_depth = MIN(loop_depth, sizeof(loop_stack) / sizeof(*loop_stack));
+    }
+    scan_expr(node->lhs);
+    return;
+  case ND_ASM:
+    no_regs = true;
+    return;
+  }
+}
+
+static bool can_alloc(Obj *fn, LiveRange *range) {
+  Obj *var = range->var;
+  Type *ty = var->ty;
+
+  if (range->addr_taken || ty->is_atomic || ty->is_volatile)
+    return false;
+  if (!is_integer(ty) && ty->kind != TY_PTR &&
+      ty->kind != TY_FLOAT && ty->kind != TY_DOUBLE)
+    return false;
+
+  // Parameters passed on the stack already live in memory.
+  if (var->offset > 0)
+    return false;
+
+  // These are accessed directly by the code generator.
+  if (var == fn->alloca_bottom)
+    return false;
+
+  Type *ret = fn->ty->return_ty;
+  if (var == fn->params && (ret->kind == TY_STRUCT || ret->kind == TY_UNION) &&
+      ret->size > 16)
+    return false;
+  return true;
+}
+
+static bool crosses_call(LiveRange *range) {
+  for (int i = range->start; i <= range->end; i++)
+    if (call_at[i])
+      return true;
+  return false;
+}
+
+static int range_cmp(const void *a, const void *b) {
+  LiveRange *x = *(LiveRange **)a;
+  LiveRange *y = *(LiveRange **)b;
+  return x->start - y->start;
+}
+
+static void alloc_regs(Obj *fn) {
+  if (!fn->is_definition || !fn->is_live)
+    return;
+
+  live_ranges = (HashMap){};
+  range_list = NULL;
+  loop_depth = 0;
+  loop_count = 0;
+  scan_pos = 0;
+  expr_depth = 0;
+  has_labels = false;
+  no_regs = false;
+  scan_max_need = 0;
+
+  if (!call_at) {
+    call_cap = 64;
+    call_at = calloc(1, call_cap);
+  }
+  call_at[0] = false;
+
+  // Parameters are live from the beginning of the function.
+  for (Obj *var = fn->params; var; var = var->next)
+    get_range(var);
+
+  scan_stmt(fn->body);
+
+  if (no_regs)
+    return;
+
+  int nranges = 0;
+  for (LiveRange *r = range_list; r; r = r->next)
+    if (can_alloc(fn, r))
+      nranges++;
+
+  LiveRange **ranges = calloc(nranges, sizeof(LiveRange *));
+  int n = 0;
+  for (LiveRange *r = range_list; r; r = r->next) {
+    if (!can_alloc(fn, r))
+      continue;
+
+    // If there may be backward jumps other than loops, we can't
+    // tell when a variable is dead.
+    if (has_labels) {
+      r->start = 0;
+      r->end = scan_pos;
+    }
+    ranges[n++] = r;
+  }
+
+  qsort(ranges, nranges, sizeof(LiveRange *), range_cmp);
+
+  // Leave a few callee-saved registers to expression temporaries.
+  int pool = CALLEE_SAVED;
+  for (int i = 0, reserve = MIN(scan_max_need, 2); i < reserve; i++)
+    for (int r = REG_R15; r >= REG_RBX; r--)
+      if (pool & (1 << r)) {
+        pool &= ~(1 << r);
+        break;
+      }
+
+  // Linear scan. `active` holds the ranges that currently have a
+  // register.
+  LiveRange **active = calloc(nranges, sizeof(LiveRange *));
+  int nactive = 0;
+  int busy = 0;
+
+  for (int i = 0; i < nranges; i++) {
+    LiveRange *cur = ranges[i];
+    bool flonum = is_flonum(cur->var->ty);
+    bool has_call = crosses_call(cur);
+
+    // Expire old ranges.
+    for (int j = 0; j < nactive;) {
+      if (active[j]->end < cur->start) {
+        busy &= ~(1 << active[j]->var->reg);
+        active[j] = active[--nactive];
+      } else {
+        j++;
+      }
+    }
+
+    int usable;
+    if (flonum)
+      usable = has_call ? 0 : XMM_LOCALS;
+    else
+      usable = has_call ? pool : (pool | 1 << REG_R11);
+
+    int reg = 0;
+    if (!flonum && !has_call && !(busy & (1 << REG_R11)))
+      reg = REG_R11;
+    for (int r = REG_RBX; r < REG_END && !reg; r++)
+      if ((usable & (1 << r)) && !(busy & (1 << r)))
+        reg = r;
+
+    if (!reg) {
+      // Spill the range that ends last.
+      int victim = -1;
+      for (int j = 0; j < nactive; j++)
+        if ((usable & (1 << active[j]->var->reg)) &&
+            (victim == -1 || active[victim]->end < active[j]->end))
+          victim = j;
+
+      if (victim == -1 || active[victim]->end <= cur->end)
+        continue;
+
+      reg = active[victim]->var->reg;
+      active[victim]->var->reg = 0;
+      active[victim] = active[--nactive];
+      busy &= ~(1 << reg);
+    }
+
+    cur->var->reg = reg;
+    busy |= 1 << reg;
+    active[nactive++] = cur;
+  }
+}
+
 // Assign offsets to local variables.
 static void assign_lvar_offsets(Obj *prog) {
   for (Obj *fn = prog; fn; fn = fn->next) {
@@ -1354,9 +2702,12 @@ static void assign_lvar_offsets(Obj *prog) {
       top += var->ty->size;
     }
 
+    if (!fn->ir)
+      alloc_regs(fn);
+
     // Assign offsets to pass-by-register parameters and local variables.
     for (Obj *var = fn->locals; var; var = var->next) {
-      if (var->offset)
+      if (var->offset || var->reg)
         continue;
 
       // AMD64 System V ABI has a special alignment rule for an array of
@@ -1375,6 +2726,16 @@ static void assign_lvar_offsets(Obj *prog) {
   }
 }
 
+// Returns "  .byte N" for a given byte. Initializers of large arrays
+// are mostly made of these lines.
+static char *byte_line(char c) {
+  static char *lines[256];
+  uint8_t i = c;
+  if (!lines[i])
+    lines[i] = format("  .byte %d", c);
+  return lines[i];
+}
+
 static void emit_data(Obj *prog) {
   for (Obj *var = prog; var; var = var->next) {
     if (var->is_function || !var->is_definition)
@@ -1414,7 +2775,7 @@ static void emit_data(Obj *prog) {
           rel = rel->next;
           pos += 8;
         } else {
-          println("  .byte %d", var->init_data[pos++]);
+          emit_line(byte_line(var->init_data[pos++]));
         }
       }
       continue;
@@ -1467,12 +2828,730 @@ static void store_gp(int r, int offset, int sz) {
   }
 }
 
+// Copy a passed-by-register argument to the register allocated to it.
+static void store_arg_reg(Obj *var, int r) {
+  Type *ty = var->ty;
+  char *insn = ty->is_unsigned ? "movz" : "movs";
+
+  switch (ty->size) {
+  case 1:
+    println("  %sbl %s, %s", insn, argreg8[r], regname32[var->reg]);
+    return;
+  case 2:
+    println("  %swl %s, %s", insn, argreg16[r], regname32[var->reg]);
+    return;
+  case 4:
+    println("  movsxd %s, %s", argreg32[r], regname64[var->reg]);
+    return;
+  }
+  println("  mov %s, %s", argreg64[r], regname64[var->reg]);
+}
+
+//
+// IR backend
+//
+// Functions lowered to IR by ir.c are compiled from the IR instead of
+// the AST. Virtual registers are assigned to %rbx, %r12-%r15 and %r11
+// by linear scan over their live intervals, and those that don't get
+// a register are spilled to the stack. Each instruction reads its
+// operands to %rax and %rdi, computes the result in %rax with the same
+// instructions gen_expr() would use, and writes it back.
+//
+
+static IRFunc *ir_fn;
+static int *vreg_loc;  // REG_* or a stack offset (negative) of each register
+static int *ir_start;  // Start and end positions of each live interval
+static int *ir_end;
+static int *ncalls;    // ncalls[i] is the number of calls before position i
+static int *ir_nuses;  // Number of uses of each register
+
+static bool test_bit(uint64_t *set, int i) {
+  return set[i / 64] & (1UL << (i % 64));
+}
+
+static void set_bit(uint64_t *set, int i) {
+  set[i / 64] |= 1UL << (i % 64);
+}
+
+// Returns the index of the lowest set bit of a nonzero value. This is
+// __builtin_ctzll(), which chibicc can't compile itself.
+static int lowest_bit(uint64_t x) {
+  int i = 0;
+  for (int n = 32; n; n /= 2) {
+    if (!(x & ((1UL << n) - 1))) {
+      x >>= n;
+      i += n;
+    }
+  }
+  return i;
+}
+
+static void extend_interval(int v, int pos) {
+  if (ir_end[v] < 0)
+    ir_start[v] = pos;
+  ir_start[v] = MIN(ir_start[v], pos);
+  ir_end[v] = MAX(ir_end[v], pos);
+}
+
+// Compute live intervals of virtual registers. Instructions are
+// numbered in the order they are emitted, and each block gets an
+// extra position at its beginning. A register's interval spans all
+// positions at which it is live, so it may include holes.
+//
+// Most registers are used only in the block that defines them. Only
+// those that are read in a block before being written there can be
+// live across blocks, so the dataflow sets are bitsets over just
+// those registers, which keeps them small for large functions.
+static void compute_intervals(IRFunc *fn) {
+  int nbbs = fn->nbbs;
+  int nregs = fn->nregs;
+  BasicBlock **succ = calloc(nbbs * 2, sizeof(BasicBlock *));
+  IRInsn **sw = calloc(nbbs, sizeof(IRInsn *));
+  int *first = calloc(nbbs, sizeof(int));
+  int *last = calloc(nbbs, sizeof(int));
+
+  // Find the registers that may be live on entry to some block.
+  // def_bb[v] is 1 + the id of the block that last defined `v`.
+  int *def_bb = calloc(nregs + 1, sizeof(int));
+  int *global = calloc(nregs + 1, sizeof(int)); // Index + 1, or 0
+  int *gregs = calloc(nregs + 1, sizeof(int));  // Index to register
+  int nglobals = 0;
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    IRInsn *end = NULL;
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next) {
+      int *regs[IR_MAX_USES];
+      int n = ir_uses(insn, regs);
+      for (int i = 0; i < n; i++) {
+        int v = *regs[i];
+        if (def_bb[v] != bb->id + 1 && !global[v]) {
+          gregs[nglobals] = v;
+          global[v] = ++nglobals;
+        }
+      }
+      if (insn->d)
+        def_bb[insn->d] = bb->id + 1;
+      end = insn;
+    }
+
+    if (!end || (end->op != IR_JMP && end->op != IR_BR && end->op != IR_SWITCH &&
+                 end->op != IR_RET)) {
+      succ[bb->id * 2] = bb->next;
+    } else if (end->op != IR_RET) {
+      succ[bb->id * 2] = end->then;
+      succ[bb->id * 2 + 1] = end->els;
+    }
+    if (end && end->op == IR_SWITCH)
+      sw[bb->id] = end;
+  }
+
+  int words = nglobals / 64 + 1;
+  uint64_t *use = calloc(nbbs * words, sizeof(uint64_t));
+  uint64_t *def = calloc(nbbs * words, sizeof(uint64_t));
+  uint64_t *in = calloc(nbbs * words, sizeof(uint64_t));
+  uint64_t *out = calloc(nbbs * words, sizeof(uint64_t));
+
+  int pos = 0;
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    uint64_t *u = use + bb->id * words;
+    uint64_t *d = def + bb->id * words;
+    first[bb->id] = pos++;
+
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next, pos++) {
+      int *regs[IR_MAX_USES];
+      int n = ir_uses(insn, regs);
+      for (int i = 0; i < n; i++) {
+        int g = global[*regs[i]] - 1;
+        if (g >= 0 && !test_bit(d, g))
+          set_bit(u, g);
+      }
+      if (insn->d && global[insn->d])
+        set_bit(d, global[insn->d] - 1);
+    }
+    last[bb->id] = pos - 1;
+  }
+
+  // Solve the dataflow equations until they converge. Liveness flows
+  // backward, so visiting blocks in reverse order converges faster.
+  BasicBlock **order = calloc(nbbs, sizeof(BasicBlock *));
+  int n = 0;
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next)
+    order[n++] = bb;
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int j = n - 1; j >= 0; j--) {
+      BasicBlock *bb = order[j];
+      uint64_t *o = out + bb->id * words;
+      uint64_t *i = in + bb->id * words;
+      uint64_t *u = use + bb->id * words;
+      uint64_t *d = def + bb->id * words;
+
+      for (int k = 0; k < 2; k++) {
+        BasicBlock *s = succ[bb->id * 2 + k];
+        if (s)
+          for (int w = 0; w < words; w++)
+            o[w] |= in[s->id * words + w];
+      }
+      if (sw[bb->id])
+        for (int k = 0; k < sw[bb->id]->ntargets; k++)
+          for (int w = 0; w < words; w++)
+            o[w] |= in[sw[bb->id]->targets[k]->id * words + w];
+
+      for (int w = 0; w < words; w++) {
+        uint64_t x = u[w] | (o[w] & ~d[w]);
+        if (x != i[w]) {
+          i[w] = x;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  free(ir_start);
+  free(ir_end);
+  free(ncalls);
+  free(ir_nuses);
+  ir_start = calloc(nregs + 1, sizeof(int));
+  ir_end = calloc(nregs + 1, sizeof(int));
+  for (int v = 0; v <= nregs; v++)
+    ir_end[v] = -1;
+  ncalls = calloc(pos + 1, sizeof(int));
+  ir_nuses = calloc(nregs + 1, sizeof(int));
+
+  pos = 0;
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    // Visit only the set bits of the live-in and live-out sets.
+    for (int w = 0; w < words; w++) {
+      for (uint64_t x = in[bb->id * words + w]; x; x &= x - 1)
+        extend_interval(gregs[w * 64 + lowest_bit(x)], first[bb->id]);
+      for (uint64_t x = out[bb->id * words + w]; x; x &= x - 1)
+        extend_interval(gregs[w * 64 + lowest_bit(x)], last[bb->id]);
+    }
+    ncalls[pos + 1] = ncalls[pos];
+    pos++;
+
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next, pos++) {
+      int *regs[IR_MAX_USES];
+      int n = ir_uses(insn, regs);
+      for (int i = 0; i < n; i++) {
+        extend_interval(*regs[i], pos);
+        ir_nuses[*regs[i]]++;
+      }
+      if (insn->d)
+        extend_interval(insn->d, pos);
+      ncalls[pos + 1] = ncalls[pos] + (insn->op == IR_CALL);
+    }
+  }
+
+  free(succ);
+  free(sw);
+  free(first);
+  free(last);
+  free(def_bb);
+  free(global);
+  free(gregs);
+  free(use);
+  free(def);
+  free(in);
+  free(out);
+  free(order);
+}
+
+// Returns true if a function is called strictly inside the interval
+// of a given register. A register used as an argument or defined by
+// a call does not have to survive the call.
+static bool interval_crosses_call(int v) {
+  return ir_end[v] > ir_start[v] + 1 && ncalls[ir_end[v]] > ncalls[ir_start[v] + 1];
+}
+
+static int by_start(const void *x, const void *y) {
+  return ir_start[*(int *)x] - ir_start[*(int *)y];
+}
+
+// Linear-scan register allocation. Returns the number of spilled
+// registers; vreg_loc holds -(i + 1) for the i'th spill slot until the
+// frame layout is known.
+static int linear_scan(IRFunc *fn) {
+  int n = 0;
+  int *order = calloc(fn->nregs, sizeof(int));
+  for (int v = 1; v <= fn->nregs; v++)
+    if (ir_end[v] >= 0)
+      order[n++] = v;
+  qsort(order, n, sizeof(int), by_start);
+
+  free(vreg_loc);
+  vreg_loc = calloc(fn->nregs + 1, sizeof(int));
+  int owner[REG_END] = {};
+  int nspill = 0;
+
+  for (int i = 0; i < n; i++) {
+    int v = order[i];
+
+    // Free the registers whose intervals have ended. An instruction
+    // reads its operands before writing its result, so an interval may
+    // start where another ends.
+    for (int r = REG_RBX; r <= REG_R11; r++)
+      if (owner[r] && ir_end[owner[r]] <= ir_start[v])
+        owner[r] = 0;
+
+    bool crosses = interval_crosses_call(v);
+    int reg = 0;
+    if (!crosses && !owner[REG_R11]) {
+      reg = REG_R11;
+    } else {
+      for (int r = REG_RBX; r <= REG_R15; r++) {
+        if (!owner[r]) {
+          reg = r;
+          break;
+        }
+      }
+    }
+
+    if (!reg) {
+      // Spill whichever interval ends last.
+      int victim = 0;
+      for (int r = REG_RBX; r <= REG_R11; r++)
+        if ((r != REG_R11 || !crosses) && ir_end[owner[r]] > ir_end[victim])
+          victim = owner[r];
+
+      if (victim && ir_end[victim] > ir_end[v]) {
+        reg = vreg_loc[victim];
+        vreg_loc[victim] = -++nspill;
+      } else {
+        vreg_loc[v] = -++nspill;
+        continue;
+      }
+    }
+
+    vreg_loc[v] = reg;
+    owner[reg] = v;
+  }
+  free(order);
+  return nspill;
+}
+
+static char *vreg(int v, bool is64) {
+  int loc = vreg_loc[v];
+  if (loc > 0)
+    return is64 ? regname64[loc] : regname32[loc];
+  return format("%d(%%rbp)", loc);
+}
+
+static void ir_load(int v, char *reg) {
+  println("  mov %s, %s", vreg(v, true), reg);
+}
+
+static void ir_store(int v) {
+  println("  mov %%rax, %s", vreg(v, true));
+}
+
+// Returns the register an instruction should write its result to: the
+// register of the destination, or %rax if the destination is spilled,
+// in which case ir_finish() stores it.
+static char *ir_dst(int v, bool is64) {
+  int r = vreg_loc[v];
+  if (r > 0)
+    return is64 ? regname64[r] : regname32[r];
+  return is64 ? "%rax" : "%eax";
+}
+
+static void ir_finish(int v) {
+  if (vreg_loc[v] < 0)
+    ir_store(v);
+}
+
+// Returns a memory operand for the address held by a register.
+static char *ir_addr(int v) {
+  if (vreg_loc[v] > 0)
+    return format("(%s)", regname64[vreg_loc[v]]);
+  ir_load(v, "%rdi");
+  return "(%rdi)";
+}
+
+// Returns the condition code of a comparison for setcc and jcc.
+static char *cond_code(IRInsn *insn, bool negate) {
+  bool uns = insn->ty->is_unsigned;
+
+  switch (insn->op) {
+  case IR_EQ: return negate ? "ne" : "e";
+  case IR_NE: return negate ? "e" : "ne";
+  case IR_LT: return uns ? (negate ? "ae" : "b") : (negate ? "ge" : "l");
+  case IR_LE: return uns ? (negate ? "a" : "be") : (negate ? "g" : "le");
+  }
+  unreachable();
+}
+
+static bool is_cmp(IRInsn *insn) {
+  return IR_EQ <= insn->op && insn->op <= IR_LE;
+}
+
+static void emit_ir_cmp(IRInsn *insn) {
+  bool is64 = insn->ty->kind == TY_LONG || insn->ty->base;
+  char *src = insn->b ? vreg(insn->b, is64) : format("$%ld", insn->imm);
+
+  if (vreg_loc[insn->a] > 0) {
+    println("  cmp %s, %s", src, vreg(insn->a, is64));
+  } else {
+    ir_load(insn->a, "%rax");
+    println("  cmp %s, %s", src, is64 ? "%rax" : "%eax");
+  }
+}
+
+static void emit_ir_binary(IRInsn *insn) {
+  Type *ty = insn->ty;
+  bool is64 = ty->kind == TY_LONG || ty->base;
+  char *ax = is64 ? "%rax" : "%eax";
+  char *di = is64 ? "%rdi" : "%edi";
+  char *dx = is64 ? "%rdx" : "%edx";
+  char *cx = is64 ? "%rcx" : "%ecx";
+  char *src = insn->b ? vreg(insn->b, is64) : format("$%ld", insn->imm);
+
+  if (is_cmp(insn)) {
+    emit_ir_cmp(insn);
+    println("  set%s %%al", cond_code(insn, false));
+    println("  movzb %%al, %%rax");
+    ir_store(insn->d);
+    return;
+  }
+
+  char *op = NULL;
+  switch (insn->op) {
+  case IR_ADD: op = "add"; break;
+  case IR_SUB: op = "sub"; break;
+  case IR_MUL: op = "imul"; break;
+  case IR_BITAND: op = "and"; break;
+  case IR_BITOR: op = "or"; break;
+  case IR_BITXOR: op = "xor"; break;
+  }
+
+  // An ALU instruction computes its result in the destination register
+  // if there is one, unless that register holds the right-hand side.
+  // Operands of a commutative operation are swapped in that case.
+  int r = vreg_loc[insn->d];
+  if (op && r > 0 && insn->b && vreg_loc[insn->b] == r && insn->op != IR_SUB &&
+      vreg_loc[insn->a] != r) {
+    println("  %s %s, %s", op, vreg(insn->a, is64), vreg(insn->d, is64));
+    return;
+  }
+
+  if (op && r > 0 && (!insn->b || vreg_loc[insn->b] != r)) {
+    if (insn->op == IR_MUL && !insn->b && vreg_loc[insn->a] > 0 &&
+        gen_mul_lea(insn->imm, regname64[vreg_loc[insn->a]], vreg(insn->d, is64)))
+      return;
+    if (vreg_loc[insn->a] != r)
+      println("  mov %s, %s", vreg(insn->a, true), regname64[r]);
+    println("  %s %s, %s", op, src, vreg(insn->d, is64));
+    return;
+  }
+
+  ir_load(insn->a, "%rax");
+
+  switch (insn->op) {
+  case IR_DIV:
+  case IR_MOD:
+    if (!insn->b && gen_div_const(insn->imm, is64, ty->is_unsigned, insn->op == IR_MOD))
+      break;
+
+    // `div` and `idiv` take neither an immediate nor, without a size
+    // suffix, a memory operand.
+    if (src[0] == '$' || vreg_loc[insn->b] < 0) {
+      println("  mov %s, %s", src, di);
+      src = di;
+    }
+
+    if (ty->is_unsigned) {
+      println("  mov $0, %s", dx);
+      println("  div %s", src);
+    } else {
+      if (ty->size == 8)
+        println("  cqo");
+      else
+        println("  cdq");
+      println("  idiv %s", src);
+    }
+
+    if (insn->op == IR_MOD)
+      println("  mov %%rdx, %%rax");
+    break;
+  case IR_SHL:
+  case IR_SHR: {
+    char *cnt = "%cl";
+    if (src[0] == '$')
+      cnt = format("$%ld", insn->imm & 63);
+    else
+      println("  mov %s, %s", src, cx);
+
+    if (insn->op == IR_SHL)
+      println("  shl %s, %s", cnt, ax);
+    else if (ty->is_unsigned)
+      println("  shr %s, %s", cnt, ax);
+    else
+      println("  sar %s, %s", cnt, ax);
+    break;
+  }
+  default:
+    println("  %s %s, %s", op, src, ax);
+  }
+
+  ir_store(insn->d);
+}
+
+static char *bb_label(BasicBlock *bb) {
+  return format(".L.bb.%s.%d", ir_fn->fn->name, bb->id);
+}
+
+// Emit a conditional jump for `br`. If `cmp` is given, the flags are
+// those set by the comparison, whose result is the branch condition.
+// Otherwise, they are those of comparing the condition with 0.
+static void emit_ir_branch(IRInsn *br, IRInsn *cmp, BasicBlock *next) {
+  char *cc = cmp ? cond_code(cmp, false) : "ne";
+  char *ncc = cmp ? cond_code(cmp, true) : "e";
+
+  if (br->then == next) {
+    println("  j%s %s", ncc, bb_label(br->els));
+    return;
+  }
+
+  println("  j%s %s", cc, bb_label(br->then));
+  if (br->els != next)
+    println("  jmp %s", bb_label(br->els));
+}
+
+static void emit_ir_insn(IRInsn *insn, BasicBlock *next) {
+  Type *ty = insn->ty;
+
+  switch (insn->op) {
+  case IR_IMM:
+    if (insn->imm == (int32_t)insn->imm) {
+      println("  movq $%ld, %s", insn->imm, vreg(insn->d, true));
+    } else {
+      println("  mov $%ld, %%rax", insn->imm);
+      ir_store(insn->d);
+    }
+    return;
+  case IR_MOV:
+    if (vreg_loc[insn->d] == vreg_loc[insn->a])
+      return;
+    if (vreg_loc[insn->d] > 0 || vreg_loc[insn->a] > 0) {
+      println("  mov %s, %s", vreg(insn->a, true), vreg(insn->d, true));
+      return;
+    }
+    ir_load(insn->a, "%rax");
+    ir_store(insn->d);
+    return;
+  case IR_PARAM:
+    println("  mov %s, %s", argreg64[insn->imm], vreg(insn->d, true));
+    return;
+  case IR_LVAR:
+    println("  lea %d(%%rbp), %%rax", insn->var->offset);
+    ir_store(insn->d);
+    return;
+  case IR_GADDR:
+    gen_global_addr(insn->var);
+    ir_store(insn->d);
+    return;
+  case IR_LOAD: {
+    char *addr = ir_addr(insn->a);
+    char *op = ty->is_unsigned ? "movz" : "movs";
+    if (ty->size == 1)
+      println("  %sbl %s, %s", op, addr, ir_dst(insn->d, false));
+    else if (ty->size == 2)
+      println("  %swl %s, %s", op, addr, ir_dst(insn->d, false));
+    else if (ty->size == 4)
+      println("  movsxd %s, %s", addr, ir_dst(insn->d, true));
+    else
+      println("  mov %s, %s", addr, ir_dst(insn->d, true));
+    ir_finish(insn->d);
+    return;
+  }
+  case IR_STORE: {
+    char *addr = ir_addr(insn->a);
+    if (vreg_loc[insn->b] > 0 && ty->size >= 4) {
+      println("  mov %s, %s", vreg(insn->b, ty->size == 8), addr);
+    } else {
+      ir_load(insn->b, "%rax");
+      println("  mov %s, %s", reg_ax(ty->size), addr);
+    }
+    return;
+  }
+  case IR_EXT:
+    if (ty->size == 4) {
+      println("  movsxd %s, %s", vreg(insn->a, false), ir_dst(insn->d, true));
+    } else {
+      char *op = ty->is_unsigned ? "movz" : "movs";
+      ir_load(insn->a, "%rax");
+      if (ty->size == 1)
+        println("  %sbl %%al, %s", op, ir_dst(insn->d, false));
+      else
+        println("  %swl %%ax, %s", op, ir_dst(insn->d, false));
+    }
+    ir_finish(insn->d);
+    return;
+  case IR_CAST:
+    // Widening a 32-bit integer is common enough to be worth doing
+    // without going through %rax.
+    if (is_integer(insn->from) && insn->from->size == 4 && ty->size == 8) {
+      if (insn->from->is_unsigned)
+        println("  mov %s, %s", vreg(insn->a, false), ir_dst(insn->d, false));
+      else
+        println("  movsxd %s, %s", vreg(insn->a, false), ir_dst(insn->d, true));
+      ir_finish(insn->d);
+      return;
+    }
+
+    ir_load(insn->a, "%rax");
+    cast(insn->from, ty);
+    ir_store(insn->d);
+    return;
+  case IR_NEG:
+    ir_load(insn->a, "%rax");
+    println("  neg %%rax");
+    ir_store(insn->d);
+    return;
+  case IR_BITNOT:
+    ir_load(insn->a, "%rax");
+    println("  not %%rax");
+    ir_store(insn->d);
+    return;
+  case IR_MEMZERO:
+    zero_mem(insn->var->offset, insn->var->ty->size);
+    return;
+  case IR_CALL:
+    for (int i = 0; i < insn->nargs; i++)
+      ir_load(insn->args[i], argreg64[i]);
+    ir_load(insn->a, "%r10");
+    println("  mov $0, %%rax");
+    println("  call *%%r10");
+
+    // Clear the upper bits of a small return value as gen_expr() does.
+    switch (ty->kind) {
+    case TY_BOOL:
+      println("  movzx %%al, %%eax");
+      break;
+    case TY_CHAR:
+      println("  %s %%al, %%eax", ty->is_unsigned ? "movzbl" : "movsbl");
+      break;
+    case TY_SHORT:
+      println("  %s %%ax, %%eax", ty->is_unsigned ? "movzwl" : "movswl");
+      break;
+    }
+    ir_store(insn->d);
+    return;
+  case IR_JMP:
+    if (insn->then != next)
+      println("  jmp %s", bb_label(insn->then));
+    return;
+  case IR_BR: {
+    bool is32 = is_integer(ty) && ty->size <= 4;
+    println("  cmp%s $0, %s", is32 ? "l" : "q", vreg(insn->a, !is32));
+    emit_ir_branch(insn, NULL, next);
+    return;
+  }
+  case IR_SWITCH: {
+    bool is64 = ty->size == 8;
+    char *di = is64 ? "%rdi" : "%edi";
+    int c = count();
+
+    println("  mov %s, %s", vreg(insn->a, is64), di);
+    if (insn->imm)
+      println("  sub $%ld, %s", insn->imm, di);
+    println("  cmp $%d, %s", insn->ntargets - 1, di);
+    println("  ja %s", bb_label(insn->then));
+    println("  lea .L.jtab.%d(%%rip), %%rdx", c);
+    println("  movslq (%%rdx,%%rdi,4), %%rdi");
+    println("  add %%rdx, %%rdi");
+    println("  jmp *%%rdi");
+
+    println("  .pushsection .rodata");
+    println("  .align 4");
+    println(".L.jtab.%d:", c);
+    for (int i = 0; i < insn->ntargets; i++)
+      println("  .long %s-.L.jtab.%d", bb_label(insn->targets[i]), c);
+    println("  .popsection");
+    return;
+  }
+  case IR_RET:
+    if (insn->a)
+      ir_load(insn->a, "%rax");
+    if (next)
+      println("  jmp .L.return.%s", ir_fn->fn->name);
+    return;
+  }
+
+  emit_ir_binary(insn);
+}
+
+static void emit_ir_function(Obj *fn) {
+  ir_fn = fn->ir;
+  compute_intervals(ir_fn);
+  int nspill = linear_scan(ir_fn);
+
+  // Callee-saved registers are saved just below local variables, and
+  // spill slots follow them.
+  int nsaved = 0;
+  int saved[REG_END];
+  for (int r = REG_RBX; r <= REG_R15; r++) {
+    for (int v = 1; v <= ir_fn->nregs; v++) {
+      if (vreg_loc[v] == r) {
+        saved[nsaved++] = r;
+        break;
+      }
+    }
+  }
+
+  int spill_base = fn->stack_size + nsaved * 8;
+  for (int v = 1; v <= ir_fn->nregs; v++)
+    if (vreg_loc[v] < 0)
+      vreg_loc[v] = -spill_base + vreg_loc[v] * 8;
+
+  // Prologue
+  println("  push %%rbp");
+  println("  mov %%rsp, %%rbp");
+  println("  sub $%d, %%rsp", align_to(spill_base + nspill * 8, 16));
+  for (int i = 0; i < nsaved; i++)
+    println("  mov %s, %d(%%rbp)", regname64[saved[i]], -fn->stack_size - (i + 1) * 8);
+
+  int file_no = 0, line_no = 0;
+  for (BasicBlock *bb = ir_fn->bbs; bb; bb = bb->next) {
+    println("%s:", bb_label(bb));
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next) {
+      Token *tok = insn->tok;
+      if (tok && (tok->file->file_no != file_no || tok->line_no != line_no)) {
+        file_no = tok->file->file_no;
+        line_no = tok->line_no;
+        println("  .loc %d %d", file_no, line_no);
+      }
+
+      // Fuse a comparison with the branch that consumes its result.
+      IRInsn *br = insn->next;
+      if (is_cmp(insn) && br && br->op == IR_BR && br->a == insn->d &&
+          ir_nuses[insn->d] == 1) {
+        emit_ir_cmp(insn);
+        emit_ir_branch(br, insn, br->next ? NULL : bb->next);
+        insn = br;
+        continue;
+      }
+
+      emit_ir_insn(insn, insn->next ? NULL : bb->next);
+    }
+  }
+
+  // Epilogue
+  println(".L.return.%s:", fn->name);
+  for (int i = 0; i < nsaved; i++)
+    println("  mov %d(%%rbp), %s", -fn->stack_size - (i + 1) * 8, regname64[saved[i]]);
+  println("  mov %%rbp, %%rsp");
+  println("  pop %%rbp");
+  println("  ret");
+}
+
 static void emit_text(Obj *prog) {
   for (Obj *fn = prog; fn; fn = fn->next) {
     if (!fn->is_function || !fn->is_definition)
       continue;
 
-    // No code is emitted for "static inline" functions
+    // No code is emitted for static functions
     // if no one is referencing them.
     if (!fn->is_live)
       continue;
@@ -1487,11 +3566,26 @@ static void emit_text(Obj *prog) {
     println("%s:", fn->name);
     current_fn = fn;
 
-    // Prologue
-    println("  push %%rbp");
-    println("  mov %%rsp, %%rbp");
-    println("  sub $%d, %%rsp", fn->stack_size);
-    println("  mov %%rsp, %d(%%rbp)", fn->alloca_bottom->offset);
+    if (fn->ir) {
+      begin_buffering();
+      emit_ir_function(fn);
+      flush_buffer();
+      continue;
+    }
+
+    // Callee-saved registers not holding variables are used for
+    // expression temporaries. Since we don't know which of them will
+    // actually be used until we generate code, the function body is
+    // generated first and the prologue is inserted before it after that.
+    regs_used = 0;
+    for (Obj *var = fn->locals; var; var = var->next)
+      if (var->reg)
+        regs_used |= 1 << var->reg;
+    tmp_pool = CALLEE_SAVED & ~regs_used;
+    tmp_busy = 0;
+    regs_used &= CALLEE_SAVED;
+
+    begin_buffering();
 
     // Save arg registers if function is variadic
     if (fn->va_area) {
@@ -1538,6 +3632,14 @@ static void emit_text(Obj *prog) {
 
       Type *ty = var->ty;
 
+      if (var->reg) {
+        if (is_flonum(ty))
+          println("  movaps %%xmm%d, %s", fp++, regname64[var->reg]);
+        else
+          store_arg_reg(var, gp++);
+        continue;
+      }
+
       switch (ty->kind) {
       case TY_STRUCT:
       case TY_UNION:
@@ -1574,22 +3676,69 @@ static void emit_text(Obj *prog) {
     if (strcmp(fn->name, "main") == 0)
       println("  mov $0, %%rax");
 
+    AsmLine *body, *body_tail;
+    hold_buffer(&body, &body_tail);
+
+    // Callee-saved registers are saved just below local variables.
+    int nsaved = 0;
+    int saved[REG_END];
+    for (int r = REG_RBX; r <= REG_R15; r++)
+      if (regs_used & (1 << r))
+        saved[nsaved++] = r;
+
+    // Prologue
+    println("  push %%rbp");
+    println("  mov %%rsp, %%rbp");
+    println("  sub $%d, %%rsp", align_to(fn->stack_size + nsaved * 8, 16));
+    println("  mov %%rsp, %d(%%rbp)", fn->alloca_bottom->offset);
+    for (int i = 0; i < nsaved; i++)
+      println("  mov %s, %d(%%rbp)", regname64[saved[i]], -fn->stack_size - (i + 1) * 8);
+
+    release_buffer(body, body_tail);
+
     // Epilogue
     println(".L.return.%s:", fn->name);
+    for (int i = 0; i < nsaved; i++)
+      println("  mov %d(%%rbp), %s", -fn->stack_size - (i + 1) * 8, regname64[saved[i]]);
     println("  mov %%rbp, %%rsp");
     println("  pop %%rbp");
     println("  ret");
+    flush_buffer();
   }
 }
 
-void codegen(Obj *prog, FILE *out) {
-  output_file = out;
+void codegen(Obj *prog, OutBuf *out) {
+  output = cur_out = out;
 
   File **files = get_input_files();
   for (int i = 0; files[i]; i++)
     println("  .file %d \"%s\"", files[i]->file_no, files[i]->name);
 
+  // At -O1 and above, the AST of a function is simplified and then
+  // compiled via the IR if possible.
+  if (opt_O) {
+    for (Obj *fn = prog; fn; fn = fn->next) {
+      if (!fn->is_function || !fn->is_definition || !fn->is_live)
+        continue;
+
+      fold_function(fn);
+      fn->ir = lower_function(fn);
+      if (fn->ir)
+        optimize_ir(fn->ir);
+    }
+
+    inline_functions(prog);
+
+    if (opt_dump_ir)
+      for (Obj *fn = prog; fn; fn = fn->next)
+        if (fn->ir && fn->is_live)
+          dump_ir(fn->ir, stderr);
+  }
+
   assign_lvar_offsets(prog);
   emit_data(prog);
   emit_text(prog);
+
+  if (opt_peephole_stats)
+    print_peephole_stats(stderr);
 }
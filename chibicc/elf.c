@@ -0,0 +1,2986 @@
+// This file implements an assembler for the x86-64 assembly that the
+// code generator emits. Instead of writing assembly text to a file and
+// running `as` on it, cc1 passes the text to assemble_elf(), which
+// encodes it and writes a relocatable ELF object directly.
+//
+// Only the subset of the GNU assembler syntax that chibicc itself
+// produces is supported: the instructions in codegen.c, the data
+// directives used for global variables, and .file/.loc for line
+// number information. Inline assembly may contain anything, so the
+// assembler gives up on the first line it doesn't understand, and the
+// caller falls back to the external assembler. The output is meant to
+// be equivalent to what `as` produces for the same input, including
+// the choice among alternative encodings of an instruction.
+//
+// Each section is a list of fragments. Most fragments are just bytes,
+// but a jump to a label is kept as a separate fragment until the end,
+// because whether it can use a 1-byte displacement depends on the
+// distance to the label. All jumps start short and are lengthened
+// until every one of them reaches its target. Values that depend on
+// symbols are recorded as fixups and either resolved after layout or
+// turned into relocations.
+
+#include "chibicc.h"
+#include <elf.h>
+
+// DWARF constants used for line number information
+enum {
+  DW_LNS_copy = 1,
+  DW_LNS_advance_pc = 2,
+  DW_LNS_advance_line = 3,
+  DW_LNS_set_file = 4,
+  DW_LNE_end_sequence = 1,
+  DW_LNE_set_address = 2,
+  DW_TAG_compile_unit = 0x11,
+  DW_CHILDREN_no = 0,
+  DW_AT_name = 0x03,
+  DW_AT_stmt_list = 0x10,
+  DW_AT_low_pc = 0x11,
+  DW_AT_high_pc = 0x12,
+  DW_AT_language = 0x13,
+  DW_AT_comp_dir = 0x1b,
+  DW_AT_producer = 0x25,
+  DW_FORM_addr = 0x01,
+  DW_FORM_data2 = 0x05,
+  DW_FORM_data4 = 0x06,
+  DW_FORM_string = 0x08,
+};
+
+typedef struct Section Section;
+typedef struct Frag Frag;
+typedef struct Symbol Symbol;
+typedef struct Fixup Fixup;
+
+typedef struct {
+  uint8_t *data;
+  int len;
+  int cap;
+} Bytes;
+
+typedef enum {
+  FRAG_DATA,   // Bytes
+  FRAG_BRANCH, // jmp or jcc to a label
+  FRAG_ALIGN,  // Padding up to an alignment boundary
+} FragKind;
+
+struct Frag {
+  Frag *next;
+  FragKind kind;
+  int addr; // Offset from the beginning of the section
+  int size;
+
+  // FRAG_DATA
+  Bytes buf;
+
+  // FRAG_BRANCH
+  int cc; // Condition code, or -1 for jmp
+  Symbol *target;
+  bool is_long;
+
+  // FRAG_ALIGN
+  int align;
+};
+
+// A value that is not known until layout is done. If it can't be
+// resolved in the assembler, it becomes a relocation.
+struct Fixup {
+  Fixup *next;
+  Frag *frag;
+  int offset;
+  int type;    // R_X86_64_*
+  int size;    // 1, 2, 4 or 8
+  Symbol *sym;
+  Symbol *sub; // For `sym - sub`
+  long addend;
+};
+
+typedef struct Rela Rela;
+struct Rela {
+  Rela *next;
+  long offset;
+  int type;
+  Symbol *sym;
+  long addend;
+};
+
+struct Section {
+  Section *next;
+  char *name;
+  int type;
+  long flags;
+  int align;
+  int size;
+  Frag *frags;
+  Frag *last;
+  Frag *common_frags; // Local common symbols, which follow `frags`
+  Frag *common_last;
+  Fixup *fixups;
+  Fixup *last_fixup;
+  Rela *relas;
+  Rela *last_rela;
+  Symbol *sym; // Section symbol
+  uint8_t *contents;
+  int index;
+  int rela_index;
+};
+
+struct Symbol {
+  Symbol *next;
+  char *name;
+  Section *sec; // NULL if undefined
+  Frag *frag;
+  int offset;
+  int bind;
+  int type;
+  long size;
+  bool is_global;
+  bool is_local;   // Given by .local
+  bool is_section;
+  bool is_common;
+  long common_align;
+  bool in_symtab;
+  int index;
+};
+
+// The value of an operand or a data directive, `sym - sub + val`.
+typedef enum {
+  MOD_NONE,
+  MOD_PLT,
+  MOD_GOTPCREL,
+  MOD_TLSGD,
+  MOD_GOTTPOFF,
+  MOD_TPOFF,
+} Modifier;
+
+typedef struct {
+  Symbol *sym;
+  Symbol *sub;
+  long val;
+  Modifier mod;
+} Expr;
+
+typedef enum {
+  OP_REG, // General-purpose register
+  OP_XMM,
+  OP_ST,  // x87 stack register
+  OP_IMM,
+  OP_MEM,
+} OpKind;
+
+#define REG_RIP 16
+
+typedef struct {
+  OpKind kind;
+  int reg;      // Register number for OP_REG, OP_XMM and OP_ST
+  int size;     // Size of OP_REG
+  bool high8;   // %ah, %ch, %dh or %bh
+  bool star;    // Operand of an indirect jmp or call
+  Expr expr;    // Immediate value or displacement
+  int base;     // Base register of OP_MEM, or -1
+  int index;    // Index register of OP_MEM, or -1
+  int scale;
+  int seg;      // Segment override prefix, or 0
+} Operand;
+
+// A .loc directive
+typedef struct LineRow LineRow;
+struct LineRow {
+  LineRow *next;
+  Section *sec;
+  Frag *frag;
+  int offset;
+  int file;
+  int line;
+};
+
+static Section *sections;
+static Section *last_section;
+static Section *cur_sec;
+static Section *prev_sec;
+static Section *sec_stack[16];
+static int sec_depth;
+static Section *text_sec;
+
+static HashMap symbols;
+static Symbol *sym_list;
+static Symbol *last_sym;
+
+static StringArray file_names;
+static LineRow *rows;
+static LineRow *last_row;
+
+static bool failed;
+static bool uses_got;
+
+// Counters of numeric local labels such as `1:`
+static int local_labels[10];
+
+static void unsupported(void) {
+  failed = true;
+}
+
+//
+// Output buffer
+//
+
+static void bytes_reserve(Bytes *b, int n) {
+  if (b->len + n <= b->cap)
+    return;
+  int cap = b->cap ? b->cap : 64;
+  while (cap < b->len + n)
+    cap *= 2;
+  b->data = realloc(b->data, cap);
+  b->cap = cap;
+}
+
+static void bytes_add(Bytes *b, void *p, int n) {
+  bytes_reserve(b, n);
+  memcpy(b->data + b->len, p, n);
+  b->len += n;
+}
+
+static void bytes_byte(Bytes *b, int c) {
+  bytes_reserve(b, 1);
+  b->data[b->len++] = c;
+}
+
+static void bytes_int(Bytes *b, uint64_t val, int size) {
+  bytes_reserve(b, size);
+  for (int i = 0; i < size; i++)
+    b->data[b->len++] = val >> (i * 8);
+}
+
+static void bytes_uleb(Bytes *b, uint64_t val) {
+  do {
+    int c = val & 0x7f;
+    val >>= 7;
+    bytes_byte(b, val ? c | 0x80 : c);
+  } while (val);
+}
+
+static void bytes_sleb(Bytes *b, int64_t val) {
+  for (;;) {
+    int c = val & 0x7f;
+    val >>= 7;
+    if ((val == 0 && !(c & 0x40)) || (val == -1 && (c & 0x40))) {
+      bytes_byte(b, c);
+      return;
+    }
+    bytes_byte(b, c | 0x80);
+  }
+}
+
+static void bytes_str(Bytes *b, char *s) {
+  bytes_add(b, s, strlen(s) + 1);
+}
+
+//
+// Sections and symbols
+//
+
+static Symbol *new_symbol(char *name) {
+  Symbol *sym = calloc(1, sizeof(Symbol));
+  sym->name = name;
+  if (last_sym)
+    last_sym->next = sym;
+  else
+    sym_list = sym;
+  last_sym = sym;
+  return sym;
+}
+
+static Symbol *get_symbol(char *name, int len) {
+  Symbol *sym = hashmap_get2(&symbols, name, len);
+  if (sym)
+    return sym;
+  name = strndup(name, len);
+  sym = new_symbol(name);
+  hashmap_put2(&symbols, name, len, sym);
+  return sym;
+}
+
+static Section *new_section(char *name, int type, long flags) {
+  Section *sec = calloc(1, sizeof(Section));
+  sec->name = name;
+  sec->type = type;
+  sec->flags = flags;
+  sec->align = 1;
+
+  sec->sym = calloc(1, sizeof(Symbol));
+  sec->sym->name = "";
+  sec->sym->sec = sec;
+  sec->sym->is_section = true;
+  sec->sym->type = STT_SECTION;
+
+  if (last_section)
+    last_section->next = sec;
+  else
+    sections = sec;
+  last_section = sec;
+  return sec;
+}
+
+static Section *find_section(char *name) {
+  for (Section *sec = sections; sec; sec = sec->next)
+    if (!strcmp(sec->name, name))
+      return sec;
+  return NULL;
+}
+
+static void switch_section(Section *sec) {
+  if (cur_sec != sec)
+    prev_sec = cur_sec;
+  cur_sec = sec;
+}
+
+static Frag *new_frag(FragKind kind) {
+  Frag *f = calloc(1, sizeof(Frag));
+  f->kind = kind;
+  if (cur_sec->last)
+    cur_sec->last->next = f;
+  else
+    cur_sec->frags = f;
+  cur_sec->last = f;
+  return f;
+}
+
+// Returns a data fragment at the end of the current section.
+static Frag *cur_frag(void) {
+  Frag *f = cur_sec->last;
+  if (f && f->kind == FRAG_DATA)
+    return f;
+  return new_frag(FRAG_DATA);
+}
+
+static void emit(int c) {
+  bytes_byte(&cur_frag()->buf, c);
+}
+
+static void emit_int(uint64_t val, int size) {
+  bytes_int(&cur_frag()->buf, val, size);
+}
+
+static void add_fixup(int type, int size, Expr *e, long addend) {
+  Frag *f = cur_frag();
+  Fixup *fx = calloc(1, sizeof(Fixup));
+  fx->frag = f;
+  fx->offset = f->buf.len;
+  fx->type = type;
+  fx->size = size;
+  fx->sym = e->sym;
+  fx->sub = e->sub;
+  fx->addend = addend;
+
+  if (cur_sec->last_fixup)
+    cur_sec->last_fixup->next = fx;
+  else
+    cur_sec->fixups = fx;
+  cur_sec->last_fixup = fx;
+  emit_int(0, size);
+}
+
+static void define_label(Symbol *sym) {
+  if (sym->sec || sym->is_common) {
+    unsupported();
+    return;
+  }
+  Frag *f = cur_frag();
+  sym->sec = cur_sec;
+  sym->frag = f;
+  sym->offset = f->buf.len;
+}
+
+static long symbol_value(Symbol *sym) {
+  if (sym->is_section)
+    return 0;
+  return sym->frag->addr + sym->offset;
+}
+
+//
+// Lexer
+//
+
+static char *skip_space(char *p) {
+  while (*p == ' ' || *p == '\t')
+    p++;
+  return p;
+}
+
+// Symbols may contain UTF-8 characters.
+static bool is_sym_char(int c) {
+  return (c & 0x80) || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') ||
+         ('0' <= c && c <= '9') || c == '_' || c == '.' || c == '$';
+}
+
+static bool is_digit(int c) {
+  return '0' <= c && c <= '9';
+}
+
+// Returns the symbol for a numeric local label reference such as `1f`.
+static Symbol *local_label(int n, bool forward) {
+  int count = local_labels[n] + (forward ? 1 : 0);
+  char *name = format(".Lnum.%d.%d", n, count);
+  return get_symbol(name, strlen(name));
+}
+
+static bool parse_number(char **rest, char *p, long *val) {
+  char *end;
+  errno = 0;
+  unsigned long v = strtoul(p, &end, 0);
+  if (end == p || errno || is_sym_char(*end))
+    return false;
+  *val = v;
+  *rest = end;
+  return true;
+}
+
+static Modifier parse_modifier(char **rest, char *p) {
+  static struct { char *name; Modifier mod; } mods[] = {
+    {"@PLT", MOD_PLT}, {"@GOTPCREL", MOD_GOTPCREL}, {"@tlsgd", MOD_TLSGD},
+    {"@gottpoff", MOD_GOTTPOFF}, {"@tpoff", MOD_TPOFF},
+  };
+
+  for (int i = 0; i < sizeof(mods) / sizeof(*mods); i++) {
+    int len = strlen(mods[i].name);
+    if (!strncmp(p, mods[i].name, len) && !is_sym_char(p[len])) {
+      // `as` puts _GLOBAL_OFFSET_TABLE_ in the symbol table as soon as
+      // it sees any of these, even if no relocation refers to the GOT.
+      uses_got = true;
+      *rest = p + len;
+      return mods[i].mod;
+    }
+  }
+  unsupported();
+  *rest = p + 1;
+  return MOD_NONE;
+}
+
+// expr = term (("+" | "-") term)*
+// term = "-"? number | symbol ("@" modifier)?
+static bool parse_expr(char **rest, char *p, Expr *e) {
+  *e = (Expr){};
+  bool neg = false;
+
+  for (;;) {
+    p = skip_space(p);
+    if (*p == '-') {
+      neg = !neg;
+      p++;
+      continue;
+    }
+    if (*p == '+') {
+      p++;
+      continue;
+    }
+
+    long val;
+    if (is_digit(*p) && (p[1] == 'f' || p[1] == 'b') && !is_sym_char(p[2])) {
+      Symbol *sym = local_label(*p - '0', p[1] == 'f');
+      if (neg || e->sym)
+        return false;
+      e->sym = sym;
+      p += 2;
+    } else if (is_digit(*p)) {
+      if (!parse_number(&p, p, &val))
+        return false;
+      e->val += neg ? -val : val;
+    } else if (is_sym_char(*p)) {
+      char *start = p;
+      while (is_sym_char(*p))
+        p++;
+      // `.` is the current location. It is a label without a name.
+      Symbol *sym;
+      if (p - start == 1 && *start == '.') {
+        sym = new_symbol(".L.");
+        define_label(sym);
+      } else {
+        sym = get_symbol(start, p - start);
+      }
+
+      if (neg) {
+        if (e->sub)
+          return false;
+        e->sub = sym;
+      } else {
+        if (e->sym)
+          return false;
+        e->sym = sym;
+      }
+
+      if (*p == '@') {
+        if (neg)
+          return false;
+        e->mod = parse_modifier(&p, p);
+      }
+    } else {
+      return false;
+    }
+
+    neg = false;
+    p = skip_space(p);
+    if (*p != '+' && *p != '-')
+      break;
+  }
+
+  *rest = p;
+  return true;
+}
+
+static char *reg64[] = {
+  "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+  "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+static char *reg32[] = {
+  "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+  "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+};
+
+static char *reg16[] = {
+  "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+  "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w",
+};
+
+static char *reg8[] = {
+  "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+  "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+};
+
+static char *reg8_high[] = {"ah", "ch", "dh", "bh"};
+
+// Reads a register name after '%'.
+static bool parse_reg(char **rest, char *p, Operand *op) {
+  char *start = p;
+  while (is_sym_char(*p))
+    p++;
+  int len = p - start;
+
+  char **tables[] = {reg64, reg32, reg16, reg8};
+  int sizes[] = {8, 4, 2, 1};
+
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 16; j++) {
+      if (strlen(tables[i][j]) == len && !strncmp(start, tables[i][j], len)) {
+        *op = (Operand){.kind = OP_REG, .reg = j, .size = sizes[i]};
+        *rest = p;
+        return true;
+      }
+    }
+  }
+
+  for (int i = 0; i < 4; i++) {
+    if (len == 2 && !strncmp(start, reg8_high[i], 2)) {
+      *op = (Operand){.kind = OP_REG, .reg = i + 4, .size = 1, .high8 = true};
+      *rest = p;
+      return true;
+    }
+  }
+
+  if (len == 3 && !strncmp(start, "rip", 3)) {
+    *op = (Operand){.kind = OP_REG, .reg = REG_RIP, .size = 8};
+    *rest = p;
+    return true;
+  }
+
+  if (len >= 4 && !strncmp(start, "xmm", 3)) {
+    long n;
+    char *q;
+    if (!parse_number(&q, start + 3, &n) || q != p || n > 15)
+      return false;
+    *op = (Operand){.kind = OP_XMM, .reg = n};
+    *rest = p;
+    return true;
+  }
+
+  if (len == 2 && !strncmp(start, "st", 2)) {
+    *op = (Operand){.kind = OP_ST, .reg = 0};
+    if (*p == '(') {
+      if (!is_digit(p[1]) || p[1] > '7' || p[2] != ')')
+        return false;
+      op->reg = p[1] - '0';
+      p += 3;
+    }
+    *rest = p;
+    return true;
+  }
+
+  return false;
+}
+
+// Reads `(base, index, scale)` of a memory operand.
+static bool parse_mem(char **rest, char *p, Operand *op) {
+  Operand r;
+  op->kind = OP_MEM;
+  op->base = op->index = -1;
+  op->scale = 1;
+
+  p = skip_space(p + 1);
+  if (*p == '%') {
+    if (!parse_reg(&p, p + 1, &r) || r.kind != OP_REG || r.size != 8)
+      return false;
+    op->base = r.reg;
+    p = skip_space(p);
+  }
+
+  if (*p == ',') {
+    p = skip_space(p + 1);
+    if (*p != '%' || !parse_reg(&p, p + 1, &r) || r.kind != OP_REG ||
+        r.size != 8 || r.reg == 4 || r.reg == REG_RIP)
+      return false;
+    op->index = r.reg;
+    p = skip_space(p);
+
+    if (*p == ',') {
+      long n;
+      if (!parse_number(&p, skip_space(p + 1), &n) ||
+          (n != 1 && n != 2 && n != 4 && n != 8))
+        return false;
+      op->scale = n;
+      p = skip_space(p);
+    }
+  }
+
+  if (*p != ')')
+    return false;
+  *rest = p + 1;
+  return true;
+}
+
+static bool parse_operand(char *p, Operand *op) {
+  *op = (Operand){};
+  p = skip_space(p);
+
+  if (*p == '*') {
+    op->star = true;
+    p = skip_space(p + 1);
+  }
+
+  if (*p == '$') {
+    op->kind = OP_IMM;
+    if (!parse_expr(&p, p + 1, &op->expr))
+      return false;
+    return !*skip_space(p);
+  }
+
+  // Segment override such as %fs:0
+  if (!strncmp(p, "%fs:", 4) || !strncmp(p, "%gs:", 4)) {
+    op->seg = (p[1] == 'f') ? 0x64 : 0x65;
+    p += 4;
+  } else if (*p == '%') {
+    bool star = op->star;
+    if (!parse_reg(&p, p + 1, op) || op->reg == REG_RIP)
+      return false;
+    op->star = star;
+    return !*skip_space(p);
+  }
+
+  // Memory operand
+  int seg = op->seg;
+  bool star = op->star;
+  Expr e = {};
+  if (*p != '(' && !parse_expr(&p, p, &e))
+    return false;
+
+  if (*p == '(') {
+    if (!parse_mem(&p, p, op))
+      return false;
+  } else {
+    op->kind = OP_MEM;
+    op->base = op->index = -1;
+    op->scale = 1;
+  }
+
+  op->expr = e;
+  op->seg = seg;
+  op->star = star;
+  if (e.sub)
+    return false;
+  return !*skip_space(p);
+}
+
+//
+// Instruction encoder
+//
+
+static bool fits8(long val) {
+  return -128 <= val && val <= 127;
+}
+
+static bool fits32(long val) {
+  return -2147483648L <= val && val <= 2147483647L;
+}
+
+// Truncates an immediate to an operand size and sign-extends it, as
+// the assembler accepts both signed and unsigned spellings.
+static long imm_value(long val, int size) {
+  switch (size) {
+  case 1: return (int8_t)val;
+  case 2: return (int16_t)val;
+  case 4: return (int32_t)val;
+  }
+  return val;
+}
+
+static int scale_bits(int scale) {
+  return (scale == 8) ? 3 : (scale == 4) ? 2 : (scale == 2) ? 1 : 0;
+}
+
+static bool is_reg(Operand *op) {
+  return op->kind == OP_REG && op->reg != REG_RIP;
+}
+
+static bool needs_rex8(Operand *op) {
+  return op && op->kind == OP_REG && op->size == 1 && !op->high8 && op->reg >= 4;
+}
+
+static bool is_high8(Operand *op) {
+  return op && op->kind == OP_REG && op->high8;
+}
+
+static void emit_imm(Expr *e, int size, bool is_signed) {
+  if (!e->sym) {
+    emit_int(e->val, size);
+    return;
+  }
+
+  int type;
+  if (e->mod == MOD_TPOFF && size == 4)
+    type = R_X86_64_TPOFF32;
+  else if (e->mod != MOD_NONE)
+    type = -1;
+  else if (size == 8)
+    type = R_X86_64_64;
+  else if (size == 4)
+    type = is_signed ? R_X86_64_32S : R_X86_64_32;
+  else if (size == 2)
+    type = R_X86_64_16;
+  else
+    type = R_X86_64_8;
+
+  if (type == -1 || e->sub) {
+    unsupported();
+    return;
+  }
+  add_fixup(type, size, e, e->val);
+}
+
+// Emits an instruction with a ModRM byte. `size` is the operand size,
+// which selects the 0x66 prefix or REX.W. `pfx` is a mandatory prefix
+// of an SSE instruction, and `op` is an opcode of one to three bytes.
+// `reg` is the register or opcode extension in the reg field, and
+// `rm` is a register or memory operand. `imm_size` is the size of an
+// immediate that follows, which RIP-relative displacements have to
+// take into account.
+static void emit_modrm(int size, int pfx, int op, int reg, Operand *reg_op,
+                       Operand *rm, int imm_size) {
+  if (rm->kind == OP_MEM && rm->seg)
+    emit(rm->seg);
+  if (size == 2)
+    emit(0x66);
+  if (pfx)
+    emit(pfx);
+
+  int rex = 0;
+  if (size == 8)
+    rex |= 8;
+  if (reg & 8)
+    rex |= 4;
+  if (rm->kind == OP_MEM) {
+    if (rm->index != -1 && (rm->index & 8))
+      rex |= 2;
+    if (rm->base != -1 && rm->base != REG_RIP && (rm->base & 8))
+      rex |= 1;
+  } else if (rm->reg & 8) {
+    rex |= 1;
+  }
+
+  if (rex || needs_rex8(reg_op) || needs_rex8(rm)) {
+    if (is_high8(reg_op) || is_high8(rm)) {
+      unsupported();
+      return;
+    }
+    emit(0x40 | rex);
+  }
+
+  if (op > 0xffff)
+    emit(op >> 16);
+  if (op > 0xff)
+    emit((op >> 8) & 0xff);
+  emit(op & 0xff);
+
+  reg &= 7;
+
+  if (rm->kind != OP_MEM) {
+    emit(0xc0 | (reg << 3) | (rm->reg & 7));
+    return;
+  }
+
+  Expr *e = &rm->expr;
+
+  // RIP-relative
+  if (rm->base == REG_RIP) {
+    if (rm->index != -1) {
+      unsupported();
+      return;
+    }
+    emit((reg << 3) | 5);
+
+    if (!e->sym) {
+      emit_int(e->val, 4);
+      return;
+    }
+
+    int type;
+    switch (e->mod) {
+    case MOD_NONE:
+      type = R_X86_64_PC32;
+      break;
+    case MOD_GOTPCREL:
+      if (op == 0x8b)
+        type = rex ? R_X86_64_REX_GOTPCRELX : R_X86_64_GOTPCRELX;
+      else
+        type = R_X86_64_GOTPCREL;
+      break;
+    case MOD_TLSGD:
+      type = R_X86_64_TLSGD;
+      break;
+    case MOD_GOTTPOFF:
+      type = R_X86_64_GOTTPOFF;
+      break;
+    default:
+      unsupported();
+      return;
+    }
+    add_fixup(type, 4, e, e->val - 4 - imm_size);
+    return;
+  }
+
+  if (e->sym && e->mod != MOD_NONE && e->mod != MOD_TPOFF) {
+    unsupported();
+    return;
+  }
+
+  // Absolute address
+  if (rm->base == -1) {
+    if (rm->index == -1) {
+      emit((reg << 3) | 4);
+      emit(0x25);
+    } else {
+      emit((reg << 3) | 4);
+      emit(scale_bits(rm->scale) << 6 | (rm->index & 7) << 3 | 5);
+    }
+    emit_imm(e, 4, true);
+    return;
+  }
+
+  int mod;
+  if (e->sym || !fits8(e->val))
+    mod = 2;
+  else if (e->val == 0 && (rm->base & 7) != 5)
+    mod = 0;
+  else
+    mod = 1;
+
+  if (rm->index == -1 && (rm->base & 7) != 4) {
+    emit(mod << 6 | reg << 3 | (rm->base & 7));
+  } else {
+    int index = (rm->index == -1) ? 4 : rm->index;
+    emit(mod << 6 | reg << 3 | 4);
+    emit(scale_bits(rm->scale) << 6 | (index & 7) << 3 | (rm->base & 7));
+  }
+
+  if (mod == 1)
+    emit(e->val);
+  else if (mod == 2)
+    emit_imm(e, 4, true);
+}
+
+// Emits an instruction with the register number in the opcode byte.
+static void emit_opreg(int size, int op, Operand *r) {
+  if (size == 2)
+    emit(0x66);
+  int rex = (size == 8 ? 8 : 0) | (r->reg & 8 ? 1 : 0);
+  if (rex || needs_rex8(r)) {
+    if (is_high8(r)) {
+      unsupported();
+      return;
+    }
+    emit(0x40 | rex);
+  }
+  emit(op + (r->reg & 7));
+}
+
+static int cond_code(char *s) {
+  static char *names[][4] = {
+    {"o"}, {"no"}, {"b", "c", "nae"}, {"ae", "nb", "nc"},
+    {"e", "z"}, {"ne", "nz"}, {"be", "na"}, {"a", "nbe"},
+    {"s"}, {"ns"}, {"p", "pe"}, {"np", "po"},
+    {"l", "nge"}, {"ge", "nl"}, {"le", "ng"}, {"g", "nle"},
+  };
+
+  for (int i = 0; i < 16; i++)
+    for (int j = 0; j < 4 && names[i][j]; j++)
+      if (!strcmp(s, names[i][j]))
+        return i;
+  return -1;
+}
+
+// If `name` is `base` followed by an optional size suffix, returns
+// the size given by the suffix or 0 for no suffix. Otherwise returns -1.
+static int match_suffix(char *name, char *base, char *suffixes) {
+  int len = strlen(base);
+  if (strncmp(name, base, len))
+    return -1;
+  if (name[len] == '\0')
+    return 0;
+  if (name[len + 1] != '\0' || !strchr(suffixes, name[len]))
+    return -1;
+
+  switch (name[len]) {
+  case 'b': return 1;
+  case 'w': return 2;
+  case 'l': return 4;
+  case 'q': return 8;
+  }
+  return -1;
+}
+
+// Determines the operand size of an instruction from its suffix or
+// its register operands.
+static int operand_size(int suffix, Operand *ops, int nops) {
+  int size = suffix;
+  for (int i = 0; i < nops; i++) {
+    if (ops[i].kind != OP_REG)
+      continue;
+    if (size && size != ops[i].size)
+      return -1;
+    size = ops[i].size;
+  }
+  return size ? size : -1;
+}
+
+static bool is_acc(Operand *op) {
+  return op->kind == OP_REG && op->reg == 0 && !op->high8;
+}
+
+static void emit_branch(int cc, Expr *e) {
+  if (e->sub || e->val || (e->mod != MOD_NONE && e->mod != MOD_PLT)) {
+    unsupported();
+    return;
+  }
+  Frag *f = new_frag(FRAG_BRANCH);
+  f->cc = cc;
+  f->target = e->sym;
+}
+
+static void asm_alu(int op, int size, Operand *src, Operand *dst) {
+  if (src->kind == OP_IMM) {
+    if (size == 1) {
+      if (is_acc(dst)) {
+        emit(op * 8 + 4);
+        emit_imm(&src->expr, 1, true);
+      } else {
+        emit_modrm(1, 0, 0x80, op, NULL, dst, 1);
+        emit_imm(&src->expr, 1, true);
+      }
+      return;
+    }
+
+    long val = imm_value(src->expr.val, size);
+    src->expr.val = val;
+    int isize = (size == 2) ? 2 : 4;
+
+    if (!src->expr.sym && fits8(val)) {
+      emit_modrm(size, 0, 0x83, op, NULL, dst, 1);
+      emit(val);
+    } else if (is_acc(dst)) {
+      emit_opreg(size, op * 8 + 5, &(Operand){.reg = 0});
+      emit_imm(&src->expr, isize, true);
+    } else {
+      if (!fits32(val))
+        unsupported();
+      emit_modrm(size, 0, 0x81, op, NULL, dst, isize);
+      emit_imm(&src->expr, isize, true);
+    }
+    return;
+  }
+
+  if (is_reg(src) && dst->kind != OP_IMM) {
+    emit_modrm(size, 0, op * 8 + (size == 1 ? 0 : 1), src->reg, src, dst, 0);
+    return;
+  }
+
+  if (src->kind == OP_MEM && is_reg(dst)) {
+    emit_modrm(size, 0, op * 8 + (size == 1 ? 2 : 3), dst->reg, dst, src, 0);
+    return;
+  }
+  unsupported();
+}
+
+static void asm_mov(int size, Operand *src, Operand *dst, bool movabs) {
+  if (src->kind == OP_IMM) {
+    Expr *e = &src->expr;
+    if (is_reg(dst)) {
+      if (size == 8 && !movabs && (e->sym || fits32(e->val))) {
+        emit_modrm(8, 0, 0xc7, 0, NULL, dst, 4);
+        emit_imm(e, 4, true);
+        return;
+      }
+      if (size != 8)
+        e->val = imm_value(e->val, size);
+      emit_opreg(size, size == 1 ? 0xb0 : 0xb8, dst);
+      emit_imm(e, size, false);
+      return;
+    }
+
+    if (dst->kind == OP_MEM && !movabs) {
+      int isize = (size == 8) ? 4 : size;
+      e->val = imm_value(e->val, isize);
+      emit_modrm(size, 0, size == 1 ? 0xc6 : 0xc7, 0, NULL, dst, isize);
+      emit_imm(e, isize, true);
+      return;
+    }
+    unsupported();
+    return;
+  }
+
+  if (movabs) {
+    unsupported();
+    return;
+  }
+
+  if (is_reg(src) && dst->kind != OP_IMM) {
+    emit_modrm(size, 0, size == 1 ? 0x88 : 0x89, src->reg, src, dst, 0);
+    return;
+  }
+
+  if (src->kind == OP_MEM && is_reg(dst)) {
+    emit_modrm(size, 0, size == 1 ? 0x8a : 0x8b, dst->reg, dst, src, 0);
+    return;
+  }
+  unsupported();
+}
+
+// movzx, movsx and their variants. `from` is the size of the source.
+static void asm_movx(bool sign, int from, int to, Operand *src, Operand *dst) {
+  if (!is_reg(dst) || src->kind == OP_IMM || src->kind == OP_XMM) {
+    unsupported();
+    return;
+  }
+  if (!to)
+    to = dst->size;
+  if (!from && src->kind == OP_REG)
+    from = src->size;
+
+  if (to != dst->size || (src->kind == OP_REG && from != src->size)) {
+    unsupported();
+    return;
+  }
+
+  if (from == 4 && sign && to == 8) {
+    emit_modrm(8, 0, 0x63, dst->reg, dst, src, 0);
+    return;
+  }
+  if ((from != 1 && from != 2) || to <= from) {
+    unsupported();
+    return;
+  }
+
+  int op = sign ? 0x0fbe : 0x0fb6;
+  if (from == 2)
+    op++;
+  emit_modrm(to, 0, op, dst->reg, dst, src, 0);
+}
+
+static void asm_shift(int op, int size, Operand *ops, int nops) {
+  Operand *dst = &ops[nops - 1];
+  if (dst->kind != OP_REG && dst->kind != OP_MEM) {
+    unsupported();
+    return;
+  }
+
+  if (nops == 1) {
+    emit_modrm(size, 0, size == 1 ? 0xd0 : 0xd1, op, NULL, dst, 0);
+    return;
+  }
+
+  if (nops != 2) {
+    unsupported();
+    return;
+  }
+
+  Operand *cnt = &ops[0];
+  if (cnt->kind == OP_REG && cnt->reg == 1 && cnt->size == 1 && !cnt->high8) {
+    emit_modrm(size, 0, size == 1 ? 0xd2 : 0xd3, op, NULL, dst, 0);
+    return;
+  }
+
+  if (cnt->kind != OP_IMM || cnt->expr.sym) {
+    unsupported();
+    return;
+  }
+
+  if (cnt->expr.val == 1) {
+    emit_modrm(size, 0, size == 1 ? 0xd0 : 0xd1, op, NULL, dst, 0);
+    return;
+  }
+  emit_modrm(size, 0, size == 1 ? 0xc0 : 0xc1, op, NULL, dst, 1);
+  emit(cnt->expr.val);
+}
+
+static void asm_imul(int size, Operand *ops, int nops) {
+  if (nops == 1) {
+    emit_modrm(size, 0, size == 1 ? 0xf6 : 0xf7, 5, NULL, &ops[0], 0);
+    return;
+  }
+
+  if (size == 1) {
+    unsupported();
+    return;
+  }
+
+  Operand *imm = NULL, *src, *dst;
+  if (nops == 2 && ops[0].kind == OP_IMM) {
+    imm = &ops[0];
+    src = dst = &ops[1];
+  } else if (nops == 2) {
+    src = &ops[0];
+    dst = &ops[1];
+  } else if (nops == 3 && ops[0].kind == OP_IMM) {
+    imm = &ops[0];
+    src = &ops[1];
+    dst = &ops[2];
+  } else {
+    unsupported();
+    return;
+  }
+
+  if (!is_reg(dst) || src->kind == OP_IMM) {
+    unsupported();
+    return;
+  }
+
+  if (!imm) {
+    emit_modrm(size, 0, 0x0faf, dst->reg, dst, src, 0);
+    return;
+  }
+
+  long val = imm_value(imm->expr.val, size);
+  imm->expr.val = val;
+  if (!imm->expr.sym && fits8(val)) {
+    emit_modrm(size, 0, 0x6b, dst->reg, dst, src, 1);
+    emit(val);
+    return;
+  }
+
+  int isize = (size == 2) ? 2 : 4;
+  emit_modrm(size, 0, 0x69, dst->reg, dst, src, isize);
+  emit_imm(&imm->expr, isize, true);
+}
+
+// xchg, cmpxchg and xadd. `op` is the opcode for operands wider
+// than a byte.
+static void asm_xchg(int op, int size, Operand *a, Operand *b) {
+  // xchg is symmetric, but the register has to be in the reg field.
+  bool xchg = (op == 0x87);
+  if (xchg && a->kind == OP_MEM) {
+    Operand *t = a;
+    a = b;
+    b = t;
+  }
+
+  if (!is_reg(a) || (b->kind != OP_REG && b->kind != OP_MEM)) {
+    unsupported();
+    return;
+  }
+
+  // The short form can't be used for `xchg %eax, %eax` because it
+  // would be a nop that doesn't clear the upper half of %rax.
+  if (xchg && size != 1 && b->kind == OP_REG && (is_acc(a) || is_acc(b)) &&
+      !(size == 4 && is_acc(a) && is_acc(b))) {
+    emit_opreg(size, 0x90, is_acc(a) ? b : a);
+    return;
+  }
+
+  emit_modrm(size, 0, size == 1 ? op - 1 : op, a->reg, a, b, 0);
+}
+
+typedef enum {
+  SSE_RM,    // xmm, xmm/mem
+  SSE_MOV,   // Load with `op` and store with `op + 1`
+  SSE_I2F,   // cvtsi2sd and the like
+  SSE_F2I,   // cvttsd2si and the like
+} SseKind;
+
+typedef struct {
+  char *name;
+  int pfx;
+  int op;
+  SseKind kind;
+} SseInsn;
+
+static SseInsn sse_insns[] = {
+  {"movss", 0xf3, 0x0f10, SSE_MOV},
+  {"movsd", 0xf2, 0x0f10, SSE_MOV},
+  {"movups", 0, 0x0f10, SSE_MOV},
+  {"movupd", 0x66, 0x0f10, SSE_MOV},
+  {"movaps", 0, 0x0f28, SSE_MOV},
+  {"movapd", 0x66, 0x0f28, SSE_MOV},
+  {"addss", 0xf3, 0x0f58, SSE_RM},
+  {"addsd", 0xf2, 0x0f58, SSE_RM},
+  {"subss", 0xf3, 0x0f5c, SSE_RM},
+  {"subsd", 0xf2, 0x0f5c, SSE_RM},
+  {"mulss", 0xf3, 0x0f59, SSE_RM},
+  {"mulsd", 0xf2, 0x0f59, SSE_RM},
+  {"divss", 0xf3, 0x0f5e, SSE_RM},
+  {"divsd", 0xf2, 0x0f5e, SSE_RM},
+  {"sqrtss", 0xf3, 0x0f51, SSE_RM},
+  {"sqrtsd", 0xf2, 0x0f51, SSE_RM},
+  {"ucomiss", 0, 0x0f2e, SSE_RM},
+  {"ucomisd", 0x66, 0x0f2e, SSE_RM},
+  {"comiss", 0, 0x0f2f, SSE_RM},
+  {"comisd", 0x66, 0x0f2f, SSE_RM},
+  {"andps", 0, 0x0f54, SSE_RM},
+  {"andpd", 0x66, 0x0f54, SSE_RM},
+  {"orps", 0, 0x0f56, SSE_RM},
+  {"orpd", 0x66, 0x0f56, SSE_RM},
+  {"xorps", 0, 0x0f57, SSE_RM},
+  {"xorpd", 0x66, 0x0f57, SSE_RM},
+  {"pxor", 0x66, 0x0fef, SSE_RM},
+  {"cvtss2sd", 0xf3, 0x0f5a, SSE_RM},
+  {"cvtsd2ss", 0xf2, 0x0f5a, SSE_RM},
+  {"cvtsi2ss", 0xf3, 0x0f2a, SSE_I2F},
+  {"cvtsi2sd", 0xf2, 0x0f2a, SSE_I2F},
+  {"cvttss2si", 0xf3, 0x0f2c, SSE_F2I},
+  {"cvttsd2si", 0xf2, 0x0f2c, SSE_F2I},
+  {"cvtss2si", 0xf3, 0x0f2d, SSE_F2I},
+  {"cvtsd2si", 0xf2, 0x0f2d, SSE_F2I},
+};
+
+static bool asm_sse(char *name, Operand *ops, int nops) {
+  for (int i = 0; i < sizeof(sse_insns) / sizeof(*sse_insns); i++) {
+    SseInsn *s = &sse_insns[i];
+    int suffix = match_suffix(name, s->name, (s->kind == SSE_RM || s->kind == SSE_MOV) ? "" : "lq");
+    if (suffix == -1)
+      continue;
+
+    if (nops != 2) {
+      unsupported();
+      return true;
+    }
+
+    Operand *src = &ops[0];
+    Operand *dst = &ops[1];
+
+    switch (s->kind) {
+    case SSE_RM:
+      if (dst->kind != OP_XMM || (src->kind != OP_XMM && src->kind != OP_MEM))
+        break;
+      emit_modrm(0, s->pfx, s->op, dst->reg, NULL, src, 0);
+      return true;
+    case SSE_MOV:
+      if (dst->kind == OP_XMM && (src->kind == OP_XMM || src->kind == OP_MEM)) {
+        emit_modrm(0, s->pfx, s->op, dst->reg, NULL, src, 0);
+        return true;
+      }
+      if (src->kind == OP_XMM && dst->kind == OP_MEM) {
+        emit_modrm(0, s->pfx, s->op + 1, src->reg, NULL, dst, 0);
+        return true;
+      }
+      break;
+    case SSE_I2F: {
+      if (dst->kind != OP_XMM || (src->kind != OP_REG && src->kind != OP_MEM))
+        break;
+      int size = operand_size(suffix, src, 1);
+      if (size != 4 && size != 8)
+        break;
+      emit_modrm(size == 8 ? 8 : 0, s->pfx, s->op, dst->reg, NULL, src, 0);
+      return true;
+    }
+    case SSE_F2I:
+      if (!is_reg(dst) || (src->kind != OP_XMM && src->kind != OP_MEM))
+        break;
+      if ((dst->size != 4 && dst->size != 8) || (suffix && suffix != dst->size))
+        break;
+      emit_modrm(dst->size == 8 ? 8 : 0, s->pfx, s->op, dst->reg, NULL, src, 0);
+      return true;
+    }
+
+    unsupported();
+    return true;
+  }
+  return false;
+}
+
+// movq and movd between general-purpose and XMM registers
+static bool asm_movq(int size, Operand *src, Operand *dst) {
+  if (src->kind != OP_XMM && dst->kind != OP_XMM)
+    return false;
+
+  int w = (size == 8) ? 8 : 0;
+
+  if (dst->kind == OP_XMM && is_reg(src))
+    emit_modrm(w, 0x66, 0x0f6e, dst->reg, NULL, src, 0);
+  else if (src->kind == OP_XMM && is_reg(dst))
+    emit_modrm(w, 0x66, 0x0f7e, src->reg, NULL, dst, 0);
+  else if (size == 4 && dst->kind == OP_XMM && src->kind == OP_MEM)
+    emit_modrm(0, 0x66, 0x0f6e, dst->reg, NULL, src, 0);
+  else if (size == 4 && src->kind == OP_XMM && dst->kind == OP_MEM)
+    emit_modrm(0, 0x66, 0x0f7e, src->reg, NULL, dst, 0);
+  else if (dst->kind == OP_XMM && src->kind != OP_IMM)
+    emit_modrm(0, 0xf3, 0x0f7e, dst->reg, NULL, src, 0);
+  else if (src->kind == OP_XMM && dst->kind == OP_MEM)
+    emit_modrm(0, 0x66, 0x0fd6, src->reg, NULL, dst, 0);
+  else
+    unsupported();
+  return true;
+}
+
+// x87 instructions without a memory operand. The operand, if any, is
+// a stack register added to the last byte of the opcode.
+static struct {
+  char *name;
+  int op;
+  int nops;
+} x87_reg_insns[] = {
+  {"fchs", 0xd9e0, 0}, {"fabs", 0xd9e1, 0}, {"fld1", 0xd9e8, 0},
+  {"fldz", 0xd9ee, 0}, {"fninit", 0xdbe3, 0},
+  {"faddp", 0xdec1, 0}, {"fmulp", 0xdec9, 0}, {"fsubp", 0xdee1, 0},
+  {"fsubrp", 0xdee9, 0}, {"fdivp", 0xdef1, 0}, {"fdivrp", 0xdef9, 0},
+  {"fcomip", 0xdff1, 0}, {"fucomip", 0xdfe9, 0}, {"fcomi", 0xdbf1, 0},
+  {"fucomi", 0xdbe9, 0}, {"fxch", 0xd9c9, 0},
+  {"faddp", 0xdec0, 2}, {"fmulp", 0xdec8, 2}, {"fsubp", 0xdee0, 2},
+  {"fsubrp", 0xdee8, 2}, {"fdivp", 0xdef0, 2}, {"fdivrp", 0xdef8, 2},
+  {"fcomip", 0xdff0, 2}, {"fucomip", 0xdfe8, 2}, {"fcomi", 0xdbf0, 2},
+  {"fucomi", 0xdbe8, 2}, {"fxch", 0xd9c8, 1}, {"fstp", 0xddd8, 1},
+  {"fst", 0xddd0, 1}, {"fld", 0xd9c0, 1}, {"ffree", 0xddc0, 1},
+};
+
+// x87 instructions with a memory operand: opcode and reg field
+static struct {
+  char *name;
+  int op;
+  int ext;
+} x87_mem_insns[] = {
+  {"flds", 0xd9, 0}, {"fldl", 0xdd, 0}, {"fldt", 0xdb, 5},
+  {"fsts", 0xd9, 2}, {"fstl", 0xdd, 2},
+  {"fstps", 0xd9, 3}, {"fstpl", 0xdd, 3}, {"fstpt", 0xdb, 7},
+  {"filds", 0xdf, 0}, {"fildl", 0xdb, 0}, {"fildll", 0xdf, 5}, {"fildq", 0xdf, 5},
+  {"fists", 0xdf, 2}, {"fistl", 0xdb, 2},
+  {"fistps", 0xdf, 3}, {"fistpl", 0xdb, 3}, {"fistpll", 0xdf, 7}, {"fistpq", 0xdf, 7},
+  {"fisttps", 0xdf, 1}, {"fisttpl", 0xdb, 1}, {"fisttpll", 0xdd, 1}, {"fisttpq", 0xdd, 1},
+  {"fnstcw", 0xd9, 7}, {"fldcw", 0xd9, 5}, {"fnstsw", 0xdd, 7},
+  {"fadds", 0xd8, 0}, {"faddl", 0xdc, 0}, {"fmuls", 0xd8, 1}, {"fmull", 0xdc, 1},
+  {"fsubs", 0xd8, 4}, {"fsubl", 0xdc, 4}, {"fsubrs", 0xd8, 5}, {"fsubrl", 0xdc, 5},
+  {"fdivs", 0xd8, 6}, {"fdivl", 0xdc, 6}, {"fdivrs", 0xd8, 7}, {"fdivrl", 0xdc, 7},
+};
+
+static bool asm_x87(char *name, Operand *ops, int nops) {
+  if (name[0] != 'f')
+    return false;
+
+  if (!strcmp(name, "fnstsw") && nops == 1 && is_acc(&ops[0]) && ops[0].size == 2) {
+    emit(0xdf);
+    emit(0xe0);
+    return true;
+  }
+
+  for (int i = 0; i < sizeof(x87_mem_insns) / sizeof(*x87_mem_insns); i++) {
+    if (strcmp(name, x87_mem_insns[i].name) || nops != 1 || ops[0].kind != OP_MEM)
+      continue;
+    emit_modrm(0, 0, x87_mem_insns[i].op, x87_mem_insns[i].ext, NULL, &ops[0], 0);
+    return true;
+  }
+
+  bool found = false;
+  for (int i = 0; i < sizeof(x87_reg_insns) / sizeof(*x87_reg_insns); i++) {
+    if (strcmp(name, x87_reg_insns[i].name))
+      continue;
+    found = true;
+
+    int op = x87_reg_insns[i].op;
+    switch (x87_reg_insns[i].nops) {
+    case 0:
+      if (nops != 0)
+        continue;
+      break;
+    case 1:
+      if (nops != 1 || ops[0].kind != OP_ST)
+        continue;
+      op += ops[0].reg;
+      break;
+    case 2:
+      // Either `%st, %st(i)` or `%st(i), %st`, depending on the
+      // instruction. The other operand is always %st(0).
+      if (nops != 2 || ops[0].kind != OP_ST || ops[1].kind != OP_ST)
+        continue;
+      if (ops[0].reg == 0)
+        op += ops[1].reg;
+      else if (ops[1].reg == 0)
+        op += ops[0].reg;
+      else
+        continue;
+      break;
+    }
+
+    emit(op >> 8);
+    emit(op & 0xff);
+    return true;
+  }
+
+  if (found || nops == 0 || ops[0].kind == OP_MEM || ops[0].kind == OP_ST) {
+    unsupported();
+    return true;
+  }
+  return false;
+}
+
+// Instructions without operands
+static struct {
+  char *name;
+  int op;
+  int size;
+} plain_insns[] = {
+  {"ret", 0xc3, 1}, {"leave", 0xc9, 1}, {"nop", 0x90, 1}, {"hlt", 0xf4, 1},
+  {"cltq", 0x4898, 2}, {"cdqe", 0x4898, 2}, {"cqto", 0x4899, 2},
+  {"cqo", 0x4899, 2}, {"cltd", 0x99, 1}, {"cdq", 0x99, 1},
+  {"cwtl", 0x98, 1}, {"cwde", 0x98, 1}, {"cwtd", 0x6699, 2}, {"cwd", 0x6699, 2},
+  {"cbtw", 0x6698, 2}, {"cbw", 0x6698, 2}, {"ud2", 0x0f0b, 2},
+  {"pause", 0xf390, 2}, {"mfence", 0x0faef0, 3}, {"lfence", 0x0faee8, 3},
+  {"sfence", 0x0faef8, 3}, {"endbr64", 0xf30f1efa, 4}, {"syscall", 0x0f05, 2},
+  {"cld", 0xfc, 1}, {"std", 0xfd, 1},
+  {"movsb", 0xa4, 1}, {"movsw", 0x66a5, 2}, {"movsl", 0xa5, 1},
+  {"movsq", 0x48a5, 2}, {"stosb", 0xaa, 1}, {"stosw", 0x66ab, 2},
+  {"stosl", 0xab, 1}, {"stosq", 0x48ab, 2}, {"lodsb", 0xac, 1},
+  {"scasb", 0xae, 1}, {"cmpsb", 0xa6, 1},
+};
+
+// Prefixes that may precede an instruction on the same line
+static struct {
+  char *name;
+  int byte;
+} prefixes[] = {
+  {"lock", 0xf0}, {"rep", 0xf3}, {"repe", 0xf3}, {"repz", 0xf3},
+  {"repne", 0xf2}, {"repnz", 0xf2}, {"data16", 0x66}, {"rex64", 0x48},
+};
+
+static void asm_insn(char *name, Operand *ops, int nops) {
+  int suffix;
+
+  if (nops == 0) {
+    for (int i = 0; i < sizeof(plain_insns) / sizeof(*plain_insns); i++) {
+      if (!strcmp(name, plain_insns[i].name)) {
+        for (int j = plain_insns[i].size - 1; j >= 0; j--)
+          emit(plain_insns[i].op >> (j * 8));
+        return;
+      }
+    }
+  }
+
+  if (!strcmp(name, "movq") || !strcmp(name, "movd")) {
+    int size = (name[3] == 'q') ? 8 : 4;
+    if (nops == 2 && asm_movq(size, &ops[0], &ops[1]))
+      return;
+  }
+
+  if ((suffix = match_suffix(name, "mov", "bwlq")) != -1 ||
+      (suffix = match_suffix(name, "movabs", "q")) != -1) {
+    bool movabs = (name[3] == 'a');
+    int size = operand_size(suffix, ops, nops);
+    if (nops != 2 || size == -1) {
+      unsupported();
+      return;
+    }
+    asm_mov(size, &ops[0], &ops[1], movabs);
+    return;
+  }
+
+  // Two-operand integer arithmetic
+  static char *alu[] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"};
+  for (int i = 0; i < 8; i++) {
+    suffix = match_suffix(name, alu[i], "bwlq");
+    if (suffix == -1)
+      continue;
+    int size = operand_size(suffix, ops, nops);
+    if (nops != 2 || size == -1) {
+      unsupported();
+      return;
+    }
+    asm_alu(i, size, &ops[0], &ops[1]);
+    return;
+  }
+
+  if ((suffix = match_suffix(name, "test", "bwlq")) != -1) {
+    int size = operand_size(suffix, ops, nops);
+    if (nops != 2 || size == -1) {
+      unsupported();
+      return;
+    }
+
+    Operand *src = &ops[0];
+    Operand *dst = &ops[1];
+    if (src->kind == OP_IMM) {
+      int isize = (size == 8) ? 4 : size;
+      src->expr.val = imm_value(src->expr.val, isize);
+      if (is_acc(dst))
+        emit_opreg(size, size == 1 ? 0xa8 : 0xa9, &(Operand){.reg = 0});
+      else
+        emit_modrm(size, 0, size == 1 ? 0xf6 : 0xf7, 0, NULL, dst, isize);
+      emit_imm(&src->expr, isize, true);
+      return;
+    }
+
+    // test is symmetric, but the register has to be in the reg field.
+    if (src->kind == OP_MEM) {
+      Operand *t = src;
+      src = dst;
+      dst = t;
+    }
+    if (!is_reg(src) || dst->kind == OP_IMM) {
+      unsupported();
+      return;
+    }
+    emit_modrm(size, 0, size == 1 ? 0x84 : 0x85, src->reg, src, dst, 0);
+    return;
+  }
+
+  // movzx, movsx and the AT&T spellings such as movzbl or movswq
+  if (nops == 2 && (!strncmp(name, "movz", 4) || !strncmp(name, "movs", 4))) {
+    bool sign = (name[3] == 's');
+    char *p = name + 4;
+    int from = 0, to = 0;
+
+    if (!strcmp(p, "x") || (sign && !strcmp(p, "xd"))) {
+      if (sign && p[1] == 'd')
+        from = 4;
+    } else if (sign && !strcmp(p, "lq")) {
+      from = 4;
+      to = 8;
+    } else if ((p[0] == 'b' || p[0] == 'w') &&
+               (p[1] == '\0' || (strchr("wlq", p[1]) && p[1] && !p[2]))) {
+      from = (p[0] == 'b') ? 1 : 2;
+      to = (p[1] == 'w') ? 2 : (p[1] == 'l') ? 4 : (p[1] == 'q') ? 8 : 0;
+    } else {
+      goto not_movx;
+    }
+
+    asm_movx(sign, from, to, &ops[0], &ops[1]);
+    return;
+  }
+not_movx:
+
+  if ((suffix = match_suffix(name, "lea", "wlq")) != -1) {
+    if (nops != 2 || ops[0].kind != OP_MEM || !is_reg(&ops[1]) ||
+        ops[1].size == 1 || (suffix && suffix != ops[1].size)) {
+      unsupported();
+      return;
+    }
+    emit_modrm(ops[1].size, 0, 0x8d, ops[1].reg, &ops[1], &ops[0], 0);
+    return;
+  }
+
+  if ((suffix = match_suffix(name, "push", "q")) != -1 ||
+      (suffix = match_suffix(name, "pop", "q")) != -1) {
+    bool push = (name[1] == 'u');
+    if (nops != 1) {
+      unsupported();
+      return;
+    }
+
+    Operand *op = &ops[0];
+    if (is_reg(op) && op->size == 8) {
+      emit_opreg(0, push ? 0x50 : 0x58, op);
+    } else if (op->kind == OP_MEM) {
+      emit_modrm(0, 0, push ? 0xff : 0x8f, push ? 6 : 0, NULL, op, 0);
+    } else if (push && op->kind == OP_IMM) {
+      if (!op->expr.sym && fits8(op->expr.val)) {
+        emit(0x6a);
+        emit(op->expr.val);
+      } else {
+        emit(0x68);
+        emit_imm(&op->expr, 4, true);
+      }
+    } else {
+      unsupported();
+    }
+    return;
+  }
+
+  // Unary arithmetic
+  static char *unary[] = {NULL, NULL, "not", "neg", "mul", NULL, "div", "idiv"};
+  for (int i = 0; i < 8; i++) {
+    if (!unary[i] || (suffix = match_suffix(name, unary[i], "bwlq")) == -1)
+      continue;
+    int size = operand_size(suffix, ops, nops);
+    if (nops != 1 || size == -1 || ops[0].kind == OP_IMM) {
+      unsupported();
+      return;
+    }
+    emit_modrm(size, 0, size == 1 ? 0xf6 : 0xf7, i, NULL, &ops[0], 0);
+    return;
+  }
+
+  if ((suffix = match_suffix(name, "inc", "bwlq")) != -1 ||
+      (suffix = match_suffix(name, "dec", "bwlq")) != -1) {
+    int size = operand_size(suffix, ops, nops);
+    if (nops != 1 || size == -1 || ops[0].kind == OP_IMM) {
+      unsupported();
+      return;
+    }
+    emit_modrm(size, 0, size == 1 ? 0xfe : 0xff, name[0] == 'd', NULL, &ops[0], 0);
+    return;
+  }
+
+  static char *shifts[] = {"rol", "ror", "rcl", "rcr", "shl", "shr", "sal", "sar"};
+  for (int i = 0; i < 8; i++) {
+    if ((suffix = match_suffix(name, shifts[i], "bwlq")) == -1)
+      continue;
+    if (nops < 1 || nops > 2) {
+      unsupported();
+      return;
+    }
+    int size = operand_size(suffix, &ops[nops - 1], 1);
+    if (size == -1) {
+      unsupported();
+      return;
+    }
+    asm_shift(i == 6 ? 4 : i, size, ops, nops);
+    return;
+  }
+
+  if ((suffix = match_suffix(name, "imul", "bwlq")) != -1) {
+    int size = operand_size(suffix, &ops[nops - 1], nops ? 1 : 0);
+    if (nops < 1 || size == -1) {
+      unsupported();
+      return;
+    }
+    asm_imul(size, ops, nops);
+    return;
+  }
+
+  if ((suffix = match_suffix(name, "xchg", "bwlq")) != -1 ||
+      (suffix = match_suffix(name, "cmpxchg", "bwlq")) != -1 ||
+      (suffix = match_suffix(name, "xadd", "bwlq")) != -1) {
+    int size = operand_size(suffix, ops, nops);
+    if (nops != 2 || size == -1) {
+      unsupported();
+      return;
+    }
+    int op = (name[1] == 'c') ? 0x87 : (name[0] == 'c') ? 0x0fb1 : 0x0fc1;
+    asm_xchg(op, size, &ops[0], &ops[1]);
+    return;
+  }
+
+  if (!strncmp(name, "set", 3) && cond_code(name + 3) != -1) {
+    if (nops != 1 || (ops[0].kind == OP_REG && ops[0].size != 1) ||
+        (ops[0].kind != OP_REG && ops[0].kind != OP_MEM)) {
+      unsupported();
+      return;
+    }
+    emit_modrm(0, 0, 0x0f90 + cond_code(name + 3), 0, NULL, &ops[0], 0);
+    return;
+  }
+
+  if (!strcmp(name, "jmp") || !strcmp(name, "call") ||
+      !strcmp(name, "jmpq") || !strcmp(name, "callq")) {
+    bool jmp = (name[0] == 'j');
+    if (nops != 1) {
+      unsupported();
+      return;
+    }
+
+    Operand *op = &ops[0];
+    if (op->star) {
+      if (op->kind == OP_IMM || (op->kind == OP_REG && op->size != 8)) {
+        unsupported();
+        return;
+      }
+      emit_modrm(0, 0, 0xff, jmp ? 4 : 2, NULL, op, 0);
+      return;
+    }
+
+    if (op->kind != OP_MEM || op->base != -1 || op->index != -1 || op->seg ||
+        !op->expr.sym) {
+      unsupported();
+      return;
+    }
+
+    if (jmp) {
+      emit_branch(-1, &op->expr);
+      return;
+    }
+
+    if (op->expr.sub || (op->expr.mod != MOD_NONE && op->expr.mod != MOD_PLT)) {
+      unsupported();
+      return;
+    }
+    emit(0xe8);
+    add_fixup(R_X86_64_PLT32, 4, &op->expr, op->expr.val - 4);
+    return;
+  }
+
+  if (name[0] == 'j' && cond_code(name + 1) != -1) {
+    if (nops != 1 || ops[0].kind != OP_MEM || ops[0].base != -1 ||
+        ops[0].index != -1 || !ops[0].expr.sym) {
+      unsupported();
+      return;
+    }
+    emit_branch(cond_code(name + 1), &ops[0].expr);
+    return;
+  }
+
+  if (asm_sse(name, ops, nops) || asm_x87(name, ops, nops))
+    return;
+
+  unsupported();
+}
+
+//
+// Directives
+//
+
+// Splits operands separated by commas outside of parentheses and
+// string literals.
+static int split_operands(char *p, char **args, int max) {
+  p = skip_space(p);
+  if (!*p)
+    return 0;
+
+  int n = 0;
+  int depth = 0;
+  bool in_str = false;
+  args[n++] = p;
+
+  for (; *p; p++) {
+    if (in_str) {
+      if (*p == '\\' && p[1])
+        p++;
+      else if (*p == '"')
+        in_str = false;
+      continue;
+    }
+    if (*p == '"')
+      in_str = true;
+    else if (*p == '(')
+      depth++;
+    else if (*p == ')')
+      depth--;
+    else if (*p == ',' && depth == 0) {
+      if (n == max)
+        return -1;
+      *p = '\0';
+      args[n++] = p + 1;
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    args[i] = skip_space(args[i]);
+    char *end = args[i] + strlen(args[i]);
+    while (end > args[i] && (end[-1] == ' ' || end[-1] == '\t'))
+      end--;
+    *end = '\0';
+  }
+  return n;
+}
+
+// Reads a string literal. Returns the length of the contents.
+static int parse_string(char **rest, char *p, char *buf) {
+  if (*p != '"')
+    return -1;
+  p++;
+
+  int len = 0;
+  while (*p != '"') {
+    if (!*p)
+      return -1;
+    if (*p != '\\') {
+      buf[len++] = *p++;
+      continue;
+    }
+
+    p++;
+    if ('0' <= *p && *p <= '7') {
+      int c = 0;
+      for (int i = 0; i < 3 && '0' <= *p && *p <= '7'; i++)
+        c = c * 8 + (*p++ - '0');
+      buf[len++] = c;
+      continue;
+    }
+
+    switch (*p) {
+    case 'n': buf[len++] = '\n'; break;
+    case 't': buf[len++] = '\t'; break;
+    case 'r': buf[len++] = '\r'; break;
+    case 'b': buf[len++] = '\b'; break;
+    case 'f': buf[len++] = '\f'; break;
+    case '\\': buf[len++] = '\\'; break;
+    case '"': buf[len++] = '"'; break;
+    default: return -1;
+    }
+    p++;
+  }
+
+  *rest = p + 1;
+  return len;
+}
+
+static void set_align(int align) {
+  if (align <= 0 || (align & (align - 1))) {
+    unsupported();
+    return;
+  }
+  if (cur_sec->align < align)
+    cur_sec->align = align;
+  Frag *f = new_frag(FRAG_ALIGN);
+  f->align = align;
+}
+
+static void emit_data(char *arg, int size) {
+  Expr e;
+  char *p;
+  if (!parse_expr(&p, arg, &e) || *p) {
+    unsupported();
+    return;
+  }
+
+  if (!e.sym && !e.sub) {
+    emit_int(e.val, size);
+    return;
+  }
+
+  if (e.mod != MOD_NONE || !e.sym) {
+    unsupported();
+    return;
+  }
+
+  if (e.sub) {
+    if (size != 4 && size != 8) {
+      unsupported();
+      return;
+    }
+    add_fixup(size == 4 ? R_X86_64_PC32 : R_X86_64_PC64, size, &e, e.val);
+    return;
+  }
+
+  int type = (size == 8) ? R_X86_64_64 : (size == 4) ? R_X86_64_32 :
+             (size == 2) ? R_X86_64_16 : R_X86_64_8;
+  add_fixup(type, size, &e, e.val);
+}
+
+static Symbol *parse_symbol_arg(char *p) {
+  if (!*p)
+    return NULL;
+  char *q = p;
+  while (is_sym_char(*q))
+    q++;
+  if (*q || is_digit(*p))
+    return NULL;
+  return get_symbol(p, q - p);
+}
+
+static Section *section_directive(char **args, int nargs) {
+  char *name = args[0];
+  Section *sec = find_section(name);
+  if (nargs == 1 && sec)
+    return sec;
+
+  int type = SHT_PROGBITS;
+  long flags = 0;
+
+  if (nargs == 1) {
+    if (!strncmp(name, ".rodata", 7))
+      flags = SHF_ALLOC;
+    else if (!strncmp(name, ".text", 5))
+      flags = SHF_ALLOC | SHF_EXECINSTR;
+    else if (!strncmp(name, ".data", 5))
+      flags = SHF_ALLOC | SHF_WRITE;
+    else if (!strncmp(name, ".bss", 4)) {
+      flags = SHF_ALLOC | SHF_WRITE;
+      type = SHT_NOBITS;
+    } else if (!strncmp(name, ".tdata", 6))
+      flags = SHF_ALLOC | SHF_WRITE | SHF_TLS;
+    else if (!strncmp(name, ".tbss", 5)) {
+      flags = SHF_ALLOC | SHF_WRITE | SHF_TLS;
+      type = SHT_NOBITS;
+    } else if (!strncmp(name, ".note", 5))
+      type = SHT_NOTE;
+    else
+      return NULL;
+  } else {
+    char buf[64];
+    char *p;
+    int len = parse_string(&p, args[1], buf);
+    if (len < 0 || *p)
+      return NULL;
+
+    for (int i = 0; i < len; i++) {
+      switch (buf[i]) {
+      case 'a': flags |= SHF_ALLOC; break;
+      case 'w': flags |= SHF_WRITE; break;
+      case 'x': flags |= SHF_EXECINSTR; break;
+      case 'T': flags |= SHF_TLS; break;
+      case 'M': flags |= SHF_MERGE; break;
+      case 'S': flags |= SHF_STRINGS; break;
+      default: return NULL;
+      }
+    }
+    if (flags & (SHF_MERGE | SHF_STRINGS))
+      return NULL;
+
+    if (nargs >= 3) {
+      if (!strcmp(args[2], "@progbits"))
+        type = SHT_PROGBITS;
+      else if (!strcmp(args[2], "@nobits"))
+        type = SHT_NOBITS;
+      else if (!strcmp(args[2], "@note"))
+        type = SHT_NOTE;
+      else
+        return NULL;
+    }
+    if (nargs > 3)
+      return NULL;
+  }
+
+  if (sec) {
+    if (sec->type != type || sec->flags != flags)
+      return NULL;
+    return sec;
+  }
+  return new_section(strdup(name), type, flags);
+}
+
+// Reserves space for a local common symbol in .bss. Like `as`, we
+// collect these in a separate list that is placed after everything
+// else in .bss, so that the symbols get the same addresses.
+static void local_common(Symbol *sym, long size, long align) {
+  Section *save = cur_sec;
+  cur_sec = find_section(".bss");
+
+  Frag *frags = cur_sec->frags;
+  Frag *last = cur_sec->last;
+  cur_sec->frags = cur_sec->common_frags;
+  cur_sec->last = cur_sec->common_last;
+
+  set_align(align);
+  define_label(sym);
+  Frag *f = cur_frag();
+  bytes_reserve(&f->buf, size);
+  memset(f->buf.data + f->buf.len, 0, size);
+  f->buf.len += size;
+  sym->size = size;
+  sym->type = STT_OBJECT;
+
+  cur_sec->common_frags = cur_sec->frags;
+  cur_sec->common_last = cur_sec->last;
+  cur_sec->frags = frags;
+  cur_sec->last = last;
+  cur_sec = save;
+}
+
+static void asm_directive(char *name, char *rest) {
+  char *args[8];
+  int nargs = 0;
+
+  if (!strcmp(name, ".ascii") || !strcmp(name, ".asciz") || !strcmp(name, ".string")) {
+    char *p = skip_space(rest);
+    char *buf = malloc(strlen(p) + 1);
+    for (;;) {
+      int len = parse_string(&p, p, buf);
+      if (len < 0) {
+        unsupported();
+        break;
+      }
+      bytes_add(&cur_frag()->buf, buf, len);
+      if (name[2] != 's')
+        emit(0);
+      p = skip_space(p);
+      if (!*p)
+        break;
+      if (*p != ',') {
+        unsupported();
+        break;
+      }
+      p = skip_space(p + 1);
+    }
+    free(buf);
+    return;
+  }
+
+  nargs = split_operands(rest, args, 8);
+  if (nargs < 0) {
+    unsupported();
+    return;
+  }
+
+  int size = 0;
+  if (!strcmp(name, ".byte"))
+    size = 1;
+  else if (!strcmp(name, ".value") || !strcmp(name, ".word") ||
+           !strcmp(name, ".short") || !strcmp(name, ".2byte"))
+    size = 2;
+  else if (!strcmp(name, ".long") || !strcmp(name, ".int") || !strcmp(name, ".4byte"))
+    size = 4;
+  else if (!strcmp(name, ".quad") || !strcmp(name, ".8byte"))
+    size = 8;
+
+  if (size) {
+    for (int i = 0; i < nargs; i++)
+      emit_data(args[i], size);
+    return;
+  }
+
+  if (!strcmp(name, ".loc")) {
+    long file, line;
+    char *p;
+    if (!parse_number(&p, skip_space(rest), &file) ||
+        !parse_number(&p, skip_space(p), &line)) {
+      unsupported();
+      return;
+    }
+
+    LineRow *row = calloc(1, sizeof(LineRow));
+    Frag *f = cur_frag();
+    row->sec = cur_sec;
+    row->frag = f;
+    row->offset = f->buf.len;
+    row->file = file;
+    row->line = line;
+    if (last_row)
+      last_row->next = row;
+    else
+      rows = row;
+    last_row = row;
+    return;
+  }
+
+  if (!strcmp(name, ".text") || !strcmp(name, ".data") || !strcmp(name, ".bss")) {
+    if (nargs) {
+      unsupported();
+      return;
+    }
+    switch_section(find_section(name));
+    return;
+  }
+
+  if (!strcmp(name, ".section") || !strcmp(name, ".pushsection")) {
+    Section *sec = nargs ? section_directive(args, nargs) : NULL;
+    if (!sec || (name[1] == 'p' && sec_depth == sizeof(sec_stack) / sizeof(*sec_stack))) {
+      unsupported();
+      return;
+    }
+    if (name[1] == 'p')
+      sec_stack[sec_depth++] = cur_sec;
+    switch_section(sec);
+    return;
+  }
+
+  if (!strcmp(name, ".popsection")) {
+    if (sec_depth == 0) {
+      unsupported();
+      return;
+    }
+    switch_section(sec_stack[--sec_depth]);
+    return;
+  }
+
+  if (!strcmp(name, ".previous")) {
+    if (prev_sec)
+      switch_section(prev_sec);
+    return;
+  }
+
+  if (!strcmp(name, ".globl") || !strcmp(name, ".global") ||
+      !strcmp(name, ".local") || !strcmp(name, ".weak")) {
+    for (int i = 0; i < nargs; i++) {
+      Symbol *sym = parse_symbol_arg(args[i]);
+      if (!sym) {
+        unsupported();
+        return;
+      }
+      if (name[1] == 'l') {
+        sym->is_local = true;
+      } else {
+        sym->is_global = true;
+        sym->bind = (name[1] == 'w') ? STB_WEAK : STB_GLOBAL;
+      }
+    }
+    return;
+  }
+
+  if (!strcmp(name, ".type")) {
+    Symbol *sym = (nargs == 2) ? parse_symbol_arg(args[0]) : NULL;
+    if (!sym) {
+      unsupported();
+      return;
+    }
+    char *type = args[1];
+    if (*type == '@' || *type == '%')
+      type++;
+    if (!strcmp(type, "function"))
+      sym->type = STT_FUNC;
+    else if (!strcmp(type, "object"))
+      sym->type = STT_OBJECT;
+    else if (!strcmp(type, "tls_object"))
+      sym->type = STT_TLS;
+    else if (!strcmp(type, "notype"))
+      sym->type = STT_NOTYPE;
+    else
+      unsupported();
+    return;
+  }
+
+  if (!strcmp(name, ".size")) {
+    Symbol *sym = (nargs == 2) ? parse_symbol_arg(args[0]) : NULL;
+    char *p;
+    long val;
+    if (!sym || !parse_number(&p, args[1], &val) || *p) {
+      unsupported();
+      return;
+    }
+    sym->size = val;
+    return;
+  }
+
+  if (!strcmp(name, ".align") || !strcmp(name, ".balign") || !strcmp(name, ".p2align")) {
+    char *p;
+    long val;
+    if (nargs != 1 || !parse_number(&p, args[0], &val) || *p || val > 4096) {
+      unsupported();
+      return;
+    }
+    set_align(name[1] == 'p' ? 1 << val : val);
+    return;
+  }
+
+  if (!strcmp(name, ".zero") || !strcmp(name, ".skip") || !strcmp(name, ".space")) {
+    char *p;
+    long val, fill = 0;
+    if (nargs < 1 || nargs > 2 || !parse_number(&p, args[0], &val) || *p ||
+        (nargs == 2 && (!parse_number(&p, args[1], &fill) || *p))) {
+      unsupported();
+      return;
+    }
+    Frag *f = cur_frag();
+    bytes_reserve(&f->buf, val);
+    memset(f->buf.data + f->buf.len, fill, val);
+    f->buf.len += val;
+    return;
+  }
+
+  if (!strcmp(name, ".comm") || !strcmp(name, ".lcomm")) {
+    Symbol *sym = (nargs >= 2) ? parse_symbol_arg(args[0]) : NULL;
+    char *p;
+    long size, align = 1;
+    if (!sym || nargs > 3 || !parse_number(&p, args[1], &size) || *p ||
+        (nargs == 3 && (!parse_number(&p, args[2], &align) || *p)) ||
+        sym->sec || sym->is_common) {
+      unsupported();
+      return;
+    }
+
+    if (sym->is_local || name[1] == 'l') {
+      local_common(sym, size, align);
+      return;
+    }
+    sym->is_common = true;
+    sym->is_global = true;
+    sym->bind = STB_GLOBAL;
+    sym->size = size;
+    sym->common_align = align;
+    sym->type = STT_OBJECT;
+    return;
+  }
+
+  if (!strcmp(name, ".file")) {
+    long n;
+    char *p;
+    if (nargs == 1 && args[0][0] == '"')
+      return;
+    if (!parse_number(&p, rest, &n) || n <= 0 || n > 100000) {
+      unsupported();
+      return;
+    }
+
+    p = skip_space(p);
+    char *buf = malloc(strlen(p) + 1);
+    int len = parse_string(&p, p, buf);
+    if (len < 0 || *skip_space(p)) {
+      unsupported();
+      return;
+    }
+    buf[len] = '\0';
+
+    while (file_names.len < n)
+      strarray_push(&file_names, NULL);
+    file_names.data[n - 1] = buf;
+    return;
+  }
+
+  if (!strcmp(name, ".ident"))
+    return;
+
+  unsupported();
+}
+
+//
+// Parser
+//
+
+// Assembles one statement, which is a line or part of a line
+// separated by ';', without a comment.
+static void asm_statement(char *p) {
+  p = skip_space(p);
+
+  // Labels
+  for (;;) {
+    char *q = p;
+    while (is_sym_char(*q))
+      q++;
+    if (q == p || *q != ':')
+      break;
+
+    if (is_digit(*p)) {
+      long n;
+      char *end;
+      if (!parse_number(&end, p, &n) || end != q || n > 9) {
+        unsupported();
+        return;
+      }
+      local_labels[n]++;
+      define_label(local_label(n, false));
+    } else {
+      define_label(get_symbol(p, q - p));
+    }
+    p = skip_space(q + 1);
+  }
+
+  if (!*p)
+    return;
+
+  char *name = p;
+  while (is_sym_char(*p))
+    p++;
+  if (p == name || (*p && *p != ' ' && *p != '\t')) {
+    unsupported();
+    return;
+  }
+  if (*p)
+    *p++ = '\0';
+
+  if (*name == '.') {
+    asm_directive(name, p);
+    return;
+  }
+
+  // Prefixes
+  for (;;) {
+    bool found = false;
+    for (int i = 0; i < sizeof(prefixes) / sizeof(*prefixes); i++) {
+      if (!strcmp(name, prefixes[i].name)) {
+        emit(prefixes[i].byte);
+        found = true;
+        break;
+      }
+    }
+    if (!found)
+      break;
+
+    p = skip_space(p);
+    if (!*p)
+      return;
+    name = p;
+    while (is_sym_char(*p))
+      p++;
+    if (*p && *p != ' ' && *p != '\t') {
+      unsupported();
+      return;
+    }
+    if (*p)
+      *p++ = '\0';
+  }
+
+  char *args[4];
+  int nargs = split_operands(p, args, 4);
+  if (nargs < 0) {
+    unsupported();
+    return;
+  }
+
+  Operand ops[4];
+  for (int i = 0; i < nargs; i++) {
+    if (!parse_operand(args[i], &ops[i])) {
+      unsupported();
+      return;
+    }
+  }
+  asm_insn(name, ops, nargs);
+}
+
+static void asm_line(char *p, char *end) {
+  static char *buf;
+  static int cap;
+
+  if (cap < end - p + 1) {
+    cap = (end - p + 1) * 2;
+    buf = realloc(buf, cap);
+  }
+
+  // Split the line into statements and strip a comment.
+  char *q = buf;
+  bool in_str = false;
+  for (; p < end; p++) {
+    if (in_str) {
+      if (*p == '\\' && p + 1 < end)
+        *q++ = *p++;
+      else if (*p == '"')
+        in_str = false;
+      *q++ = *p;
+      continue;
+    }
+    if (*p == '"')
+      in_str = true;
+    if (*p == '#')
+      break;
+    if (*p == ';') {
+      *q = '\0';
+      asm_statement(buf);
+      q = buf;
+      continue;
+    }
+    *q++ = *p;
+  }
+  *q = '\0';
+  asm_statement(buf);
+}
+
+//
+// Layout
+//
+
+static bool is_local_target(Section *sec, Symbol *sym) {
+  return sym->sec == sec && !sym->is_global;
+}
+
+static void layout(Section *sec) {
+  if (sec->common_frags) {
+    if (sec->last)
+      sec->last->next = sec->common_frags;
+    else
+      sec->frags = sec->common_frags;
+    sec->last = sec->common_last;
+    sec->common_frags = sec->common_last = NULL;
+  }
+
+  for (Frag *f = sec->frags; f; f = f->next) {
+    if (f->kind == FRAG_DATA)
+      f->size = f->buf.len;
+    else if (f->kind == FRAG_BRANCH)
+      f->is_long = !is_local_target(sec, f->target);
+  }
+
+  // Jumps start short and are made long if the target is out of range.
+  // Sizes only grow, so this terminates.
+  for (;;) {
+    int addr = 0;
+    for (Frag *f = sec->frags; f; f = f->next) {
+      f->addr = addr;
+      if (f->kind == FRAG_BRANCH)
+        f->size = !f->is_long ? 2 : (f->cc == -1) ? 5 : 6;
+      else if (f->kind == FRAG_ALIGN)
+        f->size = (f->align - addr % f->align) % f->align;
+      addr += f->size;
+    }
+    sec->size = addr;
+
+    bool changed = false;
+    for (Frag *f = sec->frags; f; f = f->next) {
+      if (f->kind != FRAG_BRANCH || f->is_long)
+        continue;
+      long disp = symbol_value(f->target) - (f->addr + 2);
+      if (!fits8(disp)) {
+        f->is_long = true;
+        changed = true;
+      }
+    }
+    if (!changed)
+      return;
+  }
+}
+
+static void add_rela(Section *sec, long offset, int type, Symbol *sym, long addend) {
+  Rela *r = calloc(1, sizeof(Rela));
+  r->offset = offset;
+  r->type = type;
+  r->sym = sym;
+  r->addend = addend;
+  if (sec->last_rela)
+    sec->last_rela->next = r;
+  else
+    sec->relas = r;
+  sec->last_rela = r;
+}
+
+static bool is_pcrel(int type) {
+  return type == R_X86_64_PC32 || type == R_X86_64_PLT32 || type == R_X86_64_PC64;
+}
+
+// Resolves a fixup or turns it into a relocation.
+static void resolve(Section *sec, Fixup *fx) {
+  long p = fx->frag->addr + fx->offset;
+  Symbol *sym = fx->sym;
+  long addend = fx->addend;
+  int type = fx->type;
+
+  if (sym->is_section) {
+    add_rela(sec, p, type, sym, addend);
+    return;
+  }
+
+  if (fx->sub) {
+    Symbol *sub = fx->sub;
+    if (!sub->sec || sub->is_common) {
+      unsupported();
+      return;
+    }
+
+    // The difference of two labels in the same section is a constant.
+    if (sym->sec == sub->sec && !sym->is_common) {
+      long val = symbol_value(sym) - symbol_value(sub) + addend;
+      memcpy(sec->contents + p, &val, fx->size);
+      return;
+    }
+
+    // `sym - sub` is PC-relative if `sub` is in this section.
+    if (sub->sec != sec) {
+      unsupported();
+      return;
+    }
+    addend += p - symbol_value(sub);
+  }
+
+  bool local = sym->sec && !sym->is_global && !sym->is_common;
+
+  if (local && is_pcrel(type) && sym->sec == sec) {
+    long val = symbol_value(sym) + addend - p;
+    if (fx->size == 4 && !fits32(val))
+      unsupported();
+    memcpy(sec->contents + p, &val, fx->size);
+    return;
+  }
+
+  // Relocations against local symbols refer to the section symbol,
+  // except for ones that need an entry in the GOT.
+  bool got = type == R_X86_64_GOTPCREL || type == R_X86_64_GOTPCRELX ||
+             type == R_X86_64_REX_GOTPCRELX || type == R_X86_64_TLSGD ||
+             type == R_X86_64_GOTTPOFF;
+  if (local && !got) {
+    add_rela(sec, p, type, sym->sec->sym, symbol_value(sym) + addend);
+    return;
+  }
+
+  if (!sym->sec && !sym->is_common && !strncmp(sym->name, ".L", 2)) {
+    unsupported();
+    return;
+  }
+  sym->in_symtab = true;
+  add_rela(sec, p, type, sym, addend);
+}
+
+static void write_contents(Section *sec) {
+  sec->contents = calloc(1, sec->size + 1);
+  bool is_code = sec->flags & SHF_EXECINSTR;
+
+  for (Frag *f = sec->frags; f; f = f->next) {
+    uint8_t *p = sec->contents + f->addr;
+
+    switch (f->kind) {
+    case FRAG_DATA:
+      memcpy(p, f->buf.data, f->buf.len);
+      break;
+    case FRAG_ALIGN:
+      memset(p, is_code ? 0x90 : 0, f->size);
+      break;
+    case FRAG_BRANCH: {
+      Symbol *sym = f->target;
+      if (!f->is_long) {
+        *p++ = (f->cc == -1) ? 0xeb : 0x70 + f->cc;
+        *p = symbol_value(sym) - (f->addr + 2);
+        break;
+      }
+
+      if (f->cc == -1) {
+        *p++ = 0xe9;
+      } else {
+        *p++ = 0x0f;
+        *p++ = 0x80 + f->cc;
+      }
+
+      int type = is_local_target(sec, sym) ? R_X86_64_PC32 : R_X86_64_PLT32;
+      Fixup fx = {.frag = f, .offset = f->size - 4, .type = type, .size = 4,
+                  .sym = sym, .addend = -4};
+      if (sym->sec && !sym->is_global && sym->sec != sec)
+        fx.type = R_X86_64_PC32;
+      resolve(sec, &fx);
+      break;
+    }
+    }
+  }
+
+  for (Fixup *fx = sec->fixups; fx; fx = fx->next)
+    resolve(sec, fx);
+}
+
+//
+// Debug information
+//
+
+// Appends a fixup that becomes a relocation against the beginning of
+// a given section.
+static void add_section_ref(Section *sec, int type, int size, Section *target, long addend) {
+  Section *save = cur_sec;
+  cur_sec = sec;
+  add_fixup(type, size, &(Expr){.sym = target->sym}, addend);
+  cur_sec = save;
+}
+
+static Section *new_debug_section(char *name) {
+  Section *save = cur_sec;
+  Section *sec = new_section(name, SHT_PROGBITS, 0);
+  cur_sec = sec;
+  cur_frag();
+  cur_sec = save;
+  return sec;
+}
+
+static Bytes *section_bytes(Section *sec) {
+  return &sec->last->buf;
+}
+
+static void emit_line_row(Bytes *b, long addr_delta, int line_delta) {
+  // These match the header of .debug_line below.
+  int line_base = -5, line_range = 14, opcode_base = 13;
+
+  if (line_delta < line_base || line_base + line_range <= line_delta) {
+    bytes_byte(b, DW_LNS_advance_line);
+    bytes_sleb(b, line_delta);
+    line_delta = 0;
+  }
+
+  // `as` writes a row that advances nothing as DW_LNS_copy.
+  if (line_delta == 0 && addr_delta == 0) {
+    bytes_byte(b, DW_LNS_copy);
+    return;
+  }
+
+  long op = (line_delta - line_base) + line_range * addr_delta + opcode_base;
+  if (op > 255) {
+    bytes_byte(b, DW_LNS_advance_pc);
+    bytes_uleb(b, addr_delta);
+    op = (line_delta - line_base) + opcode_base;
+  }
+  bytes_byte(b, op);
+}
+
+static void emit_debug_info(void) {
+  if (!rows)
+    return;
+
+  bool text_only = true;
+  for (LineRow *r = rows; r; r = r->next)
+    if (r->sec != text_sec)
+      text_only = false;
+
+  // .debug_line
+  Section *line = new_debug_section(".debug_line");
+  Bytes *b = section_bytes(line);
+
+  bytes_int(b, 0, 4); // unit_length
+  bytes_int(b, 3, 2); // version
+  int header_length_pos = b->len;
+  bytes_int(b, 0, 4); // header_length
+  int header_start = b->len;
+  bytes_byte(b, 1);   // minimum_instruction_length
+  bytes_byte(b, 1);   // default_is_stmt
+  bytes_byte(b, -5);  // line_base
+  bytes_byte(b, 14);  // line_range
+  bytes_byte(b, 13);  // opcode_base
+
+  static uint8_t opcode_lengths[] = {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1};
+  bytes_add(b, opcode_lengths, sizeof(opcode_lengths));
+
+  // Like `as`, split each path into an entry in the directory table
+  // and a file name, so that "./include/x.h" is "x.h" in "./include".
+  StringArray dirs = {};
+  int *dir_index = calloc(file_names.len + 1, sizeof(int));
+  char **base = calloc(file_names.len + 1, sizeof(char *));
+
+  for (int i = 0; i < file_names.len; i++) {
+    char *path = file_names.data[i] ? file_names.data[i] : "";
+    char *slash = strrchr(path, '/');
+    base[i] = path;
+    if (!slash)
+      continue;
+
+    char *dir = strndup(path, slash == path ? 1 : slash - path);
+    base[i] = slash + 1;
+    for (int j = 0; j < dirs.len; j++)
+      if (!strcmp(dirs.data[j], dir))
+        dir_index[i] = j + 1;
+    if (!dir_index[i]) {
+      strarray_push(&dirs, dir);
+      dir_index[i] = dirs.len;
+    }
+  }
+
+  for (int i = 0; i < dirs.len; i++)
+    bytes_str(b, dirs.data[i]);
+  bytes_byte(b, 0);
+
+  for (int i = 0; i < file_names.len; i++) {
+    bytes_str(b, base[i]);
+    bytes_uleb(b, dir_index[i]);
+    bytes_uleb(b, 0); // mtime
+    bytes_uleb(b, 0); // length
+  }
+  bytes_byte(b, 0);
+  free(dir_index);
+  free(base);
+
+  int header_length = b->len - header_start;
+  memcpy(b->data + header_length_pos, &header_length, 4);
+
+  // Emit a sequence for each section that has line numbers.
+  for (Section *sec = sections; sec; sec = sec->next) {
+    bool started = false;
+    long addr = 0;
+    int file = 1;
+    int lineno = 1;
+
+    for (LineRow *r = rows; r; r = r->next) {
+      if (r->sec != sec)
+        continue;
+
+      long row_addr = r->frag->addr + r->offset;
+      if (!started) {
+        bytes_byte(b, 0);
+        bytes_uleb(b, 9);
+        bytes_byte(b, DW_LNE_set_address);
+        add_section_ref(line, R_X86_64_64, 8, sec, row_addr);
+        b = section_bytes(line);
+        addr = row_addr;
+        started = true;
+      }
+
+      if (r->file != file) {
+        bytes_byte(b, DW_LNS_set_file);
+        bytes_uleb(b, r->file);
+        file = r->file;
+      }
+
+      emit_line_row(b, row_addr - addr, r->line - lineno);
+      addr = row_addr;
+      lineno = r->line;
+    }
+
+    if (started) {
+      if (sec->size > addr) {
+        bytes_byte(b, DW_LNS_advance_pc);
+        bytes_uleb(b, sec->size - addr);
+      }
+      bytes_byte(b, 0);
+      bytes_uleb(b, 1);
+      bytes_byte(b, DW_LNE_end_sequence);
+    }
+  }
+
+  int unit_length = b->len - 4;
+  memcpy(b->data, &unit_length, 4);
+
+  // Describe the code in .text with a compile unit, as `as` does.
+  if (!text_only)
+    return;
+
+  Section *abbrev = new_debug_section(".debug_abbrev");
+  b = section_bytes(abbrev);
+  bytes_uleb(b, 1);
+  bytes_uleb(b, DW_TAG_compile_unit);
+  bytes_byte(b, DW_CHILDREN_no);
+  int attrs[][2] = {
+    {DW_AT_stmt_list, DW_FORM_data4}, {DW_AT_low_pc, DW_FORM_addr},
+    {DW_AT_high_pc, DW_FORM_addr}, {DW_AT_name, DW_FORM_string},
+    {DW_AT_comp_dir, DW_FORM_string}, {DW_AT_producer, DW_FORM_string},
+    {DW_AT_language, DW_FORM_data2}, {0, 0},
+  };
+  for (int i = 0; i < sizeof(attrs) / sizeof(*attrs); i++) {
+    bytes_uleb(b, attrs[i][0]);
+    bytes_uleb(b, attrs[i][1]);
+  }
+  bytes_byte(b, 0);
+
+  Section *info = new_debug_section(".debug_info");
+  b = section_bytes(info);
+  bytes_int(b, 0, 4); // unit_length
+  bytes_int(b, 3, 2); // version
+  add_section_ref(info, R_X86_64_32, 4, abbrev, 0);
+  b = section_bytes(info);
+  bytes_byte(b, 8);   // address_size
+  bytes_uleb(b, 1);
+  add_section_ref(info, R_X86_64_32, 4, line, 0);
+  add_section_ref(info, R_X86_64_64, 8, text_sec, 0);
+  add_section_ref(info, R_X86_64_64, 8, text_sec, text_sec->size);
+  b = section_bytes(info);
+
+  char cwd[4096];
+  bytes_str(b, (file_names.len && file_names.data[0]) ? file_names.data[0] : "");
+  bytes_str(b, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+  bytes_str(b, "chibicc");
+  bytes_int(b, 0x8001, 2); // DW_LANG_Mips_Assembler
+  unit_length = b->len - 4;
+  memcpy(b->data, &unit_length, 4);
+
+  Section *aranges = new_debug_section(".debug_aranges");
+  b = section_bytes(aranges);
+  bytes_int(b, 44, 4); // unit_length
+  bytes_int(b, 2, 2);  // version
+  add_section_ref(aranges, R_X86_64_32, 4, info, 0);
+  b = section_bytes(aranges);
+  bytes_byte(b, 8);    // address_size
+  bytes_byte(b, 0);    // segment_size
+  bytes_int(b, 0, 4);  // padding
+  add_section_ref(aranges, R_X86_64_64, 8, text_sec, 0);
+  b = section_bytes(aranges);
+  bytes_int(b, text_sec->size, 8);
+  bytes_int(b, 0, 16);
+}
+
+//
+// ELF writer
+//
+
+static void write_elf(FILE *out) {
+  Bytes strtab = {};
+  Bytes shstrtab = {};
+  Bytes symtab = {};
+  bytes_byte(&strtab, 0);
+  bytes_byte(&shstrtab, 0);
+
+  // Assign section indices. Each section with relocations is followed
+  // by its .rela section.
+  int nsections = 1;
+  for (Section *sec = sections; sec; sec = sec->next) {
+    sec->index = nsections++;
+    if (sec->relas)
+      sec->rela_index = nsections++;
+  }
+  int symtab_index = nsections++;
+  int strtab_index = nsections++;
+  int shstrtab_index = nsections++;
+
+  // Build the symbol table. Local symbols must precede global ones.
+  bytes_int(&symtab, 0, sizeof(Elf64_Sym));
+  int nsyms = 1;
+
+  for (Section *sec = sections; sec; sec = sec->next) {
+    Elf64_Sym s = {};
+    s.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+    s.st_shndx = sec->index;
+    bytes_add(&symtab, &s, sizeof(s));
+    sec->sym->index = nsyms++;
+  }
+
+  int first_global = 0;
+
+  for (int global = 0; global < 2; global++) {
+    if (global)
+      first_global = nsyms;
+
+    if (global && uses_got) {
+      Symbol *sym = get_symbol("_GLOBAL_OFFSET_TABLE_", 21);
+      if (!sym->sec)
+        sym->in_symtab = true;
+    }
+
+    for (Symbol *sym = sym_list; sym; sym = sym->next) {
+      bool is_global = sym->is_global || sym->is_common || !sym->sec;
+      if (is_global != global)
+        continue;
+
+      if (!global && !strncmp(sym->name, ".L", 2) && !sym->in_symtab)
+        continue;
+      if (!sym->sec && !sym->is_common && !sym->is_global && !sym->in_symtab)
+        continue;
+
+      int type = sym->type;
+      if (sym->sec && (sym->sec->flags & SHF_TLS))
+        type = STT_TLS;
+
+      Elf64_Sym s = {};
+      s.st_name = strtab.len;
+      s.st_info = ELF64_ST_INFO(global ? (sym->bind ? sym->bind : STB_GLOBAL) : STB_LOCAL, type);
+      s.st_size = sym->size;
+      if (sym->is_common) {
+        s.st_shndx = SHN_COMMON;
+        s.st_value = sym->common_align;
+      } else if (sym->sec) {
+        s.st_shndx = sym->sec->index;
+        s.st_value = symbol_value(sym);
+      }
+
+      bytes_str(&strtab, sym->name);
+      bytes_add(&symtab, &s, sizeof(s));
+      sym->index = nsyms++;
+    }
+  }
+
+  // Section headers
+  Elf64_Shdr *shdrs = calloc(nsections, sizeof(Elf64_Shdr));
+  long offset = sizeof(Elf64_Ehdr);
+
+  for (Section *sec = sections; sec; sec = sec->next) {
+    Elf64_Shdr *sh = &shdrs[sec->index];
+    sh->sh_name = shstrtab.len;
+    bytes_str(&shstrtab, sec->name);
+    sh->sh_type = sec->type;
+    sh->sh_flags = sec->flags;
+    sh->sh_addralign = sec->align;
+    sh->sh_size = sec->size;
+
+    if (!sec->relas)
+      continue;
+
+    Elf64_Shdr *rsh = &shdrs[sec->rela_index];
+    rsh->sh_name = shstrtab.len;
+    bytes_str(&shstrtab, format(".rela%s", sec->name));
+    rsh->sh_type = SHT_RELA;
+    rsh->sh_flags = SHF_INFO_LINK;
+    rsh->sh_link = symtab_index;
+    rsh->sh_info = sec->index;
+    rsh->sh_addralign = 8;
+    rsh->sh_entsize = sizeof(Elf64_Rela);
+    for (Rela *r = sec->relas; r; r = r->next)
+      rsh->sh_size += sizeof(Elf64_Rela);
+  }
+
+  Elf64_Shdr *sh = &shdrs[symtab_index];
+  sh->sh_name = shstrtab.len;
+  bytes_str(&shstrtab, ".symtab");
+  sh->sh_type = SHT_SYMTAB;
+  sh->sh_size = symtab.len;
+  sh->sh_link = strtab_index;
+  sh->sh_info = first_global;
+  sh->sh_addralign = 8;
+  sh->sh_entsize = sizeof(Elf64_Sym);
+
+  sh = &shdrs[strtab_index];
+  sh->sh_name = shstrtab.len;
+  bytes_str(&shstrtab, ".strtab");
+  sh->sh_type = SHT_STRTAB;
+  sh->sh_size = strtab.len;
+  sh->sh_addralign = 1;
+
+  sh = &shdrs[shstrtab_index];
+  sh->sh_name = shstrtab.len;
+  bytes_str(&shstrtab, ".shstrtab");
+  sh->sh_type = SHT_STRTAB;
+  sh->sh_size = shstrtab.len;
+  sh->sh_addralign = 1;
+
+  // Assign file offsets.
+  for (int i = 1; i < nsections; i++) {
+    sh = &shdrs[i];
+    int align = sh->sh_addralign ? sh->sh_addralign : 1;
+    offset = (offset + align - 1) / align * align;
+    sh->sh_offset = offset;
+    if (sh->sh_type != SHT_NOBITS)
+      offset += sh->sh_size;
+  }
+  offset = (offset + 7) / 8 * 8;
+
+  Elf64_Ehdr eh = {};
+  memcpy(eh.e_ident, ELFMAG, SELFMAG);
+  eh.e_ident[EI_CLASS] = ELFCLASS64;
+  eh.e_ident[EI_DATA] = ELFDATA2LSB;
+  eh.e_ident[EI_VERSION] = EV_CURRENT;
+  eh.e_ident[EI_OSABI] = ELFOSABI_NONE;
+  eh.e_type = ET_REL;
+  eh.e_machine = EM_X86_64;
+  eh.e_version = EV_CURRENT;
+  eh.e_shoff = offset;
+  eh.e_ehsize = sizeof(Elf64_Ehdr);
+  eh.e_shentsize = sizeof(Elf64_Shdr);
+  eh.e_shnum = nsections;
+  eh.e_shstrndx = shstrtab_index;
+
+  // Write everything out.
+  Bytes buf = {};
+  bytes_add(&buf, &eh, sizeof(eh));
+
+  for (Section *sec = sections; sec; sec = sec->next) {
+    if (sec->type != SHT_NOBITS) {
+      bytes_int(&buf, 0, shdrs[sec->index].sh_offset - buf.len);
+      bytes_add(&buf, sec->contents, sec->size);
+    }
+
+    if (sec->relas) {
+      bytes_int(&buf, 0, shdrs[sec->rela_index].sh_offset - buf.len);
+      for (Rela *r = sec->relas; r; r = r->next) {
+        Elf64_Rela rela = {};
+        rela.r_offset = r->offset;
+        rela.r_info = ELF64_R_INFO(r->sym->index, r->type);
+        rela.r_addend = r->addend;
+        bytes_add(&buf, &rela, sizeof(rela));
+      }
+    }
+  }
+
+  bytes_int(&buf, 0, shdrs[symtab_index].sh_offset - buf.len);
+  bytes_add(&buf, symtab.data, symtab.len);
+  bytes_add(&buf, strtab.data, strtab.len);
+  bytes_add(&buf, shstrtab.data, shstrtab.len);
+  bytes_int(&buf, 0, offset - buf.len);
+  bytes_add(&buf, shdrs, nsections * sizeof(Elf64_Shdr));
+
+  fwrite(buf.data, buf.len, 1, out);
+}
+
+// Assembles `text` and writes a relocatable object file to `path`.
+// Returns false if the text contains anything that this assembler
+// doesn't support. Nothing is written in that case.
+bool assemble_elf(char *text, char *path) {
+  new_section(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR);
+  new_section(".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE);
+  new_section(".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE);
+  text_sec = cur_sec = sections;
+
+  for (char *p = text; *p && !failed;) {
+    char *end = strchr(p, '\n');
+    if (!end)
+      end = p + strlen(p);
+    asm_line(p, end);
+    p = *end ? end + 1 : end;
+  }
+
+  if (failed)
+    return false;
+
+  for (Section *sec = sections; sec; sec = sec->next)
+    layout(sec);
+
+  emit_debug_info();
+
+  for (Section *sec = sections; sec; sec = sec->next) {
+    if (sec->name[1] == 'd' && !strncmp(sec->name, ".debug_", 7))
+      layout(sec);
+    write_contents(sec);
+  }
+
+  if (failed)
+    return false;
+
+  FILE *out = fopen(path, "w");
+  if (!out)
+    error("cannot open output file: %s: %s", path, strerror(errno));
+  write_elf(out);
+  fclose(out);
+  return true;
+}
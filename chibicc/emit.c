@@ -0,0 +1,314 @@
+// This file implements the buffer that the code generator writes
+// assembly text to.
+//
+// The code generator emits hundreds of thousands of short lines for a
+// large translation unit. Formatting them with vfprintf is slow
+// because stdio parses every format string in full generality, takes
+// a lock on the stream and, for a memory stream, copies the result
+// once more at the end. out_printf() instead understands only the
+// conversions that codegen.c uses, copies literal text with memcpy,
+// converts integers two digits at a time and appends everything to a
+// single growing buffer, which is handed to the assembler or written
+// to the output file with one system call.
+
+#include "chibicc.h"
+#include <fcntl.h>
+
+void out_reserve(OutBuf *out, long n) {
+  if (out->len + n < out->cap)
+    return;
+
+  long cap = out->cap ? out->cap : 4096;
+  while (cap <= out->len + n)
+    cap *= 2;
+  out->data = realloc(out->data, cap);
+  out->cap = cap;
+}
+
+void out_add(OutBuf *out, char *s, long len) {
+  out_reserve(out, len);
+  memcpy(out->data + out->len, s, len);
+  out->len += len;
+  out->data[out->len] = '\0';
+}
+
+void out_str(OutBuf *out, char *s) {
+  out_add(out, s, strlen(s));
+}
+
+void out_char(OutBuf *out, int c) {
+  out_reserve(out, 1);
+  out->data[out->len++] = c;
+  out->data[out->len] = '\0';
+}
+
+static char digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// Writes an unsigned integer in decimal to `p`, which must have room
+// for 20 characters. Returns the end of the digits.
+static char *write_uint(char *p, uint64_t val) {
+  char buf[20];
+  char *q = buf + sizeof(buf);
+
+  while (val >= 100) {
+    int i = (val % 100) * 2;
+    val /= 100;
+    *--q = digit_pairs[i + 1];
+    *--q = digit_pairs[i];
+  }
+  if (val >= 10) {
+    *--q = digit_pairs[val * 2 + 1];
+    *--q = digit_pairs[val * 2];
+  } else {
+    *--q = '0' + val;
+  }
+
+  int len = buf + sizeof(buf) - q;
+  memcpy(p, q, len);
+  return p + len;
+}
+
+// A printf for the conversions used by the code generator: %s, %c, %d,
+// %u, %ld, %lu, %+d, %+ld, %% and %Lf, which only appears in comments
+// next to floating-point constants and is left to snprintf. Anything
+// else is a bug.
+//
+// The arguments are taken through a pointer, so that a caller can
+// format a line piece by piece from a single argument list.
+void out_vformat(OutBuf *out, char *fmt, va_list *ap) {
+  char *p = fmt;
+
+  for (;;) {
+    // Make room for a run of literal text or a number.
+    out_reserve(out, 64);
+    char *q = out->data + out->len;
+    char *end = out->data + out->cap - 22;
+
+    while (*p && *p != '%' && q < end)
+      *q++ = *p++;
+    out->len = q - out->data;
+
+    if (!*p)
+      break;
+    if (*p != '%')
+      continue;
+
+    p++;
+    bool plus = false;
+    if (*p == '+') {
+      plus = true;
+      p++;
+    }
+
+    bool is_long = false;
+    if (*p == 'l') {
+      is_long = true;
+      p++;
+    }
+
+    if (*p == 'L' && p[1] == 'f') {
+      p += 2;
+      long double val = va_arg(*ap, long double);
+      int len = snprintf(NULL, 0, "%Lf", val);
+      out_reserve(out, len + 1);
+      snprintf(out->data + out->len, len + 1, "%Lf", val);
+      out->len += len;
+      continue;
+    }
+
+    switch (*p++) {
+    case '%':
+      *q++ = '%';
+      break;
+    case 's': {
+      char *s = va_arg(*ap, char *);
+      int len = strlen(s);
+      out_reserve(out, len);
+      memcpy(out->data + out->len, s, len);
+      q = out->data + out->len + len;
+      break;
+    }
+    case 'c':
+      *q++ = va_arg(*ap, int);
+      break;
+    case 'd': {
+      int64_t val = is_long ? va_arg(*ap, long) : va_arg(*ap, int);
+      if (val < 0) {
+        *q++ = '-';
+        q = write_uint(q, -(uint64_t)val);
+      } else {
+        if (plus)
+          *q++ = '+';
+        q = write_uint(q, val);
+      }
+      break;
+    }
+    case 'u':
+      q = write_uint(q, is_long ? va_arg(*ap, unsigned long) : va_arg(*ap, unsigned));
+      break;
+    default:
+      error("internal error: out_printf: unsupported format: %s", fmt);
+    }
+    out->len = q - out->data;
+  }
+
+  out->data[out->len] = '\0';
+}
+
+void out_vprintf(OutBuf *out, char *fmt, va_list ap) {
+  va_list ap2;
+  va_copy(ap2, ap);
+  out_vformat(out, fmt, &ap2);
+  va_end(ap2);
+}
+
+void out_printf(OutBuf *out, char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  out_vprintf(out, fmt, ap);
+  va_end(ap);
+}
+
+// Writes the contents of a buffer to a file. NULL or "-" means stdout.
+void out_write(OutBuf *out, char *path) {
+  int fd = 1;
+  if (path && strcmp(path, "-")) {
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+      error("cannot open output file: %s: %s", path, strerror(errno));
+  }
+
+  for (long off = 0; off < out->len;) {
+    long n = write(fd, out->data + off, out->len - off);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      error("%s: write failed: %s", path ? path : "-", strerror(errno));
+    }
+    off += n;
+  }
+
+  if (fd != 1)
+    close(fd);
+}
+
+//
+// Benchmark
+//
+
+// A line of assembly turned back into a format string with up to
+// four integer arguments, for replaying the work of the code generator.
+typedef struct {
+  char *fmt;
+  long args[4];
+} BenchLine;
+
+static BenchLine make_bench_line(char *p, int len) {
+  BenchLine line = {};
+  char *fmt = calloc(1, len * 3 + 1);
+  char *q = fmt;
+  int nargs = 0;
+
+  for (int i = 0; i < len;) {
+    bool is_num = nargs < 4 && isdigit(p[i]) &&
+                  (i == 0 || (!isalnum(p[i - 1]) && p[i - 1] != '_' && p[i - 1] != '.'));
+    if (is_num) {
+      char *end;
+      long val = strtol(p + i, &end, 10);
+      if (!isalnum(*end) && *end != '.' && end - (p + i) <= 18) {
+        line.args[nargs++] = val;
+        *q++ = '%';
+        *q++ = 'l';
+        *q++ = 'd';
+        i = end - p;
+        continue;
+      }
+    }
+
+    if (p[i] == '%')
+      *q++ = '%';
+    *q++ = p[i++];
+  }
+
+  line.fmt = fmt;
+  return line;
+}
+
+static void emit_with_stdio(FILE *out, char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(out, fmt, ap);
+  va_end(ap);
+  fprintf(out, "\n");
+}
+
+// Compares the cost of formatting the lines of a given assembly file
+// with vfprintf into a memory stream, which is what the code generator
+// used to do, and with out_printf.
+void emit_bench(char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    error("%s: %s", path, strerror(errno));
+
+  int nlines = 0;
+  int cap = 1024;
+  BenchLine *lines = calloc(cap, sizeof(BenchLine));
+  long total = 0;
+
+  char *buf = NULL;
+  size_t bufsz = 0;
+  long len;
+  while ((len = getline(&buf, &bufsz, fp)) != -1) {
+    if (len > 0 && buf[len - 1] == '\n')
+      len--;
+    if (nlines == cap) {
+      cap *= 2;
+      lines = realloc(lines, cap * sizeof(BenchLine));
+    }
+    lines[nlines++] = make_bench_line(buf, len);
+    total += len + 1;
+  }
+  fclose(fp);
+
+  int rounds = MAX(1, 50000000 / MAX(total, 1));
+
+  clock_t start = clock();
+  long size1 = 0;
+  for (int r = 0; r < rounds; r++) {
+    char *text;
+    size_t textlen;
+    FILE *out = open_memstream(&text, &textlen);
+    for (int i = 0; i < nlines; i++) {
+      long *a = lines[i].args;
+      emit_with_stdio(out, lines[i].fmt, a[0], a[1], a[2], a[3]);
+    }
+    fclose(out);
+    size1 = textlen;
+    free(text);
+  }
+  double t1 = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  start = clock();
+  long size2 = 0;
+  for (int r = 0; r < rounds; r++) {
+    OutBuf out = {};
+    for (int i = 0; i < nlines; i++) {
+      long *a = lines[i].args;
+      out_printf(&out, lines[i].fmt, a[0], a[1], a[2], a[3]);
+      out_char(&out, '\n');
+    }
+    size2 = out.len;
+    free(out.data);
+  }
+  double t2 = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  if (size1 != size2)
+    error("emit_bench: output size mismatch: %ld vs %ld", size1, size2);
+
+  printf("%d lines, %ld bytes, %d rounds\n", nlines, total, rounds);
+  printf("vfprintf:   %.3fs (%.1f ns/line)\n", t1, t1 * 1e9 / nlines / rounds);
+  printf("out_printf: %.3fs (%.1f ns/line)\n", t2, t2 * 1e9 / nlines / rounds);
+}
@@ -0,0 +1,504 @@
+// This file implements an optimization pass over the AST, which runs
+// at -O1 and above before a function is compiled. It folds constant
+// subexpressions, removes algebraic identities such as `x + 0` or
+// `x * 1`, and replaces multiplication, unsigned division and unsigned
+// modulo by powers of two with shifts and masks.
+//
+// Division and modulo by other constants are left as they are here,
+// because they need the upper half of a widening multiplication,
+// which the AST cannot express. codegen.c emits them as multiply-high
+// sequences instead.
+//
+// The result of a rewritten expression has the same bits as the
+// original would have had at run time. In particular, arithmetic
+// wraps around as the code generator's does, and an expression whose
+// value is not defined, such as division by zero or an out-of-range
+// shift, is left alone.
+
+#include "chibicc.h"
+
+static Node *fold_expr(Node *node);
+static void fold_stmt(Node *node);
+
+static Node *new_const(int64_t val, Type *ty, Token *tok) {
+  Node *node = arena_alloc(MEM_NODE, sizeof(Node));
+  node->kind = ND_NUM;
+  node->val = val;
+  node->ty = ty;
+  node->tok = tok;
+  return node;
+}
+
+static Node *new_op(NodeKind kind, Node *lhs, Node *rhs, Type *ty, Token *tok) {
+  Node *node = arena_alloc(MEM_NODE, sizeof(Node));
+  node->kind = kind;
+  node->lhs = lhs;
+  node->rhs = rhs;
+  node->ty = ty;
+  node->tok = tok;
+  return node;
+}
+
+// Truncates a value to a given type in the same way as a cast does.
+static int64_t wrap(int64_t val, Type *ty) {
+  if (ty->kind == TY_BOOL)
+    return val != 0;
+
+  // Note that `c ? (uint32_t)x : (int32_t)x` would zero-extend both.
+  if (ty->is_unsigned) {
+    switch (ty->size) {
+    case 1: return (uint8_t)val;
+    case 2: return (uint16_t)val;
+    case 4: return (uint32_t)val;
+    }
+  } else {
+    switch (ty->size) {
+    case 1: return (int8_t)val;
+    case 2: return (int16_t)val;
+    case 4: return (int32_t)val;
+    }
+  }
+  return val;
+}
+
+// Integer operations are folded only if they are done in 32 or 64
+// bits. Narrower types occur only as the result of a shift of an
+// unpromoted operand.
+static bool is_int_op(Type *ty) {
+  return is_integer(ty) && ty->size >= 4;
+}
+
+static bool is_const(Node *node) {
+  return node->kind == ND_NUM && (is_integer(node->ty) || node->ty->kind == TY_PTR);
+}
+
+// A literal's value is not always normalized for its type. For
+// example, U'\xffffffff' has value -1 and type unsigned int.
+static int64_t const_val(Node *node) {
+  return wrap(node->val, node->ty);
+}
+
+static bool same_repr(Type *a, Type *b) {
+  if (a == b)
+    return true;
+  if (is_integer(a) && is_integer(b))
+    return a->size == b->size && a->is_unsigned == b->is_unsigned &&
+           a->kind != TY_BOOL && b->kind != TY_BOOL;
+  return a->kind == TY_PTR && b->kind == TY_PTR;
+}
+
+// Returns the base-2 logarithm of `val` if it is a power of two
+// greater than one, or -1 otherwise.
+static int log2_of(uint64_t val) {
+  if (val < 2 || (val & (val - 1)))
+    return -1;
+
+  int n = 0;
+  while (val >>= 1)
+    n++;
+  return n;
+}
+
+// Returns true if evaluating an expression has no side effect and
+// cannot trap, so that the expression can be removed.
+static bool is_pure(Node *node) {
+  switch (node->kind) {
+  case ND_NUM:
+    return true;
+  case ND_VAR:
+    return !node->ty->is_volatile;
+  case ND_CAST:
+  case ND_NEG:
+  case ND_NOT:
+  case ND_BITNOT:
+    return is_pure(node->lhs);
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_SHL:
+  case ND_SHR:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+    return is_pure(node->lhs) && is_pure(node->rhs);
+  }
+  return false;
+}
+
+// Computes a binary operation on two constants. Returns false if the
+// result is not defined.
+static bool eval_binary(Node *node, int64_t *res) {
+  Type *ty = node->ty;
+  int64_t a = const_val(node->lhs);
+  int64_t b = const_val(node->rhs);
+
+  switch (node->kind) {
+  case ND_ADD:
+    *res = (uint64_t)a + b;
+    break;
+  case ND_SUB:
+    *res = (uint64_t)a - b;
+    break;
+  case ND_MUL:
+    *res = (uint64_t)a * b;
+    break;
+  case ND_DIV:
+  case ND_MOD:
+    if (b == 0 || (!ty->is_unsigned && b == -1))
+      return false;
+    if (ty->is_unsigned)
+      *res = (node->kind == ND_DIV) ? (uint64_t)a / b : (uint64_t)a % b;
+    else
+      *res = (node->kind == ND_DIV) ? a / b : a % b;
+    break;
+  case ND_BITAND:
+    *res = a & b;
+    break;
+  case ND_BITOR:
+    *res = a | b;
+    break;
+  case ND_BITXOR:
+    *res = a ^ b;
+    break;
+  case ND_SHL:
+  case ND_SHR:
+    if (b < 0 || b >= node->lhs->ty->size * 8)
+      return false;
+    if (node->kind == ND_SHL)
+      *res = (uint64_t)a << b;
+    else if (ty->is_unsigned)
+      *res = (uint64_t)a >> b;
+    else
+      *res = a >> b;
+    break;
+  case ND_EQ:
+    *res = a == b;
+    break;
+  case ND_NE:
+    *res = a != b;
+    break;
+  case ND_LT:
+    *res = node->lhs->ty->is_unsigned ? (uint64_t)a < b : a < b;
+    break;
+  case ND_LE:
+    *res = node->lhs->ty->is_unsigned ? (uint64_t)a <= b : a <= b;
+    break;
+  default:
+    return false;
+  }
+
+  *res = wrap(*res, ty);
+  return true;
+}
+
+static bool is_commutative(NodeKind kind) {
+  switch (kind) {
+  case ND_ADD:
+  case ND_MUL:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_EQ:
+  case ND_NE:
+    return true;
+  }
+  return false;
+}
+
+static Node *fold_binary(Node *node) {
+  Node *lhs = node->lhs;
+  Node *rhs = node->rhs;
+  Type *ty = node->ty;
+  int64_t val;
+
+  if (!is_int_op(ty) && !(is_int_op(lhs->ty) && is_int_op(rhs->ty)))
+    return node;
+
+  if (is_const(lhs) && is_const(rhs)) {
+    if (is_int_op(ty) && eval_binary(node, &val))
+      return new_const(val, ty, node->tok);
+    return node;
+  }
+
+  if (!is_int_op(ty))
+    return node;
+
+  // Move a constant to the right-hand side, where the code generator
+  // can use it as an immediate operand.
+  if (is_const(lhs) && is_commutative(node->kind)) {
+    node = new_op(node->kind, rhs, lhs, ty, node->tok);
+    lhs = node->lhs;
+    rhs = node->rhs;
+  }
+
+  if (!is_const(rhs) || !same_repr(lhs->ty, ty))
+    return node;
+
+  int64_t c = const_val(rhs);
+  int64_t ones = wrap(-1, ty);
+
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_SUB:
+    if (c == 0)
+      return lhs;
+
+    // (x + c1) + c2 => x + (c1 + c2)
+    if ((lhs->kind == ND_ADD || lhs->kind == ND_SUB) && is_const(lhs->rhs) &&
+        same_repr(lhs->ty, ty)) {
+      int64_t c1 = const_val(lhs->rhs);
+      if (lhs->kind == ND_SUB)
+        c1 = -(uint64_t)c1;
+      int64_t c2 = (node->kind == ND_ADD) ? c : -(uint64_t)c;
+      int64_t sum = wrap((uint64_t)c1 + c2, ty);
+      if (sum == 0)
+        return lhs->lhs;
+      return new_op(ND_ADD, lhs->lhs, new_const(sum, ty, rhs->tok), ty, node->tok);
+    }
+    return node;
+  case ND_MUL: {
+    if (c == 1)
+      return lhs;
+    if (c == 0 && is_pure(lhs))
+      return new_const(0, ty, node->tok);
+
+    // (x + c1) * c2 => x * c2 + c1 * c2, which is common in array
+    // subscripts such as a[i + 1].
+    if (lhs->kind == ND_ADD && is_const(lhs->rhs) && same_repr(lhs->ty, ty)) {
+      Node *mul = fold_binary(new_op(ND_MUL, lhs->lhs, rhs, ty, node->tok));
+      int64_t off = wrap((uint64_t)const_val(lhs->rhs) * c, ty);
+      return fold_binary(new_op(ND_ADD, mul, new_const(off, ty, rhs->tok), ty, node->tok));
+    }
+
+    int k = log2_of(ty->is_unsigned || ty->size == 8 ? c : (uint32_t)c);
+    if (k > 0 && k < ty->size * 8)
+      return new_op(ND_SHL, lhs, new_const(k, ty_int, rhs->tok), ty, node->tok);
+    return node;
+  }
+  case ND_DIV:
+  case ND_MOD: {
+    if (c == 1)
+      return node->kind == ND_DIV ? lhs : (is_pure(lhs) ? new_const(0, ty, node->tok) : node);
+    if (!ty->is_unsigned)
+      return node;
+
+    int k = log2_of(ty->size == 8 ? c : (uint32_t)c);
+    if (k < 0)
+      return node;
+    if (node->kind == ND_DIV)
+      return new_op(ND_SHR, lhs, new_const(k, ty_int, rhs->tok), ty, node->tok);
+    return new_op(ND_BITAND, lhs, new_const(wrap(c - 1, ty), ty, rhs->tok), ty, node->tok);
+  }
+  case ND_BITAND:
+    if (c == ones)
+      return lhs;
+    if (c == 0 && is_pure(lhs))
+      return new_const(0, ty, node->tok);
+    return node;
+  case ND_BITOR:
+    if (c == 0)
+      return lhs;
+    if (c == ones && is_pure(lhs))
+      return new_const(ones, ty, node->tok);
+    return node;
+  case ND_BITXOR:
+  case ND_SHL:
+  case ND_SHR:
+    if (c == 0)
+      return lhs;
+    return node;
+  }
+  return node;
+}
+
+static Node *fold_unary(Node *node) {
+  Node *lhs = node->lhs;
+  Type *ty = node->ty;
+
+  if (!is_const(lhs))
+    return node;
+
+  switch (node->kind) {
+  case ND_NEG:
+    if (is_int_op(ty))
+      return new_const(wrap(-(uint64_t)const_val(lhs), ty), ty, node->tok);
+    return node;
+  case ND_BITNOT:
+    if (is_int_op(ty))
+      return new_const(wrap(~const_val(lhs), ty), ty, node->tok);
+    return node;
+  case ND_NOT:
+    return new_const(!const_val(lhs), ty, node->tok);
+  case ND_CAST:
+    if (is_integer(ty) || ty->kind == TY_PTR)
+      return new_const(wrap(const_val(lhs), ty), ty, node->tok);
+    return node;
+  }
+  return node;
+}
+
+static Node *fold_logical(Node *node) {
+  Node *lhs = node->lhs;
+  Node *rhs = node->rhs;
+
+  if (!is_const(lhs))
+    return node;
+
+  // 0 && x => 0, 1 || x => 1
+  bool val = const_val(lhs) != 0;
+  if (val != (node->kind == ND_LOGAND))
+    return new_const(val, node->ty, node->tok);
+  if (is_const(rhs))
+    return new_const(const_val(rhs) != 0, node->ty, node->tok);
+  return node;
+}
+
+static Node *fold_cond(Node *node) {
+  // The operands of a struct-typed ?: are casts, which are not lvalues.
+  if (!is_const(node->cond) || node->ty->kind == TY_STRUCT || node->ty->kind == TY_UNION)
+    return node;
+
+  Node *live = const_val(node->cond) ? node->then : node->els;
+  if (!same_repr(live->ty, node->ty) && live->ty->kind != TY_VOID)
+    return node;
+  return live;
+}
+
+static void fold_list(Node **list) {
+  for (Node **p = list; *p; p = &(*p)->next) {
+    Node *next = (*p)->next;
+    *p = fold_expr(*p);
+    (*p)->next = next;
+  }
+}
+
+static Node *fold_expr(Node *node) {
+  if (!node)
+    return NULL;
+
+  switch (node->kind) {
+  case ND_STMT_EXPR:
+    for (Node *n = node->body; n; n = n->next)
+      fold_stmt(n);
+    return node;
+  case ND_FUNCALL:
+    node->lhs = fold_expr(node->lhs);
+    fold_list(&node->ext->args);
+    return node;
+  case ND_COND:
+    node->cond = fold_expr(node->cond);
+    node->then = fold_expr(node->then);
+    node->els = fold_expr(node->els);
+    return fold_cond(node);
+  case ND_CAS:
+    node->ext->cas_addr = fold_expr(node->ext->cas_addr);
+    node->ext->cas_old = fold_expr(node->ext->cas_old);
+    node->ext->cas_new = fold_expr(node->ext->cas_new);
+    return node;
+  }
+
+  node->lhs = fold_expr(node->lhs);
+  node->rhs = fold_expr(node->rhs);
+
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_MOD:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_SHL:
+  case ND_SHR:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+    return fold_binary(node);
+  case ND_NEG:
+  case ND_NOT:
+  case ND_BITNOT:
+  case ND_CAST:
+    return fold_unary(node);
+  case ND_LOGAND:
+  case ND_LOGOR:
+    return fold_logical(node);
+  }
+  return node;
+}
+
+// Returns true if a statement defines a label that a goto or a switch
+// may jump to.
+static bool has_label(Node *node) {
+  for (; node; node = node->next) {
+    if (node->kind == ND_LABEL || node->kind == ND_CASE)
+      return true;
+    if (has_label(node->lhs) || has_label(node->rhs) || has_label(node->cond) ||
+        has_label(node->then) || has_label(node->els) || has_label(node->init) ||
+        has_label(node->inc) || has_label(node->body))
+      return true;
+  }
+  return false;
+}
+
+static void fold_stmt(Node *node) {
+  switch (node->kind) {
+  case ND_IF: {
+    node->cond = fold_expr(node->cond);
+    fold_stmt(node->then);
+    if (node->els)
+      fold_stmt(node->els);
+
+    // Remove the branch that is never taken unless it can be entered
+    // by a jump.
+    if (!is_const(node->cond))
+      return;
+    bool taken = const_val(node->cond);
+    Node *dead = taken ? node->els : node->then;
+    if (has_label(dead))
+      return;
+
+    node->kind = ND_BLOCK;
+    node->body = taken ? node->then : node->els;
+    node->cond = node->then = node->els = NULL;
+    return;
+  }
+  case ND_FOR:
+    if (node->init)
+      fold_stmt(node->init);
+    node->cond = fold_expr(node->cond);
+    node->inc = fold_expr(node->inc);
+    fold_stmt(node->then);
+    return;
+  case ND_DO:
+    fold_stmt(node->then);
+    node->cond = fold_expr(node->cond);
+    return;
+  case ND_SWITCH:
+    node->cond = fold_expr(node->cond);
+    fold_stmt(node->then);
+    return;
+  case ND_CASE:
+  case ND_LABEL:
+    fold_stmt(node->lhs);
+    return;
+  case ND_BLOCK:
+    for (Node *n = node->body; n; n = n->next)
+      fold_stmt(n);
+    return;
+  case ND_RETURN:
+  case ND_EXPR_STMT:
+  case ND_GOTO_EXPR:
+    node->lhs = fold_expr(node->lhs);
+    return;
+  }
+}
+
+void fold_function(Obj *fn) {
+  fold_stmt(fn->body);
+}
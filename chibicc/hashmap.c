@@ -1,4 +1,10 @@
 // This is an implementation of the open-addressing hash table.
+//
+// The number of buckets is a power of two, so that a hash value is
+// mapped to a bucket by masking. Each entry keeps the low 32 bits of
+// the hash of its key, which rules out almost all mismatching keys
+// without comparing them and lets the table grow without hashing the
+// keys again.
 
 #include "chibicc.h"
 
@@ -14,13 +20,69 @@
 // Represents a deleted hash entry
 #define TOMBSTONE ((void *)-1)
 
-static uint64_t fnv_hash(char *s, int len) {
-  uint64_t hash = 0xcbf29ce484222325;
-  for (int i = 0; i < len; i++) {
-    hash *= 0x100000001b3;
-    hash ^= (unsigned char)s[i];
+static uint64_t mix(uint64_t h) {
+  h ^= h >> 32;
+  h *= 0xd6e8feb86659fd93;
+  h ^= h >> 32;
+  return h;
+}
+
+static uint64_t load64(char *p) {
+  uint64_t x;
+  memcpy(&x, p, 8);
+  return x;
+}
+
+static uint64_t load32(char *p) {
+  uint32_t x;
+  memcpy(&x, p, 4);
+  return x;
+}
+
+// Hash a string eight bytes at a time. The last, partial word is read
+// with loads that overlap the rest of the string instead of byte by
+// byte.
+uint64_t hash_bytes(char *s, int len) {
+  uint64_t h = 0x9e3779b97f4a7c15 * (len + 1);
+
+  if (len >= 8) {
+    char *end = s + len - 8;
+    for (; s < end; s += 8)
+      h = mix(h ^ load64(s));
+    return mix(h ^ load64(end));
   }
-  return hash;
+
+  uint64_t word = 0;
+  if (len >= 4)
+    word = load32(s) | load32(s + len - 4) << 32;
+  else if (len > 0)
+    word = (uint8_t)s[0] | (uint8_t)s[len / 2] << 8 | (uint8_t)s[len - 1] << 16;
+  return mix(h ^ word);
+}
+
+// Move all live entries to a new bucket array of a given size.
+// Tombstones are dropped.
+static void resize(HashMap *map, int cap) {
+  HashEntry *old = map->buckets;
+  int oldcap = map->capacity;
+
+  map->buckets = calloc(cap, sizeof(HashEntry));
+  map->capacity = cap;
+  map->used = 0;
+
+  for (int i = 0; i < oldcap; i++) {
+    HashEntry *ent = &old[i];
+    if (!ent->key || ent->key == TOMBSTONE)
+      continue;
+
+    // Keys are known to be distinct, so the first free bucket is it.
+    int j = ent->hash & (cap - 1);
+    while (map->buckets[j].key)
+      j = (j + 1) & (cap - 1);
+    map->buckets[j] = *ent;
+    map->used++;
+  }
+  free(old);
 }
 
 // Make room for new entires in a given hashmap by removing
@@ -35,74 +97,91 @@ static void rehash(HashMap *map) {
   int cap = map->capacity;
   while ((nkeys * 100) / cap >= LOW_WATERMARK)
     cap = cap * 2;
-  assert(cap > 0);
+  resize(map, cap);
+}
 
-  // Create a new hashmap and copy all key-values.
-  HashMap map2 = {};
-  map2.buckets = calloc(cap, sizeof(HashEntry));
-  map2.capacity = cap;
+// Make sure that `n` keys can be added without rehashing.
+void hashmap_reserve(HashMap *map, int n) {
+  int cap = INIT_SIZE;
+  while (((map->used + n) * 100) / cap >= LOW_WATERMARK)
+    cap = cap * 2;
+  if (cap > map->capacity)
+    resize(map, cap);
+}
 
-  for (int i = 0; i < map->capacity; i++) {
-    HashEntry *ent = &map->buckets[i];
-    if (ent->key && ent->key != TOMBSTONE)
-      hashmap_put2(&map2, ent->key, ent->keylen, ent->val);
+// Compare two strings of the same length with the same overlapping
+// loads as hash_bytes().
+static bool same_bytes(char *a, char *b, int len) {
+  if (len >= 8) {
+    for (int i = 0; i < len - 8; i += 8)
+      if (load64(a + i) != load64(b + i))
+        return false;
+    return load64(a + len - 8) == load64(b + len - 8);
   }
-
-  assert(map2.used == nkeys);
-  *map = map2;
+  if (len >= 4)
+    return load32(a) == load32(b) && load32(a + len - 4) == load32(b + len - 4);
+  for (int i = 0; i < len; i++)
+    if (a[i] != b[i])
+      return false;
+  return true;
 }
 
+// Callers compare the stored hash first. Keys that are atom names are
+// unique, so they usually match by pointer without comparing their
+// contents.
 static bool match(HashEntry *ent, char *key, int keylen) {
-  return ent->key && ent->key != TOMBSTONE &&
-         ent->keylen == keylen && memcmp(ent->key, key, keylen) == 0;
+  if (ent->keylen != keylen || !ent->key || ent->key == TOMBSTONE)
+    return false;
+  return ent->key == key || same_bytes(ent->key, key, keylen);
 }
 
-static HashEntry *get_entry(HashMap *map, char *key, int keylen) {
+static HashEntry *get_entry(HashMap *map, char *key, int keylen, uint64_t hash) {
   if (!map->buckets)
     return NULL;
 
-  uint64_t hash = fnv_hash(key, keylen);
-
-  for (int i = 0; i < map->capacity; i++) {
-    HashEntry *ent = &map->buckets[(hash + i) % map->capacity];
-    if (match(ent, key, keylen))
+  for (int i = hash & (map->capacity - 1);; i = (i + 1) & (map->capacity - 1)) {
+    HashEntry *ent = &map->buckets[i];
+    if (ent->hash == (uint32_t)hash && match(ent, key, keylen))
       return ent;
     if (ent->key == NULL)
       return NULL;
   }
-  unreachable();
 }
 
-static HashEntry *get_or_insert_entry(HashMap *map, char *key, int keylen) {
-  if (!map->buckets) {
-    map->buckets = calloc(INIT_SIZE, sizeof(HashEntry));
-    map->capacity = INIT_SIZE;
-  } else if ((map->used * 100) / map->capacity >= HIGH_WATERMARK) {
+static HashEntry *
+get_or_insert_entry(HashMap *map, char *key, int keylen, uint64_t hash) {
+  if (!map->buckets)
+    resize(map, INIT_SIZE);
+  else if ((map->used * 100) / map->capacity >= HIGH_WATERMARK)
     rehash(map);
-  }
 
-  uint64_t hash = fnv_hash(key, keylen);
+  // A deleted entry is reused only once we know that the key is not
+  // further down the probe sequence.
+  HashEntry *tomb = NULL;
 
-  for (int i = 0; i < map->capacity; i++) {
-    HashEntry *ent = &map->buckets[(hash + i) % map->capacity];
+  for (int i = hash & (map->capacity - 1);; i = (i + 1) & (map->capacity - 1)) {
+    HashEntry *ent = &map->buckets[i];
 
-    if (match(ent, key, keylen))
+    if (ent->hash == (uint32_t)hash && match(ent, key, keylen))
       return ent;
 
     if (ent->key == TOMBSTONE) {
-      ent->key = key;
-      ent->keylen = keylen;
-      return ent;
+      if (!tomb)
+        tomb = ent;
+      continue;
     }
 
     if (ent->key == NULL) {
+      if (tomb)
+        ent = tomb;
+      else
+        map->used++;
       ent->key = key;
       ent->keylen = keylen;
-      map->used++;
+      ent->hash = hash;
       return ent;
     }
   }
-  unreachable();
 }
 
 void *hashmap_get(HashMap *map, char *key) {
@@ -110,7 +189,7 @@ void *hashmap_get(HashMap *map, char *key) {
 }
 
 void *hashmap_get2(HashMap *map, char *key, int keylen) {
-  HashEntry *ent = get_entry(map, key, keylen);
+  HashEntry *ent = get_entry(map, key, keylen, hash_bytes(key, keylen));
   return ent ? ent->val : NULL;
 }
 
@@ -119,7 +198,19 @@ void hashmap_put(HashMap *map, char *key, void *val) {
 }
 
 void hashmap_put2(HashMap *map, char *key, int keylen, void *val) {
-  HashEntry *ent = get_or_insert_entry(map, key, keylen);
+  HashEntry *ent = get_or_insert_entry(map, key, keylen, hash_bytes(key, keylen));
+  ent->val = val;
+}
+
+// Atoms carry a precomputed hash value, so the key doesn't have to
+// be hashed again.
+void *hashmap_get_atom(HashMap *map, Atom *atom) {
+  HashEntry *ent = get_entry(map, atom->name, atom->len, atom->hash);
+  return ent ? ent->val : NULL;
+}
+
+void hashmap_put_atom(HashMap *map, Atom *atom, void *val) {
+  HashEntry *ent = get_or_insert_entry(map, atom->name, atom->len, atom->hash);
   ent->val = val;
 }
 
@@ -128,7 +219,7 @@ void hashmap_delete(HashMap *map, char *key) {
 }
 
 void hashmap_delete2(HashMap *map, char *key, int keylen) {
-  HashEntry *ent = get_entry(map, key, keylen);
+  HashEntry *ent = get_entry(map, key, keylen, hash_bytes(key, keylen));
   if (ent)
     ent->key = TOMBSTONE;
 }
@@ -161,5 +252,157 @@ void hashmap_test(void) {
     hashmap_put(map, format("key %d", i), (void *)(size_t)i);
 
   assert(hashmap_get(map, "no such key") == NULL);
+
+  HashMap map2 = {};
+  hashmap_reserve(&map2, 1000);
+  int cap = map2.capacity;
+  for (int i = 0; i < 1000; i++)
+    hashmap_put(&map2, format("key %d", i), (void *)(size_t)i);
+  assert(map2.capacity == cap);
+  for (int i = 0; i < 1000; i++)
+    assert((size_t)hashmap_get(&map2, format("key %d", i)) == i);
+
   printf("OK\n");
 }
+
+//
+// Microbenchmark
+//
+
+// The previous implementation: FNV-1a hashing one byte at a time,
+// modulo indexing and a full key comparison on every probe. It is
+// kept as the baseline of hashmap_bench().
+typedef struct {
+  char *key;
+  int keylen;
+  void *val;
+} RefEntry;
+
+typedef struct {
+  RefEntry *buckets;
+  int capacity;
+  int used;
+} RefMap;
+
+static uint64_t fnv_hash(char *s, int len) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (int i = 0; i < len; i++) {
+    hash *= 0x100000001b3;
+    hash ^= (unsigned char)s[i];
+  }
+  return hash;
+}
+
+static RefEntry *ref_get(RefMap *map, char *key, int keylen) {
+  if (!map->buckets)
+    return NULL;
+
+  uint64_t hash = fnv_hash(key, keylen);
+  for (int i = 0; i < map->capacity; i++) {
+    RefEntry *ent = &map->buckets[(hash + i) % map->capacity];
+    if (ent->key && ent->keylen == keylen && memcmp(ent->key, key, keylen) == 0)
+      return ent;
+    if (ent->key == NULL)
+      return NULL;
+  }
+  unreachable();
+}
+
+static void ref_put(RefMap *map, char *key, int keylen, void *val) {
+  if (!map->buckets) {
+    map->buckets = calloc(INIT_SIZE, sizeof(RefEntry));
+    map->capacity = INIT_SIZE;
+  } else if ((map->used * 100) / map->capacity >= HIGH_WATERMARK) {
+    int cap = map->capacity;
+    while ((map->used * 100) / cap >= LOW_WATERMARK)
+      cap = cap * 2;
+
+    RefMap map2 = {calloc(cap, sizeof(RefEntry)), cap, 0};
+    for (int i = 0; i < map->capacity; i++)
+      if (map->buckets[i].key)
+        ref_put(&map2, map->buckets[i].key, map->buckets[i].keylen, map->buckets[i].val);
+    free(map->buckets);
+    *map = map2;
+  }
+
+  uint64_t hash = fnv_hash(key, keylen);
+  for (int i = 0; i < map->capacity; i++) {
+    RefEntry *ent = &map->buckets[(hash + i) % map->capacity];
+    if (ent->key == NULL) {
+      ent->key = key;
+      ent->keylen = keylen;
+      ent->val = val;
+      map->used++;
+      return;
+    }
+  }
+  unreachable();
+}
+
+static double elapsed_ns(clock_t start) {
+  return (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC;
+}
+
+// Look up every identifier of a source file in a map and insert the
+// ones that are missing, the way names are resolved in scopes, with
+// both the current and the previous implementation. To measure a
+// whole translation unit, preprocess it with -E first.
+void hashmap_bench(char *path) {
+  Token *tok = tokenize_file(path);
+  if (!tok)
+    error("%s: %s", path, strerror(errno));
+
+  int nkeys = 0;
+  for (Token *t = tok; t->kind != TK_EOF; t = t->next)
+    if (t->kind == TK_IDENT)
+      nkeys++;
+
+  char **keys = calloc(nkeys, sizeof(char *));
+  int *lens = calloc(nkeys, sizeof(int));
+  int n = 0;
+  for (Token *t = tok; t->kind != TK_EOF; t = t->next) {
+    if (t->kind == TK_IDENT) {
+      keys[n] = t->loc;
+      lens[n++] = t->len;
+    }
+  }
+
+  int rounds = MAX(1, 10000000 / MAX(nkeys, 1));
+  int found1 = 0, found2 = 0, used1 = 0, used2 = 0;
+
+  clock_t start = clock();
+  for (int r = 0; r < rounds; r++) {
+    RefMap map = {};
+    for (int i = 0; i < nkeys; i++) {
+      if (ref_get(&map, keys[i], lens[i]))
+        found1++;
+      else
+        ref_put(&map, keys[i], lens[i], keys[i]);
+    }
+    used1 = map.used;
+    free(map.buckets);
+  }
+  double t1 = elapsed_ns(start);
+
+  start = clock();
+  for (int r = 0; r < rounds; r++) {
+    HashMap map = {};
+    for (int i = 0; i < nkeys; i++) {
+      if (hashmap_get2(&map, keys[i], lens[i]))
+        found2++;
+      else
+        hashmap_put2(&map, keys[i], lens[i], keys[i]);
+    }
+    used2 = map.used;
+    free(map.buckets);
+  }
+  double t2 = elapsed_ns(start);
+
+  if (found1 != found2 || used1 != used2)
+    error("hashmap_bench: maps disagree");
+
+  double ops = (double)nkeys * rounds;
+  printf("%s: %d identifiers, %d distinct, %d rounds\n", path, nkeys, used2, rounds);
+  printf("previous: %6.1f ns/lookup\n", t1 / ops);
+  printf("current:  %6.1f ns/lookup (%.2fx)\n", t2 / ops, t1 / t2);
+}
@@ -0,0 +1,1822 @@
+// This file lowers the AST of a function to a three-address IR made
+// of basic blocks and virtual registers, and runs optimization passes
+// over it. codegen.c emits x86-64 assembly from the optimized IR.
+//
+// The IR covers integer and pointer arithmetic, memory accesses,
+// function calls with arguments passed in registers, and arbitrary
+// control flow. Functions that use anything else (floating-point
+// numbers, struct values, VLAs, inline assembly, atomics, etc.) are
+// not lowered; codegen.c compiles them directly from the AST.
+//
+// Virtual registers hold 64-bit values, and each instruction computes
+// the same bits as the corresponding AST node compiles to. For example,
+// the result of a 32-bit addition may have garbage in its upper half,
+// and a value loaded from memory is extended in the same way as
+// codegen.c's load() does.
+
+#include "chibicc.h"
+
+static IRFunc *cur_fn;
+static BasicBlock *cur_bb;
+static IRInsn *cur_insn;
+static HashMap label_bbs;
+static bool failed;
+
+//
+// Lowering
+//
+
+static BasicBlock *new_bb(void) {
+  BasicBlock *bb = arena_alloc(MEM_IR, sizeof(BasicBlock));
+  bb->id = cur_fn->nbbs++;
+  return bb;
+}
+
+// Append a basic block to the function and make it current.
+static void start_bb(BasicBlock *bb) {
+  if (cur_fn->last)
+    cur_fn->last->next = bb;
+  else
+    cur_fn->bbs = bb;
+  cur_fn->last = bb;
+  cur_bb = bb;
+  cur_insn = NULL;
+}
+
+static int new_reg(void) {
+  return ++cur_fn->nregs;
+}
+
+static IRInsn *new_insn(IROp op, Token *tok) {
+  IRInsn *insn = arena_alloc(MEM_IR, sizeof(IRInsn));
+  insn->op = op;
+  insn->tok = tok;
+
+  if (cur_insn)
+    cur_insn->next = insn;
+  else
+    cur_bb->insns = insn;
+  cur_insn = insn;
+  return insn;
+}
+
+static bool is_terminator(IRInsn *insn) {
+  return insn->op == IR_JMP || insn->op == IR_BR || insn->op == IR_SWITCH ||
+         insn->op == IR_RET;
+}
+
+static IRInsn *last_insn(BasicBlock *bb) {
+  IRInsn *insn = bb->insns;
+  while (insn && insn->next)
+    insn = insn->next;
+  return insn;
+}
+
+// Code after a jump is unreachable, but it still needs a block to be
+// emitted to. simplify_cfg() removes such blocks.
+static void emit_jmp(BasicBlock *to, Token *tok) {
+  new_insn(IR_JMP, tok)->then = to;
+  start_bb(new_bb());
+}
+
+static void emit_br(int cond, Type *ty, BasicBlock *then, BasicBlock *els, Token *tok) {
+  IRInsn *insn = new_insn(IR_BR, tok);
+  insn->a = cond;
+  insn->ty = ty;
+  insn->then = then;
+  insn->els = els;
+  start_bb(new_bb());
+}
+
+// Jump to a given block unless the current block already ended with
+// a jump, then start the block.
+static void fall_into(BasicBlock *bb, Token *tok) {
+  IRInsn *insn = new_insn(IR_JMP, tok);
+  insn->then = bb;
+  start_bb(bb);
+}
+
+static BasicBlock *label_bb(char *label) {
+  BasicBlock *bb = hashmap_get(&label_bbs, label);
+  if (!bb) {
+    bb = new_bb();
+    hashmap_put(&label_bbs, label, bb);
+  }
+  return bb;
+}
+
+static int emit_imm(int64_t val, Token *tok) {
+  IRInsn *insn = new_insn(IR_IMM, tok);
+  insn->d = new_reg();
+  insn->imm = val;
+  return insn->d;
+}
+
+static int emit_unary(IROp op, int a, Type *ty, Token *tok) {
+  IRInsn *insn = new_insn(op, tok);
+  insn->d = new_reg();
+  insn->a = a;
+  insn->ty = ty;
+  return insn->d;
+}
+
+static int emit_binary(IROp op, int a, int b, Type *ty, Token *tok) {
+  IRInsn *insn = new_insn(op, tok);
+  insn->d = new_reg();
+  insn->a = a;
+  insn->b = b;
+  insn->ty = ty;
+  return insn->d;
+}
+
+static int emit_binary_imm(IROp op, int a, int64_t imm, Type *ty, Token *tok) {
+  IRInsn *insn = new_insn(op, tok);
+  insn->d = new_reg();
+  insn->a = a;
+  insn->imm = imm;
+  insn->ty = ty;
+  return insn->d;
+}
+
+static void emit_mov(int d, int a, Token *tok) {
+  IRInsn *insn = new_insn(IR_MOV, tok);
+  insn->d = d;
+  insn->a = a;
+}
+
+static int unsupported(void) {
+  failed = true;
+  return new_reg();
+}
+
+static bool is_scalar(Type *ty) {
+  return is_integer(ty) || ty->kind == TY_PTR;
+}
+
+// Returns true if evaluating an expression of a given type yields an
+// address rather than a value (see load() in codegen.c).
+static bool is_aggregate(Type *ty) {
+  switch (ty->kind) {
+  case TY_ARRAY:
+  case TY_STRUCT:
+  case TY_UNION:
+  case TY_FUNC:
+    return true;
+  }
+  return false;
+}
+
+static bool is_supported_type(Type *ty) {
+  return ty->kind == TY_VOID || is_scalar(ty) || is_aggregate(ty);
+}
+
+static int lower_expr(Node *node);
+static void lower_stmt(Node *node);
+
+static int lower_addr(Node *node) {
+  switch (node->kind) {
+  case ND_VAR: {
+    Obj *var = node->var;
+    if (var->ty->kind == TY_VLA || (var->is_tls && opt_fpic))
+      return unsupported();
+
+    // va_start() reads the register save area, which only the AST
+    // code generator sets up.
+    if (var == cur_fn->fn->va_area)
+      return unsupported();
+
+    IRInsn *insn = new_insn(var->is_local ? IR_LVAR : IR_GADDR, node->tok);
+    insn->d = new_reg();
+    insn->var = var;
+    return insn->d;
+  }
+  case ND_DEREF:
+    return lower_expr(node->lhs);
+  case ND_COMMA:
+    lower_expr(node->lhs);
+    return lower_addr(node->rhs);
+  case ND_MEMBER: {
+    int addr = lower_addr(node->lhs);
+    if (node->member->offset == 0)
+      return addr;
+    return emit_binary_imm(IR_ADD, addr, node->member->offset, ty_long, node->tok);
+  }
+  }
+
+  // Struct values returned by functions or assignments and VLAs
+  return unsupported();
+}
+
+static int load(int addr, Type *ty, Token *tok) {
+  if (is_aggregate(ty))
+    return addr;
+  return emit_unary(IR_LOAD, addr, ty, tok);
+}
+
+static int lower_funcall(Node *node) {
+  if (node->lhs->kind == ND_VAR && !strcmp(node->lhs->var->name, "alloca"))
+    return unsupported();
+
+  // After a second return from setjmp(), locals must have the values
+  // they had at the time of longjmp(), which rules out keeping them
+  // in registers.
+  if (is_setjmp(node->lhs))
+    return unsupported();
+  if (node->ext->ret_buffer || !is_supported_type(node->ty) || is_aggregate(node->ty))
+    return unsupported();
+
+  int nargs = 0;
+  for (Node *arg = node->ext->args; arg; arg = arg->next) {
+    if (!is_scalar(arg->ty))
+      return unsupported();
+    nargs++;
+  }
+  if (nargs > 6)
+    return unsupported();
+
+  // Arguments are evaluated from right to left as codegen.c does.
+  int *args = calloc(nargs, sizeof(int));
+  Node **nodes = calloc(nargs, sizeof(Node *));
+  int i = 0;
+  for (Node *arg = node->ext->args; arg; arg = arg->next)
+    nodes[i++] = arg;
+  for (i = nargs - 1; i >= 0; i--)
+    args[i] = lower_expr(nodes[i]);
+
+  int fn = lower_expr(node->lhs);
+
+  IRInsn *insn = new_insn(IR_CALL, node->tok);
+  insn->d = new_reg();
+  insn->a = fn;
+  insn->ty = node->ty;
+  insn->args = args;
+  insn->nargs = nargs;
+  return insn->d;
+}
+
+// Lower `&&`, `||` or `?:`. The result is assigned to `d` on both
+// paths.
+static int lower_cond(Node *node) {
+  BasicBlock *then = new_bb();
+  BasicBlock *els = new_bb();
+  BasicBlock *end = new_bb();
+  int d = new_reg();
+
+  switch (node->kind) {
+  case ND_LOGAND:
+  case ND_LOGOR: {
+    BasicBlock *rhs = new_bb();
+    int lhs = lower_expr(node->lhs);
+    if (node->kind == ND_LOGAND)
+      emit_br(lhs, node->lhs->ty, rhs, els, node->tok);
+    else
+      emit_br(lhs, node->lhs->ty, then, rhs, node->tok);
+
+    start_bb(rhs);
+    emit_br(lower_expr(node->rhs), node->rhs->ty, then, els, node->tok);
+
+    start_bb(then);
+    emit_mov(d, emit_imm(1, node->tok), node->tok);
+    emit_jmp(end, node->tok);
+
+    start_bb(els);
+    emit_mov(d, emit_imm(0, node->tok), node->tok);
+    fall_into(end, node->tok);
+    return d;
+  }
+  }
+
+  emit_br(lower_expr(node->cond), node->cond->ty, then, els, node->tok);
+
+  start_bb(then);
+  emit_mov(d, lower_expr(node->then), node->tok);
+  emit_jmp(end, node->tok);
+
+  start_bb(els);
+  emit_mov(d, lower_expr(node->els), node->tok);
+  fall_into(end, node->tok);
+  return d;
+}
+
+static int lower_expr(Node *node) {
+  if (failed)
+    return new_reg();
+
+  // Initializers and atomic operations may have no type.
+  if (node->ty && !is_supported_type(node->ty))
+    return unsupported();
+
+  switch (node->kind) {
+  case ND_NULL_EXPR:
+    return emit_imm(0, node->tok);
+  case ND_NUM:
+    return emit_imm(node->val, node->tok);
+  case ND_NEG:
+    return emit_unary(IR_NEG, lower_expr(node->lhs), node->ty, node->tok);
+  case ND_VAR:
+  case ND_MEMBER:
+    if (node->kind == ND_MEMBER && node->member->is_bitfield)
+      return unsupported();
+    return load(lower_addr(node), node->ty, node->tok);
+  case ND_DEREF:
+    return load(lower_expr(node->lhs), node->ty, node->tok);
+  case ND_ADDR:
+    return lower_addr(node->lhs);
+  case ND_ASSIGN: {
+    if (!is_scalar(node->ty))
+      return unsupported();
+    if (node->lhs->kind == ND_MEMBER && node->lhs->member->is_bitfield)
+      return unsupported();
+
+    int addr = lower_addr(node->lhs);
+    int val = lower_expr(node->rhs);
+    IRInsn *insn = new_insn(IR_STORE, node->tok);
+    insn->a = addr;
+    insn->b = val;
+    insn->ty = node->ty;
+    return val;
+  }
+  case ND_STMT_EXPR: {
+    Node *n = node->body;
+    for (; n->next; n = n->next)
+      lower_stmt(n);
+    return lower_expr(n->lhs);
+  }
+  case ND_COMMA:
+    lower_expr(node->lhs);
+    return lower_expr(node->rhs);
+  case ND_CAST: {
+    if (!is_supported_type(node->lhs->ty))
+      return unsupported();
+
+    int val = lower_expr(node->lhs);
+    if (node->ty->kind == TY_VOID)
+      return val;
+
+    IRInsn *insn = new_insn(IR_CAST, node->tok);
+    insn->d = new_reg();
+    insn->a = val;
+    insn->from = node->lhs->ty;
+    insn->ty = node->ty;
+    return insn->d;
+  }
+  case ND_MEMZERO:
+    new_insn(IR_MEMZERO, node->tok)->var = node->var;
+    return new_reg();
+  case ND_COND:
+    if (is_aggregate(node->ty))
+      return unsupported();
+    if (node->ty->kind == TY_VOID) {
+      BasicBlock *then = new_bb();
+      BasicBlock *els = new_bb();
+      BasicBlock *end = new_bb();
+      emit_br(lower_expr(node->cond), node->cond->ty, then, els, node->tok);
+      start_bb(then);
+      lower_expr(node->then);
+      emit_jmp(end, node->tok);
+      start_bb(els);
+      lower_expr(node->els);
+      fall_into(end, node->tok);
+      return new_reg();
+    }
+    return lower_cond(node);
+  case ND_NOT:
+    return emit_binary_imm(IR_EQ, lower_expr(node->lhs), 0, node->lhs->ty, node->tok);
+  case ND_BITNOT:
+    return emit_unary(IR_BITNOT, lower_expr(node->lhs), node->ty, node->tok);
+  case ND_LOGAND:
+  case ND_LOGOR:
+    return lower_cond(node);
+  case ND_FUNCALL:
+    return lower_funcall(node);
+  }
+
+  static IROp ops[] = {
+    [ND_ADD] = IR_ADD, [ND_SUB] = IR_SUB, [ND_MUL] = IR_MUL,
+    [ND_DIV] = IR_DIV, [ND_MOD] = IR_MOD, [ND_BITAND] = IR_BITAND,
+    [ND_BITOR] = IR_BITOR, [ND_BITXOR] = IR_BITXOR, [ND_SHL] = IR_SHL,
+    [ND_SHR] = IR_SHR, [ND_EQ] = IR_EQ, [ND_NE] = IR_NE,
+    [ND_LT] = IR_LT, [ND_LE] = IR_LE,
+  };
+
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_SUB:
+  case ND_MUL:
+  case ND_DIV:
+  case ND_MOD:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_SHL:
+  case ND_SHR:
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE: {
+    if (!is_scalar(node->lhs->ty))
+      return unsupported();
+
+    // codegen.c evaluates the right-hand side first.
+    int rhs = lower_expr(node->rhs);
+    int lhs = lower_expr(node->lhs);
+    return emit_binary(ops[node->kind], lhs, rhs, node->lhs->ty, node->tok);
+  }
+  }
+
+  // Labels-as-values, atomics, etc.
+  return unsupported();
+}
+
+// Jump to `bb` if `val` matches a case, or fall through otherwise.
+static void lower_case_test(int val, Type *ty, long begin, long end, BasicBlock *bb, Token *tok) {
+  int cond;
+  if (begin == end) {
+    cond = emit_binary(IR_EQ, val, emit_imm(begin, tok), ty, tok);
+  } else {
+    // [GNU] Case ranges
+    Type *uty = (ty->size == 8) ? ty_ulong : ty_uint;
+    int off = emit_binary(IR_SUB, val, emit_imm(begin, tok), ty, tok);
+    cond = emit_binary(IR_LE, off, emit_imm(end - begin, tok), uty, tok);
+  }
+
+  BasicBlock *next = new_bb();
+  emit_br(cond, ty_int, bb, next, tok);
+  fall_into(next, tok);
+}
+
+static void lower_case_tree(int val, Type *ty, SwitchCase *cases, int len,
+                            BasicBlock *dflt, Token *tok) {
+  if (len <= 3) {
+    for (int i = 0; i < len; i++)
+      lower_case_test(val, ty, cases[i].begin, cases[i].end, label_bb(cases[i].label), tok);
+    emit_jmp(dflt, tok);
+    return;
+  }
+
+  int mid = len / 2;
+  BasicBlock *left = new_bb();
+  BasicBlock *right = new_bb();
+  int cond = emit_binary(IR_LT, val, emit_imm(cases[mid].begin, tok), ty, tok);
+  emit_br(cond, ty_int, left, right, tok);
+
+  fall_into(right, tok);
+  lower_case_tree(val, ty, cases + mid, len - mid, dflt, tok);
+  fall_into(left, tok);
+  lower_case_tree(val, ty, cases, mid, dflt, tok);
+}
+
+static void lower_jump_table(int val, Type *ty, SwitchCase *cases, int len,
+                             BasicBlock *dflt, Token *tok) {
+  IRInsn *insn = new_insn(IR_SWITCH, tok);
+  insn->a = val;
+  insn->imm = cases[0].begin;
+  insn->ty = ty;
+  insn->then = dflt;
+  insn->ntargets = cases[len - 1].hi - cases[0].lo + 1;
+  insn->targets = arena_alloc(MEM_IR, insn->ntargets * sizeof(BasicBlock *));
+
+  int j = 0;
+  for (uint64_t i = 0; i < insn->ntargets; i++) {
+    if (i > cases[j].hi - cases[0].lo)
+      j++;
+    if (i < cases[j].lo - cases[0].lo)
+      insn->targets[i] = dflt;
+    else
+      insn->targets[i] = label_bb(cases[j].label);
+  }
+  start_bb(new_bb());
+}
+
+static void lower_stmt(Node *node) {
+  if (failed)
+    return;
+
+  switch (node->kind) {
+  case ND_IF: {
+    BasicBlock *then = new_bb();
+    BasicBlock *els = new_bb();
+    BasicBlock *end = new_bb();
+
+    emit_br(lower_expr(node->cond), node->cond->ty, then, els, node->tok);
+    start_bb(then);
+    lower_stmt(node->then);
+    emit_jmp(end, node->tok);
+    start_bb(els);
+    if (node->els)
+      lower_stmt(node->els);
+    fall_into(end, node->tok);
+    return;
+  }
+  case ND_FOR: {
+    BasicBlock *begin = new_bb();
+    BasicBlock *body = new_bb();
+    BasicBlock *cont = label_bb(node->cont_label);
+    BasicBlock *brk = label_bb(node->brk_label);
+
+    if (node->init)
+      lower_stmt(node->init);
+    fall_into(begin, node->tok);
+    if (node->cond)
+      emit_br(lower_expr(node->cond), node->cond->ty, body, brk, node->tok);
+    fall_into(body, node->tok);
+    lower_stmt(node->then);
+    fall_into(cont, node->tok);
+    if (node->inc)
+      lower_expr(node->inc);
+    emit_jmp(begin, node->tok);
+    start_bb(brk);
+    return;
+  }
+  case ND_DO: {
+    BasicBlock *begin = new_bb();
+    BasicBlock *cont = label_bb(node->cont_label);
+    BasicBlock *brk = label_bb(node->brk_label);
+
+    fall_into(begin, node->tok);
+    lower_stmt(node->then);
+    fall_into(cont, node->tok);
+    emit_br(lower_expr(node->cond), node->cond->ty, begin, brk, node->tok);
+    fall_into(brk, node->tok);
+    return;
+  }
+  case ND_SWITCH: {
+    int val = lower_expr(node->cond);
+    Type *ty = switch_type(node->cond->ty);
+    BasicBlock *dflt = label_bb(node->brk_label);
+    if (node->ext->default_case)
+      dflt = label_bb(node->ext->default_case->ext->label);
+
+    SwitchCase *cases;
+    int len;
+    switch (switch_cases(node, &cases, &len)) {
+    case SW_LINEAR:
+      for (Node *n = node->ext->case_next; n; n = n->ext->case_next)
+        lower_case_test(val, ty, n->ext->begin, n->ext->end, label_bb(n->ext->label), n->tok);
+      emit_jmp(dflt, node->tok);
+      break;
+    case SW_TREE:
+      lower_case_tree(val, ty, cases, len, dflt, node->tok);
+      break;
+    case SW_TABLE:
+      lower_jump_table(val, ty, cases, len, dflt, node->tok);
+      break;
+    }
+
+    lower_stmt(node->then);
+    fall_into(label_bb(node->brk_label), node->tok);
+    return;
+  }
+  case ND_CASE:
+    fall_into(label_bb(node->ext->label), node->tok);
+    lower_stmt(node->lhs);
+    return;
+  case ND_BLOCK:
+    for (Node *n = node->body; n; n = n->next)
+      lower_stmt(n);
+    return;
+  case ND_GOTO:
+    emit_jmp(label_bb(node->ext->unique_label), node->tok);
+    return;
+  case ND_LABEL:
+    fall_into(label_bb(node->ext->unique_label), node->tok);
+    lower_stmt(node->lhs);
+    return;
+  case ND_RETURN: {
+    int val = 0;
+    if (node->lhs) {
+      if (is_aggregate(node->lhs->ty)) {
+        unsupported();
+        return;
+      }
+      val = lower_expr(node->lhs);
+      if (node->lhs->ty->kind == TY_VOID)
+        val = 0;
+    }
+    new_insn(IR_RET, node->tok)->a = val;
+    start_bb(new_bb());
+    return;
+  }
+  case ND_EXPR_STMT:
+    lower_expr(node->lhs);
+    return;
+  }
+
+  // Computed gotos and inline assembly
+  unsupported();
+}
+
+// Lower a function to IR. Returns NULL if the function uses a feature
+// the IR does not support.
+IRFunc *lower_function(Obj *fn) {
+  if (!is_supported_type(fn->ty->return_ty) ||
+      is_aggregate(fn->ty->return_ty))
+    return NULL;
+
+  int nparams = 0;
+  for (Obj *var = fn->params; var; var = var->next) {
+    if (!is_scalar(var->ty))
+      return NULL;
+    nparams++;
+  }
+  if (nparams > 6)
+    return NULL;
+
+  cur_fn = arena_alloc(MEM_IR, sizeof(IRFunc));
+  cur_fn->fn = fn;
+  label_bbs = (HashMap){};
+  failed = false;
+  start_bb(new_bb());
+
+  // Copy parameters from argument registers to their stack slots.
+  int *regs = calloc(nparams, sizeof(int));
+  int i = 0;
+  for (Obj *var = fn->params; var; var = var->next, i++) {
+    IRInsn *insn = new_insn(IR_PARAM, var->tok);
+    insn->d = regs[i] = new_reg();
+    insn->imm = i;
+  }
+
+  i = 0;
+  for (Obj *var = fn->params; var; var = var->next, i++) {
+    IRInsn *addr = new_insn(IR_LVAR, var->tok);
+    addr->d = new_reg();
+    addr->var = var;
+
+    IRInsn *insn = new_insn(IR_STORE, var->tok);
+    insn->a = addr->d;
+    insn->b = regs[i];
+    insn->ty = var->ty;
+  }
+
+  lower_stmt(fn->body);
+
+  // [https://www.sigbus.info/n1570#5.1.2.2.3p1] Reaching the end of
+  // the main function is equivalent to returning 0.
+  int ret = 0;
+  if (!strcmp(fn->name, "main"))
+    ret = emit_imm(0, fn->body->tok);
+  new_insn(IR_RET, fn->body->tok)->a = ret;
+
+  if (failed)
+    return NULL;
+  return cur_fn;
+}
+
+//
+// Analysis helpers
+//
+
+// Collect pointers to the virtual registers read by `insn`. Returns
+// the number of registers.
+int ir_uses(IRInsn *insn, int **uses) {
+  int n = 0;
+  if (insn->a)
+    uses[n++] = &insn->a;
+  if (insn->b)
+    uses[n++] = &insn->b;
+  for (int i = 0; i < insn->nargs; i++)
+    uses[n++] = &insn->args[i];
+  return n;
+}
+
+static bool has_side_effect(IRInsn *insn) {
+  switch (insn->op) {
+  case IR_LOAD:
+    return insn->ty->is_volatile;
+  case IR_STORE:
+  case IR_MEMZERO:
+  case IR_CALL:
+  case IR_JMP:
+  case IR_BR:
+  case IR_SWITCH:
+  case IR_RET:
+    return true;
+  }
+  return false;
+}
+
+static int *count_uses(IRFunc *fn) {
+  int *uses = calloc(fn->nregs + 1, sizeof(int));
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next) {
+      int *regs[IR_MAX_USES];
+      int n = ir_uses(insn, regs);
+      for (int i = 0; i < n; i++)
+        uses[*regs[i]]++;
+    }
+  }
+  return uses;
+}
+
+static int *count_defs(IRFunc *fn) {
+  int *defs = calloc(fn->nregs + 1, sizeof(int));
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next)
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next)
+      if (insn->d)
+        defs[insn->d]++;
+  return defs;
+}
+
+//
+// Passes
+//
+
+// A hashmap doesn't copy its keys, so a variable is keyed by a copy
+// of its address that outlives the map.
+static char *var_key(Obj *var) {
+  Obj **key = calloc(1, sizeof(Obj *));
+  *key = var;
+  return (char *)key;
+}
+
+// Promote scalar local variables whose addresses are used only by
+// loads and stores to virtual registers. Volatile accesses stay in
+// memory.
+static bool mem2reg(IRFunc *fn) {
+  int *uses = count_uses(fn);
+  IRInsn **def = calloc(fn->nregs + 1, sizeof(IRInsn *));
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next)
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next)
+      if (insn->d)
+        def[insn->d] = insn;
+
+  // A variable is a candidate unless one of its addresses escapes.
+  // Once an address escapes, the variable stays in memory even if the
+  // code using the address is removed later.
+  HashMap *bad = &fn->escaped;
+  HashMap vars = {};
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next) {
+      if (insn->op == IR_LVAR) {
+        Obj *var = insn->var;
+        if (!is_scalar(var->ty) || var->ty->is_atomic || var->ty->is_volatile ||
+            uses[insn->d] != 1)
+          hashmap_put2(bad, var_key(var), sizeof(Obj *), var);
+        continue;
+      }
+
+      int *regs[IR_MAX_USES];
+      int n = ir_uses(insn, regs);
+      for (int i = 0; i < n; i++) {
+        IRInsn *d = def[*regs[i]];
+        if (!d || d->op != IR_LVAR)
+          continue;
+
+        bool ok = (insn->op == IR_LOAD || (insn->op == IR_STORE && regs[i] == &insn->a)) &&
+                  insn->ty->size == d->var->ty->size && !insn->ty->is_volatile;
+        if (!ok)
+          hashmap_put2(bad, var_key(d->var), sizeof(Obj *), d->var);
+      }
+    }
+  }
+
+  bool changed = false;
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    for (IRInsn **p = &bb->insns; *p;) {
+      IRInsn *insn = *p;
+      Obj *var = NULL;
+
+      if (insn->op == IR_LVAR || insn->op == IR_MEMZERO) {
+        var = insn->var;
+      } else if (insn->op == IR_LOAD || insn->op == IR_STORE) {
+        IRInsn *d = def[insn->a];
+        if (d && d->op == IR_LVAR)
+          var = d->var;
+      }
+
+      if (!var || !is_scalar(var->ty) ||
+          hashmap_get2(bad, (char *)&var, sizeof(Obj *))) {
+        p = &insn->next;
+        continue;
+      }
+
+      int *reg = hashmap_get2(&vars, (char *)&var, sizeof(Obj *));
+      if (!reg) {
+        reg = calloc(1, sizeof(int));
+        *reg = ++fn->nregs;
+        hashmap_put2(&vars, var_key(var), sizeof(Obj *), reg);
+      }
+
+      changed = true;
+
+      switch (insn->op) {
+      case IR_LVAR:
+        *p = insn->next;
+        continue;
+      case IR_MEMZERO:
+        insn->op = IR_IMM;
+        insn->d = *reg;
+        insn->imm = 0;
+        insn->var = NULL;
+        break;
+      case IR_LOAD:
+        insn->op = IR_MOV;
+        insn->a = *reg;
+        break;
+      case IR_STORE:
+        // A store truncates the value and a load extends it again.
+        insn->op = IR_EXT;
+        insn->d = *reg;
+        insn->a = insn->b;
+        insn->b = 0;
+        insn->ty = var->ty;
+        break;
+      }
+      p = &insn->next;
+    }
+  }
+  return changed;
+}
+
+static bool is_64bit(Type *ty) {
+  return ty->kind == TY_LONG || ty->base;
+}
+
+// Constant folding computes exactly the bits the generated code would,
+// including the upper bits of values narrower than 64 bits.
+
+// Truncate a value to a given type and extend it as load() does.
+static int64_t extend(int64_t val, Type *ty) {
+  switch (ty->size) {
+  case 1: return ty->is_unsigned ? (uint8_t)val : (uint32_t)(int8_t)val;
+  case 2: return ty->is_unsigned ? (uint16_t)val : (uint32_t)(int16_t)val;
+  case 4: return (int32_t)val;
+  }
+  return val;
+}
+
+enum { I8, I16, I32, I64, U8, U16, U32, U64 };
+
+// Same as getTypeId() in codegen.c.
+static int type_id(Type *ty) {
+  switch (ty->kind) {
+  case TY_CHAR:
+    return ty->is_unsigned ? U8 : I8;
+  case TY_SHORT:
+    return ty->is_unsigned ? U16 : I16;
+  case TY_INT:
+    return ty->is_unsigned ? U32 : I32;
+  case TY_LONG:
+    return ty->is_unsigned ? U64 : I64;
+  }
+  return U64;
+}
+
+// The integer part of cast_table in codegen.c. 'b' and 'w' are sign
+// extensions from 8 and 16 bits to 32 bits, 'B' and 'W' are zero
+// extensions, and 'q' and 'Q' are sign and zero extensions from 32
+// bits to 64 bits.
+static char cast_ops[][8] = {
+  // i8 i16  i32  i64  u8   u16  u32  u64
+  {0,   0,   0,   'q', 'B', 'W', 0,   'q'}, // i8
+  {'b', 0,   0,   'q', 'B', 'W', 0,   'q'}, // i16
+  {'b', 'w', 0,   'q', 'B', 'W', 0,   'q'}, // i32
+  {'b', 'w', 0,   0,   'B', 'W', 0,   0  }, // i64
+  {'b', 0,   0,   'q', 0,   0,   0,   'q'}, // u8
+  {'b', 'w', 0,   'q', 'B', 0,   0,   'q'}, // u16
+  {'b', 'w', 0,   'Q', 'B', 'W', 0,   'Q'}, // u32
+  {'b', 'w', 0,   0,   'B', 'W', 0,   0  }, // u64
+};
+
+static bool eval_cast(int64_t val, Type *from, Type *to, int64_t *res) {
+  if (!is_scalar(from) || !is_scalar(to))
+    return false;
+
+  if (to->kind == TY_BOOL) {
+    if (is_integer(from) && from->size <= 4)
+      *res = (uint32_t)val != 0;
+    else
+      *res = val != 0;
+    return true;
+  }
+
+  switch (cast_ops[type_id(from)][type_id(to)]) {
+  case 'b': *res = (uint32_t)(int8_t)val; break;
+  case 'B': *res = (uint8_t)val; break;
+  case 'w': *res = (uint32_t)(int16_t)val; break;
+  case 'W': *res = (uint16_t)val; break;
+  case 'q': *res = (int32_t)val; break;
+  case 'Q': *res = (uint32_t)val; break;
+  default: *res = val;
+  }
+  return true;
+}
+
+// Returns true if a cast leaves the bits of a value unchanged. An array
+// or a function is converted to a pointer to itself.
+static bool is_nop_cast(Type *from, Type *to) {
+  return (is_scalar(from) || is_aggregate(from)) && is_scalar(to) &&
+         to->kind != TY_BOOL && !cast_ops[type_id(from)][type_id(to)];
+}
+
+static bool eval_binary(IROp op, int64_t x, int64_t y, Type *ty, int64_t *res) {
+  bool is64 = is_64bit(ty);
+  bool uns = ty->is_unsigned;
+  uint64_t ux = is64 ? (uint64_t)x : (uint32_t)x;
+  uint64_t uy = is64 ? (uint64_t)y : (uint32_t)y;
+  int64_t sx = is64 ? x : (int32_t)x;
+  int64_t sy = is64 ? y : (int32_t)y;
+  uint64_t r;
+
+  switch (op) {
+  case IR_ADD: r = ux + uy; break;
+  case IR_SUB: r = ux - uy; break;
+  case IR_MUL: r = ux * uy; break;
+  case IR_DIV:
+  case IR_MOD:
+    if (uy == 0)
+      return false;
+    if (uns) {
+      r = (op == IR_DIV) ? ux / uy : ux % uy;
+    } else {
+      if (sy == -1)
+        return false;
+      r = (op == IR_DIV) ? sx / sy : sx % sy;
+    }
+    break;
+  case IR_BITAND: r = ux & uy; break;
+  case IR_BITOR: r = ux | uy; break;
+  case IR_BITXOR: r = ux ^ uy; break;
+  case IR_SHL: r = ux << (uy & (is64 ? 63 : 31)); break;
+  case IR_SHR:
+    if (uns)
+      r = ux >> (uy & (is64 ? 63 : 31));
+    else
+      r = sx >> (uy & (is64 ? 63 : 31));
+    break;
+  case IR_EQ: *res = ux == uy; return true;
+  case IR_NE: *res = ux != uy; return true;
+  case IR_LT: *res = uns ? ux < uy : sx < sy; return true;
+  case IR_LE: *res = uns ? ux <= uy : sx <= sy; return true;
+  default:
+    return false;
+  }
+
+  // A 32-bit operation clears the upper half of a register.
+  *res = is64 ? r : (uint32_t)r;
+  return true;
+}
+
+static bool is_binary(IROp op) {
+  return IR_ADD <= op && op <= IR_LE;
+}
+
+// Returns true if `x op imm` is x itself. A 32-bit operation clears
+// the upper half of a register, so only 64-bit ones are considered.
+static bool is_identity(IROp op, int64_t imm, Type *ty) {
+  if (!is_64bit(ty))
+    return false;
+
+  switch (op) {
+  case IR_ADD:
+  case IR_SUB:
+  case IR_BITOR:
+  case IR_BITXOR:
+  case IR_SHL:
+  case IR_SHR:
+    return imm == 0;
+  case IR_MUL:
+  case IR_DIV:
+    return imm == 1;
+  case IR_BITAND:
+    return imm == -1;
+  }
+  return false;
+}
+
+static bool is_commutative(IROp op) {
+  switch (op) {
+  case IR_ADD:
+  case IR_MUL:
+  case IR_BITAND:
+  case IR_BITOR:
+  case IR_BITXOR:
+  case IR_EQ:
+  case IR_NE:
+    return true;
+  }
+  return false;
+}
+
+static void make_imm(IRInsn *insn, int64_t val) {
+  insn->op = IR_IMM;
+  insn->a = insn->b = 0;
+  insn->imm = val;
+  insn->from = NULL;
+}
+
+// A register is a constant if it has a single definition that is
+// IR_IMM, or if it was set to a constant earlier in the same basic
+// block. stamp[i] is the serial number of the block in which register
+// i was last set to a constant.
+static int64_t *val;
+static bool *global;
+static int *stamp;
+static int serial;
+
+static bool known(int r) {
+  return global[r] || stamp[r] == serial;
+}
+
+// Fold instructions whose operands are constants.
+static bool constprop(IRFunc *fn) {
+  int *defs = count_defs(fn);
+  val = calloc(fn->nregs + 1, sizeof(int64_t));
+  global = calloc(fn->nregs + 1, sizeof(bool));
+  stamp = calloc(fn->nregs + 1, sizeof(int));
+  serial = 0;
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next) {
+      if (insn->op == IR_IMM && defs[insn->d] == 1) {
+        global[insn->d] = true;
+        val[insn->d] = insn->imm;
+      }
+    }
+  }
+
+  bool changed = false;
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    serial++;
+
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next) {
+      int64_t res;
+
+      switch (insn->op) {
+      case IR_MOV:
+        if (known(insn->a)) {
+          make_imm(insn, val[insn->a]);
+          changed = true;
+        }
+        break;
+      case IR_EXT:
+        if (known(insn->a)) {
+          make_imm(insn, extend(val[insn->a], insn->ty));
+          changed = true;
+        } else if (insn->ty->size == 8) {
+          insn->op = IR_MOV;
+          changed = true;
+        }
+        break;
+      case IR_CAST:
+        if (known(insn->a) && eval_cast(val[insn->a], insn->from, insn->ty, &res)) {
+          make_imm(insn, res);
+          changed = true;
+        } else if (is_nop_cast(insn->from, insn->ty)) {
+          insn->op = IR_MOV;
+          insn->from = NULL;
+          changed = true;
+        }
+        break;
+      case IR_NEG:
+        if (known(insn->a)) {
+          make_imm(insn, -(uint64_t)val[insn->a]);
+          changed = true;
+        }
+        break;
+      case IR_BITNOT:
+        if (known(insn->a)) {
+          make_imm(insn, ~val[insn->a]);
+          changed = true;
+        }
+        break;
+      case IR_BR:
+        if (known(insn->a)) {
+          Type *ty = insn->ty;
+          bool taken = (is_integer(ty) && ty->size <= 4) ? (uint32_t)val[insn->a] : val[insn->a];
+          insn->op = IR_JMP;
+          insn->a = 0;
+          if (!taken)
+            insn->then = insn->els;
+          insn->els = NULL;
+          changed = true;
+        }
+        break;
+      case IR_SWITCH:
+        if (known(insn->a)) {
+          uint64_t idx = val[insn->a] - insn->imm;
+          if (insn->ty->size == 4)
+            idx = (uint32_t)idx;
+          if (idx < insn->ntargets)
+            insn->then = insn->targets[idx];
+          insn->op = IR_JMP;
+          insn->a = 0;
+          insn->targets = NULL;
+          insn->ntargets = 0;
+          changed = true;
+        }
+        break;
+      }
+
+      if (is_binary(insn->op)) {
+        // Move a constant to the right-hand side.
+        if (insn->b && known(insn->a) && !known(insn->b) && is_commutative(insn->op)) {
+          int tmp = insn->a;
+          insn->a = insn->b;
+          insn->b = tmp;
+          changed = true;
+        }
+
+        int64_t y = insn->b ? val[insn->b] : insn->imm;
+        bool y_known = !insn->b || known(insn->b);
+
+        if (known(insn->a) && y_known && eval_binary(insn->op, val[insn->a], y, insn->ty, &res)) {
+          make_imm(insn, res);
+          changed = true;
+        } else if (insn->b && y_known && (y == (int32_t)y || !is_64bit(insn->ty))) {
+          // Use the constant as an immediate operand. Only the lower
+          // half of an operand of a 32-bit operation matters.
+          insn->b = 0;
+          insn->imm = is_64bit(insn->ty) ? y : (int32_t)y;
+          changed = true;
+        } else if (!insn->b && is_identity(insn->op, insn->imm, insn->ty)) {
+          insn->op = IR_MOV;
+          changed = true;
+        }
+      }
+
+      if (insn->d) {
+        stamp[insn->d] = (insn->op == IR_IMM) ? serial : 0;
+        val[insn->d] = insn->imm;
+      }
+    }
+  }
+  return changed;
+}
+
+// Forward a copy to its uses in the same basic block as long as
+// neither side of the copy is redefined. The copy is removed if all
+// uses of its destination have been replaced.
+static bool copyprop(IRFunc *fn) {
+  int *uses = count_uses(fn);
+  int *defs = count_defs(fn);
+  bool changed = false;
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    for (IRInsn **p = &bb->insns; *p;) {
+      IRInsn *mov = *p;
+      if (mov->op != IR_MOV || mov->a == mov->d) {
+        p = &mov->next;
+        continue;
+      }
+
+      int replaced = 0;
+      for (IRInsn *insn = mov->next; insn; insn = insn->next) {
+        int *regs[IR_MAX_USES];
+        int n = ir_uses(insn, regs);
+        for (int i = 0; i < n; i++) {
+          if (*regs[i] == mov->d) {
+            *regs[i] = mov->a;
+            replaced++;
+          }
+        }
+        if (insn->d == mov->a || insn->d == mov->d)
+          break;
+      }
+
+      if (replaced)
+        changed = true;
+
+      if (defs[mov->d] == 1 && replaced == uses[mov->d])
+        *p = mov->next;
+      else
+        p = &mov->next;
+    }
+  }
+  return changed;
+}
+
+static bool reads(IRInsn *insn, int reg) {
+  int *regs[IR_MAX_USES];
+  int n = ir_uses(insn, regs);
+  for (int i = 0; i < n; i++)
+    if (*regs[i] == reg)
+      return true;
+  return false;
+}
+
+// Returns the first instruction that reads a given register, searching
+// from `insn` to the end of its basic block.
+static IRInsn *find_use(IRInsn *insn, int reg) {
+  for (; insn; insn = insn->next)
+    if (reads(insn, reg))
+      return insn;
+  return NULL;
+}
+
+// Make an instruction write directly to the register its result is
+// copied to, e.g. turn `v2 = add v1, 1; v1 = mov v2` into
+// `v1 = add v1, 1`.
+static bool coalesce(IRFunc *fn) {
+  int *uses = count_uses(fn);
+  int *defs = count_defs(fn);
+  bool changed = false;
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    for (IRInsn *def = bb->insns; def; def = def->next) {
+      if (!def->d || defs[def->d] != 1 || uses[def->d] != 1)
+        continue;
+
+      IRInsn *mov = find_use(def->next, def->d);
+      if (!mov || mov->op != IR_MOV || mov->d == def->d)
+        continue;
+
+      // The destination of the copy must be neither read nor written
+      // in between.
+      bool ok = true;
+      IRInsn **p = &def->next;
+      for (; *p != mov; p = &(*p)->next)
+        if ((*p)->d == mov->d || reads(*p, mov->d))
+          ok = false;
+      if (!ok)
+        continue;
+
+      def->d = mov->d;
+      *p = mov->next;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Remove a definition that is overwritten later in the same basic
+// block before being read.
+static bool remove_dead_defs(IRFunc *fn) {
+  IRInsn **last_def = calloc(fn->nregs + 1, sizeof(IRInsn *));
+  bool changed = false;
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next) {
+      int *regs[IR_MAX_USES];
+      int n = ir_uses(insn, regs);
+      for (int i = 0; i < n; i++)
+        last_def[*regs[i]] = NULL;
+
+      if (!insn->d)
+        continue;
+
+      IRInsn *prev = last_def[insn->d];
+      if (prev && !has_side_effect(prev)) {
+        prev->dead = true;
+        changed = true;
+      }
+      last_def[insn->d] = insn;
+    }
+
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next)
+      if (insn->d)
+        last_def[insn->d] = NULL;
+  }
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    for (IRInsn **p = &bb->insns; *p;) {
+      if ((*p)->dead)
+        *p = (*p)->next;
+      else
+        p = &(*p)->next;
+    }
+  }
+  return changed;
+}
+
+// Remove instructions whose results are never used.
+static bool dce(IRFunc *fn) {
+  bool changed = remove_dead_defs(fn);
+
+  for (;;) {
+    int *uses = count_uses(fn);
+    bool removed = false;
+
+    for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+      for (IRInsn **p = &bb->insns; *p;) {
+        IRInsn *insn = *p;
+        if (!has_side_effect(insn) && insn->d && !uses[insn->d]) {
+          *p = insn->next;
+          removed = true;
+          continue;
+        }
+        p = &insn->next;
+      }
+    }
+
+    if (!removed)
+      return changed;
+    changed = true;
+  }
+}
+
+static void mark_reachable(BasicBlock *bb) {
+  if (bb->reachable)
+    return;
+  bb->reachable = true;
+
+  IRInsn *insn = last_insn(bb);
+  if (!insn || !is_terminator(insn))
+    return;
+  if (insn->then)
+    mark_reachable(insn->then);
+  if (insn->els)
+    mark_reachable(insn->els);
+  for (int i = 0; i < insn->ntargets; i++)
+    mark_reachable(insn->targets[i]);
+}
+
+// Skip blocks that consist of only an unconditional jump.
+static BasicBlock *jump_target(BasicBlock *bb) {
+  for (int i = 0; i < 16; i++) {
+    IRInsn *insn = bb->insns;
+    if (!insn || insn->op != IR_JMP || insn->then == bb)
+      return bb;
+    bb = insn->then;
+  }
+  return bb;
+}
+
+// Unlinks the blocks that are not marked reachable.
+static bool remove_unreachable(IRFunc *fn) {
+  bool changed = false;
+  fn->last = NULL;
+  for (BasicBlock **p = &fn->bbs; *p;) {
+    if (!(*p)->reachable) {
+      *p = (*p)->next;
+      changed = true;
+      continue;
+    }
+    fn->last = *p;
+    p = &(*p)->next;
+  }
+  return changed;
+}
+
+// Thread jumps, remove unreachable blocks and merge a block into its
+// predecessor if it's the only one.
+static bool simplify_cfg(IRFunc *fn) {
+  bool changed = false;
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    IRInsn *insn = last_insn(bb);
+    if (!insn || !is_terminator(insn))
+      continue;
+
+    if (insn->then && jump_target(insn->then) != insn->then) {
+      insn->then = jump_target(insn->then);
+      changed = true;
+    }
+    if (insn->els && jump_target(insn->els) != insn->els) {
+      insn->els = jump_target(insn->els);
+      changed = true;
+    }
+    for (int i = 0; i < insn->ntargets; i++) {
+      if (jump_target(insn->targets[i]) != insn->targets[i]) {
+        insn->targets[i] = jump_target(insn->targets[i]);
+        changed = true;
+      }
+    }
+    if (insn->op == IR_BR && insn->then == insn->els) {
+      insn->op = IR_JMP;
+      insn->a = 0;
+      insn->els = NULL;
+      changed = true;
+    }
+  }
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    bb->reachable = false;
+    bb->npreds = 0;
+  }
+  mark_reachable(fn->bbs);
+  changed |= remove_unreachable(fn);
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    IRInsn *insn = last_insn(bb);
+    if (insn->then)
+      insn->then->npreds++;
+    if (insn->els)
+      insn->els->npreds++;
+    for (int i = 0; i < insn->ntargets; i++)
+      insn->targets[i]->npreds++;
+  }
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    // Skip a block that was merged into its predecessor.
+    if (!bb->reachable)
+      continue;
+
+    // `p` points to the link to the last instruction, so that a long
+    // chain of blocks is merged in linear time.
+    IRInsn **p = &bb->insns;
+    while ((*p)->next)
+      p = &(*p)->next;
+
+    for (;;) {
+      IRInsn *insn = *p;
+      BasicBlock *succ = insn->then;
+      if (insn->op != IR_JMP || succ == bb || succ == fn->bbs || succ->npreds != 1)
+        break;
+
+      // Replace the jump with the successor's instructions.
+      *p = succ->insns;
+      while ((*p)->next)
+        p = &(*p)->next;
+      succ->insns = NULL;
+      succ->reachable = false;
+      changed = true;
+    }
+  }
+
+  remove_unreachable(fn);
+  return changed;
+}
+
+typedef struct {
+  char *name;
+  bool (*run)(IRFunc *fn);
+} Pass;
+
+static Pass passes[] = {
+  {"simplify-cfg", simplify_cfg},
+  {"mem2reg", mem2reg},
+  {"constprop", constprop},
+  {"copyprop", copyprop},
+  {"coalesce", coalesce},
+  {"dce", dce},
+  {"simplify-cfg", simplify_cfg},
+};
+
+// Run the passes repeatedly until none of them changes the IR.
+void optimize_ir(IRFunc *fn) {
+  for (int round = 0; round < 8; round++) {
+    bool changed = false;
+    for (int i = 0; i < sizeof(passes) / sizeof(*passes); i++)
+      if (passes[i].run(fn))
+        changed = true;
+    if (!changed)
+      return;
+  }
+}
+
+//
+// Inlining
+//
+
+// A call to a static function is replaced with a copy of the callee's
+// IR if the callee has at most this many instructions after
+// optimization. Functions declared inline get twice as much.
+#define INLINE_BUDGET 20
+
+// Calls that come from inlined code are inlined in turn up to this
+// depth, which also limits how far a recursive function is unrolled.
+#define INLINE_DEPTH 3
+
+// Inlining into a function stops once it has grown by this many
+// instructions.
+#define INLINE_GROWTH 1000
+
+typedef struct {
+  IRFunc *fn;         // Function being inlined into
+  IRFunc *callee;
+  IRInsn *call;
+  int base;           // Callee's register r becomes r + base
+  BasicBlock **bbs;   // Copies of the callee's blocks, indexed by ID
+  BasicBlock *cont;   // Block that the copies return to
+  HashMap vars;       // Copies of the callee's local variables
+} Inliner;
+
+static int count_insns(IRFunc *fn) {
+  int n = 0;
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next)
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next)
+      n++;
+  return n;
+}
+
+// Returns the callee of `call` if it is a direct call to a function
+// that can be inlined.
+static Obj *inline_callee(BasicBlock *bb, IRInsn *call) {
+  // The callee's address is computed just before the call.
+  IRInsn *def = NULL;
+  for (IRInsn *insn = bb->insns; insn != call; insn = insn->next)
+    if (insn->d == call->a)
+      def = insn;
+  if (!def || def->op != IR_GADDR || !def->var->is_function)
+    return NULL;
+
+  Obj *fn = def->var;
+  if (!fn->ir || !fn->is_static || fn->ty->is_variadic)
+    return NULL;
+
+  // A call without a prototype may not match the definition.
+  int nparams = 0;
+  for (Obj *var = fn->params; var; var = var->next)
+    nparams++;
+  if (nparams != call->nargs)
+    return NULL;
+
+  int budget = fn->is_inline ? INLINE_BUDGET * 2 : INLINE_BUDGET;
+  if (count_insns(fn->ir) > budget)
+    return NULL;
+  return fn;
+}
+
+static int map_reg(Inliner *in, int reg) {
+  return reg ? reg + in->base : 0;
+}
+
+// Each inlined copy of a function gets its own local variables.
+static Obj *map_var(Inliner *in, Obj *var) {
+  if (!var || !var->is_local)
+    return var;
+
+  Obj *copy = hashmap_get2(&in->vars, (char *)&var, sizeof(Obj *));
+  if (copy)
+    return copy;
+
+  copy = arena_alloc(MEM_OBJ, sizeof(Obj));
+  *copy = *var;
+  copy->next = in->fn->fn->locals;
+  in->fn->fn->locals = copy;
+  hashmap_put2(&in->vars, var_key(var), sizeof(Obj *), copy);
+
+  if (hashmap_get2(&in->callee->escaped, (char *)&var, sizeof(Obj *)))
+    hashmap_put2(&in->fn->escaped, var_key(copy), sizeof(Obj *), copy);
+  return copy;
+}
+
+static IRInsn *copy_insn(Inliner *in, IRInsn *insn) {
+  IRInsn *copy = arena_alloc(MEM_IR, sizeof(IRInsn));
+  *copy = *insn;
+  copy->next = NULL;
+  copy->d = map_reg(in, insn->d);
+  copy->a = map_reg(in, insn->a);
+  copy->b = map_reg(in, insn->b);
+  copy->var = map_var(in, insn->var);
+
+  if (insn->nargs) {
+    copy->args = calloc(insn->nargs, sizeof(int));
+    for (int i = 0; i < insn->nargs; i++)
+      copy->args[i] = map_reg(in, insn->args[i]);
+  }
+
+  if (insn->then)
+    copy->then = in->bbs[insn->then->id];
+  if (insn->els)
+    copy->els = in->bbs[insn->els->id];
+  if (insn->ntargets) {
+    copy->targets = calloc(insn->ntargets, sizeof(BasicBlock *));
+    for (int i = 0; i < insn->ntargets; i++)
+      copy->targets[i] = in->bbs[insn->targets[i]->id];
+  }
+
+  // Parameters are bound to the arguments of the call.
+  if (insn->op == IR_PARAM) {
+    copy->op = IR_MOV;
+    copy->a = in->call->args[insn->imm];
+    copy->imm = 0;
+  }
+  return copy;
+}
+
+static BasicBlock *copy_bb(Inliner *in, BasicBlock *bb) {
+  IRInsn head = {};
+  IRInsn *cur = &head;
+
+  for (IRInsn *insn = bb->insns; insn; insn = insn->next) {
+    if (insn->op != IR_RET) {
+      cur = cur->next = copy_insn(in, insn);
+      continue;
+    }
+
+    // A return assigns the value of the call and jumps to the code
+    // after it.
+    if (in->call->d) {
+      IRInsn *mov = arena_alloc(MEM_IR, sizeof(IRInsn));
+      mov->op = insn->a ? IR_MOV : IR_IMM;
+      mov->d = in->call->d;
+      mov->a = map_reg(in, insn->a);
+      mov->tok = insn->tok;
+      cur = cur->next = mov;
+    }
+
+    IRInsn *jmp = arena_alloc(MEM_IR, sizeof(IRInsn));
+    jmp->op = IR_JMP;
+    jmp->then = in->cont;
+    jmp->tok = insn->tok;
+    cur = cur->next = jmp;
+  }
+
+  BasicBlock *copy = in->bbs[bb->id];
+  copy->insns = head.next;
+  return copy;
+}
+
+// Replace `call` in `bb` with a copy of the body of `callee` and return
+// the block that continues after the call. The callee may be `fn`
+// itself, so it is copied in full before `fn` is changed.
+static BasicBlock *inline_call(IRFunc *fn, BasicBlock *bb, IRInsn *call, IRFunc *callee) {
+  Inliner in = {fn, callee, call};
+  int nregs = callee->nregs;
+  int nbbs = callee->nbbs;
+
+  in.base = fn->nregs;
+  in.cont = arena_alloc(MEM_IR, sizeof(BasicBlock));
+  in.bbs = calloc(nbbs, sizeof(BasicBlock *));
+  for (BasicBlock *b = callee->bbs; b; b = b->next)
+    in.bbs[b->id] = arena_alloc(MEM_IR, sizeof(BasicBlock));
+
+  BasicBlock head = {};
+  BasicBlock *cur = &head;
+  for (BasicBlock *b = callee->bbs; b; b = b->next)
+    cur = cur->next = copy_bb(&in, b);
+
+  fn->nregs += nregs;
+  for (BasicBlock *b = head.next; b; b = b->next)
+    b->id = fn->nbbs++;
+  in.cont->id = fn->nbbs++;
+
+  // Split the block at the call and jump to the copy of the entry
+  // block instead of calling.
+  IRInsn *jmp = arena_alloc(MEM_IR, sizeof(IRInsn));
+  jmp->op = IR_JMP;
+  jmp->then = head.next;
+  jmp->tok = call->tok;
+
+  IRInsn **p = &bb->insns;
+  while (*p != call)
+    p = &(*p)->next;
+  *p = jmp;
+  in.cont->insns = call->next;
+
+  cur->next = in.cont;
+  in.cont->next = bb->next;
+  bb->next = head.next;
+  if (fn->last == bb)
+    fn->last = in.cont;
+  return in.cont;
+}
+
+// Inline calls to small static functions. Blocks copied in one round
+// are looked at in the next.
+static bool inline_calls(IRFunc *fn) {
+  bool changed = false;
+  int growth = 0;
+
+  for (int depth = 0; depth < INLINE_DEPTH; depth++) {
+    bool inlined = false;
+
+    for (BasicBlock *bb = fn->bbs; bb;) {
+      Obj *callee = NULL;
+      IRInsn *call = bb->insns;
+      for (; call; call = call->next) {
+        if (call->op != IR_CALL)
+          continue;
+        callee = inline_callee(bb, call);
+        if (callee && growth + count_insns(callee->ir) <= INLINE_GROWTH)
+          break;
+      }
+
+      if (!call) {
+        bb = bb->next;
+        continue;
+      }
+
+      growth += count_insns(callee->ir);
+      bb = inline_call(fn, bb, call, callee->ir);
+      inlined = true;
+    }
+
+    if (!inlined)
+      break;
+    changed = true;
+  }
+  return changed;
+}
+
+static void mark_live(Obj *fn, HashMap *funcs) {
+  if (fn->is_live)
+    return;
+  fn->is_live = true;
+
+  // References in the IR are exact; the references recorded by the
+  // parser include calls that have been inlined since.
+  if (fn->ir) {
+    for (BasicBlock *bb = fn->ir->bbs; bb; bb = bb->next)
+      for (IRInsn *insn = bb->insns; insn; insn = insn->next)
+        if (insn->op == IR_GADDR && insn->var->is_function)
+          mark_live(insn->var, funcs);
+    return;
+  }
+
+  for (int i = 0; i < fn->refs.len; i++) {
+    Obj *ref = hashmap_get(funcs, fn->refs.data[i]);
+    if (ref)
+      mark_live(ref, funcs);
+  }
+}
+
+// Inline calls in all functions that have been lowered to IR and
+// optimized. A static function all of whose calls have been inlined is
+// no longer emitted.
+void inline_functions(Obj *prog) {
+  for (Obj *fn = prog; fn; fn = fn->next)
+    if (fn->ir && inline_calls(fn->ir))
+      optimize_ir(fn->ir);
+
+  HashMap funcs = {};
+  for (Obj *fn = prog; fn; fn = fn->next) {
+    if (fn->is_function) {
+      hashmap_put(&funcs, fn->name, fn);
+      fn->is_live = false;
+    }
+  }
+
+  for (Obj *fn = prog; fn; fn = fn->next)
+    if (fn->is_function && fn->is_root)
+      mark_live(fn, &funcs);
+}
+
+//
+// IR dump
+//
+
+static char *op_names[] = {
+  [IR_IMM] = "imm", [IR_MOV] = "mov", [IR_PARAM] = "param",
+  [IR_LVAR] = "lvar", [IR_GADDR] = "gaddr", [IR_LOAD] = "load",
+  [IR_STORE] = "store", [IR_EXT] = "ext", [IR_CAST] = "cast",
+  [IR_ADD] = "add", [IR_SUB] = "sub", [IR_MUL] = "mul", [IR_DIV] = "div",
+  [IR_MOD] = "mod", [IR_BITAND] = "and", [IR_BITOR] = "or",
+  [IR_BITXOR] = "xor", [IR_SHL] = "shl", [IR_SHR] = "shr", [IR_EQ] = "eq",
+  [IR_NE] = "ne", [IR_LT] = "lt", [IR_LE] = "le", [IR_NEG] = "neg",
+  [IR_BITNOT] = "not", [IR_MEMZERO] = "memzero", [IR_CALL] = "call",
+  [IR_JMP] = "jmp", [IR_BR] = "br", [IR_SWITCH] = "switch", [IR_RET] = "ret",
+};
+
+static char *type_name(Type *ty) {
+  if (ty->kind == TY_PTR)
+    return "ptr";
+  if (is_aggregate(ty))
+    return "addr";
+  if (ty->kind == TY_BOOL)
+    return "bool";
+  return format("%c%d", ty->is_unsigned ? 'u' : 'i', ty->size * 8);
+}
+
+void dump_ir(IRFunc *fn, FILE *out) {
+  fprintf(out, "function %s\n", fn->fn->name);
+
+  for (BasicBlock *bb = fn->bbs; bb; bb = bb->next) {
+    fprintf(out, "bb%d:\n", bb->id);
+
+    for (IRInsn *insn = bb->insns; insn; insn = insn->next) {
+      fprintf(out, "  ");
+      if (insn->d)
+        fprintf(out, "v%d = ", insn->d);
+
+      fprintf(out, "%s", op_names[insn->op]);
+      if (insn->op == IR_CAST)
+        fprintf(out, ".%s.%s", type_name(insn->from), type_name(insn->ty));
+      else if (insn->ty && insn->op != IR_CALL && is_scalar(insn->ty))
+        fprintf(out, ".%s", type_name(insn->ty));
+
+      switch (insn->op) {
+      case IR_IMM:
+      case IR_PARAM:
+        fprintf(out, " %ld", insn->imm);
+        break;
+      case IR_LVAR:
+      case IR_GADDR:
+      case IR_MEMZERO:
+        fprintf(out, " %s", insn->var->name);
+        break;
+      case IR_JMP:
+        fprintf(out, " bb%d", insn->then->id);
+        break;
+      case IR_BR:
+        fprintf(out, " v%d, bb%d, bb%d", insn->a, insn->then->id, insn->els->id);
+        break;
+      case IR_SWITCH:
+        fprintf(out, " v%d - %ld, bb%d, [", insn->a, insn->imm, insn->then->id);
+        for (int i = 0; i < insn->ntargets; i++)
+          fprintf(out, "%sbb%d", i ? ", " : "", insn->targets[i]->id);
+        fprintf(out, "]");
+        break;
+      case IR_CALL:
+        fprintf(out, " v%d(", insn->a);
+        for (int i = 0; i < insn->nargs; i++)
+          fprintf(out, "%sv%d", i ? ", " : "", insn->args[i]);
+        fprintf(out, ")");
+        break;
+      default:
+        if (insn->a)
+          fprintf(out, " v%d", insn->a);
+        if (insn->b)
+          fprintf(out, ", v%d", insn->b);
+        else if (is_binary(insn->op))
+          fprintf(out, ", %ld", insn->imm);
+      }
+      fprintf(out, "\n");
+    }
+  }
+  fprintf(out, "\n");
+}
@@ -1,15 +1,21 @@
 #include "chibicc.h"
 
 typedef enum {
-  FILE_NONE, FILE_C, FILE_ASM, FILE_OBJ, FILE_AR, FILE_DSO,
+  FILE_NONE, FILE_C, FILE_HEADER, FILE_ASM, FILE_OBJ, FILE_AR, FILE_DSO,
 } FileType;
 
 StringArray include_paths;
 bool opt_fcommon = true;
 bool opt_fpic;
+int opt_O;
+bool opt_dump_ir;
+bool opt_peephole;
+bool opt_peephole_stats;
+char *opt_header_cache;
 
 static FileType opt_x;
 static StringArray opt_include;
+static StringArray opt_macros;
 static bool opt_E;
 static bool opt_M;
 static bool opt_MD;
@@ -24,6 +30,11 @@ static bool opt_shared;
 static char *opt_MF;
 static char *opt_MT;
 static char *opt_o;
+static int opt_j = 1;
+static bool opt_mem_report;
+static bool opt_integrated_as = true;
+static bool opt_cc1_obj;
+static bool opt_peephole_set;
 
 static StringArray ld_extra_args;
 static StringArray std_include_paths;
@@ -42,6 +53,7 @@ static void usage(int status) {
 static bool take_arg(char *arg) {
   char *x[] = {
     "-o", "-I", "-idirafter", "-include", "-x", "-MF", "-MT", "-Xlinker",
+    "-j",
   };
 
   for (int i = 0; i < sizeof(x) / sizeof(*x); i++)
@@ -76,6 +88,8 @@ static void define(char *str) {
 static FileType parse_opt_x(char *s) {
   if (!strcmp(s, "c"))
     return FILE_C;
+  if (!strcmp(s, "c-header"))
+    return FILE_HEADER;
   if (!strcmp(s, "assembler"))
     return FILE_ASM;
   if (!strcmp(s, "none"))
@@ -177,21 +191,25 @@ static void parse_args(int argc, char **argv) {
 
     if (!strcmp(argv[i], "-D")) {
       define(argv[++i]);
+      strarray_push(&opt_macros, format("-D%s", argv[i]));
       continue;
     }
 
     if (!strncmp(argv[i], "-D", 2)) {
       define(argv[i] + 2);
+      strarray_push(&opt_macros, argv[i]);
       continue;
     }
 
     if (!strcmp(argv[i], "-U")) {
       undef_macro(argv[++i]);
+      strarray_push(&opt_macros, format("-U%s", argv[i]));
       continue;
     }
 
     if (!strncmp(argv[i], "-U", 2)) {
       undef_macro(argv[i] + 2);
+      strarray_push(&opt_macros, argv[i]);
       continue;
     }
 
@@ -281,6 +299,11 @@ static void parse_args(int argc, char **argv) {
       continue;
     }
 
+    if (!strcmp(argv[i], "-cc1-obj")) {
+      opt_cc1_obj = true;
+      continue;
+    }
+
     if (!strcmp(argv[i], "-idirafter")) {
       strarray_push(&idirafter, argv[i++]);
       continue;
@@ -310,11 +333,100 @@ static void parse_args(int argc, char **argv) {
       continue;
     }
 
+    if (!strcmp(argv[i], "-O")) {
+      opt_O = 1;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-O", 2) && isdigit(argv[i][2])) {
+      opt_O = atoi(argv[i] + 2);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fdump-ir")) {
+      opt_dump_ir = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fpeephole")) {
+      opt_peephole = opt_peephole_set = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fno-peephole")) {
+      opt_peephole = false;
+      opt_peephole_set = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fpeephole-stats")) {
+      opt_peephole_stats = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-j")) {
+      opt_j = atoi(argv[++i]);
+      if (opt_j < 1)
+        error("<command line>: invalid argument for -j: %s", argv[i]);
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-j", 2) && isdigit(argv[i][2])) {
+      opt_j = atoi(argv[i] + 2);
+      if (opt_j < 1)
+        error("<command line>: invalid argument for -j: %s", argv[i] + 2);
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-fheader-cache=", 15)) {
+      opt_header_cache = argv[i] + 15;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fintegrated-as")) {
+      opt_integrated_as = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fno-integrated-as")) {
+      opt_integrated_as = false;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-ftime-report")) {
+      opt_time_report = true;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-ftime-report=", 14)) {
+      opt_time_report_file = argv[i] + 14;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fmem-report")) {
+      opt_mem_report = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-emit-bench")) {
+      if (!argv[++i])
+        usage(1);
+      emit_bench(argv[i]);
+      exit(0);
+    }
+
     if (!strcmp(argv[i], "-hashmap-test")) {
       hashmap_test();
       exit(0);
     }
 
+    if (!strcmp(argv[i], "-hashmap-bench")) {
+      if (!argv[++i])
+        usage(1);
+      hashmap_bench(argv[i]);
+      exit(0);
+    }
+
     // These options are ignored for now.
     if (!strncmp(argv[i], "-O", 2) ||
         !strncmp(argv[i], "-W", 2) ||
@@ -336,6 +448,11 @@ static void parse_args(int argc, char **argv) {
     strarray_push(&input_paths, argv[i]);
   }
 
+  // The peephole optimizer runs at -O1 and above unless it is
+  // explicitly turned on or off.
+  if (!opt_peephole_set)
+    opt_peephole = opt_O > 0;
+
   for (int i = 0; i < idirafter.len; i++)
     strarray_push(&include_paths, idirafter.data[i]);
 
@@ -388,7 +505,7 @@ static char *create_tmpfile(void) {
   return path;
 }
 
-static void run_subprocess(char **argv) {
+static void run_subprocess(char **argv, TimerVar tv) {
   // If -### is given, dump the subprocess's command line.
   if (opt_hash_hash_hash) {
     fprintf(stderr, "%s", argv[0]);
@@ -397,6 +514,8 @@ static void run_subprocess(char **argv) {
     fprintf(stderr, "\n");
   }
 
+  TimerVar prev = timer_start(tv);
+
   if (fork() == 0) {
     // Child process. Run a new command.
     execvp(argv[0], argv);
@@ -407,11 +526,14 @@ static void run_subprocess(char **argv) {
   // Wait for the child process to finish.
   int status;
   while (wait(&status) > 0);
+  timer_resume(prev);
   if (status != 0)
     exit(1);
 }
 
-static void run_cc1(int argc, char **argv, char *input, char *output) {
+// Runs cc1 as a subprocess. If `obj` is true, cc1 writes an object
+// file rather than assembly.
+static void run_cc1(int argc, char **argv, char *input, char *output, bool obj) {
   char **args = calloc(argc + 10, sizeof(char *));
   memcpy(args, argv, argc * sizeof(char *));
   args[argc++] = "-cc1";
@@ -426,7 +548,10 @@ static void run_cc1(int argc, char **argv, char *input, char *output) {
     args[argc++] = output;
   }
 
-  run_subprocess(args);
+  if (obj)
+    args[argc++] = "-cc1-obj";
+
+  run_subprocess(args, TV_CC1);
 }
 
 // Print tokens to stdout. Used for -E.
@@ -494,6 +619,26 @@ static void print_dependencies(void) {
   }
 }
 
+static FileType get_file_type(char *filename) {
+  if (opt_x != FILE_NONE)
+    return opt_x;
+
+  if (endswith(filename, ".a"))
+    return FILE_AR;
+  if (endswith(filename, ".so"))
+    return FILE_DSO;
+  if (endswith(filename, ".o"))
+    return FILE_OBJ;
+  if (endswith(filename, ".c"))
+    return FILE_C;
+  if (endswith(filename, ".h"))
+    return FILE_HEADER;
+  if (endswith(filename, ".s"))
+    return FILE_ASM;
+
+  error("<command line>: unknown file extension: %s", filename);
+}
+
 static Token *must_tokenize_file(char *path) {
   Token *tok = tokenize_file(path);
   if (!tok)
@@ -512,8 +657,34 @@ static Token *append_tokens(Token *tok1, Token *tok2) {
   return tok1;
 }
 
+// A precompiled header can be used only if the macros and include
+// paths given on the command line are the same as when it was built.
+static char *pch_signature(void) {
+  char *buf;
+  size_t buflen;
+  FILE *out = open_memstream(&buf, &buflen);
+
+  for (int i = 0; i < include_paths.len; i++)
+    fprintf(out, "-I%s\n", include_paths.data[i]);
+  for (int i = 0; i < opt_macros.len; i++)
+    fprintf(out, "%s\n", opt_macros.data[i]);
+  fclose(out);
+  return buf;
+}
+
+static void assemble(char *input, char *output) {
+  char *cmd[] = {"as", "-c", input, "-o", output, NULL};
+  run_subprocess(cmd, TV_AS);
+}
+
 static void cc1(void) {
   Token *tok = NULL;
+  Token *pch = NULL;
+  bool is_header = get_file_type(base_file) == FILE_HEADER;
+
+  // A precompiled header records the macros it changes.
+  if (is_header)
+    record_macro_changes();
 
   // Process -include option
   for (int i = 0; i < opt_include.len; i++) {
@@ -528,6 +699,18 @@ static void cc1(void) {
         error("-include: %s: %s", incl, strerror(errno));
     }
 
+    // If the first -include file has a valid precompiled header,
+    // use it instead of preprocessing the file. The result is
+    // already preprocessed, so it is prepended after the rest has
+    // gone through the preprocessor.
+    if (i == 0 && !is_header) {
+      timer_start(TV_READ);
+      pch = read_pch(format("%s.pch", path), pch_signature());
+      timer_resume(TV_OTHER);
+      if (pch)
+        continue;
+    }
+
     Token *tok2 = must_tokenize_file(path);
     tok = append_tokens(tok, tok2);
   }
@@ -535,7 +718,11 @@ static void cc1(void) {
   // Tokenize and parse.
   Token *tok2 = must_tokenize_file(base_file);
   tok = append_tokens(tok, tok2);
+  timer_start(TV_PREPROCESS);
   tok = preprocess(tok);
+  timer_resume(TV_OTHER);
+  if (pch)
+    tok = append_tokens(pch, tok);
 
   // If -M or -MD are given, print file dependencies.
   if (opt_M || opt_MD) {
@@ -546,30 +733,145 @@ static void cc1(void) {
 
   // If -E is given, print out preprocessed C code as a result.
   if (opt_E) {
+    timer_start(TV_OUTPUT);
     print_tokens(tok);
     return;
   }
 
-  Obj *prog = parse(tok);
+  if (is_header) {
+    if (!output_file)
+      error("no output file for a precompiled header");
+    timer_start(TV_OUTPUT);
+    write_pch(output_file, tok, pch_signature());
+    return;
+  }
 
-  // Open a temporary output buffer.
-  char *buf;
-  size_t buflen;
-  FILE *output_buf = open_memstream(&buf, &buflen);
+  set_mem_phase(PHASE_PARSE);
+  timer_start(TV_PARSE);
+  Obj *prog = parse(tok);
 
   // Traverse the AST to emit assembly.
-  codegen(prog, output_buf);
-  fclose(output_buf);
+  set_mem_phase(PHASE_CODEGEN);
+  timer_start(TV_CODEGEN);
+  OutBuf buf = {};
+  codegen(prog, &buf);
+  stat_count[STAT_OUTPUT_BYTES] = buf.len;
+
+  // Assemble the output in-process if asked to write an object file.
+  // If the code contains something that the integrated assembler
+  // doesn't support, such as unusual inline assembly, use `as`.
+  if (opt_cc1_obj) {
+    timer_start(TV_ASSEMBLE);
+    if (buf.data && assemble_elf(buf.data, output_file))
+      return;
+
+    timer_start(TV_OUTPUT);
+    char *tmp = create_tmpfile();
+    out_write(&buf, tmp);
+    assemble(tmp, output_file);
+    return;
+  }
 
   // Write the asembly text to a file.
-  FILE *out = open_file(output_file);
-  fwrite(buf, buflen, 1, out);
-  fclose(out);
+  timer_start(TV_OUTPUT);
+  out_write(&buf, output_file);
 }
 
-static void assemble(char *input, char *output) {
-  char *cmd[] = {"as", "-c", input, "-o", output, NULL};
-  run_subprocess(cmd);
+// A job compiles and/or assembles one input file. Jobs for different
+// inputs are independent of each other, so they can run in parallel.
+typedef struct {
+  FileType type;
+  char *input;
+  char *asm_file; // Output of cc1, or NULL for assembly input or if
+                  // cc1 writes an object file itself
+  char *obj_file; // Output of the assembler, or NULL for -S
+  char *log;      // Captured stderr when run in parallel
+} Job;
+
+static void run_job(int argc, char **argv, Job *job) {
+  if ((job->type == FILE_C || job->type == FILE_HEADER) && !job->asm_file) {
+    run_cc1(argc, argv, job->input, job->obj_file, true);
+    return;
+  }
+
+  if (job->type == FILE_C || job->type == FILE_HEADER)
+    run_cc1(argc, argv, job->input, job->asm_file, false);
+  if (job->obj_file)
+    assemble(job->asm_file ? job->asm_file : job->input, job->obj_file);
+}
+
+static void spawn_job(int argc, char **argv, Job *job) {
+  job->log = create_tmpfile();
+
+  fflush(stdout);
+  fflush(stderr);
+
+  pid_t pid = fork();
+  if (pid == -1)
+    error("fork failed: %s", strerror(errno));
+  if (pid > 0)
+    return;
+
+  // Child process. Temporary files are owned by the parent, which
+  // removes them after all jobs have finished.
+  tmpfiles.len = 0;
+
+  if (!freopen(job->log, "w", stderr))
+    _exit(1);
+  run_job(argc, argv, job);
+  print_time_report("driver", job->input);
+  exit(0);
+}
+
+static void print_log(char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return;
+
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    fwrite(buf, 1, n, stderr);
+  fclose(fp);
+}
+
+// Run jobs, up to opt_j of them at once. Diagnostics of each job are
+// written to a temporary file and replayed in input order, so that
+// the output doesn't depend on scheduling. Once a job fails, no new
+// job is started.
+static void run_jobs(int argc, char **argv, Job *jobs, int njobs) {
+  if (opt_j == 1 || njobs == 1) {
+    for (int i = 0; i < njobs; i++)
+      run_job(argc, argv, &jobs[i]);
+    return;
+  }
+
+  int started = 0;
+  int running = 0;
+  bool failed = false;
+
+  for (;;) {
+    while (!failed && started < njobs && running < opt_j) {
+      spawn_job(argc, argv, &jobs[started++]);
+      running++;
+    }
+
+    if (running == 0)
+      break;
+
+    int status;
+    if (wait(&status) == -1)
+      error("wait failed: %s", strerror(errno));
+    running--;
+    if (status != 0)
+      failed = true;
+  }
+
+  for (int i = 0; i < started; i++)
+    print_log(jobs[i].log);
+
+  if (failed)
+    exit(1);
 }
 
 static char *find_file(char *pattern) {
@@ -676,25 +978,7 @@ static void run_linker(StringArray *inputs, char *output) {
   strarray_push(&arr, format("%s/crtn.o", libpath));
   strarray_push(&arr, NULL);
 
-  run_subprocess(arr.data);
-}
-
-static FileType get_file_type(char *filename) {
-  if (opt_x != FILE_NONE)
-    return opt_x;
-
-  if (endswith(filename, ".a"))
-    return FILE_AR;
-  if (endswith(filename, ".so"))
-    return FILE_DSO;
-  if (endswith(filename, ".o"))
-    return FILE_OBJ;
-  if (endswith(filename, ".c"))
-    return FILE_C;
-  if (endswith(filename, ".s"))
-    return FILE_ASM;
-
-  error("<command line>: unknown file extension: %s", filename);
+  run_subprocess(arr.data, TV_LD);
 }
 
 int main(int argc, char **argv) {
@@ -702,9 +986,15 @@ int main(int argc, char **argv) {
   init_macros();
   parse_args(argc, argv);
 
+  if (opt_time_report || opt_time_report_file)
+    timer_init();
+
   if (opt_cc1) {
     add_default_include_paths(argv[0]);
     cc1();
+    if (opt_mem_report)
+      print_mem_report(stderr);
+    print_time_report("cc1", base_file);
     return 0;
   }
 
@@ -712,6 +1002,8 @@ int main(int argc, char **argv) {
     error("cannot specify '-o' with '-c,' '-S' or '-E' with multiple files");
 
   StringArray ld_args = {};
+  Job *jobs = calloc(input_paths.len, sizeof(Job));
+  int njobs = 0;
 
   for (int i = 0; i < input_paths.len; i++) {
     char *input = input_paths.data[i];
@@ -750,42 +1042,52 @@ int main(int argc, char **argv) {
     // Handle .s
     if (type == FILE_ASM) {
       if (!opt_S)
-        assemble(input, output);
+        jobs[njobs++] = (Job){type, input, NULL, output};
       continue;
     }
 
-    assert(type == FILE_C);
+    // Precompile a header
+    if (type == FILE_HEADER && !opt_E && !opt_M) {
+      output = opt_o ? opt_o : format("%s.pch", input);
+      jobs[njobs++] = (Job){type, input, output, NULL};
+      continue;
+    }
+
+    assert(type == FILE_C || type == FILE_HEADER);
 
     // Just preprocess
     if (opt_E || opt_M) {
-      run_cc1(argc, argv, input, NULL);
+      run_cc1(argc, argv, input, NULL, false);
       continue;
     }
 
     // Compile
     if (opt_S) {
-      run_cc1(argc, argv, input, output);
+      jobs[njobs++] = (Job){type, input, output, NULL};
       continue;
     }
 
+    // With the integrated assembler, cc1 writes an object file and no
+    // intermediate assembly file is needed.
+    char *asm_file = opt_integrated_as ? NULL : create_tmpfile();
+
     // Compile and assemble
     if (opt_c) {
-      char *tmp = create_tmpfile();
-      run_cc1(argc, argv, input, tmp);
-      assemble(tmp, output);
+      jobs[njobs++] = (Job){type, input, asm_file, output};
       continue;
     }
 
     // Compile, assemble and link
-    char *tmp1 = create_tmpfile();
     char *tmp2 = create_tmpfile();
-    run_cc1(argc, argv, input, tmp1);
-    assemble(tmp1, tmp2);
+    jobs[njobs++] = (Job){type, input, asm_file, tmp2};
     strarray_push(&ld_args, tmp2);
     continue;
   }
 
+  run_jobs(argc, argv, jobs, njobs);
+
   if (ld_args.len > 0)
     run_linker(&ld_args, opt_o ? opt_o : "a.out");
+  print_time_report("driver", NULL);
   return 0;
 }
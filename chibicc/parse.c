@@ -18,26 +18,44 @@
 
 #include "chibicc.h"
 
+// The symbol table. The declarations of an identifier that are in
+// scope form a stack hanging off its atom, innermost first, so that
+// finding a name does not depend on how deeply scopes are nested.
+// Each declaration is also appended to an undo log, and leaving a
+// scope pops the declarations made since the scope was entered.
+
 // Scope for local variables, global variables, typedefs
 // or enum constants
-typedef struct {
+struct VarScope {
+  VarScope *shadowed; // Outer declaration of the same name
+  int depth;
   Obj *var;
   Type *type_def;
   Type *enum_ty;
   int enum_val;
-} VarScope;
-
-// Represents a block scope.
-typedef struct Scope Scope;
-struct Scope {
-  Scope *next;
+};
 
-  // C has two block scopes; one is for variables/typedefs and
-  // the other is for struct/union/enum tags.
-  HashMap vars;
-  HashMap tags;
+// Scope for struct, union or enum tags
+struct TagScope {
+  TagScope *shadowed;
+  int depth;
+  Type *ty;
 };
 
+// C has two block scopes; one is for variables/typedefs and
+// the other is for struct/union/enum tags.
+typedef struct {
+  Atom *name;
+  bool is_tag;
+} ScopeLog;
+
+static ScopeLog *scope_log;
+static int scope_log_len;
+static int scope_log_cap;
+
+// 0 is the file scope.
+static int scope_depth;
+
 // Variable attributes such as typedef or extern.
 typedef struct {
   bool is_typedef;
@@ -87,11 +105,15 @@ static Obj *locals;
 // Likewise, global variables are accumulated to this list.
 static Obj *globals;
 
-static Scope *scope = &(Scope){};
-
 // Points to the function object the parser is currently parsing.
 static Obj *current_fn;
 
+// True while parsing the initializer of a variable with static storage
+// duration, including a static local variable. Such a variable is
+// emitted whether or not the enclosing function is, and so are the
+// functions it refers to.
+static bool in_static_init;
+
 // Lists of all goto statements and labels in the curent function.
 static Node *gotos;
 static Node *labels;
@@ -161,38 +183,64 @@ static int align_down(int n, int align) {
 }
 
 static void enter_scope(void) {
-  Scope *sc = calloc(1, sizeof(Scope));
-  sc->next = scope;
-  scope = sc;
+  scope_depth++;
 }
 
 static void leave_scope(void) {
-  scope = scope->next;
+  while (scope_log_len > 0) {
+    ScopeLog *log = &scope_log[scope_log_len - 1];
+    if (log->is_tag) {
+      if (log->name->tag->depth != scope_depth)
+        break;
+      log->name->tag = log->name->tag->shadowed;
+    } else {
+      if (log->name->var->depth != scope_depth)
+        break;
+      log->name->var = log->name->var->shadowed;
+    }
+    scope_log_len--;
+  }
+  scope_depth--;
+}
+
+static void log_scope(Atom *name, bool is_tag) {
+  if (scope_log_len == scope_log_cap) {
+    scope_log_cap = scope_log_cap ? scope_log_cap * 2 : 256;
+    scope_log = realloc(scope_log, sizeof(ScopeLog) * scope_log_cap);
+  }
+  scope_log[scope_log_len++] = (ScopeLog){name, is_tag};
 }
 
 // Find a variable by name.
 static VarScope *find_var(Token *tok) {
-  for (Scope *sc = scope; sc; sc = sc->next) {
-    VarScope *sc2 = hashmap_get2(&sc->vars, tok->loc, tok->len);
-    if (sc2)
-      return sc2;
-  }
-  return NULL;
+  return tok->atom->var;
 }
 
 static Type *find_tag(Token *tok) {
-  for (Scope *sc = scope; sc; sc = sc->next) {
-    Type *ty = hashmap_get2(&sc->tags, tok->loc, tok->len);
-    if (ty)
-      return ty;
-  }
-  return NULL;
+  TagScope *sc = tok->atom->tag;
+  return sc ? sc->ty : NULL;
+}
+
+static NodeExt *new_node_ext(void) {
+  return arena_alloc(MEM_NODE_EXT, sizeof(NodeExt));
 }
 
 static Node *new_node(NodeKind kind, Token *tok) {
-  Node *node = calloc(1, sizeof(Node));
+  Node *node = arena_alloc(MEM_NODE, sizeof(Node));
   node->kind = kind;
   node->tok = tok;
+
+  switch (kind) {
+  case ND_FUNCALL:
+  case ND_GOTO:
+  case ND_LABEL:
+  case ND_LABEL_VAL:
+  case ND_SWITCH:
+  case ND_CASE:
+  case ND_ASM:
+  case ND_CAS:
+    node->ext = new_node_ext();
+  }
   return node;
 }
 
@@ -244,7 +292,7 @@ static Node *new_vla_ptr(Obj *var, Token *tok) {
 Node *new_cast(Node *expr, Type *ty) {
   add_type(expr);
 
-  Node *node = calloc(1, sizeof(Node));
+  Node *node = arena_alloc(MEM_NODE, sizeof(Node));
   node->kind = ND_CAST;
   node->tok = expr->tok;
   node->lhs = expr;
@@ -253,13 +301,17 @@ Node *new_cast(Node *expr, Type *ty) {
 }
 
 static VarScope *push_scope(char *name) {
-  VarScope *sc = calloc(1, sizeof(VarScope));
-  hashmap_put(&scope->vars, name, sc);
+  Atom *atom = intern(name, strlen(name));
+  VarScope *sc = arena_alloc(MEM_SCOPE, sizeof(VarScope));
+  sc->shadowed = atom->var;
+  sc->depth = scope_depth;
+  atom->var = sc;
+  log_scope(atom, false);
   return sc;
 }
 
 static Initializer *new_initializer(Type *ty, bool is_flexible) {
-  Initializer *init = calloc(1, sizeof(Initializer));
+  Initializer *init = arena_alloc(MEM_INITIALIZER, sizeof(Initializer));
   init->ty = ty;
 
   if (ty->kind == TY_ARRAY) {
@@ -284,7 +336,7 @@ static Initializer *new_initializer(Type *ty, bool is_flexible) {
 
     for (Member *mem = ty->members; mem; mem = mem->next) {
       if (is_flexible && ty->is_flexible && !mem->next) {
-        Initializer *child = calloc(1, sizeof(Initializer));
+        Initializer *child = arena_alloc(MEM_INITIALIZER, sizeof(Initializer));
         child->ty = mem->ty;
         child->is_flexible = true;
         init->children[mem->idx] = child;
@@ -299,7 +351,7 @@ static Initializer *new_initializer(Type *ty, bool is_flexible) {
 }
 
 static Obj *new_var(char *name, Type *ty) {
-  Obj *var = calloc(1, sizeof(Obj));
+  Obj *var = arena_alloc(MEM_OBJ, sizeof(Obj));
   var->name = name;
   var->ty = ty;
   var->align = ty->align;
@@ -342,7 +394,7 @@ static Obj *new_string_literal(char *p, Type *ty) {
 static char *get_ident(Token *tok) {
   if (tok->kind != TK_IDENT)
     error_tok(tok, "expected an identifier");
-  return strndup(tok->loc, tok->len);
+  return tok->atom->name;
 }
 
 static Type *find_typedef(Token *tok) {
@@ -355,7 +407,12 @@ static Type *find_typedef(Token *tok) {
 }
 
 static void push_tag_scope(Token *tok, Type *ty) {
-  hashmap_put2(&scope->tags, tok->loc, tok->len, ty);
+  TagScope *sc = arena_alloc(MEM_SCOPE, sizeof(TagScope));
+  sc->shadowed = tok->atom->tag;
+  sc->depth = scope_depth;
+  sc->ty = ty;
+  tok->atom->tag = sc;
+  log_scope(tok->atom, true);
 }
 
 // declspec = ("void" | "_Bool" | "char" | "short" | "int" | "long"
@@ -400,21 +457,22 @@ static Type *declspec(Token **rest, Token *tok, VarAttr *attr) {
   Type *ty = ty_int;
   int counter = 0;
   bool is_atomic = false;
+  bool is_volatile = false;
 
   while (is_typename(tok)) {
     // Handle storage class specifiers.
-    if (equal(tok, "typedef") || equal(tok, "static") || equal(tok, "extern") ||
-        equal(tok, "inline") || equal(tok, "_Thread_local") || equal(tok, "__thread")) {
+    if (equal(tok, KW_TYPEDEF) || equal(tok, KW_STATIC) || equal(tok, KW_EXTERN) ||
+        equal(tok, ID_INLINE) || equal(tok, KW__THREAD_LOCAL) || equal(tok, KW___THREAD)) {
       if (!attr)
         error_tok(tok, "storage class specifier is not allowed in this context");
 
-      if (equal(tok, "typedef"))
+      if (equal(tok, KW_TYPEDEF))
         attr->is_typedef = true;
-      else if (equal(tok, "static"))
+      else if (equal(tok, KW_STATIC))
         attr->is_static = true;
-      else if (equal(tok, "extern"))
+      else if (equal(tok, KW_EXTERN))
         attr->is_extern = true;
-      else if (equal(tok, "inline"))
+      else if (equal(tok, ID_INLINE))
         attr->is_inline = true;
       else
         attr->is_tls = true;
@@ -427,50 +485,54 @@ static Type *declspec(Token **rest, Token *tok, VarAttr *attr) {
       continue;
     }
 
+    if (consume(&tok, tok, KW_VOLATILE)) {
+      is_volatile = true;
+      continue;
+    }
+
     // These keywords are recognized but ignored.
-    if (consume(&tok, tok, "const") || consume(&tok, tok, "volatile") ||
-        consume(&tok, tok, "auto") || consume(&tok, tok, "register") ||
-        consume(&tok, tok, "restrict") || consume(&tok, tok, "__restrict") ||
-        consume(&tok, tok, "__restrict__") || consume(&tok, tok, "_Noreturn"))
+    if (consume(&tok, tok, KW_CONST) || consume(&tok, tok, KW_AUTO) || consume(&tok, tok, KW_REGISTER) ||
+        consume(&tok, tok, KW_RESTRICT) || consume(&tok, tok, KW___RESTRICT) ||
+        consume(&tok, tok, KW___RESTRICT__) || consume(&tok, tok, KW__NORETURN))
       continue;
 
-    if (equal(tok, "_Atomic")) {
+    if (equal(tok, KW__ATOMIC)) {
       tok = tok->next;
-      if (equal(tok , "(")) {
+      if (equal(tok , P_LPAREN)) {
         ty = typename(&tok, tok->next);
-        tok = skip(tok, ")");
+        tok = skip(tok, P_RPAREN);
       }
       is_atomic = true;
       continue;
     }
 
-    if (equal(tok, "_Alignas")) {
+    if (equal(tok, KW__ALIGNAS)) {
       if (!attr)
         error_tok(tok, "_Alignas is not allowed in this context");
-      tok = skip(tok->next, "(");
+      tok = skip(tok->next, P_LPAREN);
 
       if (is_typename(tok))
         attr->align = typename(&tok, tok)->align;
       else
         attr->align = const_expr(&tok, tok);
-      tok = skip(tok, ")");
+      tok = skip(tok, P_RPAREN);
       continue;
     }
 
     // Handle user-defined types.
     Type *ty2 = find_typedef(tok);
-    if (equal(tok, "struct") || equal(tok, "union") || equal(tok, "enum") ||
-        equal(tok, "typeof") || ty2) {
+    if (equal(tok, KW_STRUCT) || equal(tok, KW_UNION) || equal(tok, KW_ENUM) ||
+        equal(tok, KW_TYPEOF) || ty2) {
       if (counter)
         break;
 
-      if (equal(tok, "struct")) {
+      if (equal(tok, KW_STRUCT)) {
         ty = struct_decl(&tok, tok->next);
-      } else if (equal(tok, "union")) {
+      } else if (equal(tok, KW_UNION)) {
         ty = union_decl(&tok, tok->next);
-      } else if (equal(tok, "enum")) {
+      } else if (equal(tok, KW_ENUM)) {
         ty = enum_specifier(&tok, tok->next);
-      } else if (equal(tok, "typeof")) {
+      } else if (equal(tok, KW_TYPEOF)) {
         ty = typeof_specifier(&tok, tok->next);
       } else {
         ty = ty2;
@@ -482,25 +544,25 @@ static Type *declspec(Token **rest, Token *tok, VarAttr *attr) {
     }
 
     // Handle built-in types.
-    if (equal(tok, "void"))
+    if (equal(tok, KW_VOID))
       counter += VOID;
-    else if (equal(tok, "_Bool"))
+    else if (equal(tok, KW__BOOL))
       counter += BOOL;
-    else if (equal(tok, "char"))
+    else if (equal(tok, KW_CHAR))
       counter += CHAR;
-    else if (equal(tok, "short"))
+    else if (equal(tok, KW_SHORT))
       counter += SHORT;
-    else if (equal(tok, "int"))
+    else if (equal(tok, KW_INT))
       counter += INT;
-    else if (equal(tok, "long"))
+    else if (equal(tok, KW_LONG))
       counter += LONG;
-    else if (equal(tok, "float"))
+    else if (equal(tok, KW_FLOAT))
       counter += FLOAT;
-    else if (equal(tok, "double"))
+    else if (equal(tok, KW_DOUBLE))
       counter += DOUBLE;
-    else if (equal(tok, "signed"))
+    else if (equal(tok, KW_SIGNED))
       counter |= SIGNED;
-    else if (equal(tok, "unsigned"))
+    else if (equal(tok, KW_UNSIGNED))
       counter |= UNSIGNED;
     else
       unreachable();
@@ -570,9 +632,15 @@ static Type *declspec(Token **rest, Token *tok, VarAttr *attr) {
     tok = tok->next;
   }
 
-  if (is_atomic) {
+  // An incomplete struct is completed in place later, which a copy
+  // would miss, so it doesn't get the volatile qualifier.
+  if ((ty->kind == TY_STRUCT || ty->kind == TY_UNION) && ty->size < 0)
+    is_volatile = false;
+
+  if (is_atomic || is_volatile) {
     ty = copy_type(ty);
-    ty->is_atomic = true;
+    ty->is_atomic |= is_atomic;
+    ty->is_volatile |= is_volatile;
   }
 
   *rest = tok;
@@ -582,7 +650,7 @@ static Type *declspec(Token **rest, Token *tok, VarAttr *attr) {
 // func-params = ("void" | param ("," param)* ("," "...")?)? ")"
 // param       = declspec declarator
 static Type *func_params(Token **rest, Token *tok, Type *ty) {
-  if (equal(tok, "void") && equal(tok->next, ")")) {
+  if (equal(tok, KW_VOID) && equal(tok->next, P_RPAREN)) {
     *rest = tok->next->next;
     return func_type(ty);
   }
@@ -591,14 +659,14 @@ static Type *func_params(Token **rest, Token *tok, Type *ty) {
   Type *cur = &head;
   bool is_variadic = false;
 
-  while (!equal(tok, ")")) {
+  while (!equal(tok, P_RPAREN)) {
     if (cur != &head)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
 
-    if (equal(tok, "...")) {
+    if (equal(tok, P_ELLIPSIS)) {
       is_variadic = true;
       tok = tok->next;
-      skip(tok, ")");
+      skip(tok, P_RPAREN);
       break;
     }
 
@@ -634,16 +702,16 @@ static Type *func_params(Token **rest, Token *tok, Type *ty) {
 
 // array-dimensions = ("static" | "restrict")* const-expr? "]" type-suffix
 static Type *array_dimensions(Token **rest, Token *tok, Type *ty) {
-  while (equal(tok, "static") || equal(tok, "restrict"))
+  while (equal(tok, KW_STATIC) || equal(tok, KW_RESTRICT))
     tok = tok->next;
 
-  if (equal(tok, "]")) {
+  if (equal(tok, P_RBRACKET)) {
     ty = type_suffix(rest, tok->next, ty);
     return array_of(ty, -1);
   }
 
   Node *expr = conditional(&tok, tok);
-  tok = skip(tok, "]");
+  tok = skip(tok, P_RBRACKET);
   ty = type_suffix(rest, tok, ty);
 
   if (ty->kind == TY_VLA || !is_const_expr(expr))
@@ -655,10 +723,10 @@ static Type *array_dimensions(Token **rest, Token *tok, Type *ty) {
 //             | "[" array-dimensions
 //             | ε
 static Type *type_suffix(Token **rest, Token *tok, Type *ty) {
-  if (equal(tok, "("))
+  if (equal(tok, P_LPAREN))
     return func_params(rest, tok->next, ty);
 
-  if (equal(tok, "["))
+  if (equal(tok, P_LBRACKET))
     return array_dimensions(rest, tok->next, ty);
 
   *rest = tok;
@@ -667,11 +735,14 @@ static Type *type_suffix(Token **rest, Token *tok, Type *ty) {
 
 // pointers = ("*" ("const" | "volatile" | "restrict")*)*
 static Type *pointers(Token **rest, Token *tok, Type *ty) {
-  while (consume(&tok, tok, "*")) {
+  while (consume(&tok, tok, P_STAR)) {
     ty = pointer_to(ty);
-    while (equal(tok, "const") || equal(tok, "volatile") || equal(tok, "restrict") ||
-           equal(tok, "__restrict") || equal(tok, "__restrict__"))
+    while (equal(tok, KW_CONST) || equal(tok, KW_VOLATILE) || equal(tok, KW_RESTRICT) ||
+           equal(tok, KW___RESTRICT) || equal(tok, KW___RESTRICT__)) {
+      if (equal(tok, KW_VOLATILE))
+        ty->is_volatile = true;
       tok = tok->next;
+    }
   }
   *rest = tok;
   return ty;
@@ -681,11 +752,11 @@ static Type *pointers(Token **rest, Token *tok, Type *ty) {
 static Type *declarator(Token **rest, Token *tok, Type *ty) {
   ty = pointers(&tok, tok, ty);
 
-  if (equal(tok, "(")) {
+  if (equal(tok, P_LPAREN)) {
     Token *start = tok;
     Type dummy = {};
     declarator(&tok, start->next, &dummy);
-    tok = skip(tok, ")");
+    tok = skip(tok, P_RPAREN);
     ty = type_suffix(rest, tok, ty);
     return declarator(&tok, start->next, ty);
   }
@@ -708,11 +779,11 @@ static Type *declarator(Token **rest, Token *tok, Type *ty) {
 static Type *abstract_declarator(Token **rest, Token *tok, Type *ty) {
   ty = pointers(&tok, tok, ty);
 
-  if (equal(tok, "(")) {
+  if (equal(tok, P_LPAREN)) {
     Token *start = tok;
     Type dummy = {};
     abstract_declarator(&tok, start->next, &dummy);
-    tok = skip(tok, ")");
+    tok = skip(tok, P_RPAREN);
     ty = type_suffix(rest, tok, ty);
     return abstract_declarator(&tok, start->next, ty);
   }
@@ -727,16 +798,16 @@ static Type *typename(Token **rest, Token *tok) {
 }
 
 static bool is_end(Token *tok) {
-  return equal(tok, "}") || (equal(tok, ",") && equal(tok->next, "}"));
+  return equal(tok, P_RBRACE) || (equal(tok, P_COMMA) && equal(tok->next, P_RBRACE));
 }
 
 static bool consume_end(Token **rest, Token *tok) {
-  if (equal(tok, "}")) {
+  if (equal(tok, P_RBRACE)) {
     *rest = tok->next;
     return true;
   }
 
-  if (equal(tok, ",") && equal(tok->next, "}")) {
+  if (equal(tok, P_COMMA) && equal(tok->next, P_RBRACE)) {
     *rest = tok->next->next;
     return true;
   }
@@ -758,7 +829,7 @@ static Type *enum_specifier(Token **rest, Token *tok) {
     tok = tok->next;
   }
 
-  if (tag && !equal(tok, "{")) {
+  if (tag && !equal(tok, P_LBRACE)) {
     Type *ty = find_tag(tag);
     if (!ty)
       error_tok(tag, "unknown enum type");
@@ -768,19 +839,19 @@ static Type *enum_specifier(Token **rest, Token *tok) {
     return ty;
   }
 
-  tok = skip(tok, "{");
+  tok = skip(tok, P_LBRACE);
 
   // Read an enum-list.
   int i = 0;
   int val = 0;
   while (!consume_end(rest, tok)) {
     if (i++ > 0)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
 
     char *name = get_ident(tok);
     tok = tok->next;
 
-    if (equal(tok, "="))
+    if (equal(tok, P_ASSIGN))
       val = const_expr(&tok, tok->next);
 
     VarScope *sc = push_scope(name);
@@ -795,7 +866,7 @@ static Type *enum_specifier(Token **rest, Token *tok) {
 
 // typeof-specifier = "(" (expr | typename) ")"
 static Type *typeof_specifier(Token **rest, Token *tok) {
-  tok = skip(tok, "(");
+  tok = skip(tok, P_LPAREN);
 
   Type *ty;
   if (is_typename(tok)) {
@@ -805,7 +876,7 @@ static Type *typeof_specifier(Token **rest, Token *tok) {
     add_type(node);
     ty = node->ty;
   }
-  *rest = skip(tok, ")");
+  *rest = skip(tok, P_RPAREN);
   return ty;
 }
 
@@ -833,9 +904,9 @@ static Node *compute_vla_size(Type *ty, Token *tok) {
 
 static Node *new_alloca(Node *sz) {
   Node *node = new_unary(ND_FUNCALL, new_var_node(builtin_alloca, sz->tok), sz->tok);
-  node->func_ty = builtin_alloca->ty;
+  node->ext->func_ty = builtin_alloca->ty;
   node->ty = builtin_alloca->ty->return_ty;
-  node->args = sz;
+  node->ext->args = sz;
   add_type(sz);
   return node;
 }
@@ -846,9 +917,9 @@ static Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr)
   Node *cur = &head;
   int i = 0;
 
-  while (!equal(tok, ";")) {
+  while (!equal(tok, P_SEMICOLON)) {
     if (i++ > 0)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
 
     Type *ty = declarator(&tok, tok, basety);
     if (ty->kind == TY_VOID)
@@ -860,7 +931,7 @@ static Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr)
       // static local variable
       Obj *var = new_anon_gvar(ty);
       push_scope(get_ident(ty->name))->var = var;
-      if (equal(tok, "="))
+      if (equal(tok, P_ASSIGN))
         gvar_initializer(&tok, tok->next, var);
       continue;
     }
@@ -871,7 +942,7 @@ static Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr)
     cur = cur->next = new_unary(ND_EXPR_STMT, compute_vla_size(ty, tok), tok);
 
     if (ty->kind == TY_VLA) {
-      if (equal(tok, "="))
+      if (equal(tok, P_ASSIGN))
         error_tok(tok, "variable-sized object may not be initialized");
 
       // Variable length arrays (VLAs) are translated to alloca() calls.
@@ -891,7 +962,11 @@ static Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr)
     if (attr && attr->align)
       var->align = attr->align;
 
-    if (equal(tok, "=")) {
+    // Remember where the variable's scope begins, so that codegen can
+    // tell whether a value may be carried across loop iterations.
+    cur->var = var;
+
+    if (equal(tok, P_ASSIGN)) {
       Node *expr = lvar_initializer(&tok, tok->next, var);
       cur = cur->next = new_unary(ND_EXPR_STMT, expr, tok);
     }
@@ -909,9 +984,9 @@ static Node *declaration(Token **rest, Token *tok, Type *basety, VarAttr *attr)
 }
 
 static Token *skip_excess_element(Token *tok) {
-  if (equal(tok, "{")) {
+  if (equal(tok, P_LBRACE)) {
     tok = skip_excess_element(tok->next);
-    return skip(tok, "}");
+    return skip(tok, P_RBRACE);
   }
 
   assign(&tok, tok);
@@ -981,7 +1056,7 @@ static void array_designator(Token **rest, Token *tok, Type *ty, int *begin, int
   if (*begin >= ty->array_len)
     error_tok(tok, "array designator index exceeds array bounds");
 
-  if (equal(tok, "...")) {
+  if (equal(tok, P_ELLIPSIS)) {
     *end = const_expr(&tok, tok->next);
     if (*end >= ty->array_len)
       error_tok(tok, "array designator index exceeds array bounds");
@@ -991,13 +1066,13 @@ static void array_designator(Token **rest, Token *tok, Type *ty, int *begin, int
     *end = *begin;
   }
 
-  *rest = skip(tok, "]");
+  *rest = skip(tok, P_RBRACKET);
 }
 
 // struct-designator = "." ident
 static Member *struct_designator(Token **rest, Token *tok, Type *ty) {
   Token *start = tok;
-  tok = skip(tok, ".");
+  tok = skip(tok, P_DOT);
   if (tok->kind != TK_IDENT)
     error_tok(tok, "expected a field designator");
 
@@ -1012,7 +1087,7 @@ static Member *struct_designator(Token **rest, Token *tok, Type *ty) {
     }
 
     // Regular struct member
-    if (mem->name->len == tok->len && !strncmp(mem->name->loc, tok->loc, tok->len)) {
+    if (mem->name->atom == tok->atom) {
       *rest = tok->next;
       return mem;
     }
@@ -1023,7 +1098,7 @@ static Member *struct_designator(Token **rest, Token *tok, Type *ty) {
 
 // designation = ("[" const-expr "]" | "." ident)* "="? initializer
 static void designation(Token **rest, Token *tok, Initializer *init) {
-  if (equal(tok, "[")) {
+  if (equal(tok, P_LBRACKET)) {
     if (init->ty->kind != TY_ARRAY)
       error_tok(tok, "array index in non-array initializer");
 
@@ -1037,7 +1112,7 @@ static void designation(Token **rest, Token *tok, Initializer *init) {
     return;
   }
 
-  if (equal(tok, ".") && init->ty->kind == TY_STRUCT) {
+  if (equal(tok, P_DOT) && init->ty->kind == TY_STRUCT) {
     Member *mem = struct_designator(&tok, tok, init->ty);
     designation(&tok, tok, init->children[mem->idx]);
     init->expr = NULL;
@@ -1045,17 +1120,17 @@ static void designation(Token **rest, Token *tok, Initializer *init) {
     return;
   }
 
-  if (equal(tok, ".") && init->ty->kind == TY_UNION) {
+  if (equal(tok, P_DOT) && init->ty->kind == TY_UNION) {
     Member *mem = struct_designator(&tok, tok, init->ty);
     init->mem = mem;
     designation(rest, tok, init->children[mem->idx]);
     return;
   }
 
-  if (equal(tok, "."))
+  if (equal(tok, P_DOT))
     error_tok(tok, "field name not in struct or union initializer");
 
-  if (equal(tok, "="))
+  if (equal(tok, P_ASSIGN))
     tok = tok->next;
   initializer2(rest, tok, init);
 }
@@ -1071,14 +1146,14 @@ static int count_array_init_elements(Token *tok, Type *ty) {
 
   while (!consume_end(&tok, tok)) {
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
     first = false;
 
-    if (equal(tok, "[")) {
+    if (equal(tok, P_LBRACKET)) {
       i = const_expr(&tok, tok->next);
-      if (equal(tok, "..."))
+      if (equal(tok, P_ELLIPSIS))
         i = const_expr(&tok, tok->next);
-      tok = skip(tok, "]");
+      tok = skip(tok, P_RBRACKET);
       designation(&tok, tok, dummy);
     } else {
       initializer2(&tok, tok, dummy);
@@ -1092,7 +1167,7 @@ static int count_array_init_elements(Token *tok, Type *ty) {
 
 // array-initializer1 = "{" initializer ("," initializer)* ","? "}"
 static void array_initializer1(Token **rest, Token *tok, Initializer *init) {
-  tok = skip(tok, "{");
+  tok = skip(tok, P_LBRACE);
 
   if (init->is_flexible) {
     int len = count_array_init_elements(tok, init->ty);
@@ -1108,10 +1183,10 @@ static void array_initializer1(Token **rest, Token *tok, Initializer *init) {
 
   for (int i = 0; !consume_end(rest, tok); i++) {
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
     first = false;
 
-    if (equal(tok, "[")) {
+    if (equal(tok, P_LBRACKET)) {
       int begin, end;
       array_designator(&tok, tok, init->ty, &begin, &end);
 
@@ -1140,9 +1215,9 @@ static void array_initializer2(Token **rest, Token *tok, Initializer *init, int
   for (; i < init->ty->array_len && !is_end(tok); i++) {
     Token *start = tok;
     if (i > 0)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
 
-    if (equal(tok, "[") || equal(tok, ".")) {
+    if (equal(tok, P_LBRACKET) || equal(tok, P_DOT)) {
       *rest = start;
       return;
     }
@@ -1154,17 +1229,17 @@ static void array_initializer2(Token **rest, Token *tok, Initializer *init, int
 
 // struct-initializer1 = "{" initializer ("," initializer)* ","? "}"
 static void struct_initializer1(Token **rest, Token *tok, Initializer *init) {
-  tok = skip(tok, "{");
+  tok = skip(tok, P_LBRACE);
 
   Member *mem = init->ty->members;
   bool first = true;
 
   while (!consume_end(rest, tok)) {
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
     first = false;
 
-    if (equal(tok, ".")) {
+    if (equal(tok, P_DOT)) {
       mem = struct_designator(&tok, tok, init->ty);
       designation(&tok, tok, init->children[mem->idx]);
       mem = mem->next;
@@ -1188,10 +1263,10 @@ static void struct_initializer2(Token **rest, Token *tok, Initializer *init, Mem
     Token *start = tok;
 
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
     first = false;
 
-    if (equal(tok, "[") || equal(tok, ".")) {
+    if (equal(tok, P_LBRACKET) || equal(tok, P_DOT)) {
       *rest = start;
       return;
     }
@@ -1205,20 +1280,20 @@ static void union_initializer(Token **rest, Token *tok, Initializer *init) {
   // Unlike structs, union initializers take only one initializer,
   // and that initializes the first union member by default.
   // You can initialize other member using a designated initializer.
-  if (equal(tok, "{") && equal(tok->next, ".")) {
+  if (equal(tok, P_LBRACE) && equal(tok->next, P_DOT)) {
     Member *mem = struct_designator(&tok, tok->next, init->ty);
     init->mem = mem;
     designation(&tok, tok, init->children[mem->idx]);
-    *rest = skip(tok, "}");
+    *rest = skip(tok, P_RBRACE);
     return;
   }
 
   init->mem = init->ty->members;
 
-  if (equal(tok, "{")) {
+  if (equal(tok, P_LBRACE)) {
     initializer2(&tok, tok->next, init->children[0]);
-    consume(&tok, tok, ",");
-    *rest = skip(tok, "}");
+    consume(&tok, tok, P_COMMA);
+    *rest = skip(tok, P_RBRACE);
   } else {
     initializer2(rest, tok, init->children[0]);
   }
@@ -1234,7 +1309,7 @@ static void initializer2(Token **rest, Token *tok, Initializer *init) {
   }
 
   if (init->ty->kind == TY_ARRAY) {
-    if (equal(tok, "{"))
+    if (equal(tok, P_LBRACE))
       array_initializer1(rest, tok, init);
     else
       array_initializer2(rest, tok, init, 0);
@@ -1242,7 +1317,7 @@ static void initializer2(Token **rest, Token *tok, Initializer *init) {
   }
 
   if (init->ty->kind == TY_STRUCT) {
-    if (equal(tok, "{")) {
+    if (equal(tok, P_LBRACE)) {
       struct_initializer1(rest, tok, init);
       return;
     }
@@ -1266,11 +1341,11 @@ static void initializer2(Token **rest, Token *tok, Initializer *init) {
     return;
   }
 
-  if (equal(tok, "{")) {
+  if (equal(tok, P_LBRACE)) {
     // An initializer for a scalar variable can be surrounded by
     // braces. E.g. `int x = {3};`. Handle that case.
     initializer2(&tok, tok->next, init);
-    *rest = skip(tok, "}");
+    *rest = skip(tok, P_RBRACE);
     return;
   }
 
@@ -1283,7 +1358,7 @@ static Type *copy_struct_type(Type *ty) {
   Member head = {};
   Member *cur = &head;
   for (Member *mem = ty->members; mem; mem = mem->next) {
-    Member *m = calloc(1, sizeof(Member));
+    Member *m = arena_alloc(MEM_MEMBER, sizeof(Member));
     *m = *mem;
     cur = cur->next = m;
   }
@@ -1484,7 +1559,10 @@ write_gvar_data(Relocation *cur, Initializer *init, Type *ty, char *buf, int off
 // objects to a flat byte array. It is a compile error if an
 // initializer list contains a non-constant expression.
 static void gvar_initializer(Token **rest, Token *tok, Obj *var) {
+  bool saved = in_static_init;
+  in_static_init = true;
   Initializer *init = initializer(rest, tok, var->ty, &var->ty);
+  in_static_init = saved;
 
   Relocation head = {};
   char *buf = calloc(1, var->ty->size);
@@ -1495,22 +1573,18 @@ static void gvar_initializer(Token **rest, Token *tok, Obj *var) {
 
 // Returns true if a given token represents a type.
 static bool is_typename(Token *tok) {
-  static HashMap map;
-
-  if (map.capacity == 0) {
-    static char *kw[] = {
-      "void", "_Bool", "char", "short", "int", "long", "struct", "union",
-      "typedef", "enum", "static", "extern", "_Alignas", "signed", "unsigned",
-      "const", "volatile", "auto", "register", "restrict", "__restrict",
-      "__restrict__", "_Noreturn", "float", "double", "typeof", "inline",
-      "_Thread_local", "__thread", "_Atomic",
-    };
-
-    for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-      hashmap_put(&map, kw[i], (void *)1);
+  switch (tok->atom->id) {
+  case KW_VOID: case KW__BOOL: case KW_CHAR: case KW_SHORT: case KW_INT:
+  case KW_LONG: case KW_STRUCT: case KW_UNION: case KW_TYPEDEF:
+  case KW_ENUM: case KW_STATIC: case KW_EXTERN: case KW__ALIGNAS:
+  case KW_SIGNED: case KW_UNSIGNED: case KW_CONST: case KW_VOLATILE:
+  case KW_AUTO: case KW_REGISTER: case KW_RESTRICT: case KW___RESTRICT:
+  case KW___RESTRICT__: case KW__NORETURN: case KW_FLOAT: case KW_DOUBLE:
+  case KW_TYPEOF: case ID_INLINE: case KW__THREAD_LOCAL: case KW___THREAD:
+  case KW__ATOMIC:
+    return true;
   }
-
-  return hashmap_get2(&map, tok->loc, tok->len) || find_typedef(tok);
+  return find_typedef(tok);
 }
 
 // asm-stmt = "asm" ("volatile" | "inline")* "(" string-literal ")"
@@ -1518,14 +1592,14 @@ static Node *asm_stmt(Token **rest, Token *tok) {
   Node *node = new_node(ND_ASM, tok);
   tok = tok->next;
 
-  while (equal(tok, "volatile") || equal(tok, "inline"))
+  while (equal(tok, KW_VOLATILE) || equal(tok, ID_INLINE))
     tok = tok->next;
 
-  tok = skip(tok, "(");
+  tok = skip(tok, P_LPAREN);
   if (tok->kind != TK_STR || tok->ty->base->kind != TY_CHAR)
     error_tok(tok, "expected string literal");
-  node->asm_str = tok->str;
-  *rest = skip(tok->next, ")");
+  node->ext->asm_str = tok->str;
+  *rest = skip(tok->next, P_RPAREN);
   return node;
 }
 
@@ -1545,13 +1619,13 @@ static Node *asm_stmt(Token **rest, Token *tok) {
 //      | "{" compound-stmt
 //      | expr-stmt
 static Node *stmt(Token **rest, Token *tok) {
-  if (equal(tok, "return")) {
+  if (equal(tok, KW_RETURN)) {
     Node *node = new_node(ND_RETURN, tok);
-    if (consume(rest, tok->next, ";"))
+    if (consume(rest, tok->next, P_SEMICOLON))
       return node;
 
     Node *exp = expr(&tok, tok->next);
-    *rest = skip(tok, ";");
+    *rest = skip(tok, P_SEMICOLON);
 
     add_type(exp);
     Type *ty = current_fn->ty->return_ty;
@@ -1562,23 +1636,23 @@ static Node *stmt(Token **rest, Token *tok) {
     return node;
   }
 
-  if (equal(tok, "if")) {
+  if (equal(tok, KW_IF)) {
     Node *node = new_node(ND_IF, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, P_LPAREN);
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip(tok, P_RPAREN);
     node->then = stmt(&tok, tok);
-    if (equal(tok, "else"))
+    if (equal(tok, KW_ELSE))
       node->els = stmt(&tok, tok->next);
     *rest = tok;
     return node;
   }
 
-  if (equal(tok, "switch")) {
+  if (equal(tok, KW_SWITCH)) {
     Node *node = new_node(ND_SWITCH, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, P_LPAREN);
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip(tok, P_RPAREN);
 
     Node *sw = current_switch;
     current_switch = node;
@@ -1593,7 +1667,7 @@ static Node *stmt(Token **rest, Token *tok) {
     return node;
   }
 
-  if (equal(tok, "case")) {
+  if (equal(tok, KW_CASE)) {
     if (!current_switch)
       error_tok(tok, "stray case");
 
@@ -1601,7 +1675,7 @@ static Node *stmt(Token **rest, Token *tok) {
     int begin = const_expr(&tok, tok->next);
     int end;
 
-    if (equal(tok, "...")) {
+    if (equal(tok, P_ELLIPSIS)) {
       // [GNU] Case ranges, e.g. "case 1 ... 5:"
       end = const_expr(&tok, tok->next);
       if (end < begin)
@@ -1610,31 +1684,31 @@ static Node *stmt(Token **rest, Token *tok) {
       end = begin;
     }
 
-    tok = skip(tok, ":");
-    node->label = new_unique_name();
+    tok = skip(tok, P_COLON);
+    node->ext->label = new_unique_name();
     node->lhs = stmt(rest, tok);
-    node->begin = begin;
-    node->end = end;
-    node->case_next = current_switch->case_next;
-    current_switch->case_next = node;
+    node->ext->begin = begin;
+    node->ext->end = end;
+    node->ext->case_next = current_switch->ext->case_next;
+    current_switch->ext->case_next = node;
     return node;
   }
 
-  if (equal(tok, "default")) {
+  if (equal(tok, KW_DEFAULT)) {
     if (!current_switch)
       error_tok(tok, "stray default");
 
     Node *node = new_node(ND_CASE, tok);
-    tok = skip(tok->next, ":");
-    node->label = new_unique_name();
+    tok = skip(tok->next, P_COLON);
+    node->ext->label = new_unique_name();
     node->lhs = stmt(rest, tok);
-    current_switch->default_case = node;
+    current_switch->ext->default_case = node;
     return node;
   }
 
-  if (equal(tok, "for")) {
+  if (equal(tok, KW_FOR)) {
     Node *node = new_node(ND_FOR, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, P_LPAREN);
 
     enter_scope();
 
@@ -1650,13 +1724,13 @@ static Node *stmt(Token **rest, Token *tok) {
       node->init = expr_stmt(&tok, tok);
     }
 
-    if (!equal(tok, ";"))
+    if (!equal(tok, P_SEMICOLON))
       node->cond = expr(&tok, tok);
-    tok = skip(tok, ";");
+    tok = skip(tok, P_SEMICOLON);
 
-    if (!equal(tok, ")"))
+    if (!equal(tok, P_RPAREN))
       node->inc = expr(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip(tok, P_RPAREN);
 
     node->then = stmt(rest, tok);
 
@@ -1666,11 +1740,11 @@ static Node *stmt(Token **rest, Token *tok) {
     return node;
   }
 
-  if (equal(tok, "while")) {
+  if (equal(tok, KW_WHILE)) {
     Node *node = new_node(ND_FOR, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, P_LPAREN);
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip(tok, P_RPAREN);
 
     char *brk = brk_label;
     char *cont = cont_label;
@@ -1684,7 +1758,7 @@ static Node *stmt(Token **rest, Token *tok) {
     return node;
   }
 
-  if (equal(tok, "do")) {
+  if (equal(tok, KW_DO)) {
     Node *node = new_node(ND_DO, tok);
 
     char *brk = brk_label;
@@ -1697,63 +1771,63 @@ static Node *stmt(Token **rest, Token *tok) {
     brk_label = brk;
     cont_label = cont;
 
-    tok = skip(tok, "while");
-    tok = skip(tok, "(");
+    tok = skip(tok, KW_WHILE);
+    tok = skip(tok, P_LPAREN);
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
-    *rest = skip(tok, ";");
+    tok = skip(tok, P_RPAREN);
+    *rest = skip(tok, P_SEMICOLON);
     return node;
   }
 
-  if (equal(tok, "asm"))
+  if (equal(tok, KW_ASM))
     return asm_stmt(rest, tok);
 
-  if (equal(tok, "goto")) {
-    if (equal(tok->next, "*")) {
+  if (equal(tok, KW_GOTO)) {
+    if (equal(tok->next, P_STAR)) {
       // [GNU] `goto *ptr` jumps to the address specified by `ptr`.
       Node *node = new_node(ND_GOTO_EXPR, tok);
       node->lhs = expr(&tok, tok->next->next);
-      *rest = skip(tok, ";");
+      *rest = skip(tok, P_SEMICOLON);
       return node;
     }
 
     Node *node = new_node(ND_GOTO, tok);
-    node->label = get_ident(tok->next);
-    node->goto_next = gotos;
+    node->ext->label = get_ident(tok->next);
+    node->ext->goto_next = gotos;
     gotos = node;
-    *rest = skip(tok->next->next, ";");
+    *rest = skip(tok->next->next, P_SEMICOLON);
     return node;
   }
 
-  if (equal(tok, "break")) {
+  if (equal(tok, KW_BREAK)) {
     if (!brk_label)
       error_tok(tok, "stray break");
     Node *node = new_node(ND_GOTO, tok);
-    node->unique_label = brk_label;
-    *rest = skip(tok->next, ";");
+    node->ext->unique_label = brk_label;
+    *rest = skip(tok->next, P_SEMICOLON);
     return node;
   }
 
-  if (equal(tok, "continue")) {
+  if (equal(tok, KW_CONTINUE)) {
     if (!cont_label)
       error_tok(tok, "stray continue");
     Node *node = new_node(ND_GOTO, tok);
-    node->unique_label = cont_label;
-    *rest = skip(tok->next, ";");
+    node->ext->unique_label = cont_label;
+    *rest = skip(tok->next, P_SEMICOLON);
     return node;
   }
 
-  if (tok->kind == TK_IDENT && equal(tok->next, ":")) {
+  if (tok->kind == TK_IDENT && equal(tok->next, P_COLON)) {
     Node *node = new_node(ND_LABEL, tok);
-    node->label = strndup(tok->loc, tok->len);
-    node->unique_label = new_unique_name();
+    node->ext->label = tok->atom->name;
+    node->ext->unique_label = new_unique_name();
     node->lhs = stmt(rest, tok->next->next);
-    node->goto_next = labels;
+    node->ext->goto_next = labels;
     labels = node;
     return node;
   }
 
-  if (equal(tok, "{"))
+  if (equal(tok, P_LBRACE))
     return compound_stmt(rest, tok->next);
 
   return expr_stmt(rest, tok);
@@ -1767,8 +1841,8 @@ static Node *compound_stmt(Token **rest, Token *tok) {
 
   enter_scope();
 
-  while (!equal(tok, "}")) {
-    if (is_typename(tok) && !equal(tok->next, ":")) {
+  while (!equal(tok, P_RBRACE)) {
+    if (is_typename(tok) && !equal(tok->next, P_COLON)) {
       VarAttr attr = {};
       Type *basety = declspec(&tok, tok, &attr);
 
@@ -1803,14 +1877,14 @@ static Node *compound_stmt(Token **rest, Token *tok) {
 
 // expr-stmt = expr? ";"
 static Node *expr_stmt(Token **rest, Token *tok) {
-  if (equal(tok, ";")) {
+  if (equal(tok, P_SEMICOLON)) {
     *rest = tok->next;
     return new_node(ND_BLOCK, tok);
   }
 
   Node *node = new_node(ND_EXPR_STMT, tok);
   node->lhs = expr(&tok, tok);
-  *rest = skip(tok, ";");
+  *rest = skip(tok, P_SEMICOLON);
   return node;
 }
 
@@ -1818,7 +1892,7 @@ static Node *expr_stmt(Token **rest, Token *tok) {
 static Node *expr(Token **rest, Token *tok) {
   Node *node = assign(&tok, tok);
 
-  if (equal(tok, ","))
+  if (equal(tok, P_COMMA))
     return new_binary(ND_COMMA, node, expr(rest, tok->next), tok);
 
   *rest = tok;
@@ -1908,7 +1982,7 @@ static int64_t eval2(Node *node, char ***label) {
   case ND_ADDR:
     return eval_rval(node->lhs, label);
   case ND_LABEL_VAL:
-    *label = &node->unique_label;
+    *label = &node->ext->unique_label;
     return 0;
   case ND_MEMBER:
     if (!label)
@@ -2018,7 +2092,7 @@ static double eval_double(Node *node) {
       return eval_double(node->lhs);
     return eval(node->lhs);
   case ND_NUM:
-    return node->fval;
+    return node->ext->fval;
   }
 
   error_tok(node->tok, "not a compile-time constant");
@@ -2059,6 +2133,12 @@ static Node *to_assign(Node *binary) {
     return new_binary(ND_COMMA, expr1, expr4, tok);
   }
 
+  // If A is a plain non-atomic variable, evaluating it twice has no
+  // side effect, so convert `A op= B` to `A = A op B`. This keeps the
+  // address of A untaken so that codegen can keep A in a register.
+  if (binary->lhs->kind == ND_VAR && !binary->lhs->ty->is_atomic)
+    return new_binary(ND_ASSIGN, new_var_node(binary->lhs->var, tok), binary, tok);
+
   // If A is an atomic type, Convert `A op= B` to
   //
   // ({
@@ -2108,9 +2188,9 @@ static Node *to_assign(Node *binary) {
     loop->then->body = new_unary(ND_EXPR_STMT, body, tok);
 
     Node *cas = new_node(ND_CAS, tok);
-    cas->cas_addr = new_var_node(addr, tok);
-    cas->cas_old = new_unary(ND_ADDR, new_var_node(old, tok), tok);
-    cas->cas_new = new_var_node(new, tok);
+    cas->ext->cas_addr = new_var_node(addr, tok);
+    cas->ext->cas_old = new_unary(ND_ADDR, new_var_node(old, tok), tok);
+    cas->ext->cas_new = new_var_node(new, tok);
     loop->cond = new_unary(ND_NOT, cas, tok);
 
     cur = cur->next = loop;
@@ -2145,37 +2225,37 @@ static Node *to_assign(Node *binary) {
 static Node *assign(Token **rest, Token *tok) {
   Node *node = conditional(&tok, tok);
 
-  if (equal(tok, "="))
+  if (equal(tok, P_ASSIGN))
     return new_binary(ND_ASSIGN, node, assign(rest, tok->next), tok);
 
-  if (equal(tok, "+="))
+  if (equal(tok, P_ADD_ASSIGN))
     return to_assign(new_add(node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "-="))
+  if (equal(tok, P_SUB_ASSIGN))
     return to_assign(new_sub(node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "*="))
+  if (equal(tok, P_MUL_ASSIGN))
     return to_assign(new_binary(ND_MUL, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "/="))
+  if (equal(tok, P_DIV_ASSIGN))
     return to_assign(new_binary(ND_DIV, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "%="))
+  if (equal(tok, P_MOD_ASSIGN))
     return to_assign(new_binary(ND_MOD, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "&="))
+  if (equal(tok, P_AND_ASSIGN))
     return to_assign(new_binary(ND_BITAND, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "|="))
+  if (equal(tok, P_OR_ASSIGN))
     return to_assign(new_binary(ND_BITOR, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "^="))
+  if (equal(tok, P_XOR_ASSIGN))
     return to_assign(new_binary(ND_BITXOR, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "<<="))
+  if (equal(tok, P_SHL_ASSIGN))
     return to_assign(new_binary(ND_SHL, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, ">>="))
+  if (equal(tok, P_SHR_ASSIGN))
     return to_assign(new_binary(ND_SHR, node, assign(rest, tok->next), tok));
 
   *rest = tok;
@@ -2186,12 +2266,12 @@ static Node *assign(Token **rest, Token *tok) {
 static Node *conditional(Token **rest, Token *tok) {
   Node *cond = logor(&tok, tok);
 
-  if (!equal(tok, "?")) {
+  if (!equal(tok, P_QUESTION)) {
     *rest = tok;
     return cond;
   }
 
-  if (equal(tok->next, ":")) {
+  if (equal(tok->next, P_COLON)) {
     // [GNU] Compile `a ?: b` as `tmp = a, tmp ? tmp : b`.
     add_type(cond);
     Obj *var = new_lvar("", cond->ty);
@@ -2206,7 +2286,7 @@ static Node *conditional(Token **rest, Token *tok) {
   Node *node = new_node(ND_COND, tok);
   node->cond = cond;
   node->then = expr(&tok, tok->next);
-  tok = skip(tok, ":");
+  tok = skip(tok, P_COLON);
   node->els = conditional(rest, tok);
   return node;
 }
@@ -2214,7 +2294,7 @@ static Node *conditional(Token **rest, Token *tok) {
 // logor = logand ("||" logand)*
 static Node *logor(Token **rest, Token *tok) {
   Node *node = logand(&tok, tok);
-  while (equal(tok, "||")) {
+  while (equal(tok, P_LOGOR)) {
     Token *start = tok;
     node = new_binary(ND_LOGOR, node, logand(&tok, tok->next), start);
   }
@@ -2225,7 +2305,7 @@ static Node *logor(Token **rest, Token *tok) {
 // logand = bitor ("&&" bitor)*
 static Node *logand(Token **rest, Token *tok) {
   Node *node = bitor(&tok, tok);
-  while (equal(tok, "&&")) {
+  while (equal(tok, P_LOGAND)) {
     Token *start = tok;
     node = new_binary(ND_LOGAND, node, bitor(&tok, tok->next), start);
   }
@@ -2236,7 +2316,7 @@ static Node *logand(Token **rest, Token *tok) {
 // bitor = bitxor ("|" bitxor)*
 static Node *bitor(Token **rest, Token *tok) {
   Node *node = bitxor(&tok, tok);
-  while (equal(tok, "|")) {
+  while (equal(tok, P_PIPE)) {
     Token *start = tok;
     node = new_binary(ND_BITOR, node, bitxor(&tok, tok->next), start);
   }
@@ -2247,7 +2327,7 @@ static Node *bitor(Token **rest, Token *tok) {
 // bitxor = bitand ("^" bitand)*
 static Node *bitxor(Token **rest, Token *tok) {
   Node *node = bitand(&tok, tok);
-  while (equal(tok, "^")) {
+  while (equal(tok, P_CARET)) {
     Token *start = tok;
     node = new_binary(ND_BITXOR, node, bitand(&tok, tok->next), start);
   }
@@ -2258,7 +2338,7 @@ static Node *bitxor(Token **rest, Token *tok) {
 // bitand = equality ("&" equality)*
 static Node *bitand(Token **rest, Token *tok) {
   Node *node = equality(&tok, tok);
-  while (equal(tok, "&")) {
+  while (equal(tok, P_AMP)) {
     Token *start = tok;
     node = new_binary(ND_BITAND, node, equality(&tok, tok->next), start);
   }
@@ -2273,12 +2353,12 @@ static Node *equality(Token **rest, Token *tok) {
   for (;;) {
     Token *start = tok;
 
-    if (equal(tok, "==")) {
+    if (equal(tok, P_EQ)) {
       node = new_binary(ND_EQ, node, relational(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, "!=")) {
+    if (equal(tok, P_NE)) {
       node = new_binary(ND_NE, node, relational(&tok, tok->next), start);
       continue;
     }
@@ -2295,22 +2375,22 @@ static Node *relational(Token **rest, Token *tok) {
   for (;;) {
     Token *start = tok;
 
-    if (equal(tok, "<")) {
+    if (equal(tok, P_LT)) {
       node = new_binary(ND_LT, node, shift(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, "<=")) {
+    if (equal(tok, P_LE)) {
       node = new_binary(ND_LE, node, shift(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, ">")) {
+    if (equal(tok, P_GT)) {
       node = new_binary(ND_LT, shift(&tok, tok->next), node, start);
       continue;
     }
 
-    if (equal(tok, ">=")) {
+    if (equal(tok, P_GE)) {
       node = new_binary(ND_LE, shift(&tok, tok->next), node, start);
       continue;
     }
@@ -2327,12 +2407,12 @@ static Node *shift(Token **rest, Token *tok) {
   for (;;) {
     Token *start = tok;
 
-    if (equal(tok, "<<")) {
+    if (equal(tok, P_SHL)) {
       node = new_binary(ND_SHL, node, add(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, ">>")) {
+    if (equal(tok, P_SHR)) {
       node = new_binary(ND_SHR, node, add(&tok, tok->next), start);
       continue;
     }
@@ -2420,12 +2500,12 @@ static Node *add(Token **rest, Token *tok) {
   for (;;) {
     Token *start = tok;
 
-    if (equal(tok, "+")) {
+    if (equal(tok, P_PLUS)) {
       node = new_add(node, mul(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, "-")) {
+    if (equal(tok, P_MINUS)) {
       node = new_sub(node, mul(&tok, tok->next), start);
       continue;
     }
@@ -2442,17 +2522,17 @@ static Node *mul(Token **rest, Token *tok) {
   for (;;) {
     Token *start = tok;
 
-    if (equal(tok, "*")) {
+    if (equal(tok, P_STAR)) {
       node = new_binary(ND_MUL, node, cast(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, "/")) {
+    if (equal(tok, P_SLASH)) {
       node = new_binary(ND_DIV, node, cast(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, "%")) {
+    if (equal(tok, P_PERCENT)) {
       node = new_binary(ND_MOD, node, cast(&tok, tok->next), start);
       continue;
     }
@@ -2464,13 +2544,13 @@ static Node *mul(Token **rest, Token *tok) {
 
 // cast = "(" type-name ")" cast | unary
 static Node *cast(Token **rest, Token *tok) {
-  if (equal(tok, "(") && is_typename(tok->next)) {
+  if (equal(tok, P_LPAREN) && is_typename(tok->next)) {
     Token *start = tok;
     Type *ty = typename(&tok, tok->next);
-    tok = skip(tok, ")");
+    tok = skip(tok, P_RPAREN);
 
     // compound literal
-    if (equal(tok, "{"))
+    if (equal(tok, P_LBRACE))
       return unary(rest, start);
 
     // type cast
@@ -2487,13 +2567,13 @@ static Node *cast(Token **rest, Token *tok) {
 //       | "&&" ident
 //       | postfix
 static Node *unary(Token **rest, Token *tok) {
-  if (equal(tok, "+"))
+  if (equal(tok, P_PLUS))
     return cast(rest, tok->next);
 
-  if (equal(tok, "-"))
+  if (equal(tok, P_MINUS))
     return new_unary(ND_NEG, cast(rest, tok->next), tok);
 
-  if (equal(tok, "&")) {
+  if (equal(tok, P_AMP)) {
     Node *lhs = cast(rest, tok->next);
     add_type(lhs);
     if (lhs->kind == ND_MEMBER && lhs->member->is_bitfield)
@@ -2501,7 +2581,7 @@ static Node *unary(Token **rest, Token *tok) {
     return new_unary(ND_ADDR, lhs, tok);
   }
 
-  if (equal(tok, "*")) {
+  if (equal(tok, P_STAR)) {
     // [https://www.sigbus.info/n1570#6.5.3.2p4] This is an oddity
     // in the C spec, but dereferencing a function shouldn't do
     // anything. If foo is a function, `*foo`, `**foo` or `*****foo`
@@ -2513,25 +2593,25 @@ static Node *unary(Token **rest, Token *tok) {
     return new_unary(ND_DEREF, node, tok);
   }
 
-  if (equal(tok, "!"))
+  if (equal(tok, P_NOT))
     return new_unary(ND_NOT, cast(rest, tok->next), tok);
 
-  if (equal(tok, "~"))
+  if (equal(tok, P_TILDE))
     return new_unary(ND_BITNOT, cast(rest, tok->next), tok);
 
   // Read ++i as i+=1
-  if (equal(tok, "++"))
+  if (equal(tok, P_INC))
     return to_assign(new_add(unary(rest, tok->next), new_num(1, tok), tok));
 
   // Read --i as i-=1
-  if (equal(tok, "--"))
+  if (equal(tok, P_DEC))
     return to_assign(new_sub(unary(rest, tok->next), new_num(1, tok), tok));
 
   // [GNU] labels-as-values
-  if (equal(tok, "&&")) {
+  if (equal(tok, P_LOGAND)) {
     Node *node = new_node(ND_LABEL_VAL, tok);
-    node->label = get_ident(tok->next);
-    node->goto_next = gotos;
+    node->ext->label = get_ident(tok->next);
+    node->ext->goto_next = gotos;
     gotos = node;
     *rest = tok->next->next;
     return node;
@@ -2546,15 +2626,15 @@ static void struct_members(Token **rest, Token *tok, Type *ty) {
   Member *cur = &head;
   int idx = 0;
 
-  while (!equal(tok, "}")) {
+  while (!equal(tok, P_RBRACE)) {
     VarAttr attr = {};
     Type *basety = declspec(&tok, tok, &attr);
     bool first = true;
 
     // Anonymous struct member
     if ((basety->kind == TY_STRUCT || basety->kind == TY_UNION) &&
-        consume(&tok, tok, ";")) {
-      Member *mem = calloc(1, sizeof(Member));
+        consume(&tok, tok, P_SEMICOLON)) {
+      Member *mem = arena_alloc(MEM_MEMBER, sizeof(Member));
       mem->ty = basety;
       mem->idx = idx++;
       mem->align = attr.align ? attr.align : mem->ty->align;
@@ -2563,18 +2643,18 @@ static void struct_members(Token **rest, Token *tok, Type *ty) {
     }
 
     // Regular struct members
-    while (!consume(&tok, tok, ";")) {
+    while (!consume(&tok, tok, P_SEMICOLON)) {
       if (!first)
-        tok = skip(tok, ",");
+        tok = skip(tok, P_COMMA);
       first = false;
 
-      Member *mem = calloc(1, sizeof(Member));
+      Member *mem = arena_alloc(MEM_MEMBER, sizeof(Member));
       mem->ty = declarator(&tok, tok, basety);
       mem->name = mem->ty->name;
       mem->idx = idx++;
       mem->align = attr.align ? attr.align : mem->ty->align;
 
-      if (consume(&tok, tok, ":")) {
+      if (consume(&tok, tok, P_COLON)) {
         mem->is_bitfield = true;
         mem->bit_width = const_expr(&tok, tok);
       }
@@ -2597,33 +2677,33 @@ static void struct_members(Token **rest, Token *tok, Type *ty) {
 
 // attribute = ("__attribute__" "(" "(" "packed" ")" ")")*
 static Token *attribute_list(Token *tok, Type *ty) {
-  while (consume(&tok, tok, "__attribute__")) {
-    tok = skip(tok, "(");
-    tok = skip(tok, "(");
+  while (consume(&tok, tok, KW___ATTRIBUTE__)) {
+    tok = skip(tok, P_LPAREN);
+    tok = skip(tok, P_LPAREN);
 
     bool first = true;
 
-    while (!consume(&tok, tok, ")")) {
+    while (!consume(&tok, tok, P_RPAREN)) {
       if (!first)
-        tok = skip(tok, ",");
+        tok = skip(tok, P_COMMA);
       first = false;
 
-      if (consume(&tok, tok, "packed")) {
+      if (consume(&tok, tok, ID_PACKED)) {
         ty->is_packed = true;
         continue;
       }
 
-      if (consume(&tok, tok, "aligned")) {
-        tok = skip(tok, "(");
+      if (consume(&tok, tok, ID_ALIGNED)) {
+        tok = skip(tok, P_LPAREN);
         ty->align = const_expr(&tok, tok);
-        tok = skip(tok, ")");
+        tok = skip(tok, P_RPAREN);
         continue;
       }
 
       error_tok(tok, "unknown attribute");
     }
 
-    tok = skip(tok, ")");
+    tok = skip(tok, P_RPAREN);
   }
 
   return tok;
@@ -2641,7 +2721,7 @@ static Type *struct_union_decl(Token **rest, Token *tok) {
     tok = tok->next;
   }
 
-  if (tag && !equal(tok, "{")) {
+  if (tag && !equal(tok, P_LBRACE)) {
     *rest = tok;
 
     Type *ty2 = find_tag(tag);
@@ -2653,7 +2733,7 @@ static Type *struct_union_decl(Token **rest, Token *tok) {
     return ty;
   }
 
-  tok = skip(tok, "{");
+  tok = skip(tok, P_LBRACE);
 
   // Construct a struct object.
   struct_members(&tok, tok, ty);
@@ -2662,10 +2742,10 @@ static Type *struct_union_decl(Token **rest, Token *tok) {
   if (tag) {
     // If this is a redefinition, overwrite a previous type.
     // Otherwise, register the struct type.
-    Type *ty2 = hashmap_get2(&scope->tags, tag->loc, tag->len);
-    if (ty2) {
-      *ty2 = *ty;
-      return ty2;
+    TagScope *sc = tag->atom->tag;
+    if (sc && sc->depth == scope_depth) {
+      *sc->ty = *ty;
+      return sc->ty;
     }
 
     push_tag_scope(tag, ty);
@@ -2746,8 +2826,7 @@ static Member *get_struct_member(Type *ty, Token *tok) {
     }
 
     // Regular struct member
-    if (mem->name->len == tok->len &&
-        !strncmp(mem->name->loc, tok->loc, tok->len))
+    if (mem->name->atom == tok->atom)
       return mem;
   }
   return NULL;
@@ -2805,13 +2884,13 @@ static Node *new_inc_dec(Node *node, Token *tok, int addend) {
 //              | "++"
 //              | "--"
 static Node *postfix(Token **rest, Token *tok) {
-  if (equal(tok, "(") && is_typename(tok->next)) {
+  if (equal(tok, P_LPAREN) && is_typename(tok->next)) {
     // Compound literal
     Token *start = tok;
     Type *ty = typename(&tok, tok->next);
-    tok = skip(tok, ")");
+    tok = skip(tok, P_RPAREN);
 
-    if (scope->next == NULL) {
+    if (scope_depth == 0) {
       Obj *var = new_anon_gvar(ty);
       gvar_initializer(rest, tok, var);
       return new_var_node(var, start);
@@ -2826,27 +2905,27 @@ static Node *postfix(Token **rest, Token *tok) {
   Node *node = primary(&tok, tok);
 
   for (;;) {
-    if (equal(tok, "(")) {
+    if (equal(tok, P_LPAREN)) {
       node = funcall(&tok, tok->next, node);
       continue;
     }
 
-    if (equal(tok, "[")) {
+    if (equal(tok, P_LBRACKET)) {
       // x[y] is short for *(x+y)
       Token *start = tok;
       Node *idx = expr(&tok, tok->next);
-      tok = skip(tok, "]");
+      tok = skip(tok, P_RBRACKET);
       node = new_unary(ND_DEREF, new_add(node, idx, start), start);
       continue;
     }
 
-    if (equal(tok, ".")) {
+    if (equal(tok, P_DOT)) {
       node = struct_ref(node, tok->next);
       tok = tok->next->next;
       continue;
     }
 
-    if (equal(tok, "->")) {
+    if (equal(tok, P_ARROW)) {
       // x->y is short for (*x).y
       node = new_unary(ND_DEREF, node, tok);
       node = struct_ref(node, tok->next);
@@ -2854,13 +2933,13 @@ static Node *postfix(Token **rest, Token *tok) {
       continue;
     }
 
-    if (equal(tok, "++")) {
+    if (equal(tok, P_INC)) {
       node = new_inc_dec(node, tok, 1);
       tok = tok->next;
       continue;
     }
 
-    if (equal(tok, "--")) {
+    if (equal(tok, P_DEC)) {
       node = new_inc_dec(node, tok, -1);
       tok = tok->next;
       continue;
@@ -2885,9 +2964,9 @@ static Node *funcall(Token **rest, Token *tok, Node *fn) {
   Node head = {};
   Node *cur = &head;
 
-  while (!equal(tok, ")")) {
+  while (!equal(tok, P_RPAREN)) {
     if (cur != &head)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
 
     Node *arg = assign(&tok, tok);
     add_type(arg);
@@ -2911,17 +2990,17 @@ static Node *funcall(Token **rest, Token *tok, Node *fn) {
   if (param_ty)
     error_tok(tok, "too few arguments");
 
-  *rest = skip(tok, ")");
+  *rest = skip(tok, P_RPAREN);
 
   Node *node = new_unary(ND_FUNCALL, fn, tok);
-  node->func_ty = ty;
+  node->ext->func_ty = ty;
   node->ty = ty->return_ty;
-  node->args = head.next;
+  node->ext->args = head.next;
 
   // If a function returns a struct, it is caller's responsibility
   // to allocate a space for the return value.
   if (node->ty->kind == TY_STRUCT || node->ty->kind == TY_UNION)
-    node->ret_buffer = new_lvar("", node->ty);
+    node->ext->ret_buffer = new_lvar("", node->ty);
   return node;
 }
 
@@ -2931,7 +3010,7 @@ static Node *funcall(Token **rest, Token *tok, Node *fn) {
 //               | "default" ":" assign
 static Node *generic_selection(Token **rest, Token *tok) {
   Token *start = tok;
-  tok = skip(tok, "(");
+  tok = skip(tok, P_LPAREN);
 
   Node *ctrl = assign(&tok, tok);
   add_type(ctrl);
@@ -2944,11 +3023,11 @@ static Node *generic_selection(Token **rest, Token *tok) {
 
   Node *ret = NULL;
 
-  while (!consume(rest, tok, ")")) {
-    tok = skip(tok, ",");
+  while (!consume(rest, tok, P_RPAREN)) {
+    tok = skip(tok, P_COMMA);
 
-    if (equal(tok, "default")) {
-      tok = skip(tok->next, ":");
+    if (equal(tok, KW_DEFAULT)) {
+      tok = skip(tok->next, P_COLON);
       Node *node = assign(&tok, tok);
       if (!ret)
         ret = node;
@@ -2956,7 +3035,7 @@ static Node *generic_selection(Token **rest, Token *tok) {
     }
 
     Type *t2 = typename(&tok, tok);
-    tok = skip(tok, ":");
+    tok = skip(tok, P_COLON);
     Node *node = assign(&tok, tok);
     if (is_compatible(t1, t2))
       ret = node;
@@ -2983,23 +3062,23 @@ static Node *generic_selection(Token **rest, Token *tok) {
 static Node *primary(Token **rest, Token *tok) {
   Token *start = tok;
 
-  if (equal(tok, "(") && equal(tok->next, "{")) {
+  if (equal(tok, P_LPAREN) && equal(tok->next, P_LBRACE)) {
     // This is a GNU statement expresssion.
     Node *node = new_node(ND_STMT_EXPR, tok);
     node->body = compound_stmt(&tok, tok->next->next)->body;
-    *rest = skip(tok, ")");
+    *rest = skip(tok, P_RPAREN);
     return node;
   }
 
-  if (equal(tok, "(")) {
+  if (equal(tok, P_LPAREN)) {
     Node *node = expr(&tok, tok->next);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, P_RPAREN);
     return node;
   }
 
-  if (equal(tok, "sizeof") && equal(tok->next, "(") && is_typename(tok->next->next)) {
+  if (equal(tok, KW_SIZEOF) && equal(tok->next, P_LPAREN) && is_typename(tok->next->next)) {
     Type *ty = typename(&tok, tok->next->next);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, P_RPAREN);
 
     if (ty->kind == TY_VLA) {
       if (ty->vla_size)
@@ -3013,7 +3092,7 @@ static Node *primary(Token **rest, Token *tok) {
     return new_ulong(ty->size, start);
   }
 
-  if (equal(tok, "sizeof")) {
+  if (equal(tok, KW_SIZEOF)) {
     Node *node = unary(rest, tok->next);
     add_type(node);
     if (node->ty->kind == TY_VLA)
@@ -3021,34 +3100,34 @@ static Node *primary(Token **rest, Token *tok) {
     return new_ulong(node->ty->size, tok);
   }
 
-  if (equal(tok, "_Alignof") && equal(tok->next, "(") && is_typename(tok->next->next)) {
+  if (equal(tok, KW__ALIGNOF) && equal(tok->next, P_LPAREN) && is_typename(tok->next->next)) {
     Type *ty = typename(&tok, tok->next->next);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, P_RPAREN);
     return new_ulong(ty->align, tok);
   }
 
-  if (equal(tok, "_Alignof")) {
+  if (equal(tok, KW__ALIGNOF)) {
     Node *node = unary(rest, tok->next);
     add_type(node);
     return new_ulong(node->ty->align, tok);
   }
 
-  if (equal(tok, "_Generic"))
+  if (equal(tok, ID__GENERIC))
     return generic_selection(rest, tok->next);
 
-  if (equal(tok, "__builtin_types_compatible_p")) {
-    tok = skip(tok->next, "(");
+  if (equal(tok, ID___BUILTIN_TYPES_COMPATIBLE_P)) {
+    tok = skip(tok->next, P_LPAREN);
     Type *t1 = typename(&tok, tok);
-    tok = skip(tok, ",");
+    tok = skip(tok, P_COMMA);
     Type *t2 = typename(&tok, tok);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, P_RPAREN);
     return new_num(is_compatible(t1, t2), start);
   }
 
-  if (equal(tok, "__builtin_reg_class")) {
-    tok = skip(tok->next, "(");
+  if (equal(tok, ID___BUILTIN_REG_CLASS)) {
+    tok = skip(tok->next, P_LPAREN);
     Type *ty = typename(&tok, tok);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, P_RPAREN);
 
     if (is_integer(ty) || ty->kind == TY_PTR)
       return new_num(0, start);
@@ -3057,25 +3136,25 @@ static Node *primary(Token **rest, Token *tok) {
     return new_num(2, start);
   }
 
-  if (equal(tok, "__builtin_compare_and_swap")) {
+  if (equal(tok, ID___BUILTIN_COMPARE_AND_SWAP)) {
     Node *node = new_node(ND_CAS, tok);
-    tok = skip(tok->next, "(");
-    node->cas_addr = assign(&tok, tok);
-    tok = skip(tok, ",");
-    node->cas_old = assign(&tok, tok);
-    tok = skip(tok, ",");
-    node->cas_new = assign(&tok, tok);
-    *rest = skip(tok, ")");
+    tok = skip(tok->next, P_LPAREN);
+    node->ext->cas_addr = assign(&tok, tok);
+    tok = skip(tok, P_COMMA);
+    node->ext->cas_old = assign(&tok, tok);
+    tok = skip(tok, P_COMMA);
+    node->ext->cas_new = assign(&tok, tok);
+    *rest = skip(tok, P_RPAREN);
     return node;
   }
 
-  if (equal(tok, "__builtin_atomic_exchange")) {
+  if (equal(tok, ID___BUILTIN_ATOMIC_EXCHANGE)) {
     Node *node = new_node(ND_EXCH, tok);
-    tok = skip(tok->next, "(");
+    tok = skip(tok->next, P_LPAREN);
     node->lhs = assign(&tok, tok);
-    tok = skip(tok, ",");
+    tok = skip(tok, P_COMMA);
     node->rhs = assign(&tok, tok);
-    *rest = skip(tok, ")");
+    *rest = skip(tok, P_RPAREN);
     return node;
   }
 
@@ -3084,9 +3163,10 @@ static Node *primary(Token **rest, Token *tok) {
     VarScope *sc = find_var(tok);
     *rest = tok->next;
 
-    // For "static inline" function
+    // A static function is emitted only if it is referenced from
+    // another function that is emitted or from a static initializer.
     if (sc && sc->var && sc->var->is_function) {
-      if (current_fn)
+      if (current_fn && !in_static_init)
         strarray_push(&current_fn->refs, sc->var->name);
       else
         sc->var->is_root = true;
@@ -3099,7 +3179,7 @@ static Node *primary(Token **rest, Token *tok) {
         return new_num(sc->enum_val, tok);
     }
 
-    if (equal(tok->next, "("))
+    if (equal(tok->next, P_LPAREN))
       error_tok(tok, "implicit declaration of a function");
     error_tok(tok, "undefined variable");
   }
@@ -3114,7 +3194,8 @@ static Node *primary(Token **rest, Token *tok) {
     Node *node;
     if (is_flonum(tok->ty)) {
       node = new_node(ND_NUM, tok);
-      node->fval = tok->fval;
+      node->ext = new_node_ext();
+      node->ext->fval = tok->fval;
     } else {
       node = new_num(tok->val, tok);
     }
@@ -3130,9 +3211,9 @@ static Node *primary(Token **rest, Token *tok) {
 static Token *parse_typedef(Token *tok, Type *basety) {
   bool first = true;
 
-  while (!consume(&tok, tok, ";")) {
+  while (!consume(&tok, tok, P_SEMICOLON)) {
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
     first = false;
 
     Type *ty = declarator(&tok, tok, basety);
@@ -3158,15 +3239,15 @@ static void create_param_lvars(Type *param) {
 // can refer a label that appears later in the function.
 // So, we need to do this after we parse the entire function.
 static void resolve_goto_labels(void) {
-  for (Node *x = gotos; x; x = x->goto_next) {
-    for (Node *y = labels; y; y = y->goto_next) {
-      if (!strcmp(x->label, y->label)) {
-        x->unique_label = y->unique_label;
+  for (Node *x = gotos; x; x = x->ext->goto_next) {
+    for (Node *y = labels; y; y = y->ext->goto_next) {
+      if (!strcmp(x->ext->label, y->ext->label)) {
+        x->ext->unique_label = y->ext->unique_label;
         break;
       }
     }
 
-    if (x->unique_label == NULL)
+    if (x->ext->unique_label == NULL)
       error_tok(x->tok->next, "use of undeclared label");
   }
 
@@ -3174,13 +3255,12 @@ static void resolve_goto_labels(void) {
 }
 
 static Obj *find_func(char *name) {
-  Scope *sc = scope;
-  while (sc->next)
-    sc = sc->next;
+  VarScope *sc = intern(name, strlen(name))->var;
+  while (sc && sc->depth > 0)
+    sc = sc->shadowed;
 
-  VarScope *sc2 = hashmap_get(&sc->vars, name);
-  if (sc2 && sc2->var && sc2->var->is_function)
-    return sc2->var;
+  if (sc && sc->var && sc->var->is_function)
+    return sc->var;
   return NULL;
 }
 
@@ -3207,22 +3287,21 @@ static Token *function(Token *tok, Type *basety, VarAttr *attr) {
     // Redeclaration
     if (!fn->is_function)
       error_tok(tok, "redeclared as a different kind of symbol");
-    if (fn->is_definition && equal(tok, "{"))
+    if (fn->is_definition && equal(tok, P_LBRACE))
       error_tok(tok, "redefinition of %s", name_str);
     if (!fn->is_static && attr->is_static)
       error_tok(tok, "static declaration follows a non-static declaration");
-    fn->is_definition = fn->is_definition || equal(tok, "{");
+    fn->is_definition = fn->is_definition || equal(tok, P_LBRACE);
   } else {
     fn = new_gvar(name_str, ty);
     fn->is_function = true;
-    fn->is_definition = equal(tok, "{");
+    fn->is_definition = equal(tok, P_LBRACE);
     fn->is_static = attr->is_static || (attr->is_inline && !attr->is_extern);
     fn->is_inline = attr->is_inline;
+    fn->is_root = !fn->is_static;
   }
 
-  fn->is_root = !(fn->is_static && fn->is_inline);
-
-  if (consume(&tok, tok, ";"))
+  if (consume(&tok, tok, P_SEMICOLON))
     return tok;
 
   current_fn = fn;
@@ -3242,7 +3321,7 @@ static Token *function(Token *tok, Type *basety, VarAttr *attr) {
     fn->va_area = new_lvar("__va_area__", array_of(ty_char, 136));
   fn->alloca_bottom = new_lvar("__alloca_size__", pointer_to(ty_char));
 
-  tok = skip(tok, "{");
+  tok = skip(tok, P_LBRACE);
 
   // [https://www.sigbus.info/n1570#6.4.2.2p1] "__func__" is
   // automatically defined as a local variable containing the
@@ -3264,9 +3343,9 @@ static Token *function(Token *tok, Type *basety, VarAttr *attr) {
 static Token *global_variable(Token *tok, Type *basety, VarAttr *attr) {
   bool first = true;
 
-  while (!consume(&tok, tok, ";")) {
+  while (!consume(&tok, tok, P_SEMICOLON)) {
     if (!first)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
     first = false;
 
     Type *ty = declarator(&tok, tok, basety);
@@ -3280,7 +3359,7 @@ static Token *global_variable(Token *tok, Type *basety, VarAttr *attr) {
     if (attr->align)
       var->align = attr->align;
 
-    if (equal(tok, "="))
+    if (equal(tok, P_ASSIGN))
       gvar_initializer(&tok, tok->next, var);
     else if (!attr->is_extern && !attr->is_tls)
       var->is_tentative = true;
@@ -3291,7 +3370,7 @@ static Token *global_variable(Token *tok, Type *basety, VarAttr *attr) {
 // Lookahead tokens and returns true if a given token is a start
 // of a function definition or declaration.
 static bool is_function(Token *tok) {
-  if (equal(tok, ";"))
+  if (equal(tok, P_SEMICOLON))
     return false;
 
   Type dummy = {};
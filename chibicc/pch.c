@@ -0,0 +1,544 @@
+// This file implements precompiled headers.
+//
+// `chibicc -x c-header foo.h -o foo.h.pch` preprocesses a header and
+// saves the result: the token list the preprocessor produced, the
+// macros the header defined or undefined, and the text of every file
+// that the tokens point into. When foo.h is later given to `-include`
+// and foo.h.pch is valid, cc1 loads the file instead of preprocessing
+// the header again. Most of the cost of a large common header is
+// spent in the preprocessor, so the parser just reads the saved
+// tokens as if they had been produced in the same process.
+//
+// A precompiled header is valid only if it was built by the same
+// compiler with the same include paths and -D/-U options, and if none
+// of the files read while building it has changed since then.
+//
+// Spellings and files are written once to tables and referred to by
+// index from tokens. Identifiers are interned once per distinct name
+// when loading.
+
+#include "chibicc.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// Bump this whenever the layout below or the Token struct changes.
+#define PCH_VERSION 1
+
+static FILE *out;
+
+static HashMap str_index;
+static StringArray strs;
+
+static HashMap file_index;
+static File **files;
+static int *file_len;
+static int nfiles;
+static int files_cap;
+
+static void put8(int v) {
+  fputc(v, out);
+}
+
+static void put32(int32_t v) {
+  fwrite(&v, sizeof(v), 1, out);
+}
+
+static void put64(int64_t v) {
+  fwrite(&v, sizeof(v), 1, out);
+}
+
+static void put_bytes(char *p, int len) {
+  put32(len);
+  fwrite(p, 1, len, out);
+}
+
+// Returns the index of a string in the string table.
+static int str_id(char *s) {
+  if (!s)
+    return -1;
+
+  int id = (intptr_t)hashmap_get(&str_index, s);
+  if (id)
+    return id - 1;
+
+  strarray_push(&strs, s);
+  hashmap_put(&str_index, s, (void *)(intptr_t)strs.len);
+  return strs.len - 1;
+}
+
+// Returns the index of a file in the file table.
+static int file_id(File *file) {
+  if (!file)
+    return -1;
+
+  // A File is used as its own key.
+  int id = (intptr_t)hashmap_get2(&file_index, (char *)file, sizeof(File));
+  if (id)
+    return id - 1;
+
+  if (nfiles == files_cap) {
+    files_cap = files_cap ? files_cap * 2 : 64;
+    files = realloc(files, sizeof(File *) * files_cap);
+    file_len = realloc(file_len, sizeof(int) * files_cap);
+  }
+  files[nfiles] = file;
+  file_len[nfiles] = strlen(file->contents);
+  nfiles++;
+  hashmap_put2(&file_index, (char *)file, sizeof(File), (void *)(intptr_t)nfiles);
+  return nfiles - 1;
+}
+
+// Types of literal tokens
+static Type *literal_type(int code) {
+  Type *ty[] = {
+    NULL, ty_char, ty_ushort, ty_int, ty_uint, ty_long, ty_ulong,
+    ty_float, ty_double, ty_ldouble,
+  };
+
+  if (code < 0 || code >= sizeof(ty) / sizeof(*ty))
+    return NULL;
+  return ty[code];
+}
+
+static int literal_type_code(Type *ty) {
+  for (int i = 1; literal_type(i); i++)
+    if (literal_type(i) == ty)
+      return i;
+  unreachable();
+}
+
+static void put_token(Token *tok) {
+  put8(tok->kind);
+  put8(tok->at_bol | (tok->has_space << 1));
+  put32(tok->len);
+  put32(tok->line_no);
+  put32(tok->line_delta);
+  put32(str_id(tok->filename));
+  put32(tok->atom->id == ATOM_NONE ? -1 : str_id(tok->atom->name));
+
+  // A token normally points into the text of its file. If it doesn't,
+  // its spelling is saved as a string.
+  int f = file_id(tok->file);
+  put32(f);
+
+  if (f != -1 && tok->file->contents <= tok->loc &&
+      tok->loc + tok->len <= tok->file->contents + file_len[f]) {
+    put8(1);
+    put32(tok->loc - tok->file->contents);
+  } else {
+    put8(0);
+    put32(str_id(strndup(tok->loc, tok->len)));
+  }
+
+  if (tok->kind == TK_STR) {
+    put8(literal_type_code(tok->ty->base));
+    put32(tok->ty->array_len);
+    put_bytes(tok->str, tok->ty->size);
+  } else if (tok->kind == TK_NUM) {
+    put8(literal_type_code(tok->ty));
+    if (is_flonum(tok->ty))
+      fwrite(&tok->fval, sizeof(tok->fval), 1, out);
+    else
+      put64(tok->val);
+  }
+}
+
+// Writes tokens up to and including the first TK_EOF.
+static void put_tokens(Token *tok) {
+  int n = 0;
+  for (Token *t = tok; t; t = t->next) {
+    n++;
+    if (t->kind == TK_EOF)
+      break;
+  }
+
+  put32(n);
+  for (int i = 0; i < n; i++, tok = tok->next)
+    put_token(tok);
+}
+
+static void put_macros(void) {
+  int len;
+  Atom **names = get_macro_changes(&len);
+
+  HashMap seen = {};
+  Atom **uniq = calloc(len + 1, sizeof(Atom *));
+  int n = 0;
+
+  for (int i = 0; i < len; i++) {
+    if (hashmap_get_atom(&seen, names[i]))
+      continue;
+    hashmap_put_atom(&seen, names[i], (void *)1);
+    uniq[n++] = names[i];
+  }
+
+  put32(n);
+  for (int i = 0; i < n; i++) {
+    Macro *m = uniq[i]->macro;
+    put32(str_id(uniq[i]->name));
+
+    if (!m || m->handler) {
+      put8(0);
+      continue;
+    }
+
+    put8(1);
+    put8(m->is_objlike);
+    put32(m->va_args_name ? str_id(m->va_args_name->name) : -1);
+
+    int nparams = 0;
+    for (MacroParam *p = m->params; p; p = p->next)
+      nparams++;
+    put32(nparams);
+    for (MacroParam *p = m->params; p; p = p->next)
+      put32(str_id(p->name->name));
+
+    put_tokens(m->body);
+  }
+  free(uniq);
+}
+
+// Writes a precompiled header for a preprocessed token list.
+void write_pch(char *path, Token *tok, char *signature) {
+  // Files read by the preprocessor come first, so that all of them
+  // are checked when loading even if no token refers to them.
+  File **input = get_input_files();
+  int nregistered = 0;
+  while (input[nregistered])
+    file_id(input[nregistered++]);
+
+  // Tokens and macros are written to a buffer first, because the
+  // tables they refer to are complete only after that.
+  char *body;
+  size_t body_len;
+  out = open_memstream(&body, &body_len);
+  put_macros();
+  put_tokens(tok);
+  fclose(out);
+
+  int *name = calloc(nfiles, sizeof(int));
+  int *display_name = calloc(nfiles, sizeof(int));
+  for (int i = 0; i < nfiles; i++) {
+    name[i] = str_id(files[i]->name);
+    display_name[i] = str_id(files[i]->display_name);
+  }
+
+  char *tmp = format("%s.%d", path, getpid());
+  out = fopen(tmp, "w");
+  if (!out)
+    error("cannot open output file: %s: %s", tmp, strerror(errno));
+
+  fwrite("chibipch", 1, 8, out);
+  put32(PCH_VERSION);
+  put32(sizeof(Token));
+  put_bytes(signature, strlen(signature) + 1);
+
+  put32(strs.len);
+  for (int i = 0; i < strs.len; i++)
+    put_bytes(strs.data[i], strlen(strs.data[i]) + 1);
+
+  put32(nfiles);
+  for (int i = 0; i < nfiles; i++) {
+    File *file = files[i];
+    bool registered = i < nregistered;
+
+    struct stat st = {};
+    if (registered && stat(file->name, &st))
+      error("%s: %s", file->name, strerror(errno));
+
+    put32(name[i]);
+    put32(display_name[i]);
+    put32(file->file_no);
+    put32(file->line_delta);
+    put8(registered);
+    put8(registered && is_pragma_once(file->name));
+    put64(st.st_mtim.tv_sec);
+    put64(st.st_mtim.tv_nsec);
+    put64(st.st_size);
+    put_bytes(file->contents, file_len[i] + 1);
+  }
+
+  fwrite(body, 1, body_len, out);
+  if (fclose(out))
+    error("%s: %s", tmp, strerror(errno));
+  if (rename(tmp, path))
+    error("%s: %s", path, strerror(errno));
+  free(body);
+}
+
+//
+// Reader
+//
+
+static char *cur;
+static char *end;
+
+static void need(int n) {
+  if (n < 0 || end - cur < n)
+    error("corrupt precompiled header");
+}
+
+static int get8(void) {
+  need(1);
+  return (uint8_t)*cur++;
+}
+
+static int32_t get32(void) {
+  int32_t v;
+  need(sizeof(v));
+  memcpy(&v, cur, sizeof(v));
+  cur += sizeof(v);
+  return v;
+}
+
+static int64_t get64(void) {
+  int64_t v;
+  need(sizeof(v));
+  memcpy(&v, cur, sizeof(v));
+  cur += sizeof(v);
+  return v;
+}
+
+static char *get_bytes(int *len) {
+  *len = get32();
+  need(*len);
+  char *p = cur;
+  cur += *len;
+  return p;
+}
+
+static char **str_table;
+static Atom **atom_table;
+static int nstrs;
+static File **file_table;
+static int nfile_table;
+
+static char *get_str(void) {
+  int id = get32();
+  if (id == -1)
+    return NULL;
+  if (id < 0 || id >= nstrs)
+    error("corrupt precompiled header");
+  return str_table[id];
+}
+
+static Atom *get_atom_ref(void) {
+  int id = get32();
+  if (id == -1)
+    return get_atom(ATOM_NONE);
+  if (id < 0 || id >= nstrs)
+    error("corrupt precompiled header");
+  if (!atom_table[id])
+    atom_table[id] = intern(str_table[id], strlen(str_table[id]));
+  return atom_table[id];
+}
+
+static File *get_file_ref(void) {
+  int id = get32();
+  if (id == -1)
+    return NULL;
+  if (id < 0 || id >= nfile_table)
+    error("corrupt precompiled header");
+  return file_table[id];
+}
+
+static void get_token(Token *tok) {
+  tok->kind = get8();
+  int flags = get8();
+  tok->at_bol = flags & 1;
+  tok->has_space = flags & 2;
+  tok->len = get32();
+  tok->line_no = get32();
+  tok->line_delta = get32();
+  tok->filename = get_str();
+  tok->atom = get_atom_ref();
+  tok->file = get_file_ref();
+
+  if (get8()) {
+    int off = get32();
+    if (!tok->file || off < 0 || off > strlen(tok->file->contents))
+      error("corrupt precompiled header");
+    tok->loc = tok->file->contents + off;
+  } else {
+    tok->loc = get_str();
+  }
+
+  if (tok->kind == TK_STR) {
+    Type *base = literal_type(get8());
+    int array_len = get32();
+    int len;
+    tok->str = get_bytes(&len);
+    if (!base)
+      error("corrupt precompiled header");
+    tok->ty = array_of(base, array_len);
+  } else if (tok->kind == TK_NUM) {
+    tok->ty = literal_type(get8());
+    if (!tok->ty)
+      error("corrupt precompiled header");
+    if (is_flonum(tok->ty)) {
+      need(sizeof(tok->fval));
+      memcpy(&tok->fval, cur, sizeof(tok->fval));
+      cur += sizeof(tok->fval);
+    } else {
+      tok->val = get64();
+    }
+  }
+}
+
+static Token *get_tokens(void) {
+  int n = get32();
+  if (n <= 0)
+    error("corrupt precompiled header");
+
+  // Tokens are allocated at once as an array and linked in order.
+  Token *toks = arena_alloc(MEM_TOKEN, sizeof(Token) * n);
+  for (int i = 0; i < n; i++) {
+    get_token(&toks[i]);
+    toks[i].next = (i + 1 < n) ? &toks[i + 1] : NULL;
+  }
+  return toks;
+}
+
+static void get_macros(void) {
+  int n = get32();
+  for (int i = 0; i < n; i++) {
+    Atom *name = get_atom_ref();
+    if (!get8()) {
+      name->macro = NULL;
+      continue;
+    }
+
+    Macro *m = calloc(1, sizeof(Macro));
+    m->name = name;
+    m->is_objlike = get8();
+    m->va_args_name = get_atom_ref();
+    if (m->va_args_name->id == ATOM_NONE)
+      m->va_args_name = NULL;
+
+    MacroParam head = {};
+    MacroParam *p = &head;
+    for (int nparams = get32(); nparams > 0; nparams--) {
+      p = p->next = calloc(1, sizeof(MacroParam));
+      p->name = get_atom_ref();
+    }
+    m->params = head.next;
+    m->body = get_tokens();
+    name->macro = m;
+  }
+}
+
+// Loads a precompiled header and returns its tokens. Returns NULL if
+// the file doesn't exist or was built in a different environment.
+Token *read_pch(char *path, char *signature) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < 16) {
+    close(fd);
+    return NULL;
+  }
+
+  // Tokens point into the mapping, so it is never unmapped.
+  char *buf = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED)
+    return NULL;
+
+  cur = buf;
+  end = buf + st.st_size;
+
+  int sig_len;
+  if (memcmp(buf, "chibipch", 8))
+    goto invalid;
+  cur += 8;
+  if (get32() != PCH_VERSION || get32() != sizeof(Token) ||
+      strcmp(get_bytes(&sig_len), signature))
+    goto invalid;
+
+  nstrs = get32();
+  need(nstrs);
+  str_table = calloc(nstrs + 1, sizeof(char *));
+  atom_table = calloc(nstrs + 1, sizeof(Atom *));
+  for (int i = 0; i < nstrs; i++) {
+    int len;
+    str_table[i] = get_bytes(&len);
+  }
+
+  // Check that no file has changed before changing any state.
+  nfile_table = get32();
+  need(nfile_table);
+  char **rec = calloc(nfile_table + 1, sizeof(char *));
+  for (int i = 0; i < nfile_table; i++) {
+    rec[i] = cur;
+    char *name = get_str();
+    get_str();
+    get32();
+    get32();
+    bool registered = get8();
+    get8();
+    int64_t mtime_sec = get64();
+    int64_t mtime_nsec = get64();
+    int64_t size = get64();
+    int len;
+    get_bytes(&len);
+
+    struct stat st2;
+    if (registered &&
+        (stat(name, &st2) || st2.st_mtim.tv_sec != mtime_sec ||
+         st2.st_mtim.tv_nsec != mtime_nsec || st2.st_size != size)) {
+      free(rec);
+      goto invalid;
+    }
+  }
+  char *body = cur;
+
+  // Files read while building the header are registered again, so
+  // that they get .file directives and show up in -M output.
+  file_table = calloc(nfile_table + 1, sizeof(File *));
+  int *old_file_no = calloc(nfile_table + 1, sizeof(int));
+
+  for (int i = 0; i < nfile_table; i++) {
+    cur = rec[i];
+    char *name = get_str();
+    char *display_name = get_str();
+    int file_no = get32();
+    int line_delta = get32();
+    bool registered = get8();
+    bool pragma_once = get8();
+    cur += 24;
+    int len;
+    char *contents = get_bytes(&len);
+
+    File *file;
+    if (registered) {
+      file = add_input_file(name, contents);
+    } else {
+      // Files created by the preprocessor share the number of the
+      // file they were created from.
+      file = new_file(name, file_no, contents);
+      for (int j = 0; j < i; j++)
+        if (old_file_no[j] == file_no)
+          file->file_no = file_table[j]->file_no;
+    }
+
+    file->display_name = display_name;
+    file->line_delta = line_delta;
+    if (pragma_once)
+      set_pragma_once(name);
+    file_table[i] = file;
+    old_file_no[i] = file_no;
+  }
+
+  free(rec);
+  free(old_file_no);
+
+  cur = body;
+  get_macros();
+  return get_tokens();
+
+invalid:
+  munmap(buf, st.st_size);
+  return NULL;
+}
@@ -0,0 +1,810 @@
+// This file implements a peephole optimizer for the assembly that
+// codegen.c emits. While a function is compiled, codegen.c records
+// each line as an AsmLine, which holds a mnemonic and its operands,
+// instead of writing the line out. The optimizer then rewrites short
+// sequences of instructions in the list before it is printed.
+//
+// The code generator is simple and emits a lot of redundant code,
+// such as a push immediately followed by a pop, or a boolean that is
+// materialized only to be compared with zero. Each rule below removes
+// one such pattern. A rule must preserve the meaning of any
+// instruction sequence, not just the ones the code generator emits
+// today; it may not rely on registers being dead unless it checks it.
+
+#include "chibicc.h"
+
+typedef enum {
+  RULE_SELF_MOV,
+  RULE_PUSH_POP,
+  RULE_STORE_RELOAD,
+  RULE_MOV_BACK,
+  RULE_LEA_LOAD,
+  RULE_REDUNDANT_EXT,
+  RULE_ADD_ZERO,
+  RULE_ZERO_IDIOM,
+  RULE_SETCC_BRANCH,
+  RULE_JUMP_NEXT,
+  RULE_JUMP_THREAD,
+  RULE_DEAD_CODE,
+  NUM_RULES,
+} Rule;
+
+static char *rule_names[] = {
+  [RULE_SELF_MOV] = "self-mov",
+  [RULE_PUSH_POP] = "push-pop",
+  [RULE_STORE_RELOAD] = "store-reload",
+  [RULE_MOV_BACK] = "mov-back",
+  [RULE_LEA_LOAD] = "lea-load",
+  [RULE_REDUNDANT_EXT] = "redundant-ext",
+  [RULE_ADD_ZERO] = "add-zero",
+  [RULE_ZERO_IDIOM] = "zero-idiom",
+  [RULE_SETCC_BRANCH] = "setcc-branch",
+  [RULE_JUMP_NEXT] = "jump-next",
+  [RULE_JUMP_THREAD] = "jump-thread",
+  [RULE_DEAD_CODE] = "dead-code",
+};
+
+static long rule_count[NUM_RULES];
+
+// Labels of the function being optimized
+static HashMap labels;
+
+//
+// Line templates
+//
+// codegen.c describes every line with a println() format string. The
+// first time a format string is seen, it is split into a mnemonic,
+// operands and a trailing comment, each of which is either literal
+// text or a smaller format string. A line is then built by formatting
+// only the pieces that take arguments, so the text of an instruction
+// is never taken apart again.
+//
+
+enum {
+  F_OP,          // Mnemonic, label name, or the whole line if not AL_INSN
+  F_ARG,         // First operand; the others follow
+  F_COMMENT = 4, // Trailing comment
+  NUM_FIELDS,
+};
+
+typedef struct {
+  char *fmt;                // The format string itself, for the key
+  AsmLineKind kind;
+  int nargs;
+  char *field[NUM_FIELDS];  // NULL if absent
+  bool is_fmt[NUM_FIELDS];  // The field consumes arguments
+  bool indirect;            // The line is the string argument
+} AsmFormat;
+
+static HashMap formats;   // Keyed by the address of a format string
+static HashMap indirect;  // Keyed by the text of an argument
+
+static void set_field(AsmFormat *f, int i, char *start, char *end, bool literal) {
+  char *s = strndup(start, end - start);
+  bool is_fmt = false;
+
+  if (!literal) {
+    for (char *p = s; *p; p++) {
+      if (*p == '%' && p[1] == '%')
+        p++;
+      else if (*p == '%')
+        is_fmt = true;
+    }
+
+    // Without conversions, only the escapes are left to undo.
+    if (!is_fmt) {
+      char *q = s;
+      for (char *p = s; *p; p++) {
+        if (*p == '%' && p[1] == '%')
+          p++;
+        *q++ = *p;
+      }
+      *q = '\0';
+    }
+  }
+
+  f->field[i] = s;
+  f->is_fmt[i] = is_fmt;
+}
+
+static void set_trimmed_field(AsmFormat *f, int i, char *start, char *end, bool literal) {
+  while (start < end && isspace(*start))
+    start++;
+  while (end > start && isspace(end[-1]))
+    end--;
+  set_field(f, i, start, end, literal);
+}
+
+// Splits an instruction into a mnemonic, operands and a comment.
+// Commas inside parentheses, as in `(%rax,%rdi,8)`, do not separate
+// operands.
+static bool split_insn(AsmFormat *f, char *p, bool literal) {
+  char *q = p;
+  while (*q && !isspace(*q))
+    q++;
+  set_field(f, F_OP, p, q, literal);
+
+  while (isspace(*q))
+    q++;
+  if (!*q)
+    return true;
+
+  int depth = 0;
+  char *start = q;
+  for (;; q++) {
+    if (*q == '(') {
+      depth++;
+    } else if (*q == ')') {
+      depth--;
+    } else if (depth == 0 && (*q == ',' || *q == '#' || !*q)) {
+      if (f->nargs == 3)
+        return false;
+      set_trimmed_field(f, F_ARG + f->nargs++, start, q, literal);
+
+      if (*q == '#') {
+        // The comment keeps the spaces in front of it.
+        char *c = q;
+        while (c > start && isspace(c[-1]))
+          c--;
+        set_field(f, F_COMMENT, c, q + strlen(q), literal);
+        return true;
+      }
+      if (!*q)
+        return true;
+      start = q + 1;
+    }
+  }
+}
+
+// If `literal` is true, `fmt` is the text of a line rather than a
+// format string.
+static AsmFormat *compile_format(char *fmt, bool literal) {
+  AsmFormat *f = calloc(1, sizeof(AsmFormat));
+  int len = strlen(fmt);
+  f->fmt = fmt;
+
+  if (!literal && !strcmp(fmt, "  %s")) {
+    f->indirect = true;
+    return f;
+  }
+
+  if (strchr(fmt, '\n') || strchr(fmt, ';')) {
+    f->kind = AL_RAW;
+  } else if (fmt[0] != ' ' && len > 1 && fmt[len - 1] == ':') {
+    f->kind = AL_LABEL;
+    set_field(f, F_OP, fmt, fmt + len - 1, literal);
+    return f;
+  } else if (!strncmp(fmt, "  .loc ", 7)) {
+    f->kind = AL_LOC;
+  } else if (!strncmp(fmt, "  ", 2) && fmt[2] != '.' && !isspace(fmt[2]) &&
+             split_insn(f, fmt + 2, literal)) {
+    f->kind = AL_INSN;
+    return f;
+  } else {
+    f->kind = AL_RAW;
+  }
+
+  for (int i = 0; i < NUM_FIELDS; i++)
+    f->field[i] = NULL;
+  f->nargs = 0;
+  set_field(f, F_OP, fmt, fmt + len, literal);
+  return f;
+}
+
+static char *field_value(AsmFormat *f, int i, va_list *ap) {
+  if (!f->is_fmt[i])
+    return f->field[i];
+
+  static OutBuf buf;
+  buf.len = 0;
+  out_vformat(&buf, f->field[i], ap);
+
+  char *s = arena_alloc(MEM_ASM, buf.len + 1);
+  memcpy(s, buf.data, buf.len + 1);
+  return s;
+}
+
+// Builds a line from a println() format string and its arguments.
+AsmLine *new_asm_line(char *fmt, va_list *ap) {
+  AsmFormat *f = hashmap_get2(&formats, (char *)&fmt, sizeof(fmt));
+  if (!f) {
+    f = compile_format(fmt, false);
+    hashmap_put2(&formats, (char *)&f->fmt, sizeof(f->fmt), f);
+  }
+
+  // "  %s" prints an instruction taken from a table, such as the one
+  // for type casts, which is split once per distinct string.
+  if (f->indirect) {
+    char *s = va_arg(*ap, char *);
+    f = hashmap_get(&indirect, s);
+    if (!f) {
+      f = compile_format(format("  %s", s), true);
+      hashmap_put(&indirect, strdup(s), f);
+    }
+  }
+
+  AsmLine *line = arena_alloc(MEM_ASM, sizeof(AsmLine));
+  line->kind = f->kind;
+  line->op = field_value(f, F_OP, ap);
+  for (int i = 0; i < f->nargs; i++)
+    line->args[i] = field_value(f, F_ARG + i, ap);
+  line->nargs = f->nargs;
+  if (f->field[F_COMMENT])
+    line->comment = field_value(f, F_COMMENT, ap);
+  return line;
+}
+
+// Makes a line that no rule looks into, such as inline assembly.
+AsmLine *new_raw_asm_line(char *text) {
+  AsmLine *line = arena_alloc(MEM_ASM, sizeof(AsmLine));
+  line->kind = AL_RAW;
+  line->op = text;
+  return line;
+}
+
+void print_asm_lines(AsmLine *line, OutBuf *out) {
+  for (; line; line = line->next) {
+    switch (line->kind) {
+    case AL_INSN:
+      out_str(out, "  ");
+      out_str(out, line->op);
+      for (int i = 0; i < line->nargs; i++) {
+        out_str(out, i ? ", " : " ");
+        out_str(out, line->args[i]);
+      }
+      if (line->comment)
+        out_str(out, line->comment);
+      out_char(out, '\n');
+      break;
+    case AL_LABEL:
+      out_str(out, line->op);
+      out_str(out, ":\n");
+      break;
+    default:
+      out_str(out, line->op);
+      out_char(out, '\n');
+    }
+  }
+}
+
+//
+// Helpers
+//
+
+static AsmLine *head;
+
+static void delete_line(AsmLine *line) {
+  if (line->prev)
+    line->prev->next = line->next;
+  else
+    head = line->next;
+  if (line->next)
+    line->next->prev = line->prev;
+}
+
+// Returns the instruction or label following a given line. A `.loc`
+// directive does not affect the code, so it is skipped.
+static AsmLine *next_line(AsmLine *line) {
+  line = line->next;
+  while (line && line->kind == AL_LOC)
+    line = line->next;
+  return line;
+}
+
+static bool is_insn(AsmLine *line, char *op) {
+  return line && line->kind == AL_INSN && !strcmp(line->op, op);
+}
+
+static void set_insn(AsmLine *line, char *op, int nargs, char *arg0, char *arg1) {
+  line->op = op;
+  line->nargs = nargs;
+  line->args[0] = arg0;
+  line->args[1] = arg1;
+}
+
+static char *regs[][4] = {
+  {"%rax", "%eax", "%ax", "%al"},    {"%rbx", "%ebx", "%bx", "%bl"},
+  {"%rcx", "%ecx", "%cx", "%cl"},    {"%rdx", "%edx", "%dx", "%dl"},
+  {"%rsi", "%esi", "%si", "%sil"},   {"%rdi", "%edi", "%di", "%dil"},
+  {"%rbp", "%ebp", "%bp", "%bpl"},   {"%rsp", "%esp", "%sp", "%spl"},
+  {"%r8", "%r8d", "%r8w", "%r8b"},   {"%r9", "%r9d", "%r9w", "%r9b"},
+  {"%r10", "%r10d", "%r10w", "%r10b"}, {"%r11", "%r11d", "%r11w", "%r11b"},
+  {"%r12", "%r12d", "%r12w", "%r12b"}, {"%r13", "%r13d", "%r13w", "%r13b"},
+  {"%r14", "%r14d", "%r14w", "%r14b"}, {"%r15", "%r15d", "%r15w", "%r15b"},
+};
+
+#define REG_RSP 7
+
+// Returns the general-purpose register a name refers to, or -1. If
+// `width` is not NULL, it is set to 0 for a 64-bit name, 1 for 32-bit,
+// and so on.
+static int reg_of(char *s, int len, int *width) {
+  for (int i = 0; i < sizeof(regs) / sizeof(*regs); i++) {
+    for (int j = 0; j < 4; j++) {
+      if (strlen(regs[i][j]) == len && !strncmp(s, regs[i][j], len)) {
+        if (width)
+          *width = j;
+        return i;
+      }
+    }
+  }
+  return -1;
+}
+
+static int operand_reg(char *arg, int *width) {
+  if (!arg || arg[0] != '%')
+    return -1;
+  return reg_of(arg, strlen(arg), width);
+}
+
+static bool is_reg64(char *arg) {
+  int width;
+  return operand_reg(arg, &width) != -1 && width == 0;
+}
+
+static bool is_mem(char *arg) {
+  return strchr(arg, '(') != NULL;
+}
+
+static bool mentions_arg(char *arg, int reg) {
+  for (char *p = arg; *p; p++) {
+    if (*p != '%')
+      continue;
+    char *q = p + 1;
+    while (isalnum(*q))
+      q++;
+    if (reg_of(p, q - p, NULL) == reg)
+      return true;
+    p = q - 1;
+  }
+  return false;
+}
+
+// Returns true if an operand of an instruction names a register.
+static bool mentions(AsmLine *line, int reg) {
+  for (int i = 0; i < line->nargs; i++)
+    if (mentions_arg(line->args[i], reg))
+      return true;
+  return false;
+}
+
+static bool starts_with(char *s, char *prefix) {
+  return !strncmp(s, prefix, strlen(prefix));
+}
+
+// Instructions that read only their operands, write only their last
+// operand and do not touch the stack.
+static bool is_simple(AsmLine *line) {
+  static char *ops[] = {
+    "mov", "movsxd", "movzb", "movzx", "movsbl", "movzbl", "movswl",
+    "movzwl", "movsbq", "movzbq", "movswq", "movzwq", "lea", "add", "sub",
+    "and", "or", "xor", "neg", "not", "movss", "movsd", "movaps", "movq",
+  };
+
+  if (line->kind != AL_INSN || line->nargs == 0)
+    return false;
+  for (int i = 0; i < sizeof(ops) / sizeof(*ops); i++)
+    if (!strcmp(line->op, ops[i]))
+      return true;
+  if (!strcmp(line->op, "imul") && line->nargs == 2)
+    return true;
+  if ((!strcmp(line->op, "shl") || !strcmp(line->op, "shr") ||
+       !strcmp(line->op, "sar")) && line->nargs == 2 && line->args[0][0] == '$')
+    return true;
+  return false;
+}
+
+static bool is_jump(AsmLine *line) {
+  return line && line->kind == AL_INSN && line->op[0] == 'j' && line->nargs == 1 &&
+         line->args[0][0] != '*';
+}
+
+static bool reads_flags(AsmLine *line) {
+  char *op = line->op;
+  if (op[0] == 'j')
+    return strcmp(op, "jmp");
+  return starts_with(op, "set") || starts_with(op, "cmov") || !strcmp(op, "adc") ||
+         !strcmp(op, "sbb");
+}
+
+static bool writes_flags(AsmLine *line) {
+  static char *ops[] = {
+    "cmp", "test", "add", "sub", "and", "or", "xor", "imul", "neg", "inc",
+    "dec", "ucomiss", "ucomisd", "comiss", "comisd", "fucomip",
+  };
+  for (int i = 0; i < sizeof(ops) / sizeof(*ops); i++)
+    if (!strcmp(line->op, ops[i]))
+      return true;
+  return false;
+}
+
+// Returns true if the flags set before `line` are never read.
+static bool flags_dead(AsmLine *line) {
+  for (; line; line = next_line(line)) {
+    if (line->kind != AL_INSN)
+      return false;
+    if (reads_flags(line))
+      return false;
+    // Flags are not preserved across function calls.
+    if (writes_flags(line) || !strcmp(line->op, "call") || !strcmp(line->op, "ret"))
+      return true;
+    if (!is_simple(line))
+      return false;
+  }
+  return false;
+}
+
+static AsmLine *find_label(char *name) {
+  return hashmap_get(&labels, name);
+}
+
+// Returns true if a register is overwritten before it is read when
+// control reaches `line`. This follows unconditional jumps, but gives
+// up at anything else that is not a plain move to the register.
+static bool reg_dead(AsmLine *line, int reg) {
+  for (int budget = 8; line && budget > 0; line = next_line(line)) {
+    if (line->kind == AL_LABEL)
+      continue;
+    if (line->kind != AL_INSN)
+      return false;
+
+    if (is_jump(line) && !strcmp(line->op, "jmp")) {
+      line = find_label(line->args[0]);
+      budget--;
+      if (!line)
+        return false;
+      continue;
+    }
+
+    if (!is_simple(line) || line->nargs != 2)
+      return false;
+
+    bool is_move = !strcmp(line->op, "lea") || starts_with(line->op, "mov");
+    int width;
+    if (is_move && operand_reg(line->args[1], &width) == reg && width <= 1 &&
+        !mentions_arg(line->args[0], reg))
+      return true;
+    if (mentions(line, reg))
+      return false;
+  }
+  return false;
+}
+
+//
+// Rules
+//
+// Each rule is tried at an instruction and returns true if it changed
+// the list.
+//
+
+// mov %rax, %rax
+static bool self_mov(AsmLine *line) {
+  if (!is_insn(line, "mov") || line->nargs != 2 || !is_reg64(line->args[0]) ||
+      strcmp(line->args[0], line->args[1]))
+    return false;
+  delete_line(line);
+  return true;
+}
+
+// push X; ...; pop Y => mov X, Y; ...
+//
+// The instructions in between must not use the stack or Y.
+static bool push_pop(AsmLine *line) {
+  if (!is_insn(line, "push") || line->nargs != 1 || !is_reg64(line->args[0]))
+    return false;
+
+  AsmLine *pop = next_line(line);
+  for (int i = 0; pop && i < 8 && !is_insn(pop, "pop"); i++) {
+    if (!is_simple(pop) || mentions(pop, REG_RSP))
+      return false;
+    pop = next_line(pop);
+  }
+  if (!is_insn(pop, "pop") || pop->nargs != 1 || !is_reg64(pop->args[0]))
+    return false;
+
+  int dst = operand_reg(pop->args[0], NULL);
+  for (AsmLine *p = next_line(line); p != pop; p = next_line(p))
+    if (mentions(p, dst))
+      return false;
+
+  if (operand_reg(line->args[0], NULL) == dst)
+    delete_line(line);
+  else
+    set_insn(line, "mov", 2, line->args[0], pop->args[0]);
+  delete_line(pop);
+  return true;
+}
+
+// mov R, M; mov M, R => mov R, M
+// mov R32, M; movsxd M, R64 => mov R32, M; movsxd R32, R64
+static bool store_reload(AsmLine *line) {
+  if (!is_insn(line, "mov") || line->nargs != 2 || line->args[0][0] != '%' ||
+      !is_mem(line->args[1]))
+    return false;
+
+  AsmLine *next = next_line(line);
+  if (!next || next->kind != AL_INSN || next->nargs != 2 ||
+      strcmp(next->args[0], line->args[1]))
+    return false;
+
+  if (!strcmp(next->op, "mov") && !strcmp(next->args[1], line->args[0])) {
+    delete_line(next);
+    return true;
+  }
+
+  int w1, w2;
+  if (!strcmp(next->op, "movsxd") &&
+      operand_reg(line->args[0], &w1) == operand_reg(next->args[1], &w2) &&
+      w1 == 1 && w2 == 0) {
+    next->args[0] = line->args[0];
+    return true;
+  }
+  return false;
+}
+
+// mov A, B; mov B, A => mov A, B
+static bool mov_back(AsmLine *line) {
+  if (!is_insn(line, "mov") || line->nargs != 2 || !is_reg64(line->args[0]) ||
+      !is_reg64(line->args[1]))
+    return false;
+
+  AsmLine *next = next_line(line);
+  if (!is_insn(next, "mov") || next->nargs != 2 ||
+      strcmp(next->args[0], line->args[1]) || strcmp(next->args[1], line->args[0]))
+    return false;
+  delete_line(next);
+  return true;
+}
+
+// lea M, R; mov (R), X => mov M, X
+//
+// R must be X or be dead after the load.
+static bool lea_load(AsmLine *line) {
+  if (!is_insn(line, "lea") || line->nargs != 2 || !is_reg64(line->args[1]))
+    return false;
+
+  AsmLine *next = next_line(line);
+  if (!next || !is_simple(next) || next->nargs != 2 || !is_mem(next->args[0]) ||
+      !starts_with(next->op, "mov") || is_mem(next->args[1]))
+    return false;
+
+  char *r = line->args[1];
+  if (strlen(next->args[0]) != strlen(r) + 2 || next->args[0][0] != '(' ||
+      strncmp(next->args[0] + 1, r, strlen(r)))
+    return false;
+
+  int reg = operand_reg(r, NULL);
+  int width;
+  bool overwritten = operand_reg(next->args[1], &width) == reg && width <= 1;
+  if (!overwritten && !reg_dead(next_line(next), reg))
+    return false;
+
+  next->args[0] = line->args[0];
+  delete_line(line);
+  return true;
+}
+
+// movsxd X, R64; movsxd R32, R64 => movsxd X, R64
+static bool redundant_ext(AsmLine *line) {
+  if (!is_insn(line, "movsxd") || line->nargs != 2)
+    return false;
+
+  AsmLine *next = next_line(line);
+  int w1, w2;
+  if (!is_insn(next, "movsxd") || next->nargs != 2 ||
+      strcmp(next->args[1], line->args[1]) ||
+      operand_reg(next->args[0], &w1) != operand_reg(line->args[1], &w2) ||
+      w1 != 1 || w2 != 0)
+    return false;
+  delete_line(next);
+  return true;
+}
+
+// add $0, R => (nothing), if the flags it sets are not used
+static bool add_zero(AsmLine *line) {
+  if ((!is_insn(line, "add") && !is_insn(line, "sub")) || line->nargs != 2 ||
+      strcmp(line->args[0], "$0") || !flags_dead(next_line(line)))
+    return false;
+  delete_line(line);
+  return true;
+}
+
+// mov $0, R => xor R32, R32, if the flags it sets are not used
+static bool zero_idiom(AsmLine *line) {
+  int width;
+  if (!is_insn(line, "mov") || line->nargs != 2 || strcmp(line->args[0], "$0"))
+    return false;
+
+  int reg = operand_reg(line->args[1], &width);
+  if (reg == -1 || reg == REG_RSP || width > 1 || !flags_dead(next_line(line)))
+    return false;
+
+  char *r32 = regs[reg][1];
+  set_insn(line, "xor", 2, r32, r32);
+  return true;
+}
+
+static char *negate_cc(char *cc) {
+  static char *pairs[][2] = {
+    {"e", "ne"}, {"l", "ge"}, {"le", "g"}, {"b", "ae"}, {"be", "a"},
+    {"p", "np"}, {"s", "ns"}, {"o", "no"},
+  };
+
+  for (int i = 0; i < sizeof(pairs) / sizeof(*pairs); i++) {
+    if (!strcmp(cc, pairs[i][0]))
+      return pairs[i][1];
+    if (!strcmp(cc, pairs[i][1]))
+      return pairs[i][0];
+  }
+  return NULL;
+}
+
+// setCC %al; movzb %al, %eax; cmp $0, %eax; je L => jNCC L
+//
+// The boolean in %rax must not be used after the branch.
+static bool setcc_branch(AsmLine *line) {
+  if (line->kind != AL_INSN || !starts_with(line->op, "set") || line->nargs != 1 ||
+      strcmp(line->args[0], "%al"))
+    return false;
+
+  char *cc = line->op + 3;
+  if (!negate_cc(cc))
+    return false;
+
+  AsmLine *ext = next_line(line);
+  if (!ext || ext->kind != AL_INSN || ext->nargs != 2 ||
+      (strcmp(ext->op, "movzb") && strcmp(ext->op, "movzx") && strcmp(ext->op, "movzbl")) ||
+      strcmp(ext->args[0], "%al") ||
+      (strcmp(ext->args[1], "%eax") && strcmp(ext->args[1], "%rax")))
+    return false;
+
+  AsmLine *cmp = next_line(ext);
+  if (!is_insn(cmp, "cmp") || cmp->nargs != 2 || strcmp(cmp->args[0], "$0") ||
+      (strcmp(cmp->args[1], "%eax") && strcmp(cmp->args[1], "%rax")))
+    return false;
+
+  AsmLine *jmp = next_line(cmp);
+  if (!is_jump(jmp) || (strcmp(jmp->op, "je") && strcmp(jmp->op, "jne")))
+    return false;
+
+  int rax = 0;
+  if (!reg_dead(next_line(jmp), rax) || !reg_dead(find_label(jmp->args[0]), rax))
+    return false;
+
+  if (!strcmp(jmp->op, "je"))
+    cc = negate_cc(cc);
+  set_insn(line, format("j%s", cc), 1, jmp->args[0], NULL);
+  delete_line(ext);
+  delete_line(cmp);
+  delete_line(jmp);
+  return true;
+}
+
+// jmp L; L: => L:
+static bool jump_next(AsmLine *line) {
+  if (!is_jump(line))
+    return false;
+
+  for (AsmLine *p = next_line(line); p && p->kind == AL_LABEL; p = next_line(p)) {
+    if (!strcmp(p->op, line->args[0])) {
+      delete_line(line);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the first instruction at a label.
+static AsmLine *jump_target(char *label) {
+  AsmLine *line = find_label(label);
+  while (line && line->kind == AL_LABEL)
+    line = next_line(line);
+  return line;
+}
+
+// jmp L1; ...; L1: jmp L2 => jmp L2; ...; L1: jmp L2
+//
+// A chain of jumps is followed to its end. A cycle of jumps is left
+// alone.
+static bool jump_thread(AsmLine *line) {
+  if (!is_jump(line))
+    return false;
+
+  char *label = line->args[0];
+  for (int i = 0; i < 8; i++) {
+    AsmLine *target = jump_target(label);
+    if (!is_insn(target, "jmp") || !is_jump(target) || !find_label(target->args[0])) {
+      if (label == line->args[0])
+        return false;
+      line->args[0] = label;
+      return true;
+    }
+    label = target->args[0];
+  }
+  return false;
+}
+
+// jmp L; X; M: => jmp L; M:
+//
+// Instructions between an unconditional jump and the next label are
+// never executed.
+static bool dead_code(AsmLine *line) {
+  if (!is_insn(line, "jmp") && !is_insn(line, "ret"))
+    return false;
+
+  bool changed = false;
+  AsmLine *p = next_line(line);
+  while (p && p->kind == AL_INSN) {
+    AsmLine *next = next_line(p);
+    delete_line(p);
+    changed = true;
+    p = next;
+  }
+  return changed;
+}
+
+static bool (*rules[])(AsmLine *) = {
+  [RULE_SELF_MOV] = self_mov,
+  [RULE_PUSH_POP] = push_pop,
+  [RULE_STORE_RELOAD] = store_reload,
+  [RULE_MOV_BACK] = mov_back,
+  [RULE_LEA_LOAD] = lea_load,
+  [RULE_REDUNDANT_EXT] = redundant_ext,
+  [RULE_ADD_ZERO] = add_zero,
+  [RULE_ZERO_IDIOM] = zero_idiom,
+  [RULE_SETCC_BRANCH] = setcc_branch,
+  [RULE_JUMP_NEXT] = jump_next,
+  [RULE_JUMP_THREAD] = jump_thread,
+  [RULE_DEAD_CODE] = dead_code,
+};
+
+AsmLine *peephole(AsmLine *lines) {
+  head = lines;
+  labels = (HashMap){};
+  for (AsmLine *line = head; line; line = line->next)
+    if (line->kind == AL_LABEL)
+      hashmap_put(&labels, line->op, line);
+
+  // A rewrite may enable another one, so the list is scanned until
+  // nothing changes. Jump threading can go around a cycle of jumps
+  // forever, hence the limit.
+  for (int pass = 0; pass < 10; pass++) {
+    bool changed = false;
+
+    for (AsmLine *line = head; line;) {
+      // Rules may delete the current line, so remember the neighbors.
+      AsmLine *prev = line->prev;
+      AsmLine *next = line->next;
+      bool applied = false;
+
+      if (line->kind == AL_INSN) {
+        for (int i = 0; i < NUM_RULES; i++) {
+          if (rules[i](line)) {
+            rule_count[i]++;
+            applied = true;
+            break;
+          }
+        }
+      }
+
+      if (applied) {
+        changed = true;
+        // Retry at the previous line, which may now match a pattern.
+        line = prev ? prev : head;
+        if (!line)
+          break;
+        continue;
+      }
+      line = next;
+    }
+
+    if (!changed)
+      break;
+  }
+  return head;
+}
+
+void print_peephole_stats(FILE *out) {
+  for (int i = 0; i < NUM_RULES; i++)
+    fprintf(out, "peephole: %-14s %ld\n", rule_names[i], rule_count[i]);
+}
@@ -24,30 +24,13 @@
 
 #include "chibicc.h"
 
-typedef struct MacroParam MacroParam;
-struct MacroParam {
-  MacroParam *next;
-  char *name;
-};
-
 typedef struct MacroArg MacroArg;
 struct MacroArg {
   MacroArg *next;
-  char *name;
+  Atom *name;
   bool is_va_args;
   Token *tok;
-};
-
-typedef Token *macro_handler_fn(Token *);
-
-typedef struct Macro Macro;
-struct Macro {
-  char *name;
-  bool is_objlike; // Object-like or function-like
-  MacroParam *params;
-  char *va_args_name;
-  Token *body;
-  macro_handler_fn *handler;
+  Token *expanded; // Fully macro-expanded `tok`, computed on first use
 };
 
 // `#if` can be nested, so we use a stack to manage nested `#if`s.
@@ -62,19 +45,26 @@ struct CondIncl {
 typedef struct Hideset Hideset;
 struct Hideset {
   Hideset *next;
-  char *name;
+  Atom *name;
 };
 
-static HashMap macros;
 static CondIncl *cond_incl;
 static HashMap pragma_once;
 static int include_next_idx;
 
+// Names of macros defined or undefined while recording is on. This is
+// used to write precompiled headers, which only have to contain the
+// macros that differ from the ones given on the command line.
+static bool macro_log_on;
+static Atom **macro_log;
+static int macro_log_len;
+static int macro_log_cap;
+
 static Token *preprocess2(Token *tok);
 static Macro *find_macro(Token *tok);
 
 static bool is_hash(Token *tok) {
-  return tok->at_bol && equal(tok, "#");
+  return tok->at_bol && equal(tok, P_HASH);
 }
 
 // Some preprocessor directives such as #include allow extraneous
@@ -89,7 +79,7 @@ static Token *skip_line(Token *tok) {
 }
 
 static Token *copy_token(Token *tok) {
-  Token *t = calloc(1, sizeof(Token));
+  Token *t = arena_alloc(MEM_TOKEN, sizeof(Token));
   *t = *tok;
   t->next = NULL;
   return t;
@@ -102,48 +92,96 @@ static Token *new_eof(Token *tok) {
   return t;
 }
 
-static Hideset *new_hideset(char *name) {
-  Hideset *hs = calloc(1, sizeof(Hideset));
-  hs->name = name;
+// Hidesets are hash-consed. A hideset is a list of atoms sorted by
+// ID, and lists with the same contents share their cells, so equal
+// sets are the same pointer. This makes unions cheap to memoize:
+// every token of an expansion gets the same union of the same sets.
+static HashMap hideset_cells;
+static HashMap hideset_unions;
+
+static Hideset *hideset_cons(Atom *name, Hideset *next) {
+  // A cell is its own key.
+  Hideset key = {next, name};
+  Hideset *hs = hashmap_get2(&hideset_cells, (char *)&key, sizeof(key));
+  if (hs)
+    return hs;
+
+  hs = arena_alloc(MEM_HIDESET, sizeof(Hideset));
+  *hs = key;
+  hashmap_put2(&hideset_cells, (char *)hs, sizeof(Hideset), hs);
   return hs;
 }
 
-static Hideset *hideset_union(Hideset *hs1, Hideset *hs2) {
-  Hideset head = {};
-  Hideset *cur = &head;
+static Hideset *new_hideset(Atom *name) {
+  return hideset_cons(name, NULL);
+}
 
-  for (; hs1; hs1 = hs1->next)
-    cur = cur->next = new_hideset(hs1->name);
-  cur->next = hs2;
-  return head.next;
+static Hideset *hideset_merge(Hideset *hs1, Hideset *hs2) {
+  if (!hs1 || hs1 == hs2)
+    return hs2;
+  if (!hs2)
+    return hs1;
+  if (hs1->name->id < hs2->name->id)
+    return hideset_cons(hs1->name, hideset_merge(hs1->next, hs2));
+  if (hs1->name->id > hs2->name->id)
+    return hideset_cons(hs2->name, hideset_merge(hs1, hs2->next));
+  return hideset_cons(hs1->name, hideset_merge(hs1->next, hs2->next));
 }
 
-static bool hideset_contains(Hideset *hs, char *s, int len) {
-  for (; hs; hs = hs->next)
-    if (strlen(hs->name) == len && !strncmp(hs->name, s, len))
+static Hideset *hideset_union(Hideset *hs1, Hideset *hs2) {
+  if (!hs1 || hs1 == hs2)
+    return hs2;
+  if (!hs2)
+    return hs1;
+
+  Hideset *key[] = {hs1, hs2};
+  Hideset *hs = hashmap_get2(&hideset_unions, (char *)key, sizeof(key));
+  if (hs)
+    return hs;
+
+  hs = hideset_merge(hs1, hs2);
+  Hideset **k = arena_alloc(MEM_HIDESET, sizeof(key));
+  k[0] = hs1;
+  k[1] = hs2;
+  hashmap_put2(&hideset_unions, (char *)k, sizeof(key), hs);
+  return hs;
+}
+
+static bool hideset_contains(Hideset *hs, Atom *name) {
+  for (; hs && hs->name->id <= name->id; hs = hs->next)
+    if (hs->name == name)
       return true;
   return false;
 }
 
 static Hideset *hideset_intersection(Hideset *hs1, Hideset *hs2) {
-  Hideset head = {};
-  Hideset *cur = &head;
-
-  for (; hs1; hs1 = hs1->next)
-    if (hideset_contains(hs2, hs1->name, strlen(hs1->name)))
-      cur = cur->next = new_hideset(hs1->name);
-  return head.next;
+  if (!hs1 || !hs2)
+    return NULL;
+  if (hs1 == hs2)
+    return hs1;
+  if (hs1->name->id < hs2->name->id)
+    return hideset_intersection(hs1->next, hs2);
+  if (hs1->name->id > hs2->name->id)
+    return hideset_intersection(hs1, hs2->next);
+  return hideset_cons(hs1->name, hideset_intersection(hs1->next, hs2->next));
 }
 
-static Token *add_hideset(Token *tok, Hideset *hs) {
+// Add `hs` to the hidesets of the tokens of an expansion, record the
+// macro token they came from and put the list in front of `next`.
+// Tokens are copied if `copy` is true; the result of subst() is a
+// private list, so it is updated in place.
+static Token *splice_expansion(Token *tok, Hideset *hs, Token *origin, Token *next,
+                               bool copy) {
   Token head = {};
   Token *cur = &head;
 
-  for (; tok; tok = tok->next) {
-    Token *t = copy_token(tok);
+  for (; tok->kind != TK_EOF; tok = tok->next) {
+    Token *t = copy ? copy_token(tok) : tok;
     t->hideset = hideset_union(t->hideset, hs);
+    t->origin = origin;
     cur = cur->next = t;
   }
+  cur->next = next;
   return head.next;
 }
 
@@ -164,12 +202,12 @@ static Token *append(Token *tok1, Token *tok2) {
 static Token *skip_cond_incl2(Token *tok) {
   while (tok->kind != TK_EOF) {
     if (is_hash(tok) &&
-        (equal(tok->next, "if") || equal(tok->next, "ifdef") ||
-         equal(tok->next, "ifndef"))) {
+        (equal(tok->next, KW_IF) || equal(tok->next, ID_IFDEF) ||
+         equal(tok->next, ID_IFNDEF))) {
       tok = skip_cond_incl2(tok->next->next);
       continue;
     }
-    if (is_hash(tok) && equal(tok->next, "endif"))
+    if (is_hash(tok) && equal(tok->next, ID_ENDIF))
       return tok->next->next;
     tok = tok->next;
   }
@@ -181,15 +219,15 @@ static Token *skip_cond_incl2(Token *tok) {
 static Token *skip_cond_incl(Token *tok) {
   while (tok->kind != TK_EOF) {
     if (is_hash(tok) &&
-        (equal(tok->next, "if") || equal(tok->next, "ifdef") ||
-         equal(tok->next, "ifndef"))) {
+        (equal(tok->next, KW_IF) || equal(tok->next, ID_IFDEF) ||
+         equal(tok->next, ID_IFNDEF))) {
       tok = skip_cond_incl2(tok->next->next);
       continue;
     }
 
     if (is_hash(tok) &&
-        (equal(tok->next, "elif") || equal(tok->next, "else") ||
-         equal(tok->next, "endif")))
+        (equal(tok->next, ID_ELIF) || equal(tok->next, KW_ELSE) ||
+         equal(tok->next, ID_ENDIF)))
       break;
     tok = tok->next;
   }
@@ -252,9 +290,9 @@ static Token *read_const_expr(Token **rest, Token *tok) {
   while (tok->kind != TK_EOF) {
     // "defined(foo)" or "defined foo" becomes "1" if macro "foo"
     // is defined. Otherwise "0".
-    if (equal(tok, "defined")) {
+    if (equal(tok, ID_DEFINED)) {
       Token *start = tok;
-      bool has_paren = consume(&tok, tok->next, "(");
+      bool has_paren = consume(&tok, tok->next, P_LPAREN);
 
       if (tok->kind != TK_IDENT)
         error_tok(start, "macro name must be an identifier");
@@ -262,7 +300,7 @@ static Token *read_const_expr(Token **rest, Token *tok) {
       tok = tok->next;
 
       if (has_paren)
-        tok = skip(tok, ")");
+        tok = skip(tok, P_RPAREN);
 
       cur = cur->next = new_num_token(m ? 1 : 0, start);
       continue;
@@ -320,43 +358,65 @@ static CondIncl *push_cond_incl(Token *tok, bool included) {
 static Macro *find_macro(Token *tok) {
   if (tok->kind != TK_IDENT)
     return NULL;
-  return hashmap_get2(&macros, tok->loc, tok->len);
+  return tok->atom->macro;
+}
+
+static void log_macro(Atom *name) {
+  if (!macro_log_on)
+    return;
+  if (macro_log_len == macro_log_cap) {
+    macro_log_cap = macro_log_cap ? macro_log_cap * 2 : 256;
+    macro_log = realloc(macro_log, sizeof(Atom *) * macro_log_cap);
+  }
+  macro_log[macro_log_len++] = name;
+}
+
+void record_macro_changes(void) {
+  macro_log_on = true;
+}
+
+// Returns the names of macros changed since record_macro_changes()
+// was called. A name may appear more than once.
+Atom **get_macro_changes(int *len) {
+  *len = macro_log_len;
+  return macro_log;
 }
 
 static Macro *add_macro(char *name, bool is_objlike, Token *body) {
   Macro *m = calloc(1, sizeof(Macro));
-  m->name = name;
+  m->name = intern(name, strlen(name));
   m->is_objlike = is_objlike;
   m->body = body;
-  hashmap_put(&macros, name, m);
+  m->name->macro = m;
+  log_macro(m->name);
   return m;
 }
 
-static MacroParam *read_macro_params(Token **rest, Token *tok, char **va_args_name) {
+static MacroParam *read_macro_params(Token **rest, Token *tok, Atom **va_args_name) {
   MacroParam head = {};
   MacroParam *cur = &head;
 
-  while (!equal(tok, ")")) {
+  while (!equal(tok, P_RPAREN)) {
     if (cur != &head)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
 
-    if (equal(tok, "...")) {
-      *va_args_name = "__VA_ARGS__";
-      *rest = skip(tok->next, ")");
+    if (equal(tok, P_ELLIPSIS)) {
+      *va_args_name = get_atom(ID___VA_ARGS__);
+      *rest = skip(tok->next, P_RPAREN);
       return head.next;
     }
 
     if (tok->kind != TK_IDENT)
       error_tok(tok, "expected an identifier");
 
-    if (equal(tok->next, "...")) {
-      *va_args_name = strndup(tok->loc, tok->len);
-      *rest = skip(tok->next->next, ")");
+    if (equal(tok->next, P_ELLIPSIS)) {
+      *va_args_name = tok->atom;
+      *rest = skip(tok->next->next, P_RPAREN);
       return head.next;
     }
 
     MacroParam *m = calloc(1, sizeof(MacroParam));
-    m->name = strndup(tok->loc, tok->len);
+    m->name = tok->atom;
     cur = cur->next = m;
     tok = tok->next;
   }
@@ -368,12 +428,12 @@ static MacroParam *read_macro_params(Token **rest, Token *tok, char **va_args_na
 static void read_macro_definition(Token **rest, Token *tok) {
   if (tok->kind != TK_IDENT)
     error_tok(tok, "macro name must be an identifier");
-  char *name = strndup(tok->loc, tok->len);
+  char *name = tok->atom->name;
   tok = tok->next;
 
-  if (!tok->has_space && equal(tok, "(")) {
+  if (!tok->has_space && equal(tok, P_LPAREN)) {
     // Function-like macro
-    char *va_args_name = NULL;
+    Atom *va_args_name = NULL;
     MacroParam *params = read_macro_params(&tok, tok->next, &va_args_name);
 
     Macro *m = add_macro(name, false, copy_line(rest, tok));
@@ -391,17 +451,17 @@ static MacroArg *read_macro_arg_one(Token **rest, Token *tok, bool read_rest) {
   int level = 0;
 
   for (;;) {
-    if (level == 0 && equal(tok, ")"))
+    if (level == 0 && equal(tok, P_RPAREN))
       break;
-    if (level == 0 && !read_rest && equal(tok, ","))
+    if (level == 0 && !read_rest && equal(tok, P_COMMA))
       break;
 
     if (tok->kind == TK_EOF)
       error_tok(tok, "premature end of input");
 
-    if (equal(tok, "("))
+    if (equal(tok, P_LPAREN))
       level++;
-    else if (equal(tok, ")"))
+    else if (equal(tok, P_RPAREN))
       level--;
 
     cur = cur->next = copy_token(tok);
@@ -417,7 +477,7 @@ static MacroArg *read_macro_arg_one(Token **rest, Token *tok, bool read_rest) {
 }
 
 static MacroArg *
-read_macro_args(Token **rest, Token *tok, MacroParam *params, char *va_args_name) {
+read_macro_args(Token **rest, Token *tok, MacroParam *params, Atom *va_args_name) {
   Token *start = tok;
   tok = tok->next->next;
 
@@ -427,19 +487,19 @@ read_macro_args(Token **rest, Token *tok, MacroParam *params, char *va_args_name
   MacroParam *pp = params;
   for (; pp; pp = pp->next) {
     if (cur != &head)
-      tok = skip(tok, ",");
+      tok = skip(tok, P_COMMA);
     cur = cur->next = read_macro_arg_one(&tok, tok, false);
     cur->name = pp->name;
   }
 
   if (va_args_name) {
     MacroArg *arg;
-    if (equal(tok, ")")) {
+    if (equal(tok, P_RPAREN)) {
       arg = calloc(1, sizeof(MacroArg));
       arg->tok = new_eof(tok);
     } else {
       if (pp != params)
-        tok = skip(tok, ",");
+        tok = skip(tok, P_COMMA);
       arg = read_macro_arg_one(&tok, tok, true);
     }
     arg->name = va_args_name;;
@@ -449,14 +509,14 @@ read_macro_args(Token **rest, Token *tok, MacroParam *params, char *va_args_name
     error_tok(start, "too many arguments");
   }
 
-  skip(tok, ")");
+  skip(tok, P_RPAREN);
   *rest = tok;
   return head.next;
 }
 
 static MacroArg *find_arg(MacroArg *args, Token *tok) {
   for (MacroArg *ap = args; ap; ap = ap->next)
-    if (tok->len == strlen(ap->name) && !strncmp(tok->loc, ap->name, tok->len))
+    if (tok->atom == ap->name)
       return ap;
   return NULL;
 }
@@ -509,7 +569,7 @@ static Token *paste(Token *lhs, Token *rhs) {
 
 static bool has_varargs(MacroArg *args) {
   for (MacroArg *ap = args; ap; ap = ap->next)
-    if (!strcmp(ap->name, "__VA_ARGS__"))
+    if (ap->name->id == ID___VA_ARGS__)
       return ap->tok->kind != TK_EOF;
   return false;
 }
@@ -521,7 +581,7 @@ static Token *subst(Token *tok, MacroArg *args) {
 
   while (tok->kind != TK_EOF) {
     // "#" followed by a parameter is replaced with stringized actuals.
-    if (equal(tok, "#")) {
+    if (equal(tok, P_HASH)) {
       MacroArg *arg = find_arg(args, tok->next);
       if (!arg)
         error_tok(tok->next, "'#' is not followed by a macro parameter");
@@ -533,7 +593,7 @@ static Token *subst(Token *tok, MacroArg *args) {
     // [GNU] If __VA_ARG__ is empty, `,##__VA_ARGS__` is expanded
     // to the empty token list. Otherwise, its expaned to `,` and
     // __VA_ARGS__.
-    if (equal(tok, ",") && equal(tok->next, "##")) {
+    if (equal(tok, P_COMMA) && equal(tok->next, P_HASHHASH)) {
       MacroArg *arg = find_arg(args, tok->next->next);
       if (arg && arg->is_va_args) {
         if (arg->tok->kind == TK_EOF) {
@@ -546,7 +606,7 @@ static Token *subst(Token *tok, MacroArg *args) {
       }
     }
 
-    if (equal(tok, "##")) {
+    if (equal(tok, P_HASHHASH)) {
       if (cur == &head)
         error_tok(tok, "'##' cannot appear at start of macro expansion");
 
@@ -571,7 +631,7 @@ static Token *subst(Token *tok, MacroArg *args) {
 
     MacroArg *arg = find_arg(args, tok);
 
-    if (arg && equal(tok->next, "##")) {
+    if (arg && equal(tok->next, P_HASHHASH)) {
       Token *rhs = tok->next->next;
 
       if (arg->tok->kind == TK_EOF) {
@@ -594,23 +654,29 @@ static Token *subst(Token *tok, MacroArg *args) {
 
     // If __VA_ARG__ is empty, __VA_OPT__(x) is expanded to the
     // empty token list. Otherwise, __VA_OPT__(x) is expanded to x.
-    if (equal(tok, "__VA_OPT__") && equal(tok->next, "(")) {
+    if (equal(tok, ID___VA_OPT__) && equal(tok->next, P_LPAREN)) {
       MacroArg *arg = read_macro_arg_one(&tok, tok->next->next, true);
       if (has_varargs(args))
         for (Token *t = arg->tok; t->kind != TK_EOF; t = t->next)
           cur = cur->next = t;
-      tok = skip(tok, ")");
+      tok = skip(tok, P_RPAREN);
       continue;
     }
 
     // Handle a macro token. Macro arguments are completely macro-expanded
-    // before they are substituted into a macro body.
+    // before they are substituted into a macro body. An argument is
+    // expanded once no matter how many times it is used.
     if (arg) {
-      Token *t = preprocess2(arg->tok);
-      t->at_bol = tok->at_bol;
-      t->has_space = tok->has_space;
-      for (; t->kind != TK_EOF; t = t->next)
+      if (!arg->expanded)
+        arg->expanded = preprocess2(arg->tok);
+
+      Token *first = cur;
+      for (Token *t = arg->expanded; t->kind != TK_EOF; t = t->next)
         cur = cur->next = copy_token(t);
+      if (cur != first) {
+        first->next->at_bol = tok->at_bol;
+        first->next->has_space = tok->has_space;
+      }
       tok = tok->next;
       continue;
     }
@@ -628,7 +694,7 @@ static Token *subst(Token *tok, MacroArg *args) {
 // If tok is a macro, expand it and return true.
 // Otherwise, do nothing and return false.
 static bool expand_macro(Token **rest, Token *tok) {
-  if (hideset_contains(tok->hideset, tok->loc, tok->len))
+  if (hideset_contains(tok->hideset, tok->atom))
     return false;
 
   Macro *m = find_macro(tok);
@@ -645,10 +711,7 @@ static bool expand_macro(Token **rest, Token *tok) {
   // Object-like macro application
   if (m->is_objlike) {
     Hideset *hs = hideset_union(tok->hideset, new_hideset(m->name));
-    Token *body = add_hideset(m->body, hs);
-    for (Token *t = body; t->kind != TK_EOF; t = t->next)
-      t->origin = tok;
-    *rest = append(body, tok->next);
+    *rest = splice_expansion(m->body, hs, tok, tok->next, true);
     (*rest)->at_bol = tok->at_bol;
     (*rest)->has_space = tok->has_space;
     return true;
@@ -656,7 +719,7 @@ static bool expand_macro(Token **rest, Token *tok) {
 
   // If a funclike macro token is not followed by an argument list,
   // treat it as a normal identifier.
-  if (!equal(tok->next, "("))
+  if (!equal(tok->next, P_LPAREN))
     return false;
 
   // Function-like macro application
@@ -673,10 +736,7 @@ static bool expand_macro(Token **rest, Token *tok) {
   hs = hideset_union(hs, new_hideset(m->name));
 
   Token *body = subst(m->body, args);
-  body = add_hideset(body, hs);
-  for (Token *t = body; t->kind != TK_EOF; t = t->next)
-    t->origin = macro_token;
-  *rest = append(body, tok->next);
+  *rest = splice_expansion(body, hs, macro_token, tok->next, false);
   (*rest)->at_bol = macro_token->at_bol;
   (*rest)->has_space = macro_token->has_space;
   return true;
@@ -727,13 +787,13 @@ static char *read_include_filename(Token **rest, Token *tok, bool *is_dquote) {
   }
 
   // Pattern 2: #include <foo.h>
-  if (equal(tok, "<")) {
+  if (equal(tok, P_LT)) {
     // Reconstruct a filename from a sequence of tokens between
     // "<" and ">".
     Token *start = tok;
 
     // Find closing ">".
-    for (; !equal(tok, ">"); tok = tok->next)
+    for (; !equal(tok, P_GT); tok = tok->next)
       if (tok->at_bol || tok->kind == TK_EOF)
         error_tok(tok, "expected '>'");
 
@@ -759,19 +819,19 @@ static char *read_include_filename(Token **rest, Token *tok, bool *is_dquote) {
 //   #define FOO_H
 //   ...
 //   #endif
-static char *detect_include_guard(Token *tok) {
+static Atom *detect_include_guard(Token *tok) {
   // Detect the first two lines.
-  if (!is_hash(tok) || !equal(tok->next, "ifndef"))
+  if (!is_hash(tok) || !equal(tok->next, ID_IFNDEF))
     return NULL;
   tok = tok->next->next;
 
   if (tok->kind != TK_IDENT)
     return NULL;
 
-  char *macro = strndup(tok->loc, tok->len);
+  Atom *macro = tok->atom;
   tok = tok->next;
 
-  if (!is_hash(tok) || !equal(tok->next, "define") || !equal(tok->next->next, macro))
+  if (!is_hash(tok) || !equal(tok->next, ID_DEFINE) || tok->next->next->atom != macro)
     return NULL;
 
   // Read until the end of the file.
@@ -781,10 +841,10 @@ static char *detect_include_guard(Token *tok) {
       continue;
     }
 
-    if (equal(tok->next, "endif") && tok->next->next->kind == TK_EOF)
+    if (equal(tok->next, ID_ENDIF) && tok->next->next->kind == TK_EOF)
       return macro;
 
-    if (equal(tok, "if") || equal(tok, "ifdef") || equal(tok, "ifndef"))
+    if (equal(tok, KW_IF) || equal(tok, ID_IFDEF) || equal(tok, ID_IFNDEF))
       tok = skip_cond_incl(tok->next);
     else
       tok = tok->next;
@@ -793,6 +853,8 @@ static char *detect_include_guard(Token *tok) {
 }
 
 static Token *include_file(Token *tok, char *path, Token *filename_tok) {
+  stat_count[STAT_INCLUDES]++;
+
   // Check for "#pragma once"
   if (hashmap_get(&pragma_once, path))
     return tok;
@@ -801,15 +863,26 @@ static Token *include_file(Token *tok, char *path, Token *filename_tok) {
   // by the usual #ifndef ... #endif pattern, we may be able to
   // skip the file without opening it.
   static HashMap include_guards;
-  char *guard_name = hashmap_get(&include_guards, path);
-  if (guard_name && hashmap_get(&macros, guard_name))
+  Atom *guard_name = hashmap_get(&include_guards, path);
+  if (guard_name && guard_name->macro)
     return tok;
 
-  Token *tok2 = tokenize_file(path);
-  if (!tok2)
-    error_tok(filename_tok, "%s: cannot open file: %s", path, strerror(errno));
+  // With -fheader-cache, a header tokenized by another compiler
+  // process may be loaded from disk instead.
+  Token *tok2 = NULL;
+  if (opt_header_cache)
+    tok2 = load_cached_header(path, &guard_name);
+
+  if (!tok2) {
+    tok2 = tokenize_file(path);
+    if (!tok2)
+      error_tok(filename_tok, "%s: cannot open file: %s", path, strerror(errno));
+
+    guard_name = detect_include_guard(tok2);
+    if (opt_header_cache)
+      save_cached_header(path, tok2, guard_name);
+  }
 
-  guard_name = detect_include_guard(tok2);
   if (guard_name)
     hashmap_put(&include_guards, path, guard_name);
 
@@ -842,8 +915,10 @@ static Token *preprocess2(Token *tok) {
 
   while (tok->kind != TK_EOF) {
     // If it is a macro, expand it.
-    if (expand_macro(&tok, tok))
+    if (expand_macro(&tok, tok)) {
+      stat_count[STAT_MACRO_EXPANSIONS]++;
       continue;
+    }
 
     // Pass through if it is not a "#".
     if (!is_hash(tok)) {
@@ -857,7 +932,7 @@ static Token *preprocess2(Token *tok) {
     Token *start = tok;
     tok = tok->next;
 
-    if (equal(tok, "include")) {
+    if (equal(tok, ID_INCLUDE)) {
       bool is_dquote;
       char *filename = read_include_filename(&tok, tok->next, &is_dquote);
 
@@ -874,7 +949,7 @@ static Token *preprocess2(Token *tok) {
       continue;
     }
 
-    if (equal(tok, "include_next")) {
+    if (equal(tok, ID_INCLUDE_NEXT)) {
       bool ignore;
       char *filename = read_include_filename(&tok, tok->next, &ignore);
       char *path = search_include_next(filename);
@@ -882,21 +957,21 @@ static Token *preprocess2(Token *tok) {
       continue;
     }
 
-    if (equal(tok, "define")) {
+    if (equal(tok, ID_DEFINE)) {
       read_macro_definition(&tok, tok->next);
       continue;
     }
 
-    if (equal(tok, "undef")) {
+    if (equal(tok, ID_UNDEF)) {
       tok = tok->next;
       if (tok->kind != TK_IDENT)
         error_tok(tok, "macro name must be an identifier");
-      undef_macro(strndup(tok->loc, tok->len));
+      undef_macro(tok->atom->name);
       tok = skip_line(tok->next);
       continue;
     }
 
-    if (equal(tok, "if")) {
+    if (equal(tok, KW_IF)) {
       long val = eval_const_expr(&tok, tok);
       push_cond_incl(start, val);
       if (!val)
@@ -904,7 +979,7 @@ static Token *preprocess2(Token *tok) {
       continue;
     }
 
-    if (equal(tok, "ifdef")) {
+    if (equal(tok, ID_IFDEF)) {
       bool defined = find_macro(tok->next);
       push_cond_incl(tok, defined);
       tok = skip_line(tok->next->next);
@@ -913,7 +988,7 @@ static Token *preprocess2(Token *tok) {
       continue;
     }
 
-    if (equal(tok, "ifndef")) {
+    if (equal(tok, ID_IFNDEF)) {
       bool defined = find_macro(tok->next);
       push_cond_incl(tok, !defined);
       tok = skip_line(tok->next->next);
@@ -922,7 +997,7 @@ static Token *preprocess2(Token *tok) {
       continue;
     }
 
-    if (equal(tok, "elif")) {
+    if (equal(tok, ID_ELIF)) {
       if (!cond_incl || cond_incl->ctx == IN_ELSE)
         error_tok(start, "stray #elif");
       cond_incl->ctx = IN_ELIF;
@@ -934,7 +1009,7 @@ static Token *preprocess2(Token *tok) {
       continue;
     }
 
-    if (equal(tok, "else")) {
+    if (equal(tok, KW_ELSE)) {
       if (!cond_incl || cond_incl->ctx == IN_ELSE)
         error_tok(start, "stray #else");
       cond_incl->ctx = IN_ELSE;
@@ -945,7 +1020,7 @@ static Token *preprocess2(Token *tok) {
       continue;
     }
 
-    if (equal(tok, "endif")) {
+    if (equal(tok, ID_ENDIF)) {
       if (!cond_incl)
         error_tok(start, "stray #endif");
       cond_incl = cond_incl->next;
@@ -953,7 +1028,7 @@ static Token *preprocess2(Token *tok) {
       continue;
     }
 
-    if (equal(tok, "line")) {
+    if (equal(tok, ID_LINE)) {
       read_line_marker(&tok, tok->next);
       continue;
     }
@@ -963,20 +1038,20 @@ static Token *preprocess2(Token *tok) {
       continue;
     }
 
-    if (equal(tok, "pragma") && equal(tok->next, "once")) {
+    if (equal(tok, ID_PRAGMA) && equal(tok->next, ID_ONCE)) {
       hashmap_put(&pragma_once, tok->file->name, (void *)1);
       tok = skip_line(tok->next->next);
       continue;
     }
 
-    if (equal(tok, "pragma")) {
+    if (equal(tok, ID_PRAGMA)) {
       do {
         tok = tok->next;
       } while (!tok->at_bol);
       continue;
     }
 
-    if (equal(tok, "error"))
+    if (equal(tok, ID_ERROR))
       error_tok(tok, "error");
 
     // `#`-only line is legal. It's called a null directive.
@@ -996,7 +1071,17 @@ void define_macro(char *name, char *buf) {
 }
 
 void undef_macro(char *name) {
-  hashmap_delete(&macros, name);
+  Atom *atom = intern(name, strlen(name));
+  atom->macro = NULL;
+  log_macro(atom);
+}
+
+bool is_pragma_once(char *path) {
+  return hashmap_get(&pragma_once, path);
+}
+
+void set_pragma_once(char *path) {
+  hashmap_put(&pragma_once, path, (void *)1);
 }
 
 static Macro *add_builtin(char *name, macro_handler_fn *fn) {
@@ -0,0 +1,225 @@
+#!/bin/bash
+#
+# Offline benchmarks for compile speed and for the speed of generated
+# code. Nothing is downloaded; the inputs are the compiler's own
+# sources, generated translation units and test/bench/kernels.c.
+#
+# Usage: test/bench.sh ./chibicc [results [baseline]]
+#
+# Results are written as "name value" lines to `results` (default
+# tmp-bench.txt). If `baseline` (default bench-baseline.txt) exists,
+# each result is compared with it. `make bench-baseline` saves the
+# current results as the baseline. Times depend on the machine, so a
+# baseline is only meaningful on the machine that recorded it.
+#
+# BENCH_RUNS sets how many times each measurement is repeated (the
+# fastest run counts) and BENCH_SCALE scales the work of the kernels.
+#
+# The script exits with status 1 if any result is worse than the
+# baseline by more than BENCH_THRESHOLD percent (default 5). Set
+# BENCH_NO_FAIL=1 to only print the comparison.
+
+chibicc=$(realpath $1)
+results=${2:-tmp-bench.txt}
+baseline=${3:-bench-baseline.txt}
+runs=${BENCH_RUNS:-3}
+scale=${BENCH_SCALE:-1}
+threshold=${BENCH_THRESHOLD:-5}
+cc=${CC:-cc}
+
+tmp=`mktemp -d /tmp/chibicc-bench-XXXXXX`
+trap 'rm -rf $tmp' INT TERM HUP EXIT
+
+: > $results
+
+fail() {
+  echo "bench: $1" >&2
+  exit 1
+}
+
+report() {
+  echo "$1 $2" >> $results
+  printf '%-36s %12s\n' "$1" "$2"
+}
+
+now_ms() {
+  echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# Generates a large translation unit without system headers, so that
+# it measures the compiler rather than the headers of the host.
+generate_source() {
+  awk -v n=$1 'BEGIN {
+    print "#define MIX(a, b) ((a) * 31 + (b))"
+    print "typedef struct { int a, b; double c; long d[4]; } S;"
+    for (i = 0; i < n; i++) {
+      printf "static int f%d(S *s, int x) {\n", i
+      print  "  int y = MIX(x, s->a);"
+      print  "  for (int i = 0; i < s->b; i++) {"
+      print  "    switch ((y + i) & 3) {"
+      print  "    case 0: y += i; break;"
+      print  "    case 1: y ^= MIX(i, y) >> 3; break;"
+      print  "    case 2: s->d[i & 3] += y; break;"
+      print  "    default: y = y * 7 - (int)s->c;"
+      print  "    }"
+      print  "  }"
+      print  "  if (y > s->a && x < 100)"
+      print  "    s->c += y * 0.5;"
+      print  "  else"
+      print  "    s->c -= x / 3.0;"
+      printf "  return y ^ %d;\n", i
+      print  "}"
+      print  ""
+    }
+    print "int main(void) {"
+    print "  S s = {1, 3, 0};"
+    print "  int r = 0;"
+    for (i = 0; i < n; i++)
+      printf "  r += f%d(&s, %d);\n", i, i
+    print "  return r & 1;"
+    print "}"
+  }'
+}
+
+# Generates a single function with a long chain of ifs. Its number of
+# basic blocks and virtual registers grows with n, so compile time
+# that is superlinear in the size of a function shows up here.
+generate_large_function() {
+  awk -v n=$1 'BEGIN {
+    print "int f(int x) {"
+    print "  int s = 0;"
+    for (i = 0; i < n; i++)
+      printf "  if (x == %d) s += %d * x;\n", i, i
+    print "  return s;"
+    print "}"
+  }'
+}
+
+# compile_speed name flags files...
+#
+# Compiles each file to an object file. Reports the wall time of the
+# fastest run, lines per second and the peak RSS of cc1. Lines include
+# only the given files, not the headers they include.
+compile_speed() {
+  local name=$1 flags=$2
+  shift 2
+
+  local lines=$(cat "$@" | wc -l)
+  local best=
+
+  for i in $(seq $runs); do
+    rm -f $tmp/report.json
+    local start=$(now_ms)
+    for f in "$@"; do
+      $chibicc $flags -Iinclude -ftime-report=$tmp/report.json \
+        -c -o $tmp/out.o $f || fail "$name: cannot compile $f"
+    done
+    local t=$(( $(now_ms) - start ))
+    [ -z "$best" -o "$t" -lt "${best:-0}" ] && best=$t
+  done
+
+  local rss=$(sed -n 's/^{"process":"cc1".*"max_rss_kb":\([0-9]*\)}$/\1/p' \
+                $tmp/report.json | sort -n | tail -1)
+
+  report compile.$name.ms $best
+  report compile.$name.lines_per_s $(( lines * 1000 / (best > 0 ? best : 1) ))
+  report compile.$name.rss_kb $rss
+}
+
+# run_kernels name compiler flags...
+#
+# Builds test/bench/kernels.c and reports the fastest time of each
+# kernel. The checksums must match those of the reference build.
+run_kernels() {
+  local name=$1
+  shift
+
+  "$@" -o $tmp/kernels-$name test/bench/kernels.c 2> /dev/null ||
+    fail "$name: cannot build kernels"
+
+  for i in $(seq $runs); do
+    $tmp/kernels-$name $scale > $tmp/run-$name.$i || fail "$name: kernels failed"
+  done
+
+  cut -d' ' -f1,3 $tmp/run-$name.1 > $tmp/sum-$name
+  if [ -f $tmp/sum-ref ]; then
+    cmp -s $tmp/sum-ref $tmp/sum-$name ||
+      fail "$name: kernels computed different results than $cc"
+  else
+    mv $tmp/sum-$name $tmp/sum-ref
+  fi
+
+  cat $tmp/run-$name.* |
+    awk '!($1 in best) || $2 < best[$1] { best[$1] = $2 }
+         END { for (k in best) print k, best[k] }' |
+    sort |
+    while read kernel ms; do
+      report run.$kernel.$name.ms $ms
+    done
+}
+
+# self_host name flags
+#
+# Builds chibicc with chibicc and reports how long the result takes to
+# compile the compiler's sources to assembly, which exercises code
+# that is larger and less regular than the kernels.
+self_host() {
+  local name=$1 flags=$2
+  local dir=$tmp/stage-$name
+  mkdir -p $dir
+  ln -s $(realpath include) $dir/include
+
+  for f in *.c; do
+    $chibicc $flags -c -o $dir/${f%.c}.o $f || fail "$name: cannot compile $f"
+  done
+  $cc -o $dir/chibicc $dir/*.o || fail "$name: cannot link chibicc"
+
+  local best=
+  for i in $(seq $runs); do
+    local start=$(now_ms)
+    for f in *.c; do
+      $dir/chibicc -S -o $tmp/out.s $f || fail "$name: stage2 failed on $f"
+    done
+    local t=$(( $(now_ms) - start ))
+    [ -z "$best" -o "$t" -lt "${best:-0}" ] && best=$t
+  done
+
+  report selfhost.$name.ms $best
+}
+
+generate_source 3000 > $tmp/generated.c
+generate_large_function 8000 > $tmp/large.c
+
+compile_speed self.O0 "" *.c
+compile_speed self.O1 "-O1" *.c
+compile_speed generated.O0 "" $tmp/generated.c
+compile_speed generated.O1 "-O1" $tmp/generated.c
+compile_speed large.O1 "-O1" $tmp/large.c
+
+run_kernels cc $cc -O2
+run_kernels O0 $chibicc
+run_kernels O1 $chibicc -O1
+
+self_host O0 ""
+self_host O1 "-O1"
+
+[ -f "$baseline" ] || exit 0
+
+# Compare with the baseline. A change of more than the threshold in
+# the wrong direction is marked with "!" and is a failure. Run-to-run
+# noise is often about 5%, so a tighter threshold needs more runs.
+echo
+echo "compared with $baseline:"
+awk -v threshold=$threshold '
+  FNR == NR { base[$1] = $2; next }
+  !($1 in base) || base[$1] == 0 { next }
+  {
+    change = ($2 - base[$1]) * 100 / base[$1]
+    worse = ($1 ~ /lines_per_s$/) ? change < -threshold : change > threshold
+    nworse += worse
+    printf "%-36s %12s %12s %+7.1f%% %s\n", $1, base[$1], $2, change, worse ? "!" : ""
+  }
+  END { exit nworse > 0 }' $baseline $results && exit 0
+
+[ "$BENCH_NO_FAIL" = 1 ] && exit 0
+fail "regressed by more than $threshold% compared with $baseline"
@@ -0,0 +1,356 @@
+// Compute kernels for measuring the speed of generated code.
+//
+// Each kernel prints its name, its running time in milliseconds and a
+// checksum of its result. test/bench.sh builds this file with chibicc
+// at each optimization level and with the system compiler, and
+// compares the checksums as well as the times, so that a kernel that
+// gets faster by computing the wrong thing doesn't go unnoticed.
+//
+// An optional argument scales the amount of work.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int scale = 1;
+
+static uint32_t rand_state = 1;
+
+static uint32_t next_rand(void) {
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return rand_state;
+}
+
+// Integer loops and array indexing.
+static uint64_t sieve(void) {
+  int n = 2000000;
+  char *composite = calloc(n + 1, 1);
+  uint64_t sum = 0;
+
+  for (int r = 0; r < 3 * scale; r++) {
+    memset(composite, 0, n + 1);
+    for (int i = 2; i <= n; i++) {
+      if (composite[i])
+        continue;
+      sum += i;
+      for (long j = (long)i * i; j <= n; j += i)
+        composite[j] = 1;
+    }
+  }
+  free(composite);
+  return sum;
+}
+
+// Floating-point arithmetic and two-dimensional arrays.
+#define MAT_N 160
+
+static double mat_a[MAT_N][MAT_N];
+static double mat_b[MAT_N][MAT_N];
+static double mat_c[MAT_N][MAT_N];
+
+static uint64_t matmul(void) {
+  for (int i = 0; i < MAT_N; i++) {
+    for (int j = 0; j < MAT_N; j++) {
+      mat_a[i][j] = (i * 7 + j * 3) % 17 - 8;
+      mat_b[i][j] = (i * 5 + j * 11) % 13 - 6;
+    }
+  }
+
+  for (int r = 0; r < 2 * scale; r++) {
+    for (int i = 0; i < MAT_N; i++) {
+      for (int j = 0; j < MAT_N; j++) {
+        double sum = 0;
+        for (int k = 0; k < MAT_N; k++)
+          sum += mat_a[i][k] * mat_b[k][j];
+        mat_c[i][j] = sum;
+      }
+    }
+  }
+
+  double sum = 0;
+  for (int i = 0; i < MAT_N; i++)
+    for (int j = 0; j < MAT_N; j++)
+      sum += mat_c[i][j] * (i + 1) - j;
+  return (uint64_t)(int64_t)sum;
+}
+
+// Recursion and function calls.
+static void quicksort(int *a, int lo, int hi) {
+  while (lo < hi) {
+    int pivot = a[(lo + hi) / 2];
+    int i = lo, j = hi;
+    while (i <= j) {
+      while (a[i] < pivot)
+        i++;
+      while (a[j] > pivot)
+        j--;
+      if (i <= j) {
+        int t = a[i];
+        a[i++] = a[j];
+        a[j--] = t;
+      }
+    }
+    if (j - lo < hi - i) {
+      quicksort(a, lo, j);
+      lo = i;
+    } else {
+      quicksort(a, i, hi);
+      hi = j;
+    }
+  }
+}
+
+static uint64_t sort(void) {
+  int n = 300000;
+  int *a = malloc(n * sizeof(int));
+  uint64_t sum = 0;
+
+  for (int r = 0; r < 2 * scale; r++) {
+    for (int i = 0; i < n; i++)
+      a[i] = next_rand() % 1000000;
+    quicksort(a, 0, n - 1);
+    for (int i = 0; i < n; i += 1000)
+      sum = sum * 31 + a[i];
+  }
+  free(a);
+  return sum;
+}
+
+// Byte loads, shifts and table lookups.
+static uint64_t crc32(void) {
+  uint32_t table[256];
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++)
+      c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    table[i] = c;
+  }
+
+  int n = 1 << 20;
+  unsigned char *buf = malloc(n);
+  for (int i = 0; i < n; i++)
+    buf[i] = next_rand();
+
+  uint64_t sum = 0;
+  for (int r = 0; r < 4 * scale; r++) {
+    uint32_t crc = 0xffffffff;
+    for (int i = 0; i < n; i++)
+      crc = table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    sum += crc ^ 0xffffffff;
+    buf[r] ^= 1;
+  }
+  free(buf);
+  return sum;
+}
+
+// Structs and floating-point math.
+typedef struct {
+  double x, y, z;
+  double vx, vy, vz;
+  double mass;
+} Body;
+
+static uint64_t nbody(void) {
+  Body bodies[5] = {
+    {0, 0, 0, 0, 0, 0, 39.47},
+    {4.84, -1.16, -0.10, 0.60, 2.81, -0.02, 0.037},
+    {8.34, 4.12, -0.40, -1.01, 1.82, 0.008, 0.011},
+    {12.89, -15.11, -0.22, 1.08, 0.86, -0.01, 0.0017},
+    {15.37, -25.91, 0.17, 0.97, 0.59, -0.03, 0.002},
+  };
+  double dt = 0.01;
+
+  for (int step = 0; step < 200000 * scale; step++) {
+    for (int i = 0; i < 5; i++) {
+      Body *a = &bodies[i];
+      for (int j = i + 1; j < 5; j++) {
+        Body *b = &bodies[j];
+        double dx = a->x - b->x;
+        double dy = a->y - b->y;
+        double dz = a->z - b->z;
+        double d2 = dx * dx + dy * dy + dz * dz + 0.01;
+        double mag = dt / (d2 * d2);
+        a->vx -= dx * b->mass * mag;
+        a->vy -= dy * b->mass * mag;
+        a->vz -= dz * b->mass * mag;
+        b->vx += dx * a->mass * mag;
+        b->vy += dy * a->mass * mag;
+        b->vz += dz * a->mass * mag;
+      }
+    }
+    for (int i = 0; i < 5; i++) {
+      bodies[i].x += dt * bodies[i].vx;
+      bodies[i].y += dt * bodies[i].vy;
+      bodies[i].z += dt * bodies[i].vz;
+    }
+  }
+
+  double sum = 0;
+  for (int i = 0; i < 5; i++)
+    sum += bodies[i].x + bodies[i].y + bodies[i].z;
+  return (uint64_t)(int64_t)(sum * 1000);
+}
+
+// Pointer chasing and string comparison.
+typedef struct Entry Entry;
+struct Entry {
+  Entry *next;
+  char key[16];
+  int val;
+};
+
+static uint64_t hashtable(void) {
+  int nbuckets = 4096;
+  int n = 50000;
+  Entry **buckets = calloc(nbuckets, sizeof(Entry *));
+  Entry *entries = calloc(n, sizeof(Entry));
+  uint64_t sum = 0;
+
+  for (int i = 0; i < n; i++) {
+    Entry *e = &entries[i];
+    sprintf(e->key, "k%d", i * 7919 % 1000003);
+    e->val = i;
+    uint32_t h = 2166136261u;
+    for (char *p = e->key; *p; p++)
+      h = (h ^ *p) * 16777619u;
+    e->next = buckets[h % nbuckets];
+    buckets[h % nbuckets] = e;
+  }
+
+  char key[16];
+  for (int r = 0; r < 20 * scale; r++) {
+    for (int i = 0; i < n; i += 3) {
+      sprintf(key, "k%d", (i + r) * 7919 % 1000003);
+      uint32_t h = 2166136261u;
+      for (char *p = key; *p; p++)
+        h = (h ^ *p) * 16777619u;
+      for (Entry *e = buckets[h % nbuckets]; e; e = e->next) {
+        if (!strcmp(e->key, key)) {
+          sum += e->val;
+          break;
+        }
+      }
+    }
+  }
+  free(buckets);
+  free(entries);
+  return sum;
+}
+
+// Switch dispatch, as in a bytecode interpreter.
+enum { OP_PUSH, OP_ADD, OP_SUB, OP_MUL, OP_DUP, OP_SWAP, OP_JNZ, OP_DEC, OP_POP, OP_HALT };
+
+static uint64_t interp(void) {
+  // Iterates acc = acc * 3 + 5 - 0xffff a million times.
+  int prog[64];
+  int n = 0;
+  prog[n++] = OP_PUSH; prog[n++] = 1;         // acc
+  prog[n++] = OP_PUSH; prog[n++] = 1000000;   // counter
+  int loop = n;
+  prog[n++] = OP_SWAP;                        // counter acc
+  prog[n++] = OP_PUSH; prog[n++] = 3;
+  prog[n++] = OP_MUL;                         // counter acc*3
+  prog[n++] = OP_PUSH; prog[n++] = 5;
+  prog[n++] = OP_ADD;                         // counter acc*3+5
+  prog[n++] = OP_PUSH; prog[n++] = 0xffff;
+  prog[n++] = OP_SUB;                         // counter acc*3+5-0xffff
+  prog[n++] = OP_SWAP;                        // acc counter
+  prog[n++] = OP_DEC;                         // acc counter-1
+  prog[n++] = OP_DUP;
+  prog[n++] = OP_JNZ; prog[n++] = loop;
+  prog[n++] = OP_POP;
+  prog[n++] = OP_HALT;
+
+  uint64_t sum = 0;
+  for (int r = 0; r < 4 * scale; r++) {
+    int64_t stack[16];
+    int sp = 0;
+    int pc = 0;
+
+    for (;;) {
+      switch (prog[pc++]) {
+      case OP_PUSH:
+        stack[sp++] = prog[pc++];
+        break;
+      case OP_ADD:
+        sp--;
+        stack[sp - 1] += stack[sp];
+        break;
+      case OP_SUB:
+        sp--;
+        stack[sp - 1] -= stack[sp];
+        break;
+      case OP_MUL:
+        sp--;
+        stack[sp - 1] = (uint64_t)stack[sp - 1] * stack[sp];
+        break;
+      case OP_DUP:
+        stack[sp] = stack[sp - 1];
+        sp++;
+        break;
+      case OP_SWAP: {
+        int64_t t = stack[sp - 1];
+        stack[sp - 1] = stack[sp - 2];
+        stack[sp - 2] = t;
+        break;
+      }
+      case OP_JNZ:
+        if (stack[--sp])
+          pc = prog[pc];
+        else
+          pc++;
+        break;
+      case OP_DEC:
+        stack[sp - 1]--;
+        break;
+      case OP_POP:
+        sp--;
+        break;
+      case OP_HALT:
+        goto done;
+      }
+    }
+  done:
+    sum += stack[sp - 1];
+  }
+  return sum;
+}
+
+typedef struct {
+  char *name;
+  uint64_t (*fn)(void);
+} Kernel;
+
+static Kernel kernels[] = {
+  {"sieve", sieve},
+  {"matmul", matmul},
+  {"sort", sort},
+  {"crc32", crc32},
+  {"nbody", nbody},
+  {"hashtable", hashtable},
+  {"interp", interp},
+};
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1)
+    scale = atoi(argv[1]);
+
+  for (int i = 0; i < sizeof(kernels) / sizeof(*kernels); i++) {
+    rand_state = 1;
+    double start = now_ms();
+    uint64_t sum = kernels[i].fn();
+    printf("%s %.1f %llu\n", kernels[i].name, now_ms() - start,
+           (unsigned long long)sum);
+  }
+  return 0;
+}
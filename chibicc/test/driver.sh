@@ -54,6 +54,28 @@ echo 'int y;' > $tmp/bar.c
 [ -f $tmp/foo.s ] && [ -f $tmp/bar.s ]
 check 'multiple input files'
 
+# -j
+rm -f $tmp/foo.o $tmp/bar.o $tmp/baz.o
+echo 'int x;' > $tmp/foo.c
+echo 'int y;' > $tmp/bar.c
+echo 'int z;' > $tmp/baz.c
+(cd $tmp; $OLDPWD/$chibicc -j3 -c $tmp/foo.c $tmp/bar.c $tmp/baz.c)
+[ -f $tmp/foo.o ] && [ -f $tmp/bar.o ] && [ -f $tmp/baz.o ]
+check -j
+
+echo 'int foo() { return 3; }' > $tmp/foo.c
+echo 'int bar() { return 4; }' > $tmp/bar.c
+echo 'int foo(); int bar(); int main() { return foo() + bar() != 7; }' > $tmp/baz.c
+$chibicc -j 2 -o $tmp/foo $tmp/foo.c $tmp/bar.c $tmp/baz.c
+$tmp/foo
+check -j
+
+echo 'int x = ;' > $tmp/foo.c
+echo 'int y = ;' > $tmp/bar.c
+(cd $tmp; $OLDPWD/$chibicc -j2 -c $tmp/foo.c $tmp/bar.c 2> $tmp/log)
+[ $? -ne 0 ] && grep -n . $tmp/log | grep -q "^1:.*foo.c" && grep -q "bar.c" $tmp/log
+check -j
+
 # Run linker
 rm -f $tmp/foo
 echo 'int main() { return 0; }' | $chibicc -o $tmp/foo -xc -xc -
@@ -274,6 +296,117 @@ echo 'foo' > $tmp/next3/file2.h
 $chibicc -I$tmp/next1 -I$tmp/next2 -I$tmp/next3 -E $tmp/file.c | grep -q foo
 check '#include_next'
 
+# -fheader-cache
+echo '#include "hc.h"' > $tmp/hc.c
+echo 'char *s = "foo"; int x = FOO;' >> $tmp/hc.c
+printf '#ifndef HC_H\n#define HC_H\n#define FOO 3\n#endif\n' > $tmp/hc.h
+$chibicc -fheader-cache=$tmp/hcache -E $tmp/hc.c > $tmp/hc1.i
+ls $tmp/hcache | grep -q '\.tok$'
+check -fheader-cache
+$chibicc -fheader-cache=$tmp/hcache -E $tmp/hc.c > $tmp/hc2.i
+cmp -s $tmp/hc1.i $tmp/hc2.i && grep -q 'x = 3' $tmp/hc2.i
+check -fheader-cache
+printf '#ifndef HC_H\n#define HC_H\n#define FOO 42\n#endif\n' > $tmp/hc.h
+$chibicc -fheader-cache=$tmp/hcache -E $tmp/hc.c | grep -q 'x = 42'
+check -fheader-cache
+# A damaged entry is a cache miss: point the include guard and the
+# last token out of bounds.
+for f in $tmp/hcache/*.tok; do
+  printf '\377\377\377\177' | dd of=$f bs=1 seek=52 conv=notrunc 2>/dev/null
+  printf '\377\377\377\377' | dd of=$f bs=1 seek=$(($(stat -c %s $f) - 48)) conv=notrunc 2>/dev/null
+done
+$chibicc -fheader-cache=$tmp/hcache -E $tmp/hc.c | grep -q 'x = 42'
+check -fheader-cache
+
+# Precompiled header
+printf '#ifndef PCH_H\n#define PCH_H\n#define SQ(x) ((x) * (x))\ntypedef int T;\n#endif\n' > $tmp/pch.h
+echo '#include "pch.h"' > $tmp/pch.c
+echo 'T main() { return SQ(3); }' >> $tmp/pch.c
+$chibicc -x c-header -o $tmp/pch.h.pch $tmp/pch.h
+[ -f $tmp/pch.h.pch ]
+check 'precompiled header'
+$chibicc -include $tmp/pch.h -o $tmp/foo $tmp/pch.c
+$tmp/foo
+[ $? = 9 ]
+check 'precompiled header'
+$chibicc -include $tmp/pch.h -DSQ=x -E $tmp/pch.c | grep -q '((3) \* (3))'
+check 'precompiled header'
+printf '#ifndef PCH_H\n#define PCH_H\n#define SQ(x) ((x) + (x) + 0)\ntypedef int T;\n#endif\n' > $tmp/pch.h
+$chibicc -include $tmp/pch.h -o $tmp/foo $tmp/pch.c
+$tmp/foo
+[ $? = 6 ]
+check 'precompiled header'
+
+# Integrated assembler
+echo 'int x = 3; static int y; int f(int a) { switch (a) { case 0: return x; case 1: return y; case 2: return 5; case 3: return 7; } return a * 1.5; }' > $tmp/ias.c
+$chibicc -c -o $tmp/ias1.o $tmp/ias.c
+$chibicc -fno-integrated-as -c -o $tmp/ias2.o $tmp/ias.c
+objdump -dr $tmp/ias1.o | tail -n +3 > $tmp/ias1.txt
+objdump -dr $tmp/ias2.o | tail -n +3 > $tmp/ias2.txt
+cmp -s $tmp/ias1.txt $tmp/ias2.txt
+check -fintegrated-as
+$chibicc -S -o - $tmp/ias.c | grep -q '^  \.text'
+check -fintegrated-as
+cat > $tmp/ias.c <<'EOF'
+static char a;
+int f1(void) { static long x; return x; }
+static long b;
+int f2(void) { static char y; return y; }
+_Thread_local int c;
+int d;
+int g(void) { return a + b + c + d; }
+EOF
+for opt in -fcommon -fno-common; do
+  $chibicc $opt -c -o $tmp/ias1.o $tmp/ias.c
+  $chibicc $opt -fno-integrated-as -c -o $tmp/ias2.o $tmp/ias.c
+  for f in ias1 ias2; do
+    objdump -h $tmp/$f.o | awk '$1 ~ /^[0-9]+$/ && $2 !~ /^\.debug/ { print $2, $3, $7 }' > $tmp/$f.txt
+    nm -S $tmp/$f.o >> $tmp/$f.txt
+  done
+  cmp -s $tmp/ias1.txt $tmp/ias2.txt
+  check "-fintegrated-as $opt layout"
+done
+mkdir -p $tmp/ias-inc
+printf 'static int sq(int x) {\n  return x * x;\n}\n' > $tmp/ias-inc/sq.h
+printf '#include "ias-inc/sq.h"\nint main() {\n  return sq(3);\n}\n' > $tmp/ias.c
+(cd $tmp; $OLDPWD/$chibicc -g -c -o ias1.o ias.c; $OLDPWD/$chibicc -g -fno-integrated-as -c -o ias2.o ias.c)
+for f in ias1 ias2; do
+  objdump -s -j .debug_line $tmp/$f.o | tail -n +4 > $tmp/$f.txt
+done
+cmp -s $tmp/ias1.txt $tmp/ias2.txt
+check '-fintegrated-as .debug_line'
+echo 'int main() { asm("cmc; cmc"); return 0; }' > $tmp/ias.c
+$chibicc -o $tmp/foo $tmp/ias.c 2> /dev/null && $tmp/foo
+check -fintegrated-as
+
+# -ftime-report
+echo '#define SQ(x) ((x) * (x))' > $tmp/tr.h
+printf '#include "tr.h"\nint main() { return SQ(3); }\n' > $tmp/tr.c
+$chibicc -ftime-report -c -o $tmp/tr.o $tmp/tr.c 2>&1 | grep -q '^time: parse '
+check -ftime-report
+$chibicc -ftime-report -c -o $tmp/tr.o $tmp/tr.c 2>&1 | grep -q '^count: macro-expansions *1$'
+check -ftime-report
+rm -f $tmp/tr.json
+$chibicc -ftime-report=$tmp/tr.json -fno-integrated-as -o $tmp/tr $tmp/tr.c
+grep -q '"process":"cc1".*"includes":1,' $tmp/tr.json
+check -ftime-report
+grep -q '"process":"driver".*"as":.*"ld":' $tmp/tr.json
+check -ftime-report
+
+# volatile
+for opt in -O0 -O1; do
+  echo 'void rd(volatile int *p) { *p; *p; }' | $chibicc $opt -S -o- -xc - > $tmp/vol.s
+  [ "$(grep -c 'movs.*(%r[a-z0-9]*),' $tmp/vol.s)" = 2 ]
+  check "volatile $opt"
+done
+
+# -fpeephole
+echo 'int f(int x) { return x + 1; }' > $tmp/pp.c
+$chibicc -O0 -fpeephole -fpeephole-stats -S -o /dev/null $tmp/pp.c 2>&1 | grep -q 'jump-next *[1-9]'
+check '-fpeephole at -O0'
+$chibicc -O0 -fpeephole-stats -S -o /dev/null $tmp/pp.c 2>&1 | grep -q 'jump-next *0'
+check '-fpeephole-stats at -O0'
+
 # -static
 echo 'extern int bar; int foo() { return bar; }' > $tmp/foo.c
 echo 'int foo(); int bar=3; int main() { foo(); }' > $tmp/bar.c
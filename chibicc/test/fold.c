@@ -0,0 +1,104 @@
+#include "test.h"
+
+int div3(int x) { return x / 3; }
+int mod3(int x) { return x % 3; }
+int div7(int x) { return x / 7; }
+int divm7(int x) { return x / -7; }
+int modm7(int x) { return x % -7; }
+int div8(int x) { return x / 8; }
+int mod8(int x) { return x % 8; }
+int divm8(int x) { return x / -8; }
+unsigned udiv7(unsigned x) { return x / 7; }
+unsigned umod7(unsigned x) { return x % 7; }
+unsigned udiv8(unsigned x) { return x / 8; }
+unsigned umod8(unsigned x) { return x % 8; }
+unsigned udiv_big(unsigned x) { return x / 0xfffffffe; }
+long ldiv10(long x) { return x / 10; }
+long lmod10(long x) { return x % 10; }
+long ldiv_big(long x) { return x / 1000000007; }
+unsigned long uldiv7(unsigned long x) { return x / 7; }
+unsigned long ulmod7(unsigned long x) { return x % 7; }
+unsigned long uldiv_big(unsigned long x) { return x / 0x8000000000000001; }
+int mul3(int x) { return x * 3; }
+int mul8(int x) { return 8 * x; }
+long mulsub(long x) { return (x + 1) * 4; }
+
+int dead_branch(int x) {
+  if (0)
+    return 1;
+  if (sizeof(long) == 8)
+    x++;
+  else
+    x--;
+  return x;
+}
+
+int goto_into_dead(int x) {
+  if (x)
+    goto L;
+  if (0) {
+  L:
+    return 5;
+  }
+  return 3;
+}
+
+int main() {
+  ASSERT(7, div3(21));
+  ASSERT(7, div3(23));
+  ASSERT(-7, div3(-23));
+  ASSERT(2, mod3(23));
+  ASSERT(-2, mod3(-23));
+  ASSERT(-306783378, div7(-2147483647-1));
+  ASSERT(306783378, div7(2147483647));
+  ASSERT(-3, divm7(23));
+  ASSERT(3, divm7(-23));
+  ASSERT(2, modm7(23));
+  ASSERT(-2, modm7(-23));
+  ASSERT(2, div8(23));
+  ASSERT(-2, div8(-23));
+  ASSERT(7, mod8(23));
+  ASSERT(-7, mod8(-23));
+  ASSERT(-2, divm8(23));
+  ASSERT(268435456, divm8(-2147483647-1));
+
+  ASSERT(3, udiv7(23));
+  ASSERT(613566756, udiv7(-1));
+  ASSERT(3, umod7(-1));
+  ASSERT(536870911, udiv8(-1));
+  ASSERT(7, umod8(-1));
+  ASSERT(1, udiv_big(-1));
+  ASSERT(0, udiv_big(-3));
+
+  ASSERT(-922337203, ldiv10(-9223372036854775807L) / 1000000000);
+  ASSERT(-7, lmod10(-9223372036854775807L));
+  ASSERT(92, ldiv_big(9223372036854775807L) / 100000000);
+  ASSERT(1, uldiv7(-1L) == 2635249153387078802UL);
+  ASSERT(1, ulmod7(-1L));
+  ASSERT(1, uldiv_big(-1L));
+  ASSERT(0, uldiv_big(0x8000000000000000));
+
+  ASSERT(-9, mul3(-3));
+  ASSERT(-24, mul8(-3));
+  ASSERT(0, mulsub(-1));
+  ASSERT(44, mulsub(10));
+
+  ASSERT(6, ({ int x = 5; x + 0 + 1; }));
+  ASSERT(5, ({ int x = 5; x * 1 - 0; }));
+  ASSERT(0, ({ int x = 5; x * 0; }));
+  ASSERT(5, ({ int x = 5; (x | 0) & -1; }));
+  ASSERT(-1, ({ int x = 5; x | -1; }));
+  ASSERT(2, ({ int x = 5; (x + 3) - 6; }));
+  ASSERT(1, ({ int x = 2147483647; (x + 1) - 1 == 2147483647; }));
+  ASSERT(1, ({ unsigned x = 5; x - 6 > 0; }));
+  ASSERT(-2147483648, ({ int x = 1; x * (-2147483647-1); }));
+  ASSERT(3, ({ int i = 0; int x = (i++, 0) * 7; x + i + 2; }));
+  ASSERT(4, ({ char c = 2; c * 2; }));
+
+  ASSERT(6, dead_branch(5));
+  ASSERT(5, goto_into_dead(1));
+  ASSERT(3, goto_into_dead(0));
+
+  printf("OK\n");
+  return 0;
+}
@@ -197,6 +197,22 @@ Ty21 struct_test38(void) {
   return (Ty21){1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20};
 }
 
+typedef struct { long a; char b[17]; } Ty22;
+
+Ty22 struct_test39(int x) {
+  Ty22 s = {x};
+  for (int i = 0; i < 17; i++)
+    s.b[i] = x + i;
+  return s;
+}
+
+int struct_test40(Ty22 s) {
+  int sum = s.a;
+  for (int i = 0; i < 17; i++)
+    sum += s.b[i];
+  return sum;
+}
+
 inline int inline_fn(void) {
   return 3;
 }
@@ -375,6 +391,9 @@ int main() {
   ASSERT(15, struct_test38().a[14]);
   ASSERT(20, struct_test38().a[19]);
 
+  ASSERT(172, struct_test40(struct_test39(2)));
+  ASSERT(244, struct_test40(struct_test39(struct_test40(struct_test39(0)) - 130)));
+
   ASSERT(5, (***add2)(2,3));
 
   ASSERT(3, inline_fn());
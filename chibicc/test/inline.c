@@ -0,0 +1,137 @@
+#include "test.h"
+
+typedef struct {
+  int x;
+  long y;
+} Pair;
+
+static inline int get_x(Pair *p) { return p->x; }
+static inline void set_y(Pair *p, long v) { p->y = v; }
+static int add(int a, int b) { return a + b; }
+static int add3(int a, int b, int c) { return add(add(a, b), c); }
+static char to_char(int x) { return x; }
+static unsigned char to_uchar(int x) { return x; }
+static _Bool to_bool(long x) { return x; }
+
+static int sign(int x) {
+  if (x < 0)
+    return -1;
+  if (x > 0)
+    return 1;
+  return 0;
+}
+
+static int fact(int n) { return n <= 1 ? 1 : n * fact(n - 1); }
+static int fib(int n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+
+static int counter(void) {
+  static int n;
+  return ++n;
+}
+
+static int sum_to(int n) {
+  int sum = 0;
+  for (int i = 1; i <= n; i++)
+    sum += i;
+  return sum;
+}
+
+static int twice(int *p) {
+  *p *= 2;
+  return *p;
+}
+
+static int by_addr(int x) {
+  int *p = &x;
+  *p += 10;
+  return x;
+}
+
+static int classify(int x) {
+  switch (x) {
+  case 0: return 10;
+  case 1: return 11;
+  case 2: return 12;
+  case 3: return 13;
+  case 4: return 14;
+  default: return -1;
+  }
+}
+
+static int with_label(int x) {
+  if (x)
+    goto out;
+  x = 5;
+out:
+  return x + 1;
+}
+
+static int no_return_value(int x) {
+  if (x)
+    return x;
+}
+
+static int fn_ptr_target(int x) { return x * 3; }
+
+static int call_via(int (*fp)(int), int x) { return fp(x); }
+
+int main() {
+  Pair p = {3, 4};
+  ASSERT(3, get_x(&p));
+  set_y(&p, 42);
+  ASSERT(42, p.y);
+
+  ASSERT(7, add(3, 4));
+  ASSERT(12, add3(3, 4, 5));
+  ASSERT(12, add(add(1, 2), add(4, 5)));
+
+  ASSERT(-1, to_char(255));
+  ASSERT(255, to_uchar(255));
+  ASSERT(1, to_bool(256));
+  ASSERT(0, to_bool(0));
+
+  ASSERT(-1, sign(-5));
+  ASSERT(1, sign(5));
+  ASSERT(0, sign(0));
+
+  ASSERT(120, fact(5));
+  ASSERT(3628800, fact(10));
+  ASSERT(55, fib(10));
+
+  ASSERT(1, counter());
+  ASSERT(2, counter());
+  ASSERT(3, counter());
+
+  ASSERT(55, sum_to(10));
+  ASSERT(5050, sum_to(100));
+
+  int x = 5;
+  ASSERT(10, twice(&x));
+  ASSERT(20, twice(&x));
+  ASSERT(20, x);
+
+  ASSERT(11, by_addr(1));
+  ASSERT(12, by_addr(2));
+  ASSERT(23, by_addr(1) + by_addr(2));
+
+  ASSERT(10, classify(0));
+  ASSERT(14, classify(4));
+  ASSERT(-1, classify(5));
+  ASSERT(23, classify(1) + classify(2));
+
+  ASSERT(6, with_label(0));
+  ASSERT(4, with_label(3));
+
+  ASSERT(7, no_return_value(7));
+
+  ASSERT(9, fn_ptr_target(3));
+  ASSERT(12, call_via(fn_ptr_target, 4));
+
+  int n = 0;
+  for (int i = 0; i < 10; i++)
+    n = add(n, sign(i - 5));
+  ASSERT(-1, n);
+
+  printf("OK\n");
+  return 0;
+}
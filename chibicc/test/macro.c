@@ -392,6 +392,10 @@ int main() {
   ASSERT(1, __COUNTER__);
   ASSERT(2, __COUNTER__);
 
+  // An argument is macro-expanded once, however many times it is used.
+#define M32(x) (x * 10 + x)
+  ASSERT(33, M32(__COUNTER__));
+
   ASSERT(24, strlen(__TIMESTAMP__));
 
   ASSERT(0, strcmp(__BASE_FILE__, "test/macro.c"));
@@ -1,5 +1,31 @@
 #include "test.h"
 
+int ret_buffer_test(void *(*fn)(void *, int), void *buf);
+
+// Structs larger than 16 bytes are returned through a hidden pointer.
+#define RET_TEST(n)                                         \
+  typedef struct { char a[n]; } Ret##n;                     \
+  Ret##n ret##n(int x) {                                    \
+    Ret##n r;                                               \
+    for (int i = 0; i < n; i++)                             \
+      r.a[i] = x + i;                                       \
+    return r;                                               \
+  }                                                         \
+  Ret##n pass##n(int x) { return ret##n(x); }               \
+  int sum##n(Ret##n r) {                                    \
+    int s = 0;                                              \
+    for (int i = 0; i < n; i++)                             \
+      s += r.a[i];                                          \
+    return s;                                               \
+  }
+
+RET_TEST(17)
+RET_TEST(24)
+RET_TEST(32)
+RET_TEST(33)
+RET_TEST(48)
+RET_TEST(64)
+
 int main() {
   ASSERT(1, ({ struct {int a; int b;} x; x.a=1; x.b=2; x.a; }));
   ASSERT(2, ({ struct {int a; int b;} x; x.a=1; x.b=2; x.b; }));
@@ -61,6 +87,53 @@ int main() {
   ASSERT(1, ({ struct {int a;} x={1}, y={2}; (1?x:y).a; }));
   ASSERT(2, ({ struct {int a;} x={1}, y={2}; (0?x:y).a; }));
 
+  ASSERT(7, ({ struct {char a[7];} x={1,2,3,4,5,6,7}, y; y=x; y.a[6]; }));
+  ASSERT(5, ({ struct {char a[7];} x={1,2,3,4,5,6,7}, y; y=x; y.a[4]; }));
+  ASSERT(30, ({ struct {char a[30];} x, y; for (int i=0; i<30; i++) x.a[i]=i+1; y=x; y.a[29]; }));
+  ASSERT(17, ({ struct {char a[30];} x, y; for (int i=0; i<30; i++) x.a[i]=i+1; y=x; y.a[16]; }));
+  ASSERT(4950, ({ struct {char a[300];} x, y; for (int i=0; i<300; i++) x.a[i]=i; y=x; int s=0; for (int i=0; i<100; i++) s+=y.a[i]; s; }));
+  ASSERT(43, ({ struct {char a[300];} x, y; for (int i=0; i<300; i++) x.a[i]=i; y=x; y.a[299]; }));
+  ASSERT(0, ({ struct {char a[23];} x={1}; x.a[22]; }));
+  ASSERT(0, ({ struct {char a[300];} x={1}; x.a[299]; }));
+  ASSERT(1, ({ struct {char a[300];} x={1}; x.a[0]; }));
+
+  ASSERT(153, sum17(ret17(1)));
+  ASSERT(170, sum17(pass17(2)));
+  ASSERT(187, sum17(ret17(sum17(ret17(0)) - 133)));
+  ASSERT(19, ret17(3).a[16]);
+  ASSERT(1, ({ char buf[17]; ret_buffer_test((void *)ret17, buf); }));
+  ASSERT(1, ({ char buf[17]; ret_buffer_test((void *)pass17, buf); }));
+  ASSERT(300, sum24(ret24(1)));
+  ASSERT(324, sum24(pass24(2)));
+  ASSERT(348, sum24(ret24(sum24(ret24(0)) - 273)));
+  ASSERT(26, ret24(3).a[23]);
+  ASSERT(1, ({ char buf[24]; ret_buffer_test((void *)ret24, buf); }));
+  ASSERT(1, ({ char buf[24]; ret_buffer_test((void *)pass24, buf); }));
+  ASSERT(528, sum32(ret32(1)));
+  ASSERT(560, sum32(pass32(2)));
+  ASSERT(592, sum32(ret32(sum32(ret32(0)) - 493)));
+  ASSERT(34, ret32(3).a[31]);
+  ASSERT(1, ({ char buf[32]; ret_buffer_test((void *)ret32, buf); }));
+  ASSERT(1, ({ char buf[32]; ret_buffer_test((void *)pass32, buf); }));
+  ASSERT(561, sum33(ret33(1)));
+  ASSERT(594, sum33(pass33(2)));
+  ASSERT(627, sum33(ret33(sum33(ret33(0)) - 525)));
+  ASSERT(35, ret33(3).a[32]);
+  ASSERT(1, ({ char buf[33]; ret_buffer_test((void *)ret33, buf); }));
+  ASSERT(1, ({ char buf[33]; ret_buffer_test((void *)pass33, buf); }));
+  ASSERT(1176, sum48(ret48(1)));
+  ASSERT(1224, sum48(pass48(2)));
+  ASSERT(1272, sum48(ret48(sum48(ret48(0)) - 1125)));
+  ASSERT(50, ret48(3).a[47]);
+  ASSERT(1, ({ char buf[48]; ret_buffer_test((void *)ret48, buf); }));
+  ASSERT(1, ({ char buf[48]; ret_buffer_test((void *)pass48, buf); }));
+  ASSERT(2080, sum64(ret64(1)));
+  ASSERT(2144, sum64(pass64(2)));
+  ASSERT(2208, sum64(ret64(sum64(ret64(0)) - 2013)));
+  ASSERT(66, ret64(3).a[63]);
+  ASSERT(1, ({ char buf[64]; ret_buffer_test((void *)ret64, buf); }));
+  ASSERT(1, ({ char buf[64]; ret_buffer_test((void *)pass64, buf); }));
+
   printf("OK\n");
   return 0;
 }
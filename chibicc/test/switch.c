@@ -0,0 +1,181 @@
+#include "test.h"
+
+int dense(int x) {
+  switch (x) {
+  case 0: return 10;
+  case 1: return 11;
+  case 2: return 12;
+  case 3: return 13;
+  case 5: return 15;
+  case 6: return 16;
+  case 7: return 17;
+  default: return -1;
+  }
+}
+
+int dense_offset(int x) {
+  switch (x) {
+  case -3: return 1;
+  case -2: return 2;
+  case -1: return 3;
+  case 0: return 4;
+  case 1: return 5;
+  }
+  return 0;
+}
+
+int sparse(int x) {
+  switch (x) {
+  case -1000000: return 1;
+  case -5: return 2;
+  case 0: return 3;
+  case 7: return 4;
+  case 100: return 5;
+  case 1000: return 6;
+  case 65536: return 7;
+  case 2147483647: return 8;
+  }
+  return 0;
+}
+
+int sparse_unsigned(unsigned x) {
+  switch (x) {
+  case 0: return 1;
+  case 10: return 2;
+  case 1000: return 3;
+  case 0x7fffffff: return 4;
+  case 0x80000000: return 5;
+  case 0xfffffffe: return 6;
+  case 0xffffffff: return 7;
+  }
+  return 0;
+}
+
+int sparse_long(long x) {
+  switch (x) {
+  case -2147483647 - 1: return 1;
+  case -100: return 2;
+  case 0: return 3;
+  case 100: return 4;
+  case 2147483647: return 5;
+  }
+  return 0;
+}
+
+int sparse_ulong(unsigned long x) {
+  switch (x) {
+  case 0: return 1;
+  case 100: return 2;
+  case 10000: return 3;
+  case -1: return 4;
+  case -100: return 5;
+  }
+  return 0;
+}
+
+int ranges(char c) {
+  switch (c) {
+  case 'a' ... 'z': return 1;
+  case 'A' ... 'Z': return 2;
+  case '0' ... '9': return 3;
+  case '_': return 4;
+  case '$': return 5;
+  default: return 0;
+  }
+}
+
+int sparse_ranges(int x) {
+  switch (x) {
+  case -100000 ... -50000: return 1;
+  case 0 ... 9: return 2;
+  case 100: return 3;
+  case 1000 ... 1999: return 4;
+  case 100000 ... 200000: return 5;
+  }
+  return 0;
+}
+
+int fallthrough(int x) {
+  int i = 0;
+  switch (x) {
+  case 0: i++;
+  case 1: i++;
+  case 2: i++;
+  case 3: i++;
+  case 4: i++;
+  }
+  return i;
+}
+
+int main() {
+  ASSERT(10, dense(0));
+  ASSERT(13, dense(3));
+  ASSERT(-1, dense(4));
+  ASSERT(17, dense(7));
+  ASSERT(-1, dense(8));
+  ASSERT(-1, dense(-1));
+  ASSERT(-1, dense(-2147483647 - 1));
+
+  ASSERT(0, dense_offset(-4));
+  ASSERT(1, dense_offset(-3));
+  ASSERT(4, dense_offset(0));
+  ASSERT(5, dense_offset(1));
+  ASSERT(0, dense_offset(2));
+
+  ASSERT(1, sparse(-1000000));
+  ASSERT(2, sparse(-5));
+  ASSERT(3, sparse(0));
+  ASSERT(4, sparse(7));
+  ASSERT(5, sparse(100));
+  ASSERT(6, sparse(1000));
+  ASSERT(7, sparse(65536));
+  ASSERT(8, sparse(2147483647));
+  ASSERT(0, sparse(1));
+  ASSERT(0, sparse(-2147483647 - 1));
+
+  ASSERT(1, sparse_unsigned(0));
+  ASSERT(3, sparse_unsigned(1000));
+  ASSERT(4, sparse_unsigned(0x7fffffff));
+  ASSERT(5, sparse_unsigned(0x80000000));
+  ASSERT(6, sparse_unsigned(0xfffffffe));
+  ASSERT(7, sparse_unsigned(-1));
+  ASSERT(0, sparse_unsigned(5));
+
+  ASSERT(1, sparse_long(-2147483647 - 1));
+  ASSERT(2, sparse_long(-100));
+  ASSERT(5, sparse_long(2147483647));
+  ASSERT(0, sparse_long(2147483648));
+  ASSERT(0, sparse_long(4294967296 + 100));
+
+  ASSERT(1, sparse_ulong(0));
+  ASSERT(3, sparse_ulong(10000));
+  ASSERT(4, sparse_ulong(-1));
+  ASSERT(5, sparse_ulong(-100));
+  ASSERT(0, sparse_ulong(4294967295));
+
+  ASSERT(1, ranges('a'));
+  ASSERT(1, ranges('q'));
+  ASSERT(2, ranges('Z'));
+  ASSERT(3, ranges('5'));
+  ASSERT(4, ranges('_'));
+  ASSERT(5, ranges('$'));
+  ASSERT(0, ranges('@'));
+  ASSERT(0, ranges(-1));
+
+  ASSERT(1, sparse_ranges(-75000));
+  ASSERT(0, sparse_ranges(-49999));
+  ASSERT(2, sparse_ranges(9));
+  ASSERT(3, sparse_ranges(100));
+  ASSERT(4, sparse_ranges(1000));
+  ASSERT(4, sparse_ranges(1999));
+  ASSERT(0, sparse_ranges(2000));
+  ASSERT(5, sparse_ranges(150000));
+  ASSERT(0, sparse_ranges(200001));
+
+  ASSERT(5, fallthrough(0));
+  ASSERT(2, fallthrough(3));
+  ASSERT(0, fallthrough(5));
+
+  printf("OK\n");
+  return 0;
+}
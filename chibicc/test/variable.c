@@ -48,8 +48,8 @@ int main() {
   ASSERT(2, ({ int x=2; { int x=3; } int y=4; x; }));
   ASSERT(3, ({ int x=2; { x=3; } x; }));
 
-  ASSERT(7, ({ int x; int y; char z; char *a=&y; char *b=&z; b-a; }));
-  ASSERT(1, ({ int x; char y; int z; char *a=&y; char *b=&z; b-a; }));
+  ASSERT(7, ({ int x; int y; char z; &x; char *a=&y; char *b=&z; b-a; }));
+  ASSERT(1, ({ int x; char y; int z; &x; char *a=&y; char *b=&z; b-a; }));
 
   ASSERT(8, ({ long x; sizeof(x); }));
   ASSERT(2, ({ short x; sizeof(x); }));
@@ -0,0 +1,66 @@
+#include "test.h"
+#include <setjmp.h>
+
+static jmp_buf buf;
+
+static void jump(void) {
+  longjmp(buf, 1);
+}
+
+static int local(void) {
+  volatile int x = 400;
+  if (setjmp(buf))
+    return x;
+  x = 404;
+  jump();
+  return 0;
+}
+
+static int loop(void) {
+  volatile int i = 0;
+  setjmp(buf);
+  if (++i < 5)
+    jump();
+  return i;
+}
+
+static int member(void) {
+  volatile struct { int a, b; } s = {1, 2};
+  if (setjmp(buf))
+    return s.a + s.b;
+  s.a = 10;
+  s.b = 20;
+  jump();
+  return 0;
+}
+
+static int pointer(void) {
+  int a[] = {3, 5};
+  int *volatile p = a;
+  if (setjmp(buf))
+    return *p;
+  p++;
+  jump();
+  return 0;
+}
+
+static int count;
+
+static int next(void) {
+  return ++count;
+}
+
+int main() {
+  ASSERT(404, local());
+  ASSERT(5, loop());
+  ASSERT(30, member());
+  ASSERT(5, pointer());
+
+  ASSERT(0, ({ volatile int x = 5; x * 0; }));
+  ASSERT(3, ({ volatile int x = 3; int *p = (int *)&x; x; *p; }));
+  ASSERT(2, ({ volatile int x = next(); x = next(); x; }));
+  ASSERT(8, sizeof(volatile long));
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,212 @@
+// This file implements -ftime-report, which shows where the compiler
+// spends its time and memory.
+//
+// At any moment exactly one timer is running. Entering a phase stops
+// the current timer and starts another one, and leaving it switches
+// back, so that the time of a header that is read and tokenized in
+// the middle of preprocessing is charged to reading and tokenizing and
+// not to preprocessing as well. Each timer also accumulates the growth
+// of the arenas and of the malloc heap while it runs.
+//
+// A compiler invocation consists of several processes: the driver,
+// one cc1 per input file, `as` and `ld`. Each chibicc process reports
+// what it did itself. The driver accounts for the subprocesses it
+// launched as a whole.
+
+#include "chibicc.h"
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/resource.h>
+
+bool opt_time_report;
+char *opt_time_report_file;
+
+long stat_count[NUM_STATS];
+
+static bool enabled;
+static TimerVar current;
+static int64_t start_time;
+static int64_t last_time;
+static size_t last_arena;
+static size_t last_heap;
+
+static int64_t elapsed[NUM_TIMERS];
+static size_t arena_bytes[NUM_TIMERS];
+static size_t heap_bytes[NUM_TIMERS];
+static long calls[NUM_TIMERS];
+
+static char *timer_names[] = {
+  "other", "read", "tokenize", "preprocess", "parse", "codegen",
+  "assemble", "output", "cc1", "as", "ld",
+};
+
+static char *stat_names[] = {
+  "files", "bytes-read", "includes", "macro-expansions", "output-bytes",
+};
+
+static int64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static size_t heap_size(void) {
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+void timer_init(void) {
+  enabled = true;
+  start_time = last_time = now();
+  last_arena = arena_total();
+  last_heap = heap_size();
+}
+
+static void charge(void) {
+  int64_t t = now();
+  size_t arena = arena_total();
+  size_t heap = heap_size();
+
+  elapsed[current] += t - last_time;
+  arena_bytes[current] += arena - last_arena;
+  if (heap > last_heap)
+    heap_bytes[current] += heap - last_heap;
+
+  last_time = t;
+  last_arena = arena;
+  last_heap = heap;
+}
+
+// Stops the running timer and starts `tv`. Returns the timer that was
+// running, which the caller passes to timer_resume() when it is done.
+// Memory is counted as the net growth of the heap, so a phase that
+// frees more than it allocates is charged nothing.
+TimerVar timer_start(TimerVar tv) {
+  if (!enabled)
+    return tv;
+
+  charge();
+  TimerVar prev = current;
+  current = tv;
+  calls[tv]++;
+  return prev;
+}
+
+// Like timer_start(), but doesn't count as another call of `tv`.
+void timer_resume(TimerVar tv) {
+  if (!enabled)
+    return;
+
+  charge();
+  current = tv;
+}
+
+static double ms(int64_t ns) {
+  return ns / 1e6;
+}
+
+static void print_table(FILE *out, char *name, int64_t total) {
+  fprintf(out, "time: %s\n", name);
+  fprintf(out, "time: %-12s %10s %7s %6s %12s %12s\n",
+          "phase", "wall(ms)", "%", "calls", "arena", "heap");
+
+  for (int i = 0; i < NUM_TIMERS; i++) {
+    if (calls[i] == 0 && elapsed[i] == 0)
+      continue;
+    fprintf(out, "time: %-12s %10.2f %6.1f%% %6ld %12zu %12zu\n",
+            timer_names[i], ms(elapsed[i]), 100.0 * elapsed[i] / MAX(total, 1),
+            calls[i], arena_bytes[i], heap_bytes[i]);
+  }
+  fprintf(out, "time: %-12s %10.2f\n", "total", ms(total));
+
+  for (int i = 0; i < NUM_STATS; i++)
+    if (stat_count[i])
+      fprintf(out, "count: %-16s %ld\n", stat_names[i], stat_count[i]);
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  fprintf(out, "count: %-16s %ld\n", "max-rss-kb", ru.ru_maxrss);
+}
+
+static char *json_string(char *s) {
+  char *buf;
+  size_t buflen;
+  FILE *out = open_memstream(&buf, &buflen);
+
+  fputc('"', out);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(out, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(out, "\\u%04x", *s);
+    else
+      fputc(*s, out);
+  }
+  fputc('"', out);
+  fclose(out);
+  return buf;
+}
+
+// Appends the report to a file as a single line of JSON. Processes
+// that run in parallel append to the same file, so the line is written
+// with one write(2) to a file opened with O_APPEND.
+static void write_json(char *path, char *process, char *input, int64_t total) {
+  char *buf;
+  size_t buflen;
+  FILE *out = open_memstream(&buf, &buflen);
+
+  fprintf(out, "{\"process\":\"%s\",\"input\":%s,\"pid\":%d,\"total_ms\":%.3f",
+          process, json_string(input ? input : ""), getpid(), ms(total));
+
+  fprintf(out, ",\"phases\":{");
+  bool first = true;
+  for (int i = 0; i < NUM_TIMERS; i++) {
+    if (calls[i] == 0 && elapsed[i] == 0)
+      continue;
+    fprintf(out, "%s\"%s\":{\"ms\":%.3f,\"calls\":%ld,\"arena\":%zu,\"heap\":%zu}",
+            first ? "" : ",", timer_names[i], ms(elapsed[i]), calls[i],
+            arena_bytes[i], heap_bytes[i]);
+    first = false;
+  }
+
+  fprintf(out, "},\"counts\":{");
+  for (int i = 0; i < NUM_STATS; i++)
+    fprintf(out, "%s\"%s\":%ld", i ? "," : "", stat_names[i], stat_count[i]);
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  fprintf(out, "},\"max_rss_kb\":%ld}\n", ru.ru_maxrss);
+  fclose(out);
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+  if (fd == -1)
+    error("cannot open %s: %s", path, strerror(errno));
+  if (write(fd, buf, buflen) != (long)buflen)
+    error("%s: write failed: %s", path, strerror(errno));
+  close(fd);
+  free(buf);
+}
+
+// Prints the report of this process. `process` is "cc1" or "driver".
+// A process that did nothing worth reporting prints nothing.
+void print_time_report(char *process, char *input) {
+  if (!enabled)
+    return;
+  timer_resume(TV_OTHER);
+
+  bool any = false;
+  for (int i = 1; i < NUM_TIMERS; i++)
+    if (calls[i])
+      any = true;
+  if (!any)
+    return;
+
+  int64_t total = now() - start_time;
+
+  if (opt_time_report) {
+    char *name = input ? format("%s %s", process, input) : process;
+    print_table(stderr, name, total);
+  }
+  if (opt_time_report_file)
+    write_json(opt_time_report_file, process, input, total);
+}
@@ -0,0 +1,292 @@
+// This file implements an on-disk cache of tokenized header files.
+//
+// When the driver compiles many files, every cc1 process reads the
+// same system headers again. With -fheader-cache=DIR, the first
+// process that includes a header saves the normalized text of the
+// file and its token list to DIR in a compact binary form. Other
+// processes map that file into memory and rebuild the tokens with a
+// single pass over a fixed-size record array, without reading the
+// header itself or running the lexer.
+//
+// An entry is keyed by the path of the header, its mtime and its size.
+// The path and the key are stored in the entry and checked on load,
+// so a stale or colliding entry is just a cache miss. So is a damaged
+// one: every offset and length in an entry is checked against the
+// size of the file before the entry is used. Entries are
+// written to a temporary file and renamed into place, so concurrent
+// compilations never see a partially written entry.
+
+#include "chibicc.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// Bump this whenever the layout below or the lexer output changes.
+#define CACHE_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t ntoks;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  int64_t size;
+  uint32_t path_len;     // Length of the path, not including '\0'
+  uint32_t contents_len; // Length of the text including '\0'
+  uint32_t data_len;     // Total size of string literal contents
+  int32_t guard;         // Index of the include guard token or -1
+} CacheHeader;
+
+// Types of literal tokens
+enum {
+  LIT_NONE,
+  LIT_CHAR,
+  LIT_USHORT,
+  LIT_INT,
+  LIT_UINT,
+};
+
+// A token. `loc` is an offset into the text, and `str` is an offset
+// into the string literal contents. For a string literal, `val` is
+// the number of its elements.
+typedef struct {
+  uint32_t loc;
+  uint32_t len;
+  int32_t line_no;
+  uint8_t kind;
+  uint8_t lit;
+  uint8_t at_bol;
+  uint8_t has_space;
+  uint32_t str;
+  uint32_t pad;
+  int64_t val;
+} CacheToken;
+
+static int64_t align8(int64_t n) {
+  return (n + 7) & ~7;
+}
+
+static char *cache_path(char *path) {
+  return format("%s/%016lx.tok", opt_header_cache,
+                (unsigned long)hash_bytes(path, strlen(path)));
+}
+
+static Type *lit_type(int lit) {
+  switch (lit) {
+  case LIT_CHAR: return ty_char;
+  case LIT_USHORT: return ty_ushort;
+  case LIT_INT: return ty_int;
+  case LIT_UINT: return ty_uint;
+  }
+  return NULL;
+}
+
+static int type_lit(Type *ty) {
+  if (ty == ty_char)
+    return LIT_CHAR;
+  if (ty == ty_ushort)
+    return LIT_USHORT;
+  if (ty == ty_int)
+    return LIT_INT;
+  if (ty == ty_uint)
+    return LIT_UINT;
+  return LIT_NONE;
+}
+
+// Returns true if all offsets in the records of an entry point into
+// the entry. The sections themselves are known to fit in the file.
+static bool is_valid_entry(CacheHeader *hdr, char *contents, CacheToken *ctok) {
+  if (hdr->contents_len == 0 || contents[hdr->contents_len - 1] != '\0')
+    return false;
+  if (hdr->ntoks == 0 || ctok[hdr->ntoks - 1].kind != TK_EOF)
+    return false;
+  if (hdr->guard < -1 || hdr->guard >= (int64_t)hdr->ntoks)
+    return false;
+
+  for (int i = 0; i < hdr->ntoks; i++) {
+    CacheToken *c = &ctok[i];
+    if (c->kind > TK_EOF || (uint64_t)c->loc + c->len >= hdr->contents_len)
+      return false;
+
+    if (c->kind == TK_STR) {
+      Type *ty = lit_type(c->lit);
+      if (!ty || c->val < 0 || c->val > hdr->data_len ||
+          c->str + c->val * ty->size > hdr->data_len)
+        return false;
+    } else if (c->kind == TK_NUM) {
+      if (!lit_type(c->lit))
+        return false;
+    }
+  }
+  return true;
+}
+
+// Returns the tokens of a given header if they are in the cache.
+// `*guard` is set to the macro name of its include guard, if any.
+Token *load_cached_header(char *path, Atom **guard) {
+  struct stat st;
+  if (stat(path, &st))
+    return NULL;
+
+  int fd = open(cache_path(path), O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+  struct stat st2;
+  if (fstat(fd, &st2) || st2.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    return NULL;
+  }
+
+  // The mapping is private and writable because the rest of the
+  // compiler treats file contents as ordinary heap memory. It is
+  // never unmapped since tokens point into it.
+  char *buf = mmap(NULL, st2.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED)
+    return NULL;
+
+  CacheHeader *hdr = (CacheHeader *)buf;
+  int64_t path_off = sizeof(CacheHeader);
+  int64_t contents_off = path_off + align8(hdr->path_len + 1);
+  int64_t toks_off = contents_off + align8(hdr->contents_len);
+  int64_t data_off = toks_off + (int64_t)hdr->ntoks * sizeof(CacheToken);
+
+  if (memcmp(hdr->magic, "chibitok", 8) || hdr->version != CACHE_VERSION ||
+      hdr->mtime_sec != st.st_mtim.tv_sec ||
+      hdr->mtime_nsec != st.st_mtim.tv_nsec || hdr->size != st.st_size ||
+      data_off + hdr->data_len != st2.st_size ||
+      hdr->path_len != strlen(path) || memcmp(buf + path_off, path, hdr->path_len) ||
+      !is_valid_entry(hdr, buf + contents_off, (CacheToken *)(buf + toks_off))) {
+    munmap(buf, st2.st_size);
+    return NULL;
+  }
+
+  char *contents = buf + contents_off;
+  CacheToken *ctok = (CacheToken *)(buf + toks_off);
+  char *data = buf + data_off;
+  File *file = add_input_file(path, contents);
+
+  // Tokens are allocated at once as an array and linked in order.
+  Token *toks = arena_alloc(MEM_TOKEN, sizeof(Token) * hdr->ntoks);
+
+  for (int i = 0; i < hdr->ntoks; i++) {
+    CacheToken *c = &ctok[i];
+    Token *tok = &toks[i];
+    tok->kind = c->kind;
+    tok->loc = contents + c->loc;
+    tok->len = c->len;
+    tok->line_no = c->line_no;
+    tok->at_bol = c->at_bol;
+    tok->has_space = c->has_space;
+    tok->file = file;
+    tok->filename = file->display_name;
+    tok->next = (i + 1 < hdr->ntoks) ? tok + 1 : NULL;
+
+    switch (tok->kind) {
+    case TK_IDENT:
+    case TK_PUNCT:
+      tok->atom = intern(tok->loc, tok->len);
+      break;
+    case TK_STR:
+      tok->atom = get_atom(ATOM_NONE);
+      tok->ty = array_of(lit_type(c->lit), c->val);
+      tok->str = data + c->str;
+      break;
+    case TK_NUM:
+      tok->atom = get_atom(ATOM_NONE);
+      tok->ty = lit_type(c->lit);
+      tok->val = c->val;
+      break;
+    default:
+      tok->atom = get_atom(ATOM_NONE);
+    }
+  }
+
+  *guard = (hdr->guard == -1) ? NULL : toks[hdr->guard].atom;
+  return toks;
+}
+
+// Saves the tokens of a header that were just read from `path`.
+// Failures are silently ignored; the cache is only an optimization.
+void save_cached_header(char *path, Token *tok, Atom *guard) {
+  struct stat st;
+  if (stat(path, &st))
+    return;
+
+  char *contents = tok->file->contents;
+  CacheHeader hdr = {};
+  memcpy(hdr.magic, "chibitok", 8);
+  hdr.version = CACHE_VERSION;
+  hdr.mtime_sec = st.st_mtim.tv_sec;
+  hdr.mtime_nsec = st.st_mtim.tv_nsec;
+  hdr.size = st.st_size;
+  hdr.path_len = strlen(path);
+  hdr.contents_len = strlen(contents) + 1;
+  hdr.guard = -1;
+
+  for (Token *t = tok; t; t = t->next) {
+    // A file that contains tokens of other files can't be cached.
+    // That doesn't happen for the output of the lexer, but be safe.
+    if (t->file != tok->file)
+      return;
+    if (t->kind == TK_STR)
+      hdr.data_len += align8(t->ty->size);
+    hdr.ntoks++;
+  }
+
+  CacheToken *ctok = calloc(hdr.ntoks, sizeof(CacheToken));
+  char *data = calloc(1, hdr.data_len + 1);
+  int data_len = 0;
+  int i = 0;
+
+  for (Token *t = tok; t; t = t->next, i++) {
+    CacheToken *c = &ctok[i];
+    c->kind = t->kind;
+    c->loc = t->loc - contents;
+    c->len = t->len;
+    c->line_no = t->line_no;
+    c->at_bol = t->at_bol;
+    c->has_space = t->has_space;
+
+    if (t->kind == TK_STR) {
+      c->lit = type_lit(t->ty->base);
+      c->val = t->ty->array_len;
+      c->str = data_len;
+      memcpy(data + data_len, t->str, t->ty->size);
+      data_len += align8(t->ty->size);
+    } else if (t->kind == TK_NUM) {
+      c->lit = type_lit(t->ty);
+      c->val = t->val;
+    }
+
+    if ((t->kind == TK_STR || t->kind == TK_NUM) && c->lit == LIT_NONE)
+      goto done;
+    if (guard && t->kind == TK_IDENT && t->atom == guard && hdr.guard == -1)
+      hdr.guard = i;
+  }
+
+  char *tmp = format("%s.%d", cache_path(path), getpid());
+  FILE *out = fopen(tmp, "w");
+  if (!out) {
+    mkdir(opt_header_cache, 0777);
+    out = fopen(tmp, "w");
+    if (!out)
+      goto done;
+  }
+
+  static char zero[8];
+  fwrite(&hdr, sizeof(hdr), 1, out);
+  fwrite(path, 1, hdr.path_len, out);
+  fwrite(zero, 1, align8(hdr.path_len + 1) - hdr.path_len, out);
+  fwrite(contents, 1, hdr.contents_len, out);
+  fwrite(zero, 1, align8(hdr.contents_len) - hdr.contents_len, out);
+  fwrite(ctok, sizeof(CacheToken), hdr.ntoks, out);
+  fwrite(data, 1, hdr.data_len, out);
+
+  if (fclose(out) || rename(tmp, cache_path(path)))
+    unlink(tmp);
+
+done:
+  free(ctok);
+  free(data);
+}
@@ -12,6 +12,36 @@ static bool at_bol;
 // True if the current position follows a space character
 static bool has_space;
 
+// Line number of the current position
+static int line_no;
+
+// Character classes of ASCII characters. The lexer dispatches on
+// these instead of calling <ctype.h> functions for each character.
+enum {
+  C_SPACE = 1,  // Whitespace other than newline
+  C_ALPHA = 2,  // Letter
+  C_DIGIT = 4,  // Decimal digit
+  C_IDENT = 8,  // Letter, '_' or '$'
+  C_PUNCT = 16, // Punctuator character
+};
+
+static uint8_t char_class[256];
+
+static void init_char_class(void) {
+  for (int c = 0; c < 128; c++) {
+    if (isspace(c) && c != '\n')
+      char_class[c] |= C_SPACE;
+    if (isalpha(c))
+      char_class[c] |= C_ALPHA | C_IDENT;
+    if (isdigit(c))
+      char_class[c] |= C_DIGIT;
+    if (ispunct(c))
+      char_class[c] |= C_PUNCT;
+  }
+  char_class['_'] |= C_IDENT;
+  char_class['$'] |= C_IDENT;
+}
+
 // Reports an error and exit.
 void error(char *fmt, ...) {
   va_list ap;
@@ -75,20 +105,181 @@ void warn_tok(Token *tok, char *fmt, ...) {
   va_end(ap);
 }
 
-// Consumes the current token if it matches `op`.
-bool equal(Token *tok, char *op) {
-  return memcmp(tok->loc, op, tok->len) == 0 && op[tok->len] == '\0';
-}
-
-// Ensure that the current token is `op`.
-Token *skip(Token *tok, char *op) {
-  if (!equal(tok, op))
-    error_tok(tok, "expected '%s'", op);
+static char *atom_names[] = {
+  [ATOM_NONE] = "",
+  [KW_RETURN] = "return",
+  [KW_IF] = "if",
+  [KW_ELSE] = "else",
+  [KW_FOR] = "for",
+  [KW_WHILE] = "while",
+  [KW_INT] = "int",
+  [KW_SIZEOF] = "sizeof",
+  [KW_CHAR] = "char",
+  [KW_STRUCT] = "struct",
+  [KW_UNION] = "union",
+  [KW_SHORT] = "short",
+  [KW_LONG] = "long",
+  [KW_VOID] = "void",
+  [KW_TYPEDEF] = "typedef",
+  [KW__BOOL] = "_Bool",
+  [KW_ENUM] = "enum",
+  [KW_STATIC] = "static",
+  [KW_GOTO] = "goto",
+  [KW_BREAK] = "break",
+  [KW_CONTINUE] = "continue",
+  [KW_SWITCH] = "switch",
+  [KW_CASE] = "case",
+  [KW_DEFAULT] = "default",
+  [KW_EXTERN] = "extern",
+  [KW__ALIGNOF] = "_Alignof",
+  [KW__ALIGNAS] = "_Alignas",
+  [KW_DO] = "do",
+  [KW_SIGNED] = "signed",
+  [KW_UNSIGNED] = "unsigned",
+  [KW_CONST] = "const",
+  [KW_VOLATILE] = "volatile",
+  [KW_AUTO] = "auto",
+  [KW_REGISTER] = "register",
+  [KW_RESTRICT] = "restrict",
+  [KW___RESTRICT] = "__restrict",
+  [KW___RESTRICT__] = "__restrict__",
+  [KW__NORETURN] = "_Noreturn",
+  [KW_FLOAT] = "float",
+  [KW_DOUBLE] = "double",
+  [KW_TYPEOF] = "typeof",
+  [KW_ASM] = "asm",
+  [KW__THREAD_LOCAL] = "_Thread_local",
+  [KW___THREAD] = "__thread",
+  [KW__ATOMIC] = "_Atomic",
+  [KW___ATTRIBUTE__] = "__attribute__",
+  [P_LPAREN] = "(",
+  [P_RPAREN] = ")",
+  [P_LBRACE] = "{",
+  [P_RBRACE] = "}",
+  [P_LBRACKET] = "[",
+  [P_RBRACKET] = "]",
+  [P_COMMA] = ",",
+  [P_SEMICOLON] = ";",
+  [P_DOT] = ".",
+  [P_ARROW] = "->",
+  [P_ELLIPSIS] = "...",
+  [P_COLON] = ":",
+  [P_QUESTION] = "?",
+  [P_ASSIGN] = "=",
+  [P_ADD_ASSIGN] = "+=",
+  [P_SUB_ASSIGN] = "-=",
+  [P_MUL_ASSIGN] = "*=",
+  [P_DIV_ASSIGN] = "/=",
+  [P_MOD_ASSIGN] = "%=",
+  [P_AND_ASSIGN] = "&=",
+  [P_OR_ASSIGN] = "|=",
+  [P_XOR_ASSIGN] = "^=",
+  [P_SHL_ASSIGN] = "<<=",
+  [P_SHR_ASSIGN] = ">>=",
+  [P_PLUS] = "+",
+  [P_MINUS] = "-",
+  [P_STAR] = "*",
+  [P_SLASH] = "/",
+  [P_PERCENT] = "%",
+  [P_AMP] = "&",
+  [P_PIPE] = "|",
+  [P_CARET] = "^",
+  [P_TILDE] = "~",
+  [P_NOT] = "!",
+  [P_SHL] = "<<",
+  [P_SHR] = ">>",
+  [P_INC] = "++",
+  [P_DEC] = "--",
+  [P_LOGAND] = "&&",
+  [P_LOGOR] = "||",
+  [P_EQ] = "==",
+  [P_NE] = "!=",
+  [P_LT] = "<",
+  [P_LE] = "<=",
+  [P_GT] = ">",
+  [P_GE] = ">=",
+  [P_HASH] = "#",
+  [P_HASHHASH] = "##",
+  [ID_INLINE] = "inline",
+  [ID__GENERIC] = "_Generic",
+  [ID___BUILTIN_TYPES_COMPATIBLE_P] = "__builtin_types_compatible_p",
+  [ID___BUILTIN_REG_CLASS] = "__builtin_reg_class",
+  [ID___BUILTIN_COMPARE_AND_SWAP] = "__builtin_compare_and_swap",
+  [ID___BUILTIN_ATOMIC_EXCHANGE] = "__builtin_atomic_exchange",
+  [ID_PACKED] = "packed",
+  [ID_ALIGNED] = "aligned",
+  [ID_DEFINED] = "defined",
+  [ID_DEFINE] = "define",
+  [ID_UNDEF] = "undef",
+  [ID_INCLUDE] = "include",
+  [ID_INCLUDE_NEXT] = "include_next",
+  [ID_IFDEF] = "ifdef",
+  [ID_IFNDEF] = "ifndef",
+  [ID_ELIF] = "elif",
+  [ID_ENDIF] = "endif",
+  [ID_LINE] = "line",
+  [ID_PRAGMA] = "pragma",
+  [ID_ONCE] = "once",
+  [ID_ERROR] = "error",
+  [ID___VA_ARGS__] = "__VA_ARGS__",
+  [ID___VA_OPT__] = "__VA_OPT__",
+};
+
+static HashMap atoms;
+static Atom predefined_atoms[NUM_PREDEFINED_ATOMS];
+static int num_atoms = NUM_PREDEFINED_ATOMS;
+
+static Atom *new_atom(char *name, int len, int id) {
+  Atom *atom = (id < NUM_PREDEFINED_ATOMS) ? &predefined_atoms[id]
+                                           : arena_alloc(MEM_ATOM, sizeof(Atom));
+  atom->name = name;
+  atom->len = len;
+  atom->id = id;
+  atom->hash = hash_bytes(name, len);
+  hashmap_put2(&atoms, name, len, atom);
+  return atom;
+}
+
+static void init_atoms(void) {
+  // Even small programs see a few thousand identifiers once the
+  // standard headers are included.
+  hashmap_reserve(&atoms, 4096);
+  for (int i = 0; i < NUM_PREDEFINED_ATOMS; i++)
+    new_atom(atom_names[i], strlen(atom_names[i]), i);
+}
+
+// Returns the unique atom for a given spelling.
+Atom *intern(char *name, int len) {
+  if (!atoms.capacity)
+    init_atoms();
+
+  Atom *atom = hashmap_get2(&atoms, name, len);
+  if (atom)
+    return atom;
+  return new_atom(strndup(name, len), len, num_atoms++);
+}
+
+Atom *get_atom(AtomId id) {
+  if (!atoms.capacity)
+    init_atoms();
+  return &predefined_atoms[id];
+}
+
+// Returns true if the current token is `id`.
+bool equal(Token *tok, AtomId id) {
+  return tok->atom->id == id;
+}
+
+// Ensure that the current token is `id`.
+Token *skip(Token *tok, AtomId id) {
+  if (!equal(tok, id))
+    error_tok(tok, "expected '%s'", get_atom(id)->name);
   return tok->next;
 }
 
-bool consume(Token **rest, Token *tok, char *str) {
-  if (equal(tok, str)) {
+// Consumes the current token if it is `id`.
+bool consume(Token **rest, Token *tok, AtomId id) {
+  if (equal(tok, id)) {
     *rest = tok->next;
     return true;
   }
@@ -98,12 +289,14 @@ bool consume(Token **rest, Token *tok, char *str) {
 
 // Create a new token.
 static Token *new_token(TokenKind kind, char *start, char *end) {
-  Token *tok = calloc(1, sizeof(Token));
+  Token *tok = arena_alloc(MEM_TOKEN, sizeof(Token));
   tok->kind = kind;
   tok->loc = start;
   tok->len = end - start;
+  tok->atom = get_atom(ATOM_NONE);
   tok->file = current_file;
   tok->filename = current_file->display_name;
+  tok->line_no = line_no;
   tok->at_bol = at_bol;
   tok->has_space = has_space;
 
@@ -119,13 +312,25 @@ static bool startswith(char *p, char *q) {
 // If p does not point to a valid identifier, 0 is returned.
 static int read_ident(char *start) {
   char *p = start;
-  uint32_t c = decode_utf8(&p, p);
-  if (!is_ident1(c))
-    return 0;
+
+  // Most identifiers consist only of ASCII characters, for which
+  // the character class table is enough.
+  if (char_class[(uint8_t)*p] & C_IDENT) {
+    p++;
+    while (char_class[(uint8_t)*p] & (C_IDENT | C_DIGIT))
+      p++;
+    if ((uint8_t)*p < 128)
+      return p - start;
+  } else {
+    if ((uint8_t)*p < 128)
+      return 0;
+    if (!is_ident1(decode_utf8(&p, p)))
+      return 0;
+  }
 
   for (;;) {
     char *q;
-    c = decode_utf8(&q, p);
+    uint32_t c = decode_utf8(&q, p);
     if (!is_ident2(c))
       return p - start;
     p = q;
@@ -142,39 +347,39 @@ static int from_hex(char c) {
 
 // Read a punctuator token from p and returns its length.
 static int read_punct(char *p) {
-  static char *kw[] = {
-    "<<=", ">>=", "...", "==", "!=", "<=", ">=", "->", "+=",
-    "-=", "*=", "/=", "++", "--", "%=", "&=", "|=", "^=", "&&",
-    "||", "<<", ">>", "##",
-  };
-
-  for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-    if (startswith(p, kw[i]))
-      return strlen(kw[i]);
+  switch (*p) {
+  case '<':
+  case '>':
+    // <<= >>= << >> <= >=
+    if (p[1] == p[0])
+      return (p[2] == '=') ? 3 : 2;
+    return (p[1] == '=') ? 2 : 1;
+  case '.':
+    return (p[1] == '.' && p[2] == '.') ? 3 : 1;
+  case '+':
+  case '&':
+  case '|':
+    // ++ += && &= || |=
+    return (p[1] == p[0] || p[1] == '=') ? 2 : 1;
+  case '-':
+    // -- -= ->
+    return (p[1] == '-' || p[1] == '=' || p[1] == '>') ? 2 : 1;
+  case '=':
+  case '!':
+  case '*':
+  case '/':
+  case '%':
+  case '^':
+    return (p[1] == '=') ? 2 : 1;
+  case '#':
+    return (p[1] == '#') ? 2 : 1;
+  }
 
-  return ispunct(*p) ? 1 : 0;
+  return (char_class[(uint8_t)*p] & C_PUNCT) ? 1 : 0;
 }
 
 static bool is_keyword(Token *tok) {
-  static HashMap map;
-
-  if (map.capacity == 0) {
-    static char *kw[] = {
-      "return", "if", "else", "for", "while", "int", "sizeof", "char",
-      "struct", "union", "short", "long", "void", "typedef", "_Bool",
-      "enum", "static", "goto", "break", "continue", "switch", "case",
-      "default", "extern", "_Alignof", "_Alignas", "do", "signed",
-      "unsigned", "const", "volatile", "auto", "register", "restrict",
-      "__restrict", "__restrict__", "_Noreturn", "float", "double",
-      "typeof", "asm", "_Thread_local", "__thread", "_Atomic",
-      "__attribute__",
-    };
-
-    for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-      hashmap_put(&map, kw[i], (void *)1);
-  }
-
-  return hashmap_get2(&map, tok->loc, tok->len);
+  return ATOM_NONE < tok->atom->id && tok->atom->id <= KW_LAST;
 }
 
 static int read_escaped_char(char **new_pos, char *p) {
@@ -461,27 +666,13 @@ void convert_pp_tokens(Token *tok) {
   }
 }
 
-// Initialize line info for all tokens.
-static void add_line_numbers(Token *tok) {
-  char *p = current_file->contents;
-  int n = 1;
-
-  do {
-    if (p == tok->loc) {
-      tok->line_no = n;
-      tok = tok->next;
-    }
-    if (*p == '\n')
-      n++;
-  } while (*p++);
-}
-
 Token *tokenize_string_literal(Token *tok, Type *basety) {
   Token *t;
   if (basety->size == 2)
     t = read_utf16_string_literal(tok->loc, tok->loc);
   else
     t = read_utf32_string_literal(tok->loc, tok->loc, basety);
+  t->line_no = tok->line_no;
   t->next = tok->next;
   return t;
 }
@@ -496,49 +687,62 @@ Token *tokenize(File *file) {
 
   at_bol = true;
   has_space = false;
+  line_no = 1;
+
+  if (!char_class['a'])
+    init_char_class();
 
   while (*p) {
-    // Skip line comments.
-    if (startswith(p, "//")) {
-      p += 2;
-      while (*p != '\n')
-        p++;
-      has_space = true;
-      continue;
-    }
+    uint8_t c = *p;
 
-    // Skip block comments.
-    if (startswith(p, "/*")) {
-      char *q = strstr(p + 2, "*/");
-      if (!q)
-        error_at(p, "unclosed block comment");
-      p = q + 2;
+    // Skip whitespace characters.
+    if (char_class[c] & C_SPACE) {
+      p++;
+      while (char_class[(uint8_t)*p] & C_SPACE)
+        p++;
       has_space = true;
       continue;
     }
 
     // Skip newline.
-    if (*p == '\n') {
+    if (c == '\n') {
       p++;
+      line_no++;
       at_bol = true;
       has_space = false;
       continue;
     }
 
-    // Skip whitespace characters.
-    if (isspace(*p)) {
-      p++;
+    // Skip line comments. strchr and memchr scan many bytes at once,
+    // which makes skipping comments cheap.
+    if (c == '/' && p[1] == '/') {
+      char *q = strchr(p + 2, '\n');
+      p = q ? q : p + strlen(p);
+      has_space = true;
+      continue;
+    }
+
+    // Skip block comments.
+    if (c == '/' && p[1] == '*') {
+      char *q = strstr(p + 2, "*/");
+      if (!q)
+        error_at(p, "unclosed block comment");
+      for (char *r = p; (r = memchr(r, '\n', q - r)); r++)
+        line_no++;
+      p = q + 2;
       has_space = true;
       continue;
     }
 
     // Numeric literal
-    if (isdigit(*p) || (*p == '.' && isdigit(p[1]))) {
+    if ((char_class[c] & C_DIGIT) ||
+        (c == '.' && (char_class[(uint8_t)p[1]] & C_DIGIT))) {
       char *q = p++;
       for (;;) {
-        if (p[0] && p[1] && strchr("eEpP", p[0]) && strchr("+-", p[1]))
+        if ((*p == 'e' || *p == 'E' || *p == 'p' || *p == 'P') &&
+            (p[1] == '+' || p[1] == '-'))
           p += 2;
-        else if (isalnum(*p) || *p == '.')
+        else if ((char_class[(uint8_t)*p] & (C_ALPHA | C_DIGIT)) || *p == '.')
           p++;
         else
           break;
@@ -548,42 +752,42 @@ Token *tokenize(File *file) {
     }
 
     // String literal
-    if (*p == '"') {
+    if (c == '"') {
       cur = cur->next = read_string_literal(p, p);
       p += cur->len;
       continue;
     }
 
     // UTF-8 string literal
-    if (startswith(p, "u8\"")) {
+    if (c == 'u' && p[1] == '8' && p[2] == '"') {
       cur = cur->next = read_string_literal(p, p + 2);
       p += cur->len;
       continue;
     }
 
     // UTF-16 string literal
-    if (startswith(p, "u\"")) {
+    if (c == 'u' && p[1] == '"') {
       cur = cur->next = read_utf16_string_literal(p, p + 1);
       p += cur->len;
       continue;
     }
 
     // Wide string literal
-    if (startswith(p, "L\"")) {
+    if (c == 'L' && p[1] == '"') {
       cur = cur->next = read_utf32_string_literal(p, p + 1, ty_int);
       p += cur->len;
       continue;
     }
 
     // UTF-32 string literal
-    if (startswith(p, "U\"")) {
+    if (c == 'U' && p[1] == '"') {
       cur = cur->next = read_utf32_string_literal(p, p + 1, ty_uint);
       p += cur->len;
       continue;
     }
 
     // Character literal
-    if (*p == '\'') {
+    if (c == '\'') {
       cur = cur->next = read_char_literal(p, p, ty_int);
       cur->val = (char)cur->val;
       p += cur->len;
@@ -591,7 +795,7 @@ Token *tokenize(File *file) {
     }
 
     // UTF-16 character literal
-    if (startswith(p, "u'")) {
+    if (c == 'u' && p[1] == '\'') {
       cur = cur->next = read_char_literal(p, p + 1, ty_ushort);
       cur->val &= 0xffff;
       p += cur->len;
@@ -599,14 +803,14 @@ Token *tokenize(File *file) {
     }
 
     // Wide character literal
-    if (startswith(p, "L'")) {
+    if (c == 'L' && p[1] == '\'') {
       cur = cur->next = read_char_literal(p, p + 1, ty_int);
       p += cur->len;
       continue;
     }
 
     // UTF-32 character literal
-    if (startswith(p, "U'")) {
+    if (c == 'U' && p[1] == '\'') {
       cur = cur->next = read_char_literal(p, p + 1, ty_uint);
       p += cur->len;
       continue;
@@ -616,6 +820,7 @@ Token *tokenize(File *file) {
     int ident_len = read_ident(p);
     if (ident_len) {
       cur = cur->next = new_token(TK_IDENT, p, p + ident_len);
+      cur->atom = intern(p, ident_len);
       p += cur->len;
       continue;
     }
@@ -624,6 +829,7 @@ Token *tokenize(File *file) {
     int punct_len = read_punct(p);
     if (punct_len) {
       cur = cur->next = new_token(TK_PUNCT, p, p + punct_len);
+      cur->atom = intern(p, punct_len);
       p += cur->len;
       continue;
     }
@@ -632,7 +838,6 @@ Token *tokenize(File *file) {
   }
 
   cur = cur->next = new_token(TK_EOF, p, p);
-  add_line_numbers(head.next);
   return head.next;
 }
 
@@ -687,50 +892,17 @@ File *new_file(char *name, int file_no, char *contents) {
   return file;
 }
 
-// Replaces \r or \r\n with \n.
-static void canonicalize_newline(char *p) {
-  int i = 0, j = 0;
-
-  while (p[i]) {
-    if (p[i] == '\r' && p[i + 1] == '\n') {
-      i += 2;
-      p[j++] = '\n';
-    } else if (p[i] == '\r') {
-      i++;
-      p[j++] = '\n';
-    } else {
-      p[j++] = p[i++];
-    }
-  }
-
-  p[j] = '\0';
-}
-
-// Removes backslashes followed by a newline.
-static void remove_backslash_newline(char *p) {
-  int i = 0, j = 0;
-
-  // We want to keep the number of newline characters so that
-  // the logical line number matches the physical one.
-  // This counter maintain the number of newlines we have removed.
-  int n = 0;
-
-  while (p[i]) {
-    if (p[i] == '\\' && p[i + 1] == '\n') {
-      i += 2;
-      n++;
-    } else if (p[i] == '\n') {
-      p[j++] = p[i++];
-      for (; n > 0; n--)
-        p[j++] = '\n';
-    } else {
-      p[j++] = p[i++];
-    }
-  }
+// Creates a file with given contents that have been prepared for the
+// lexer, and saves the filename for assembler .file directive.
+File *add_input_file(char *path, char *contents) {
+  static int file_no;
+  File *file = new_file(path, file_no + 1, contents);
 
-  for (; n > 0; n--)
-    p[j++] = '\n';
-  p[j] = '\0';
+  input_files = realloc(input_files, sizeof(char *) * (file_no + 2));
+  input_files[file_no] = file;
+  input_files[file_no + 1] = NULL;
+  file_no++;
+  return file;
 }
 
 static uint32_t read_universal_char(char *p, int len) {
@@ -743,42 +915,91 @@ static uint32_t read_universal_char(char *p, int len) {
   return c;
 }
 
-// Replace \u or \U escape sequences with corresponding UTF-8 bytes.
-static void convert_universal_chars(char *p) {
+static bool is_newline(char c) {
+  return c == '\n' || c == '\r';
+}
+
+// Prepares the contents of a source file for the lexer in a single
+// pass over it:
+//
+//  - \r and \r\n are replaced with \n
+//  - Backslashes followed by a newline are removed
+//  - \u and \U escape sequences are replaced with UTF-8 bytes
+//
+// The text is rewritten in place. Until the first byte that needs to
+// be changed, nothing has to be moved, so the pass starts with a fast
+// scan for that byte.
+static void normalize_source(char *p) {
+  p += strcspn(p, "\r\\");
   char *q = p;
 
+  // We want to keep the number of newline characters so that
+  // the logical line number matches the physical one.
+  // This counter maintain the number of newlines we have removed.
+  int n = 0;
+
   while (*p) {
-    if (startswith(p, "\\u")) {
+    if (is_newline(*p)) {
+      p += (p[0] == '\r' && p[1] == '\n') ? 2 : 1;
+      *q++ = '\n';
+      for (; n > 0; n--)
+        *q++ = '\n';
+      continue;
+    }
+
+    if (*p != '\\') {
+      *q++ = *p++;
+      continue;
+    }
+
+    // Line splicing
+    if (is_newline(p[1])) {
+      p += (p[1] == '\r' && p[2] == '\n') ? 3 : 2;
+      n++;
+      continue;
+    }
+
+    if (p[1] == 'u') {
       uint32_t c = read_universal_char(p + 2, 4);
       if (c) {
         p += 6;
         q += encode_utf8(q, c);
-      } else {
-        *q++ = *p++;
+        continue;
       }
-    } else if (startswith(p, "\\U")) {
+    }
+
+    if (p[1] == 'U') {
       uint32_t c = read_universal_char(p + 2, 8);
       if (c) {
         p += 10;
         q += encode_utf8(q, c);
-      } else {
-        *q++ = *p++;
+        continue;
       }
-    } else if (p[0] == '\\') {
-      *q++ = *p++;
-      *q++ = *p++;
-    } else {
-      *q++ = *p++;
     }
+
+    // Copy an escaped character as is, so that the "u" in "\\u"
+    // isn't taken as the start of an escape sequence.
+    *q++ = *p++;
+    if (*p && !is_newline(*p) && !(*p == '\\' && is_newline(p[1])))
+      *q++ = *p++;
   }
 
+  for (; n > 0; n--)
+    *q++ = '\n';
   *q = '\0';
 }
 
 Token *tokenize_file(char *path) {
+  TimerVar prev = timer_start(TV_READ);
   char *p = read_file(path);
-  if (!p)
+  if (!p) {
+    timer_resume(prev);
     return NULL;
+  }
+
+  stat_count[STAT_FILES]++;
+  stat_count[STAT_BYTES_READ] += strlen(p);
+  timer_start(TV_TOKENIZE);
 
   // UTF-8 texts may start with a 3-byte "BOM" marker sequence.
   // If exists, just skip them because they are useless bytes.
@@ -787,19 +1008,8 @@ Token *tokenize_file(char *path) {
   if (!memcmp(p, "\xef\xbb\xbf", 3))
     p += 3;
 
-  canonicalize_newline(p);
-  remove_backslash_newline(p);
-  convert_universal_chars(p);
-
-  // Save the filename for assembler .file directive.
-  static int file_no;
-  File *file = new_file(path, file_no + 1, p);
-
-  // Save the filename for assembler .file directive.
-  input_files = realloc(input_files, sizeof(char *) * (file_no + 2));
-  input_files[file_no] = file;
-  input_files[file_no + 1] = NULL;
-  file_no++;
-
-  return tokenize(file);
+  normalize_source(p);
+  Token *tok = tokenize(add_input_file(path, p));
+  timer_resume(prev);
+  return tok;
 }
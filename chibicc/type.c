@@ -18,7 +18,7 @@ Type *ty_double = &(Type){TY_DOUBLE, 8, 8};
 Type *ty_ldouble = &(Type){TY_LDOUBLE, 16, 16};
 
 static Type *new_type(TypeKind kind, int size, int align) {
-  Type *ty = calloc(1, sizeof(Type));
+  Type *ty = arena_alloc(MEM_TYPE, sizeof(Type));
   ty->kind = kind;
   ty->size = size;
   ty->align = align;
@@ -88,7 +88,7 @@ bool is_compatible(Type *t1, Type *t2) {
 }
 
 Type *copy_type(Type *ty) {
-  Type *ret = calloc(1, sizeof(Type));
+  Type *ret = arena_alloc(MEM_TYPE, sizeof(Type));
   *ret = *ty;
   ret->origin = ty;
   return ret;
@@ -187,8 +187,9 @@ void add_type(Node *node) {
 
   for (Node *n = node->body; n; n = n->next)
     add_type(n);
-  for (Node *n = node->args; n; n = n->next)
-    add_type(n);
+  if (node->kind == ND_FUNCALL)
+    for (Node *n = node->ext->args; n; n = n->next)
+      add_type(n);
 
   switch (node->kind) {
   case ND_NUM:
@@ -226,7 +227,7 @@ void add_type(Node *node) {
     node->ty = ty_int;
     return;
   case ND_FUNCALL:
-    node->ty = node->func_ty->return_ty;
+    node->ty = node->ext->func_ty->return_ty;
     return;
   case ND_NOT:
   case ND_LOGOR:
@@ -255,6 +256,12 @@ void add_type(Node *node) {
     return;
   case ND_MEMBER:
     node->ty = node->member->ty;
+
+    // A member of a volatile struct is volatile.
+    if (node->lhs->ty->is_volatile && !node->ty->is_volatile) {
+      node->ty = copy_type(node->ty);
+      node->ty->is_volatile = true;
+    }
     return;
   case ND_ADDR: {
     Type *ty = node->lhs->ty;
@@ -288,19 +295,19 @@ void add_type(Node *node) {
     node->ty = pointer_to(ty_void);
     return;
   case ND_CAS:
-    add_type(node->cas_addr);
-    add_type(node->cas_old);
-    add_type(node->cas_new);
+    add_type(node->ext->cas_addr);
+    add_type(node->ext->cas_old);
+    add_type(node->ext->cas_new);
     node->ty = ty_bool;
 
-    if (node->cas_addr->ty->kind != TY_PTR)
-      error_tok(node->cas_addr->tok, "pointer expected");
-    if (node->cas_old->ty->kind != TY_PTR)
-      error_tok(node->cas_old->tok, "pointer expected");
+    if (node->ext->cas_addr->ty->kind != TY_PTR)
+      error_tok(node->ext->cas_addr->tok, "pointer expected");
+    if (node->ext->cas_old->ty->kind != TY_PTR)
+      error_tok(node->ext->cas_old->tok, "pointer expected");
     return;
   case ND_EXCH:
     if (node->lhs->ty->kind != TY_PTR)
-      error_tok(node->cas_addr->tok, "pointer expected");
+      error_tok(node->ext->cas_addr->tok, "pointer expected");
     node->ty = node->lhs->ty->base;
     return;
   }
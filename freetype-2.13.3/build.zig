@@ -1,5 +1,4 @@
 const std = @import("std");
-const builtin = @import("builtin");
 
 pub fn build(b: *std.Build) void {
     const target = b.standardTargetOptions(.{});
@@ -22,7 +21,35 @@ pub fn build(b: *std.Build) void {
     lib.installHeadersDirectory(b.path("include/freetype"), "freetype", .{});
     lib.installHeader(b.path("include/ft2build.h"), "ft2build.h");
 
-    switch (builtin.target.os.tag) {
+    // The stream implementation follows CMakeLists.txt: on Unix, fonts
+    // are opened with mmap(2), so frame accesses point straight into the
+    // page cache and processes that open the same font share its pages.
+    // builds/unix/ftsystem.c falls back to reading the file into memory
+    // if it cannot be mapped (e.g. a pipe or a file on some FUSE mounts).
+    const os_tag = target.result.os.tag;
+    const use_mmap = switch (os_tag) {
+        .linux, .macos, .freebsd, .netbsd, .openbsd, .dragonfly => true,
+        else => false,
+    };
+    const system_files: []const []const u8 = if (os_tag == .windows)
+        &.{ "builds/windows/ftsystem.c", "builds/windows/ftdebug.c" }
+    else if (use_mmap)
+        &.{ "builds/unix/ftsystem.c", "src/base/ftdebug.c" }
+    else
+        &.{ "src/base/ftsystem.c", "src/base/ftdebug.c" };
+    lib.addCSourceFiles(.{
+        .root = b.path("."),
+        .files = system_files,
+        .flags = &.{},
+    });
+    if (use_mmap) {
+        // Normally set by the configure-generated ftconfig.h.
+        lib.root_module.addCMacro("HAVE_UNISTD_H", "1");
+        lib.root_module.addCMacro("HAVE_FCNTL_H", "1");
+        lib.root_module.addCMacro("MUNMAP_USES_VOIDP", "1");
+    }
+
+    switch (os_tag) {
         .windows => {
             lib.addCSourceFiles(.{
                 .root = b.path("."),
@@ -79,16 +106,40 @@ pub fn build(b: *std.Build) void {
 
     const run_step = b.step("run", "run build");
     run_step.dependOn(&run.step);
+
+    // Benchmarks of the smooth rasterizer, comparing the dense and the
+    // cell-list code paths and the fixed and the heap-grown cell pool;
+    // pass a font file after `--` to render its glyphs.
+    const bench_grays_step = b.step("bench-grays", "benchmark the smooth rasterizer");
+    for (grays_benchmarks) |name| {
+        const bench_exe = b.addExecutable(.{
+            .name = name,
+            .root_module = b.createModule(.{
+                .target = target,
+                .optimize = optimize,
+                .link_libc = true,
+            }),
+        });
+        bench_exe.root_module.addCSourceFile(.{
+            .file = b.path(b.fmt("tests/bench/{s}.c", .{name})),
+            .flags = &.{},
+        });
+        bench_exe.root_module.linkLibrary(lib);
+
+        const bench_run = b.addRunArtifact(bench_exe);
+        if (b.args) |args| {
+            bench_run.addArgs(args);
+        }
+        bench_grays_step.dependOn(&bench_run.step);
+    }
 }
 
 // Taken from line 385 of CMakeLists.txt
+// ftsystem.c and ftdebug.c are platform-specific and chosen in build().
 const source_files = [_][]const u8{
-    "src/base/ftsystem.c",
-    "src/base/ftdebug.c",
     "src/autofit/autofit.c",
+    "src/base/ftatlas.c",
     "src/base/ftbase.c",
-    "src/base/ftsystem.c",
-    "src/base/ftdebug.c",
     "src/base/ftbbox.c",
     "src/base/ftbdf.c",
     "src/base/ftbitmap.c",
@@ -130,11 +181,13 @@ const source_files = [_][]const u8{
 };
 
 const windows_source_files = [_][]const u8{
-    "builds/windows/ftsystem.c",
-    "builds/windows/ftdebug.c",
     "src/base/ftver.rc",
 };
 
 const mac_source_files = [_][]const u8{
     "src/base/ftmac.c",
 };
+
+const grays_benchmarks = [_][]const u8{
+    "grays",
+};
@@ -196,6 +196,7 @@ FT_BEGIN_HEADER
    *   FT_New_Face
    *   FT_Done_Face
    *   FT_Reference_Face
+   *   FT_New_Face_Handle
    *   FT_New_Memory_Face
    *   FT_Face_Properties
    *   FT_Open_Face
@@ -2879,6 +2880,68 @@ FT_BEGIN_HEADER
   FT_Done_Face( FT_Face  face );
 
 
+  /**************************************************************************
+   *
+   * @function:
+   *   FT_New_Face_Handle
+   *
+   * @description:
+   *   Create a lightweight face object that shares the parsed font data of
+   *   another face, for loading glyphs from several threads at once.
+   *
+   *   For TrueType fonts without variations, the handle shares the font
+   *   bytes, the tables, the glyph locations, and the charmaps with
+   *   `parent`; it only owns a stream, a glyph slot, a size (with its own
+   *   bytecode execution context), and auto-hinter data.
+   *
+   *   Other fonts (CFF, Type~1, variation fonts, etc.) keep state in the
+   *   face object while loading glyphs, so their parsed data cannot be
+   *   shared.  For them, the handle is an independent face that is parsed
+   *   again from the bytes of `parent`, which costs as much time and
+   *   memory as @FT_New_Memory_Face; only the font bytes are shared.
+   *
+   * @input:
+   *   parent ::
+   *     A handle to the face whose data gets shared.  If `parent` is a
+   *     handle itself, its own parent is used.
+   *
+   * @output:
+   *   ahandle ::
+   *     A handle to the new face.  Destroy it with @FT_Done_Face.
+   *
+   * @return:
+   *   FreeType error code.  0~means success.  `Unimplemented_Feature` is
+   *   returned if the font bytes of `parent` are not in memory (or mapped
+   *   into memory), which is the case for custom streams.
+   *
+   * @note:
+   *   The handle holds a reference to `parent` (see @FT_Reference_Face),
+   *   so the parent can be discarded first.
+   *
+   *   Creating and destroying handles changes the parent and the library;
+   *   like @FT_New_Face and @FT_Done_Face, these calls must be serialized.
+   *   Afterwards, different handles of the same parent can be used by
+   *   different threads without locking, for setting sizes and
+   *   transformations, mapping characters, and loading and rendering
+   *   glyphs.
+   *
+   *   Iterating over a charmap with @FT_Get_First_Char and
+   *   @FT_Get_Next_Char, and retrieving SFNT name table entries, update
+   *   state shared with the parent and must still be serialized.
+   *
+   *   The 'smooth' renderer gives every rendering call a cell pool of its
+   *   own, so handles can render at the same time.  Renderer properties
+   *   (see @FT_Set_Renderer and @FT_Property_Set) are shared by the whole
+   *   library and must not be changed while other threads render.
+   *
+   * @since:
+   *   2.13.3
+   */
+  FT_EXPORT( FT_Error )
+  FT_New_Face_Handle( FT_Face   parent,
+                      FT_Face  *ahandle );
+
+
   /**************************************************************************
    *
    * @section:
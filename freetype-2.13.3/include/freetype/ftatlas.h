@@ -0,0 +1,289 @@
+/****************************************************************************
+ *
+ * ftatlas.h
+ *
+ *   FreeType glyph atlas packing (specification).
+ *
+ * Copyright (C) 2024 by
+ * David Turner, Robert Wilhelm, and Werner Lemberg.
+ *
+ * This file is part of the FreeType project, and may only be used,
+ * modified, and distributed under the terms of the FreeType project
+ * license, LICENSE.TXT.  By continuing to use, modify, or distribute
+ * this file you indicate that you have read the license and
+ * understand and accept it fully.
+ *
+ */
+
+
+#ifndef FTATLAS_H_
+#define FTATLAS_H_
+
+#include <freetype/freetype.h>
+
+#ifdef FREETYPE_H
+#error "freetype.h of FreeType 1 has been loaded!"
+#error "Please fix the directory search order for header files"
+#error "so that freetype.h of FreeType 2 is found first."
+#endif
+
+
+FT_BEGIN_HEADER
+
+
+  /**************************************************************************
+   *
+   * @section:
+   *   glyph_atlas
+   *
+   * @title:
+   *   Glyph Atlas
+   *
+   * @abstract:
+   *   Rendering many glyphs into a single texture.
+   *
+   * @description:
+   *   This component renders a batch of glyphs of one face and size into a
+   *   caller-provided 8-bit bitmap, typically a texture used by a GPU text
+   *   renderer.  Free space is tracked with a 'skyline' packer, and outline
+   *   glyphs are rasterized directly into their place in the atlas,
+   *   without going through the bitmap of the glyph slot.
+   *
+   * @order:
+   *   FT_Atlas
+   *   FT_Atlas_GlyphRec
+   *   FT_Atlas_Glyph
+   *
+   *   FT_Atlas_New
+   *   FT_Atlas_Reset
+   *   FT_Atlas_Render_Glyphs
+   *   FT_Atlas_Done
+   *
+   */
+
+
+  /**************************************************************************
+   *
+   * @type:
+   *   FT_Atlas
+   *
+   * @description:
+   *   Opaque handle to a glyph atlas object.
+   */
+  typedef struct FT_AtlasRec_*  FT_Atlas;
+
+
+  /**************************************************************************
+   *
+   * @struct:
+   *   FT_Atlas_GlyphRec
+   *
+   * @description:
+   *   A structure describing one glyph of a batch passed to
+   *   @FT_Atlas_Render_Glyphs.  The first two fields are input, the others
+   *   are output.
+   *
+   * @fields:
+   *   glyph_index ::
+   *     The index of the glyph in the face.
+   *
+   *   origin ::
+   *     An offset applied to the outline before rendering, in 26.6
+   *     pixels; use it for subpixel positioning.  Ignored for bitmap
+   *     glyphs.
+   *
+   *   x ::
+   *   y ::
+   *     The position of the top-left corner of the glyph in the atlas, in
+   *     pixels.  Zero for empty glyphs.
+   *
+   *   width ::
+   *   rows ::
+   *     The size of the glyph image in the atlas.
+   *
+   *   bitmap_left ::
+   *   bitmap_top ::
+   *     The position of the glyph image relative to the pen position, as
+   *     in @FT_GlyphSlotRec.
+   *
+   *   advance ::
+   *     The transformed advance of the glyph, in 26.6 pixels.
+   *
+   *   error ::
+   *     The error of loading or rendering this glyph; if non-zero, all
+   *     other output fields are undefined.
+   */
+  typedef struct  FT_Atlas_GlyphRec_
+  {
+    FT_UInt    glyph_index;
+    FT_Vector  origin;
+
+    FT_Int     x;
+    FT_Int     y;
+    FT_UInt    width;
+    FT_UInt    rows;
+    FT_Int     bitmap_left;
+    FT_Int     bitmap_top;
+    FT_Vector  advance;
+    FT_Error   error;
+
+  } FT_Atlas_GlyphRec;
+
+
+  /**************************************************************************
+   *
+   * @type:
+   *   FT_Atlas_Glyph
+   *
+   * @description:
+   *   A pointer to an @FT_Atlas_GlyphRec structure.
+   */
+  typedef FT_Atlas_GlyphRec*  FT_Atlas_Glyph;
+
+
+  /**************************************************************************
+   *
+   * @function:
+   *   FT_Atlas_New
+   *
+   * @description:
+   *   Create a new atlas object packing glyphs into a given bitmap.
+   *
+   * @input:
+   *   library ::
+   *     FreeType library handle.
+   *
+   *   target ::
+   *     The bitmap to fill.  It must be of pixel mode
+   *     @FT_PIXEL_MODE_GRAY; the atlas keeps a copy of the descriptor but
+   *     not of the buffer, which must stay valid until @FT_Atlas_Done.
+   *
+   *   padding ::
+   *     The number of empty pixels kept between glyphs, so that texture
+   *     filtering does not bleed into neighbours.  No padding is needed at
+   *     the edges of the bitmap, so glyphs can fill it up to its right and
+   *     bottom edges.
+   *
+   * @output:
+   *   aatlas ::
+   *     A new atlas object handle.  NULL in case of error.
+   *
+   * @return:
+   *   FreeType error code.  0~means success.
+   *
+   * @note:
+   *   The atlas starts out empty; the pixels of the bitmap are not
+   *   cleared, but every glyph clears its rectangle before rendering.
+   */
+  FT_EXPORT( FT_Error )
+  FT_Atlas_New( FT_Library        library,
+                const FT_Bitmap*  target,
+                FT_UInt           padding,
+                FT_Atlas         *aatlas );
+
+
+  /**************************************************************************
+   *
+   * @function:
+   *   FT_Atlas_Reset
+   *
+   * @description:
+   *   Forget all glyphs packed so far, making the whole bitmap available
+   *   again.
+   *
+   * @input:
+   *   atlas ::
+   *     The target atlas handle.
+   */
+  FT_EXPORT( void )
+  FT_Atlas_Reset( FT_Atlas  atlas );
+
+
+  /**************************************************************************
+   *
+   * @function:
+   *   FT_Atlas_Render_Glyphs
+   *
+   * @description:
+   *   Load a batch of glyphs of a face at its current size, place them in
+   *   the atlas, and render them there.
+   *
+   * @input:
+   *   atlas ::
+   *     The target atlas handle.
+   *
+   *   face ::
+   *     The source face.  Its glyph slot gets overwritten.
+   *
+   *   load_flags ::
+   *     The flags passed to @FT_Load_Glyph for every glyph; they also
+   *     select the render mode, see @FT_LOAD_TARGET_XXX.
+   *     @FT_LOAD_RENDER is implied.
+   *
+   *   num_glyphs ::
+   *     The number of elements in `glyphs`.
+   *
+   * @inout:
+   *   glyphs ::
+   *     The glyphs to render; see @FT_Atlas_GlyphRec for the fields that
+   *     get filled in.
+   *
+   * @output:
+   *   anum_done ::
+   *     The number of glyphs processed, either placed in the atlas or
+   *     failed with their own error.  May be NULL.
+   *
+   * @return:
+   *   FreeType error code.  0~means success.  `Raster_Overflow` means that
+   *   the atlas is full: glyph number `*anum_done` did not fit, and it and
+   *   the following glyphs were not processed.  `Missing_Module` means
+   *   that the render mode is @FT_RENDER_MODE_NORMAL or
+   *   @FT_RENDER_MODE_LIGHT but the 'smooth' module is not available.
+   *
+   * @note:
+   *   Errors of individual glyphs (an invalid glyph index, say) are
+   *   reported in their `error` field and do not stop the batch.
+   *
+   *   Outline glyphs rendered in @FT_RENDER_MODE_NORMAL or
+   *   @FT_RENDER_MODE_LIGHT are rasterized in place, with the same result
+   *   as @FT_Render_Glyph.  All other glyphs (bitmap strikes, other render
+   *   modes, or outlines flagged with @FT_OUTLINE_OVERLAP) are rendered in
+   *   the glyph slot, converted to 8-bit gray if necessary, and copied.
+   *   LCD modes give an image three times as wide or high.
+   *
+   *   Glyphs are packed in the given order; sorting them by decreasing
+   *   height before the call reduces wasted space.
+   */
+  FT_EXPORT( FT_Error )
+  FT_Atlas_Render_Glyphs( FT_Atlas        atlas,
+                          FT_Face         face,
+                          FT_Int32        load_flags,
+                          FT_UInt         num_glyphs,
+                          FT_Atlas_Glyph  glyphs,
+                          FT_UInt        *anum_done );
+
+
+  /**************************************************************************
+   *
+   * @function:
+   *   FT_Atlas_Done
+   *
+   * @description:
+   *   Destroy an atlas object.  The bitmap buffer is left alone.
+   *
+   * @input:
+   *   atlas ::
+   *     An atlas handle.  Can be NULL.
+   */
+  FT_EXPORT( void )
+  FT_Atlas_Done( FT_Atlas  atlas );
+
+  /* */
+
+
+FT_END_HEADER
+
+#endif /* FTATLAS_H_ */
+
+
+/* END */
@@ -140,6 +140,7 @@
    *   bitmap_handling
    *   raster
    *   glyph_stroker
+   *   glyph_atlas
    *   system_interface
    *   module_management
    *   gzip
@@ -353,6 +353,15 @@ FT_BEGIN_HEADER
    *     created.  @FT_Reference_Face increments this counter, and
    *     @FT_Done_Face only destroys a face if the counter is~1, otherwise it
    *     simply decrements it.
+   *
+   *   parent ::
+   *     For a face created with @FT_New_Face_Handle, the face it was
+   *     created from; the handle holds a reference to it.  NULL otherwise.
+   *
+   *   shared ::
+   *     If set, the format-specific data and the charmaps of this face
+   *     belong to `parent`, and only the handle's own objects are
+   *     destroyed with it.
    */
   typedef struct  FT_Face_InternalRec_
   {
@@ -376,6 +385,9 @@ FT_BEGIN_HEADER
 
     FT_Int  refcount;
 
+    FT_Face  parent;
+    FT_Bool  shared;
+
   } FT_Face_InternalRec;
 
 
@@ -38,6 +38,7 @@ FT_TRACE_DEF( objs )      /* base objects            (ftobjs.c)   */
 FT_TRACE_DEF( outline )   /* outline management      (ftoutln.c)  */
 FT_TRACE_DEF( stream )    /* stream manager          (ftstream.c) */
 
+FT_TRACE_DEF( atlas )     /* glyph atlas packing     (ftatlas.c)  */
 FT_TRACE_DEF( bitmap )    /* bitmap manipulation     (ftbitmap.c) */
 FT_TRACE_DEF( checksum )  /* bitmap checksum         (ftobjs.c)   */
 FT_TRACE_DEF( mm )        /* MM interface            (ftmm.c)     */
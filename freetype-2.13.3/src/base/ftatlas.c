@@ -0,0 +1,522 @@
+/****************************************************************************
+ *
+ * ftatlas.c
+ *
+ *   FreeType glyph atlas packing (body).
+ *
+ * Copyright (C) 2024 by
+ * David Turner, Robert Wilhelm, and Werner Lemberg.
+ *
+ * This file is part of the FreeType project, and may only be used,
+ * modified, and distributed under the terms of the FreeType project
+ * license, LICENSE.TXT.  By continuing to use, modify, or distribute
+ * this file you indicate that you have read the license and
+ * understand and accept it fully.
+ *
+ */
+
+
+#include <freetype/ftatlas.h>
+#include <freetype/ftbitmap.h>
+#include <freetype/ftoutln.h>
+#include <freetype/ftrender.h>
+#include <freetype/internal/ftmemory.h>
+#include <freetype/internal/ftdebug.h>
+#include <freetype/internal/ftobjs.h>
+
+
+  /**************************************************************************
+   *
+   * The macro FT_COMPONENT is used in trace mode.  It is an implicit
+   * parameter of the FT_TRACE() and FT_ERROR() macros, used to print/log
+   * messages during execution.
+   */
+#undef  FT_COMPONENT
+#define FT_COMPONENT  atlas
+
+
+  /* A segment of the skyline: the lowest free row (counted from the  */
+  /* top) above `width' columns starting at `x'.  The segments are    */
+  /* sorted by `x' and cover the width of the atlas without gaps.     */
+  /*                                                                  */
+  /* Every rectangle includes the padding to the right of and below   */
+  /* its glyph.  The packer works on an area larger than the atlas by */
+  /* the padding, so that the padding of a glyph at the right or      */
+  /* bottom edge may fall outside of the atlas.                       */
+  typedef struct  FT_AtlasNodeRec_
+  {
+    FT_Int  x;
+    FT_Int  y;
+    FT_Int  width;
+
+  } FT_AtlasNodeRec, *FT_AtlasNode;
+
+
+  typedef struct  FT_AtlasRec_
+  {
+    FT_Library    library;
+    FT_Bitmap     target;
+    FT_Byte*      origin;     /* top-left pixel of `target'        */
+    FT_Int        padding;
+    FT_Int        width;      /* of the packed area, with padding  */
+    FT_Int        rows;
+
+    FT_AtlasNode  nodes;      /* at most one per column, plus one  */
+    FT_Int        num_nodes;
+
+    FT_Bitmap     scratch;    /* for glyphs not rendered in place  */
+
+  } FT_AtlasRec;
+
+
+  /* Return the top row of a `width' x `height' rectangle resting on the */
+  /* skyline from node `n' on, or -1 if it does not fit.                 */
+  static FT_Int
+  ft_atlas_fit( FT_Atlas  atlas,
+                FT_Int    n,
+                FT_Int    width,
+                FT_Int    height )
+  {
+    FT_AtlasNode  node = atlas->nodes + n;
+    FT_Int        y    = 0;
+    FT_Int        left = width;
+
+
+    if ( node->x + width > atlas->width )
+      return -1;
+
+    /* the nodes cover the atlas width, so this stops before the end */
+    while ( left > 0 )
+    {
+      if ( node->y > y )
+        y = node->y;
+
+      if ( y + height > atlas->rows )
+        return -1;
+
+      left -= node->width;
+      node++;
+    }
+
+    return y;
+  }
+
+
+  /* Find the lowest position for a rectangle (the leftmost one among */
+  /* equals) and raise the skyline above it.                          */
+  static FT_Bool
+  ft_atlas_pack( FT_Atlas  atlas,
+                 FT_Int    width,
+                 FT_Int    height,
+                 FT_Int   *ax,
+                 FT_Int   *ay )
+  {
+    FT_AtlasNode  nodes  = atlas->nodes;
+    FT_Int        best   = -1;
+    FT_Int        best_y = 0;
+    FT_Int        x, n;
+
+
+    for ( n = 0; n < atlas->num_nodes; n++ )
+    {
+      FT_Int  y;
+
+
+      /* a rectangle starting here cannot be higher than `best_y' */
+      if ( best >= 0 && nodes[n].y >= best_y )
+        continue;
+
+      y = ft_atlas_fit( atlas, n, width, height );
+      if ( y >= 0 && ( best < 0 || y < best_y ) )
+      {
+        best   = n;
+        best_y = y;
+      }
+    }
+
+    if ( best < 0 )
+      return 0;
+
+    x = nodes[best].x;
+
+    /* insert the new segment ... */
+    FT_MEM_MOVE( nodes + best + 1,
+                 nodes + best,
+                 (FT_Offset)( atlas->num_nodes - best ) * sizeof ( *nodes ) );
+    atlas->num_nodes++;
+
+    nodes[best].x     = x;
+    nodes[best].y     = best_y + height;
+    nodes[best].width = width;
+
+    /* ... remove or shorten the ones it covers ... */
+    n = best + 1;
+    while ( n < atlas->num_nodes && nodes[n].x < x + width )
+    {
+      FT_Int  right = nodes[n].x + nodes[n].width;
+
+
+      if ( right > x + width )
+      {
+        nodes[n].width = right - ( x + width );
+        nodes[n].x     = x + width;
+        break;
+      }
+
+      atlas->num_nodes--;
+      FT_MEM_MOVE( nodes + n,
+                   nodes + n + 1,
+                   (FT_Offset)( atlas->num_nodes - n ) * sizeof ( *nodes ) );
+    }
+
+    /* ... and merge neighbours of equal height */
+    for ( n = 0; n + 1 < atlas->num_nodes; )
+    {
+      if ( nodes[n].y == nodes[n + 1].y )
+      {
+        nodes[n].width += nodes[n + 1].width;
+
+        atlas->num_nodes--;
+        FT_MEM_MOVE( nodes + n + 1,
+                     nodes + n + 2,
+                     (FT_Offset)( atlas->num_nodes - n - 1 ) *
+                       sizeof ( *nodes ) );
+      }
+      else
+        n++;
+    }
+
+    *ax = x;
+    *ay = best_y;
+
+    return 1;
+  }
+
+
+  /* Clear a rectangle of the atlas, clipped to its size. */
+  static void
+  ft_atlas_clear( FT_Atlas  atlas,
+                  FT_Int    x,
+                  FT_Int    y,
+                  FT_Int    width,
+                  FT_Int    height )
+  {
+    FT_Int    pitch = atlas->target.pitch;
+    FT_Byte*  line;
+
+
+    if ( x + width > (FT_Int)atlas->target.width )
+      width = (FT_Int)atlas->target.width - x;
+    if ( y + height > (FT_Int)atlas->target.rows )
+      height = (FT_Int)atlas->target.rows - y;
+
+    for ( line = atlas->origin + y * pitch + x; height > 0; height-- )
+    {
+      FT_MEM_ZERO( line, width );
+      line += pitch;
+    }
+  }
+
+
+  /* Copy an 8-bit bitmap into the atlas, expanding fewer gray levels. */
+  static void
+  ft_atlas_copy( FT_Atlas          atlas,
+                 const FT_Bitmap*  source,
+                 FT_Int            x,
+                 FT_Int            y )
+  {
+    FT_Int    pitch = atlas->target.pitch;
+    FT_Byte*  line  = atlas->origin + y * pitch + x;
+    FT_Byte*  src   = source->buffer;
+    FT_UInt   max   = source->num_grays > 1 ? source->num_grays - 1U
+                                            : 255;
+    FT_UInt   i, j;
+
+
+    if ( source->pitch < 0 )
+      src -= source->pitch * (FT_Int)( source->rows - 1 );
+
+    for ( i = 0; i < source->rows; i++ )
+    {
+      if ( max == 255 )
+        FT_MEM_COPY( line, src, source->width );
+      else
+        for ( j = 0; j < source->width; j++ )
+          line[j] = (FT_Byte)( src[j] * 255U / max );
+
+      line += pitch;
+      src  += source->pitch;
+    }
+  }
+
+
+  /* documentation is in ftatlas.h */
+
+  FT_EXPORT_DEF( FT_Error )
+  FT_Atlas_New( FT_Library        library,
+                const FT_Bitmap*  target,
+                FT_UInt           padding,
+                FT_Atlas         *aatlas )
+  {
+    FT_Error   error;           /* assigned in FT_NEW */
+    FT_Memory  memory;
+    FT_Atlas   atlas = NULL;
+
+
+    if ( !library )
+      return FT_THROW( Invalid_Library_Handle );
+
+    if ( !aatlas || !target || !target->buffer )
+      return FT_THROW( Invalid_Argument );
+
+    *aatlas = NULL;
+
+    if ( target->pixel_mode != FT_PIXEL_MODE_GRAY ||
+         !target->width || target->width > 0x7FFF ||
+         !target->rows  || target->rows  > 0x7FFF ||
+         padding > 0x7FFF                         )
+      return FT_THROW( Invalid_Argument );
+
+    memory = library->memory;
+
+    if ( FT_NEW( atlas )                                  ||
+         FT_QNEW_ARRAY( atlas->nodes, target->width + padding + 1 ) )
+    {
+      FT_FREE( atlas );
+      return error;
+    }
+
+    atlas->library = library;
+    atlas->target  = *target;
+    atlas->origin  = target->buffer;
+    atlas->padding = (FT_Int)padding;
+    atlas->width   = (FT_Int)( target->width + padding );
+    atlas->rows    = (FT_Int)( target->rows + padding );
+
+    /* we address pixels from the top-left one, see `FT_Bitmap' */
+    if ( target->pitch < 0 )
+      atlas->origin -= target->pitch * (FT_Int)( target->rows - 1 );
+
+    FT_Bitmap_Init( &atlas->scratch );
+    FT_Atlas_Reset( atlas );
+
+    *aatlas = atlas;
+
+    return FT_Err_Ok;
+  }
+
+
+  /* documentation is in ftatlas.h */
+
+  FT_EXPORT_DEF( void )
+  FT_Atlas_Reset( FT_Atlas  atlas )
+  {
+    if ( !atlas )
+      return;
+
+    atlas->nodes[0].x     = 0;
+    atlas->nodes[0].y     = 0;
+    atlas->nodes[0].width = atlas->width;
+    atlas->num_nodes      = 1;
+  }
+
+
+  /* documentation is in ftatlas.h */
+
+  FT_EXPORT_DEF( FT_Error )
+  FT_Atlas_Render_Glyphs( FT_Atlas        atlas,
+                          FT_Face         face,
+                          FT_Int32        load_flags,
+                          FT_UInt         num_glyphs,
+                          FT_Atlas_Glyph  glyphs,
+                          FT_UInt        *anum_done )
+  {
+    FT_Error        error = FT_Err_Ok;
+    FT_GlyphSlot    slot;
+    FT_Renderer     renderer;
+    FT_Render_Mode  mode;
+    FT_UInt         n;
+
+
+    if ( anum_done )
+      *anum_done = 0;
+
+    if ( !atlas )
+      return FT_THROW( Invalid_Argument );
+
+    if ( !face || !face->glyph )
+      return FT_THROW( Invalid_Face_Handle );
+
+    if ( num_glyphs && !glyphs )
+      return FT_THROW( Invalid_Argument );
+
+    /* we render the glyphs ourselves */
+    load_flags &= ~FT_LOAD_RENDER;
+
+    /* the same as in `FT_Load_Glyph' */
+    mode = FT_LOAD_TARGET_MODE( load_flags );
+    if ( mode == FT_RENDER_MODE_NORMAL      &&
+         load_flags & FT_LOAD_MONOCHROME )
+      mode = FT_RENDER_MODE_MONO;
+
+    /* Gray outlines are rasterized in place with the `smooth' module; */
+    /* whatever renderer is current might not render gray levels.      */
+    slot     = face->glyph;
+    renderer = (FT_Renderer)FT_Get_Module( atlas->library, "smooth" );
+    if ( !renderer                      &&
+         ( mode == FT_RENDER_MODE_NORMAL ||
+           mode == FT_RENDER_MODE_LIGHT  ) )
+      return FT_THROW( Missing_Module );
+
+    for ( n = 0; n < num_glyphs; n++ )
+    {
+      FT_Atlas_Glyph  glyph  = glyphs + n;
+      FT_Bitmap*      source = NULL;
+      FT_Bool         direct;
+      FT_Int          x, y;
+
+
+      glyph->x     = 0;
+      glyph->y     = 0;
+      glyph->error = FT_Load_Glyph( face, glyph->glyph_index, load_flags );
+      if ( glyph->error )
+        continue;
+
+      direct = FT_BOOL( renderer                                   &&
+                        slot->format == FT_GLYPH_FORMAT_OUTLINE    &&
+                        ( mode == FT_RENDER_MODE_NORMAL ||
+                          mode == FT_RENDER_MODE_LIGHT  )          &&
+                        !( slot->outline.flags & FT_OUTLINE_OVERLAP ) );
+
+      if ( direct )
+      {
+        /* only compute the bitmap size; no buffer is allocated */
+        if ( ft_glyphslot_preset_bitmap( slot, mode, &glyph->origin ) )
+        {
+          glyph->error = FT_THROW( Raster_Overflow );
+          continue;
+        }
+      }
+      else
+      {
+        if ( slot->format == FT_GLYPH_FORMAT_OUTLINE )
+          FT_Outline_Translate( &slot->outline,
+                                glyph->origin.x,
+                                glyph->origin.y );
+
+        glyph->error = FT_Render_Glyph( slot, mode );
+        if ( glyph->error )
+          continue;
+
+        source = &slot->bitmap;
+        if ( source->pixel_mode != FT_PIXEL_MODE_GRAY )
+        {
+          glyph->error = FT_Bitmap_Convert( atlas->library,
+                                            source,
+                                            &atlas->scratch,
+                                            1 );
+          if ( glyph->error )
+            continue;
+
+          source = &atlas->scratch;
+        }
+      }
+
+      glyph->width       = slot->bitmap.width;
+      glyph->rows        = slot->bitmap.rows;
+      glyph->bitmap_left = slot->bitmap_left;
+      glyph->bitmap_top  = slot->bitmap_top;
+      glyph->advance     = slot->advance;
+
+      if ( source )
+      {
+        glyph->width = source->width;
+        glyph->rows  = source->rows;
+      }
+
+      if ( !glyph->width || !glyph->rows )
+        continue;
+
+      if ( !ft_atlas_pack( atlas,
+                           (FT_Int)glyph->width + atlas->padding,
+                           (FT_Int)glyph->rows  + atlas->padding,
+                           &x, &y ) )
+      {
+        FT_TRACE3(( "FT_Atlas_Render_Glyphs:"
+                    " no room for glyph %u (%ux%u)\n",
+                    glyph->glyph_index, glyph->width, glyph->rows ));
+
+        error = glyph->error = FT_THROW( Raster_Overflow );
+        break;
+      }
+
+      glyph->x = x;
+      glyph->y = y;
+
+      ft_atlas_clear( atlas,
+                      x,
+                      y,
+                      (FT_Int)glyph->width + atlas->padding,
+                      (FT_Int)glyph->rows  + atlas->padding );
+
+      if ( direct )
+      {
+        FT_Bitmap         view;
+        FT_Raster_Params  params;
+        FT_Pos            x_shift, y_shift;
+
+
+        /* a window into the atlas, flowing like the atlas itself */
+        view        = atlas->target;
+        view.width  = glyph->width;
+        view.rows   = glyph->rows;
+        view.buffer = atlas->origin + y * view.pitch + x;
+        if ( view.pitch < 0 )
+          view.buffer += ( (FT_Int)view.rows - 1 ) * view.pitch;
+
+        /* the same as in `ft_smooth_render' */
+        x_shift = 64 * -slot->bitmap_left + glyph->origin.x;
+        y_shift = 64 * ( (FT_Int)glyph->rows - slot->bitmap_top ) +
+                  glyph->origin.y;
+
+        FT_Outline_Translate( &slot->outline, x_shift, y_shift );
+
+        params.target = &view;
+        params.source = &slot->outline;
+        params.flags  = FT_RASTER_FLAG_AA;
+
+        glyph->error = renderer->raster_render( renderer->raster, &params );
+
+        FT_Outline_Translate( &slot->outline, -x_shift, -y_shift );
+      }
+      else
+        ft_atlas_copy( atlas, source, x, y );
+    }
+
+    if ( anum_done )
+      *anum_done = n;
+
+    return error;
+  }
+
+
+  /* documentation is in ftatlas.h */
+
+  FT_EXPORT_DEF( void )
+  FT_Atlas_Done( FT_Atlas  atlas )
+  {
+    FT_Memory  memory;
+
+
+    if ( !atlas )
+      return;
+
+    memory = atlas->library->memory;
+
+    FT_Bitmap_Done( atlas->library, &atlas->scratch );
+    FT_FREE( atlas->nodes );
+    FT_FREE( atlas );
+  }
+
+
+/* END */
@@ -1326,12 +1326,16 @@
     if ( face->generic.finalizer )
       face->generic.finalizer( face );
 
-    /* discard charmaps */
-    destroy_charmaps( face, memory );
+    /* a face handle borrows both from its parent */
+    if ( !face->internal || !face->internal->shared )
+    {
+      /* discard charmaps */
+      destroy_charmaps( face, memory );
 
-    /* finalize format-specific stuff */
-    if ( clazz->done_face )
-      clazz->done_face( face );
+      /* finalize format-specific stuff */
+      if ( clazz->done_face )
+        clazz->done_face( face );
+    }
 
     /* close the stream for this face if needed */
     FT_Stream_Free(
@@ -2951,6 +2955,9 @@
         error = FT_Err_Ok;
       else
       {
+        FT_Face  parent = face->internal->parent;
+
+
         driver = face->driver;
         memory = driver->root.memory;
 
@@ -2965,6 +2972,10 @@
           /* now destroy the object proper */
           destroy_face( memory, face, driver );
           error = FT_Err_Ok;
+
+          /* release the reference taken by `FT_New_Face_Handle' */
+          if ( parent )
+            error = FT_Done_Face( parent );
         }
       }
     }
@@ -2973,6 +2984,166 @@
   }
 
 
+  /* documentation is in freetype.h */
+
+  FT_EXPORT_DEF( FT_Error )
+  FT_New_Face_Handle( FT_Face   parent,
+                      FT_Face  *ahandle )
+  {
+    FT_Error          error;
+    FT_Driver         driver;
+    FT_Driver_Class   clazz;
+    FT_Memory         memory;
+    FT_Stream         stream   = NULL;
+    FT_Face           face     = NULL;
+    FT_Face_Internal  internal = NULL;
+    FT_ListNode       node     = NULL;
+    FT_Bool           share;
+
+
+    if ( !parent || !parent->driver )
+      return FT_THROW( Invalid_Face_Handle );
+
+    if ( !ahandle )
+      return FT_THROW( Invalid_Argument );
+
+    *ahandle = NULL;
+
+    /* a handle of a handle shares the data of the original face */
+    if ( parent->internal->parent )
+      parent = parent->internal->parent;
+
+    /* the font bytes must be in memory so that every handle can read */
+    /* them through a stream of its own                               */
+    if ( !parent->stream->base || parent->stream->read )
+      return FT_THROW( Unimplemented_Feature );
+
+    driver = parent->driver;
+    clazz  = driver->clazz;
+    memory = driver->root.memory;
+
+    /* Only the TrueType driver keeps nothing mutable in its face object */
+    /* while loading glyphs; variation fonts keep the blend state there. */
+    share = FT_BOOL( !ft_strcmp( driver->root.clazz->module_name,
+                                 "truetype" ) &&
+                     !FT_HAS_MULTIPLE_MASTERS( parent ) );
+#ifdef FT_CONFIG_OPTION_INCREMENTAL
+    if ( parent->internal->incremental_interface )
+      share = FALSE;
+#endif
+
+    if ( !share )
+    {
+      FT_Open_Args  args;
+
+
+      /* fall back to a face of its own, parsed from the same bytes */
+      args.flags       = FT_OPEN_MEMORY | FT_OPEN_DRIVER;
+      args.memory_base = parent->stream->base;
+      args.memory_size = (FT_Long)parent->stream->size;
+      args.driver      = FT_MODULE( driver );
+
+      error = FT_Open_Face( driver->root.library,
+                            &args,
+                            parent->face_index,
+                            &face );
+      if ( error )
+        goto Exit;
+
+      /* destroy it before the parent if the library goes away first */
+      FT_List_Up( &driver->faces_list,
+                  FT_List_Find( &driver->faces_list, face ) );
+
+      face->internal->parent = parent;
+      FT_Reference_Face( parent );
+
+      *ahandle = face;
+      goto Exit;
+    }
+
+    /* Force lazily loaded data into the parent so that the copy below */
+    /* shares it instead of loading (and leaking) its own.             */
+    (void)FT_Get_Postscript_Name( parent );
+    if ( FT_HAS_GLYPH_NAMES( parent ) )
+    {
+      char  name[2];
+
+
+      (void)FT_Get_Glyph_Name( parent, 0, name, sizeof ( name ) );
+    }
+
+    if ( FT_ALLOC( face, clazz->face_object_size ) ||
+         FT_NEW( stream )                          ||
+         FT_NEW( internal )                        ||
+         FT_QNEW( node )                           )
+      goto Fail;
+
+    /* tables, glyph locations, charmaps, etc. are shared with the parent */
+    FT_MEM_COPY( face, parent, clazz->face_object_size );
+
+    face->face_flags        &= ~FT_FACE_FLAG_EXTERNAL_STREAM;
+    face->generic.data       = NULL;
+    face->generic.finalizer  = NULL;
+    face->glyph              = NULL;
+    face->size               = NULL;
+    face->sizes_list.head    = NULL;
+    face->sizes_list.tail    = NULL;
+    face->autohint.data      = NULL;
+    face->autohint.finalizer = NULL;
+    face->extensions         = NULL;
+
+    /* the stream position is per handle */
+    FT_Stream_OpenMemory( stream,
+                          parent->stream->base,
+                          parent->stream->size );
+    stream->memory = memory;
+    face->stream   = stream;
+
+    internal->transform_matrix.xx = 0x10000L;
+    internal->transform_matrix.yy = 0x10000L;
+    internal->no_stem_darkening   = -1;
+    internal->random_seed         = -1;
+    internal->refcount            = 1;
+    internal->parent              = parent;
+    internal->shared              = TRUE;
+    face->internal                = internal;
+
+    /* add it in front of the parent, see above */
+    node->data = face;
+    FT_List_Insert( &driver->faces_list, node );
+    FT_Reference_Face( parent );
+
+    error = FT_New_GlyphSlot( face, NULL );
+    if ( !error )
+    {
+      FT_Size  size;
+
+
+      error = FT_New_Size( face, &size );
+      if ( !error )
+        face->size = size;
+    }
+
+    if ( error )
+    {
+      FT_Done_Face( face );
+      goto Exit;
+    }
+
+    *ahandle = face;
+    goto Exit;
+
+  Fail:
+    FT_FREE( node );
+    FT_FREE( stream );
+    FT_FREE( internal );
+    FT_FREE( face );
+
+  Exit:
+    return error;
+  }
+
+
   /* documentation is in ftobjs.h */
 
   FT_EXPORT_DEF( FT_Error )
@@ -436,6 +436,18 @@ typedef ptrdiff_t  FT_PtrDist;
   FT_END_STMNT
 
 
+  /* The sweep of the dense accumulation buffer processes 16 pixels at */
+  /* a time with SSE2 or AVX2 if the compiler targets them.            */
+#if defined( __AVX2__ )
+#define FT_GRAY_DENSE_AVX2
+#include <immintrin.h>
+#elif defined( __SSE2__ ) || defined( _M_X64 ) || \
+      ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define FT_GRAY_DENSE_SSE2
+#include <emmintrin.h>
+#endif
+
+
   /**************************************************************************
    *
    * TYPE DEFINITIONS
@@ -479,6 +491,15 @@ typedef ptrdiff_t  FT_PtrDist;
 #define FT_MAX_GRAY_SPANS  16
 
 
+  typedef struct gray_TRaster_
+  {
+    void*          memory;
+    int            no_dense;    /* set with `FT_GRAY_DENSE_RENDER'     */
+    unsigned long  pool_limit;  /* set with `FT_GRAY_POOL_LIMIT'       */
+
+  } gray_TRaster, *gray_PRaster;
+
+
 #if defined( _MSC_VER )      /* Visual C++ (and Intel C++) */
   /* We disable the warning `structure was padded due to   */
   /* __declspec(align())' in order to compile cleanly with */
@@ -489,6 +510,11 @@ typedef ptrdiff_t  FT_PtrDist;
 
   typedef struct  gray_TWorker_
   {
+    gray_PRaster  raster;
+
+    PCell       pool;        /* heap cell pool of this call, or NULL     */
+    size_t      pool_size;   /* number of cells in `pool'                */
+
     FT_BBox     cbox;
 
     TCoord  min_ex, max_ex;  /* min and max integer pixel coordinates */
@@ -510,6 +536,12 @@ typedef ptrdiff_t  FT_PtrDist;
     FT_Raster_Span_Func  render_span;
     void*                render_span_data;
 
+    int         dense_ok;    /* may use the dense accumulation buffer     */
+    TArea*      dense;       /* dense accumulation buffer, or NULL        */
+    TCoord      dense_pitch; /* number of `TArea' values per buffer row   */
+    TArea*      dense_pos;   /* buffer position of `dense_cell', or NULL  */
+    TCell       dense_cell;  /* current cell when `dense' is used         */
+
     ft_jmp_buf  jump_buffer;
 
   } gray_TWorker, *gray_PWorker;
@@ -534,13 +566,6 @@ typedef ptrdiff_t  FT_PtrDist;
           ras.cell->area  = ADD_INT( ras.cell->area, (a) * (TArea)(b) )
 
 
-  typedef struct gray_TRaster_
-  {
-    void*  memory;
-
-  } gray_TRaster, *gray_PRaster;
-
-
 #ifdef FT_DEBUG_LEVEL_TRACE
 
   /* to be called while in the debugger --                                */
@@ -568,6 +593,38 @@ typedef ptrdiff_t  FT_PtrDist;
 #endif /* FT_DEBUG_LEVEL_TRACE */
 
 
+  /**************************************************************************
+   *
+   * Add the current cell to the dense accumulation buffer and clear it.
+   *
+   * A row of the buffer holds, for each cell, the difference between its
+   * coverage value and that of its left neighbour, so that a prefix sum
+   * over the row restores what `gray_sweep' computes from the cell list.
+   * The first slot of a row stands for all cells left of the clipping
+   * region, like the (min_ex-1) cell in the list.
+   */
+  static void
+  gray_dense_flush( RAS_ARG )
+  {
+    TArea*  pos = ras.dense_pos;
+
+
+    if ( pos )
+    {
+      TArea  area = ras.dense_cell.area;
+
+
+      pos[0] = ADD_INT( pos[0],
+                        (TArea)ras.dense_cell.cover * ( ONE_PIXEL * 2 ) -
+                          area );
+      pos[1] = ADD_INT( pos[1], area );
+    }
+
+    ras.dense_cell.cover = 0;
+    ras.dense_cell.area  = 0;
+  }
+
+
   /**************************************************************************
    *
    * Set the current cell to a new position.
@@ -576,6 +633,25 @@ typedef ptrdiff_t  FT_PtrDist;
   gray_set_cell( RAS_ARG_ TCoord  ex,
                           TCoord  ey )
   {
+    if ( ras.dense )
+    {
+      TCoord  ey_index = ey - ras.min_ey;
+
+
+      gray_dense_flush( RAS_VAR );
+
+      if ( ey_index < 0 || ey_index >= ras.count_ey || ex >= ras.max_ex )
+        ras.dense_pos = NULL;
+      else
+      {
+        ex = FT_MAX( ex, ras.min_ex - 1 );
+
+        ras.dense_pos = ras.dense + ey_index * ras.dense_pitch +
+                          ( ex - ras.min_ex + 1 );
+      }
+      return;
+    }
+
     /* Move the cell pointer to a new position in the linked list. We use  */
     /* a dumpster null cell for everything outside of the clipping region  */
     /* during the render phase.  This means that:                          */
@@ -1862,28 +1938,358 @@ typedef ptrdiff_t  FT_PtrDist;
   }
 
 
+  /**************************************************************************
+   *
+   * Compute the coverage bytes of one row of the dense accumulation
+   * buffer, from pixel `x' on.  `acc' holds `width + 1' values, the
+   * first of which is left of the row, and `cover' is the sum of those
+   * before pixel `x'.  Only pixels with a non-zero accumulated value are
+   * written, like in `gray_sweep'.
+   */
+  static void
+  gray_dense_span( const TArea*    acc,
+                   unsigned char*  line,
+                   TCoord          x,
+                   TCoord          width,
+                   TArea           cover,
+                   int             even_odd )
+  {
+    int  fill = even_odd ? 0x100 : INT_MIN;
+    int  coverage;
+
+
+    for ( ; x < width; x++ )
+    {
+      cover = ADD_INT( cover, acc[x + 1] );
+
+      if ( cover != 0 )
+      {
+        FT_FILL_RULE( coverage, cover, fill );
+        line[x] = (unsigned char)coverage;
+      }
+    }
+  }
+
+
+#if defined( FT_GRAY_DENSE_AVX2 ) || defined( FT_GRAY_DENSE_SSE2 )
+
+  /* This is `FT_FILL_RULE' for a vector of accumulated values, except */
+  /* that clamping to 255 for the non-zero rule is left to the         */
+  /* saturating packs that narrow the result to bytes.                 */
+#define FT_FILL_RULE_X( fn, bits, v, even_odd )                        \
+  FT_BEGIN_STMNT                                                      \
+    v = fn ## _srai_epi32( v, PIXEL_BITS * 2 + 1 - 8 );               \
+    if ( even_odd )                                                   \
+      v = fn ## _and_si ## bits(                                      \
+            fn ## _xor_si ## bits(                                    \
+              v, fn ## _srai_epi32( fn ## _slli_epi32( v, 23 ), 31 ) ), \
+            fn ## _set1_epi32( 0xFF ) );                              \
+    else                                                              \
+      v = fn ## _xor_si ## bits( v, fn ## _srai_epi32( v, 31 ) );     \
+  FT_END_STMNT
+
+
+  /* Store 16 coverage bytes, except where `keep' is set. */
+  static void
+  gray_store_x16( unsigned char*  line,
+                  __m128i         cov,
+                  __m128i         keep )
+  {
+    if ( _mm_movemask_epi8( keep ) )
+      cov = _mm_or_si128( _mm_and_si128( keep,
+                                         _mm_loadu_si128( (__m128i*)line ) ),
+                          _mm_andnot_si128( keep, cov ) );
+
+    _mm_storeu_si128( (__m128i*)line, cov );
+  }
+
+#endif
+
+
+#ifdef FT_GRAY_DENSE_AVX2
+
+  /* Prefix sum of eight values, plus the running total `carry'. */
+  static __m256i
+  gray_prefix_sum_x8( __m256i   v,
+                      __m256i*  carry )
+  {
+    __m256i  t;
+
+
+    v = _mm256_add_epi32( v, _mm256_slli_si256( v, 4 ) );
+    v = _mm256_add_epi32( v, _mm256_slli_si256( v, 8 ) );
+
+    /* add the total of the low lane to the high lane */
+    t = _mm256_shuffle_epi32( v, 0xFF );
+    t = _mm256_permute2x128_si256( t, t, 0x08 );
+    v = _mm256_add_epi32( v, t );
+
+    v      = _mm256_add_epi32( v, *carry );
+    *carry = _mm256_permutevar8x32_epi32( v, _mm256_set1_epi32( 7 ) );
+
+    return v;
+  }
+
+
+  /* Narrow two vectors of 32-bit values to 16 bytes, keeping the order; */
+  /* `packs' works within 128-bit lanes, hence the permutations.         */
+  static __m128i
+  gray_pack_x16( __m256i  a,
+                 __m256i  b,
+                 int      is_signed )
+  {
+    __m256i  p = _mm256_permute4x64_epi64( _mm256_packs_epi32( a, b ),
+                                           0xD8 );
+    __m128i  lo = _mm256_castsi256_si128( p );
+    __m128i  hi = _mm256_extracti128_si256( p, 1 );
+
+
+    return is_signed ? _mm_packs_epi16( lo, hi ) : _mm_packus_epi16( lo, hi );
+  }
+
+
+  static void
+  gray_dense_row( const TArea*    acc,
+                  unsigned char*  line,
+                  TCoord          width,
+                  int             even_odd )
+  {
+    __m256i  carry = _mm256_set1_epi32( acc[0] );
+    __m256i  zero  = _mm256_setzero_si256();
+    TCoord   x;
+
+
+    for ( x = 0; x + 16 <= width; x += 16 )
+    {
+      __m256i  a = _mm256_loadu_si256( (const __m256i*)( acc + x + 1 ) );
+      __m256i  b = _mm256_loadu_si256( (const __m256i*)( acc + x + 9 ) );
+      __m128i  keep;
+
+
+      a = gray_prefix_sum_x8( a, &carry );
+      b = gray_prefix_sum_x8( b, &carry );
+
+      /* 0xFF where the accumulated value is zero */
+      keep = gray_pack_x16( _mm256_cmpeq_epi32( a, zero ),
+                            _mm256_cmpeq_epi32( b, zero ),
+                            1 );
+      if ( _mm_movemask_epi8( keep ) == 0xFFFF )
+        continue;
+
+      FT_FILL_RULE_X( _mm256, 256, a, even_odd );
+      FT_FILL_RULE_X( _mm256, 256, b, even_odd );
+
+      gray_store_x16( line + x, gray_pack_x16( a, b, 0 ), keep );
+    }
+
+    gray_dense_span( acc, line, x, width,
+                     _mm_cvtsi128_si32( _mm256_castsi256_si128( carry ) ), even_odd );
+  }
+
+#elif defined( FT_GRAY_DENSE_SSE2 )
+
+  /* Prefix sum of four values, plus the running total `carry'. */
+  static __m128i
+  gray_prefix_sum_x4( __m128i   v,
+                      __m128i*  carry )
+  {
+    v = _mm_add_epi32( v, _mm_slli_si128( v, 4 ) );
+    v = _mm_add_epi32( v, _mm_slli_si128( v, 8 ) );
+
+    v      = _mm_add_epi32( v, *carry );
+    *carry = _mm_shuffle_epi32( v, 0xFF );
+
+    return v;
+  }
+
+
+  static void
+  gray_dense_row( const TArea*    acc,
+                  unsigned char*  line,
+                  TCoord          width,
+                  int             even_odd )
+  {
+    __m128i  carry = _mm_set1_epi32( acc[0] );
+    __m128i  zero  = _mm_setzero_si128();
+    TCoord   x;
+
+
+    for ( x = 0; x + 16 <= width; x += 16 )
+    {
+      __m128i  v[4];
+      __m128i  keep;
+      int      i;
+
+
+      for ( i = 0; i < 4; i++ )
+        v[i] = gray_prefix_sum_x4(
+                 _mm_loadu_si128( (const __m128i*)( acc + x + 1 + 4 * i ) ),
+                 &carry );
+
+      /* 0xFF where the accumulated value is zero */
+      keep = _mm_packs_epi16(
+               _mm_packs_epi32( _mm_cmpeq_epi32( v[0], zero ),
+                                _mm_cmpeq_epi32( v[1], zero ) ),
+               _mm_packs_epi32( _mm_cmpeq_epi32( v[2], zero ),
+                                _mm_cmpeq_epi32( v[3], zero ) ) );
+      if ( _mm_movemask_epi8( keep ) == 0xFFFF )
+        continue;
+
+      for ( i = 0; i < 4; i++ )
+        FT_FILL_RULE_X( _mm, 128, v[i], even_odd );
+
+      gray_store_x16( line + x,
+                      _mm_packus_epi16( _mm_packs_epi32( v[0], v[1] ),
+                                        _mm_packs_epi32( v[2], v[3] ) ),
+                      keep );
+    }
+
+    gray_dense_span( acc, line, x, width,
+                     _mm_cvtsi128_si32( carry ), even_odd );
+  }
+
+#else /* !FT_GRAY_DENSE_AVX2 && !FT_GRAY_DENSE_SSE2 */
+
+  static void
+  gray_dense_row( const TArea*    acc,
+                  unsigned char*  line,
+                  TCoord          width,
+                  int             even_odd )
+  {
+    gray_dense_span( acc, line, 0, width, acc[0], even_odd );
+  }
+
+#endif /* !FT_GRAY_DENSE_AVX2 && !FT_GRAY_DENSE_SSE2 */
+
+
+  static void
+  gray_sweep_dense( RAS_ARG )
+  {
+    int     even_odd = ( ras.outline.flags & FT_OUTLINE_EVEN_ODD_FILL ) != 0;
+    TCoord  width    = ras.max_ex - ras.min_ex;
+    TCoord  y;
+
+
+    for ( y = ras.min_ey; y < ras.max_ey; y++ )
+      gray_dense_row( ras.dense + ( y - ras.min_ey ) * ras.dense_pitch,
+                      ras.target.origin - ras.target.pitch * y + ras.min_ex,
+                      width,
+                      even_odd );
+  }
+
+
+  /**************************************************************************
+   *
+   * Render the whole glyph with a dense accumulation buffer instead of
+   * cell lists.  Every cell is then found by indexing rather than by
+   * walking a list, and the sweep is a prefix sum over each row, which
+   * vectorizes well.  The buffer needs room for every pixel of the
+   * target, so this is only used for small and medium sizes; the result
+   * is the same as that of `gray_sweep'.
+   */
   static int
-  gray_convert_glyph( RAS_ARG )
+  gray_convert_dense( RAS_ARG_ TArea*  buffer )
   {
-    TCell    buffer[FT_MAX_GRAY_POOL];
-    size_t   height = (size_t)( ras.cbox.yMax - ras.cbox.yMin );
-    size_t   n = FT_MAX_GRAY_POOL / 8;
-    TCoord   y;
-    TCoord   bands[32];  /* enough to accommodate bisections */
-    TCoord*  band;
+    int  error;
 
-    int  continued = 0;
+
+    ras.min_ex   = (TCoord)ras.cbox.xMin;
+    ras.max_ex   = (TCoord)ras.cbox.xMax;
+    ras.min_ey   = (TCoord)ras.cbox.yMin;
+    ras.max_ey   = (TCoord)ras.cbox.yMax;
+    ras.count_ey = ras.max_ey - ras.min_ey;
+
+    ras.dense_pitch = ras.max_ex - ras.min_ex + 2;
+    FT_MEM_ZERO( buffer, (size_t)ras.dense_pitch * (size_t)ras.count_ey *
+                           sizeof ( TArea ) );
+
+    ras.dense     = buffer;
+    ras.dense_pos = NULL;
+    ras.cell      = &ras.dense_cell;
+
+    ras.dense_cell.cover = 0;
+    ras.dense_cell.area  = 0;
+
+    error = FT_Outline_Decompose( &ras.outline, &func_interface, &ras );
+    gray_dense_flush( RAS_VAR );
+
+    if ( !error )
+      gray_sweep_dense( RAS_VAR );
+
+    ras.dense = NULL;
+
+    return error;
+  }
+
+
+  /**************************************************************************
+   *
+   * Replace the heap cell pool with one twice as large as `size' cells,
+   * up to the limit set with `FT_GRAY_POOL_LIMIT'.  The pool belongs to
+   * the worker of the current call and is freed by `gray_raster_render',
+   * so that calls on the same raster object do not share it.  Return 0
+   * on success and 1 if the pool cannot grow.
+   */
+  static int
+  gray_grow_pool( RAS_ARG_ size_t  size )
+  {
+#ifdef STANDALONE_
+
+    FT_UNUSED( size );
+
+    return 1;
+
+#else
+
+    FT_Memory  memory   = (FT_Memory)ras.raster->memory;
+    size_t     new_size = FT_MIN( 2 * size,
+                                  ras.raster->pool_limit / sizeof ( TCell ) );
+    PCell      pool;
+    FT_Error   error;
+
+
+    if ( new_size <= size )
+      return 1;
+
+    /* the old pool may be in use if we fail */
+    if ( FT_QNEW_ARRAY( pool, new_size ) )
+      return 1;
+
+    FT_FREE( ras.pool );
+    ras.pool      = pool;
+    ras.pool_size = new_size;
+
+    FT_TRACE7(( "gray_grow_pool: %zu cells\n", new_size ));
+
+    return 0;
+
+#endif /* !STANDALONE_ */
+  }
+
+
+  /**************************************************************************
+   *
+   * Use `pool' for the cells of the following bands, and return the
+   * height of the bands that fit in it for the rows from `y' on.
+   */
+  static size_t
+  gray_set_pool( RAS_ARG_ PCell   pool,
+                          size_t  pool_size,
+                          TCoord  y )
+  {
+    size_t  height = (size_t)( ras.cbox.yMax - y );
+    size_t  n      = pool_size / 8;
 
 
     /* Initialize the null cell at the end of the poll. */
-    ras.cell_null        = buffer + FT_MAX_GRAY_POOL - 1;
+    ras.cell_null        = pool + pool_size - 1;
     ras.cell_null->x     = CELL_MAX_X_VALUE;
     ras.cell_null->area  = 0;
     ras.cell_null->cover = 0;
     ras.cell_null->next  = NULL;
 
     /* set up vertical bands */
-    ras.ycells     = (PCell*)buffer;
+    ras.ycells = (PCell*)pool;
 
     if ( height > n )
     {
@@ -1892,7 +2298,41 @@ typedef ptrdiff_t  FT_PtrDist;
       height  = ( height + n - 1 ) / n;
     }
 
-    for ( y = ras.cbox.yMin; y < ras.cbox.yMax; )
+    return height;
+  }
+
+
+  static int
+  gray_convert_glyph( RAS_ARG )
+  {
+    TCell    buffer[FT_MAX_GRAY_POOL];
+    PCell    pool      = buffer;
+    size_t   pool_size = FT_MAX_GRAY_POOL;
+    size_t   height    = (size_t)( ras.cbox.yMax - ras.cbox.yMin );
+    size_t   n;
+    TCoord   y;
+    TCoord   bands[32];  /* enough to accommodate bisections */
+    TCoord*  band;
+
+    int  continued = 0;
+
+
+    /* Small glyphs rendered to a bitmap go through the dense buffer, */
+    /* which takes the place of the cell pool.                        */
+    if ( ras.dense_ok && !ras.render_span )
+    {
+      size_t  width = (size_t)( ras.cbox.xMax - ras.cbox.xMin ) + 2;
+      size_t  max   = FT_MAX_GRAY_POOL * sizeof ( TCell ) / sizeof ( TArea );
+
+
+      if ( width <= max && height <= max / width )
+        return gray_convert_dense( RAS_VAR_ (TArea*)buffer );
+    }
+
+    y      = (TCoord)ras.cbox.yMin;
+    height = gray_set_pool( RAS_VAR_ pool, pool_size, y );
+
+    while ( y < ras.cbox.yMax )
     {
       ras.min_ey = y;
       y         += height;
@@ -1920,7 +2360,7 @@ typedef ptrdiff_t  FT_PtrDist;
         n = ( (size_t)ras.count_ey * sizeof ( PCell ) + sizeof ( TCell ) - 1 )
               / sizeof ( TCell );
 
-        ras.cell_free = buffer + n;
+        ras.cell_free = pool + n;
         ras.cell      = ras.cell_null;
 
         error     = gray_convert_glyph_inner( RAS_VAR_ continued );
@@ -1938,7 +2378,20 @@ typedef ptrdiff_t  FT_PtrDist;
         else if ( error != Smooth_Err_Raster_Overflow )
           return error;
 
-        /* render pool overflow; we will reduce the render band by half */
+        /* render pool overflow; rather than splitting the band, try */
+        /* it again with a larger pool if we may; the parts of the    */
+        /* band that are done stay done, and the bands that follow    */
+        /* get taller                                                 */
+        if ( !gray_grow_pool( RAS_VAR_ pool_size ) )
+        {
+          pool      = ras.pool;
+          pool_size = ras.pool_size;
+          height    = gray_set_pool( RAS_VAR_ pool, pool_size,
+                                     ras.max_ey );
+          continue;
+        }
+
+        /* otherwise we will reduce the render band by half */
         i = ( band[0] - band[1] ) >> 1;
 
         /* this should never happen even with tiny rendering pool */
@@ -1991,7 +2444,11 @@ typedef ptrdiff_t  FT_PtrDist;
            outline->contours[outline->n_contours - 1] + 1 )
       return FT_THROW( Invalid_Outline );
 
-    ras.outline = *outline;
+    ras.raster   = (gray_PRaster)raster;
+    ras.pool     = NULL;
+    ras.outline  = *outline;
+    ras.dense_ok = !ras.raster->no_dense;
+    ras.dense    = NULL;
 
     if ( params->flags & FT_RASTER_FLAG_DIRECT )
     {
@@ -2037,7 +2494,18 @@ typedef ptrdiff_t  FT_PtrDist;
     if ( ras.cbox.xMin >= ras.cbox.xMax || ras.cbox.yMin >= ras.cbox.yMax )
       return Smooth_Err_Ok;
 
+#ifdef STANDALONE_
     return gray_convert_glyph( RAS_VAR );
+#else
+    {
+      FT_Memory  memory = (FT_Memory)ras.raster->memory;
+      int        error  = gray_convert_glyph( RAS_VAR );
+
+
+      FT_FREE( ras.pool );
+      return error;
+    }
+#endif
   }
 
 
@@ -2119,12 +2587,29 @@ typedef ptrdiff_t  FT_PtrDist;
                         unsigned long  mode,
                         void*          args )
   {
-    FT_UNUSED( raster );
-    FT_UNUSED( mode );
-    FT_UNUSED( args );
+    gray_PRaster  rast = (gray_PRaster)raster;
 
 
-    return 0; /* nothing to do */
+    if ( mode == FT_GRAY_DENSE_RENDER )
+    {
+      if ( !rast || !args )
+        return FT_THROW( Invalid_Argument );
+
+      rast->no_dense = !*(int*)args;
+    }
+    else if ( mode == FT_GRAY_POOL_LIMIT )
+    {
+#ifdef STANDALONE_
+      return FT_THROW( Invalid_Argument );
+#else
+      if ( !rast || !args )
+        return FT_THROW( Invalid_Argument );
+
+      rast->pool_limit = *(unsigned long*)args;
+#endif
+    }
+
+    return 0;
   }
 
 
@@ -47,6 +47,44 @@
   FT_EXPORT_VAR( const FT_Raster_Funcs )  ft_grays_raster;
 
 
+  /**************************************************************************
+   *
+   * Glyphs that are rendered to a bitmap and are small enough are
+   * accumulated in a dense buffer rather than in cell lists (see
+   * `gray_convert_dense' in `ftgrays.c').  The output is the same; the
+   * buffer is just faster.  Passing this tag to `raster_set_mode' (or to
+   * `FT_Set_Renderer' for the `smooth' renderer) together with a pointer
+   * to an `int' turns it off (0) or on again (non-zero), for example to
+   * compare the two.
+   */
+#define FT_GRAY_DENSE_RENDER                    \
+          ( ( (unsigned long)'d' << 24 ) |      \
+            ( (unsigned long)'e' << 16 ) |      \
+            ( (unsigned long)'n' <<  8 ) |      \
+              (unsigned long)'s'         )
+
+
+  /**************************************************************************
+   *
+   * Glyphs whose cells do not fit in the fixed render pool (see
+   * `FT_RENDER_POOL_SIZE') are split into bands, and the outline is
+   * decomposed once per band, which makes very large glyphs expensive.
+   * Passing this tag to `raster_set_mode' (or to `FT_Set_Renderer' for
+   * the `smooth' renderer) together with a pointer to an `unsigned long'
+   * lets the raster grow a heap pool of up to that many bytes instead.
+   * Each rendering call allocates its own pool and frees it before it
+   * returns, so calls never share one; 0, the default, disables it.
+   * Like other renderer properties, the limit must not be changed while
+   * another thread renders with the same library.  This is not available
+   * in stand-alone mode.
+   */
+#define FT_GRAY_POOL_LIMIT                      \
+          ( ( (unsigned long)'p' << 24 ) |      \
+            ( (unsigned long)'o' << 16 ) |      \
+            ( (unsigned long)'o' <<  8 ) |      \
+              (unsigned long)'l'         )
+
+
 #ifdef __cplusplus
   }
 #endif
@@ -0,0 +1,208 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+
+
+  /*
+   * Compare the cost of opening a face handle (see `FT_New_Face_Handle')
+   * with a face of its own, and the glyph throughput of one thread with
+   * the one of several threads, each with a handle of a single parent
+   * face.  `tests/face-handles' checks that the threads agree.
+   *
+   * Usage: face-handles [font-file]
+   *
+   * Without a font file, `As.I.Lay.Dying.ttf' from the test data is used.
+   */
+
+#define NUM_THREADS  8
+#define NUM_ROUNDS   8
+#define NUM_CHARS    ( 127 - 33 )
+
+
+  static const int  sizes[] = { 9, 12, 16, 24, 36 };
+
+#define NUM_SIZES  (int)( sizeof ( sizes ) / sizeof ( *sizes ) )
+
+
+  static FT_Library  library;
+  static FT_Face     parent;
+
+
+  typedef struct  Worker_
+  {
+    pthread_t  thread;
+    FT_Face    face;
+    int        rounds;
+
+  } Worker;
+
+
+  static double
+  now( void )
+  {
+    struct timespec  ts;
+
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+  }
+
+
+  static void*
+  work( void*  arg )
+  {
+    Worker*  worker = (Worker*)arg;
+    int      k, i, c;
+
+
+    for ( k = 0; k < worker->rounds; k++ )
+      for ( i = 0; i < NUM_SIZES; i++ )
+      {
+        FT_Set_Pixel_Sizes( worker->face, 0, (FT_UInt)sizes[i] );
+
+        for ( c = 0; c < NUM_CHARS; c++ )
+          FT_Load_Char( worker->face, (FT_ULong)( c + 33 ), FT_LOAD_RENDER );
+      }
+
+    return NULL;
+  }
+
+
+  /* Share the rounds among `n' threads; return the elapsed time. */
+  static double
+  run_threads( int  n )
+  {
+    Worker  workers[NUM_THREADS];
+    double  start;
+    int     i;
+
+
+    for ( i = 0; i < n; i++ )
+    {
+      if ( FT_New_Face_Handle( parent, &workers[i].face ) )
+      {
+        fprintf( stderr, "cannot create a face handle\n" );
+        exit( 1 );
+      }
+      workers[i].rounds = NUM_ROUNDS * NUM_THREADS / n;
+    }
+
+    start = now();
+
+    for ( i = 0; i < n; i++ )
+      pthread_create( &workers[i].thread, NULL, work, &workers[i] );
+    for ( i = 0; i < n; i++ )
+      pthread_join( workers[i].thread, NULL );
+
+    start = now() - start;
+
+    for ( i = 0; i < n; i++ )
+      FT_Done_Face( workers[i].face );
+
+    return start;
+  }
+
+
+  /* Print the time to open a face and a handle, in microseconds. */
+  static void
+  bench_open( const FT_Byte*  data,
+              long            size )
+  {
+    double  face_time, handle_time;
+    int     k;
+
+
+    face_time = now();
+    for ( k = 0; k < 100; k++ )
+    {
+      FT_Face  face;
+
+
+      FT_New_Memory_Face( library, data, size, 0, &face );
+      FT_Set_Pixel_Sizes( face, 0, 16 );
+      FT_Load_Char( face, 'a', FT_LOAD_DEFAULT );
+      FT_Done_Face( face );
+    }
+    face_time = ( now() - face_time ) * 1e4;
+
+    handle_time = now();
+    for ( k = 0; k < 100; k++ )
+    {
+      FT_Face  face;
+
+
+      FT_New_Face_Handle( parent, &face );
+      FT_Set_Pixel_Sizes( face, 0, 16 );
+      FT_Load_Char( face, 'a', FT_LOAD_DEFAULT );
+      FT_Done_Face( face );
+    }
+    handle_time = ( now() - handle_time ) * 1e4;
+
+    printf( "open and load one glyph: face %.1fus, handle %.1fus\n",
+            face_time, handle_time );
+  }
+
+
+  int
+  main( int     argc,
+        char**  argv )
+  {
+    const char*  testdata_dir = getenv( "FREETYPE_TESTS_DATA_DIR" );
+    char         filepath[FILENAME_MAX];
+    FILE*        file;
+    FT_Byte*     data;
+    long         size;
+    double       one, all;
+
+
+    if ( argc > 1 )
+      snprintf( filepath, sizeof ( filepath ), "%s", argv[1] );
+    else
+      snprintf( filepath, sizeof ( filepath ), "%s/%s",
+                testdata_dir ? testdata_dir : "../tests/data",
+                "As.I.Lay.Dying.ttf" );
+
+    /* handles need the bytes in memory */
+    file = fopen( filepath, "rb" );
+    if ( !file )
+    {
+      fprintf( stderr, "Could not open file: %s\n", filepath );
+      return 1;
+    }
+    fseek( file, 0, SEEK_END );
+    size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+    data = malloc( (size_t)size );
+    if ( fread( data, 1, (size_t)size, file ) != (size_t)size )
+      size = 0;
+    fclose( file );
+
+    FT_Init_FreeType( &library );
+
+    if ( FT_New_Memory_Face( library, data, size, 0, &parent ) )
+    {
+      fprintf( stderr, "Could not open file: %s\n", filepath );
+      return 1;
+    }
+
+    bench_open( data, size );
+
+    one = run_threads( 1 );
+    all = run_threads( NUM_THREADS );
+
+    printf( "%d glyphs: 1 thread %.1fms, %d threads %.1fms (%.2fx)\n",
+            NUM_ROUNDS * NUM_THREADS * NUM_SIZES * NUM_CHARS,
+            one * 1e3, NUM_THREADS, all * 1e3, one / all );
+
+    FT_Done_Face( parent );
+    FT_Done_FreeType( library );
+    free( data );
+
+    return 0;
+  }
+
+/* EOF */
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+#include <freetype/ftatlas.h>
+#include <freetype/ftbitmap.h>
+#include <freetype/ftoutln.h>
+
+
+  /*
+   * Compare `FT_Atlas_Render_Glyphs' with rendering glyph by glyph and
+   * copying into a simple row packer.  `tests/glyph-atlas' checks that
+   * both give the same glyph images.
+   *
+   * Usage: glyph-atlas [font-file]
+   *
+   * Without a font file, `As.I.Lay.Dying.ttf' from the test data is used.
+   */
+
+#define ATLAS_SIZE  1024
+#define PADDING     1
+#define NUM_CHARS   ( 127 - 33 )
+
+
+  static FT_Face        face;
+  static unsigned char  pixels[ATLAS_SIZE * ATLAS_SIZE];
+
+
+  static double
+  now( void )
+  {
+    struct timespec  ts;
+
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+  }
+
+
+  /* Render and copy the glyphs one by one. */
+  static void
+  render_single( FT_Atlas_GlyphRec*  glyphs )
+  {
+    int  x = 0, y = 0, row_height = 0, i;
+
+
+    for ( i = 0; i < NUM_CHARS; i++ )
+    {
+      FT_Bitmap*    bitmap = &face->glyph->bitmap;
+      unsigned int  j;
+
+
+      if ( FT_Load_Glyph( face, glyphs[i].glyph_index, FT_LOAD_DEFAULT ) )
+        continue;
+
+      FT_Outline_Translate( &face->glyph->outline,
+                            glyphs[i].origin.x,
+                            glyphs[i].origin.y );
+      FT_Render_Glyph( face->glyph, FT_RENDER_MODE_NORMAL );
+
+      if ( x + (int)bitmap->width + PADDING > ATLAS_SIZE )
+      {
+        x           = 0;
+        y          += row_height;
+        row_height  = 0;
+      }
+      for ( j = 0; j < bitmap->rows; j++ )
+        memcpy( pixels + ( y + (int)j ) * ATLAS_SIZE + x,
+                bitmap->buffer + j * (unsigned int)bitmap->pitch,
+                bitmap->width );
+
+      x += (int)bitmap->width + PADDING;
+      if ( (int)bitmap->rows + PADDING > row_height )
+        row_height = (int)bitmap->rows + PADDING;
+    }
+  }
+
+
+  /* Print the best time per glyph of both ways, in nanoseconds. */
+  static void
+  bench( FT_Atlas  atlas,
+         int       size )
+  {
+    FT_Atlas_GlyphRec  glyphs[NUM_CHARS];
+    double             single = 1e30, batch = 1e30;
+    int                rounds = 200;
+    int                c, k, r;
+
+
+    FT_Set_Pixel_Sizes( face, 0, (FT_UInt)size );
+
+    for ( c = 0; c < NUM_CHARS; c++ )
+    {
+      glyphs[c].glyph_index = FT_Get_Char_Index( face, (FT_ULong)( c + 33 ) );
+      glyphs[c].origin.x    = ( c * 21 ) & 63;
+      glyphs[c].origin.y    = 0;
+    }
+
+    /* interleave short runs and keep the best, to reduce noise */
+    for ( k = 0; k < 5; k++ )
+    {
+      double  t;
+
+
+      t = now();
+      for ( r = 0; r < rounds; r++ )
+        render_single( glyphs );
+      t = ( now() - t ) * 1e9 / ( rounds * NUM_CHARS );
+      single = t < single ? t : single;
+
+      t = now();
+      for ( r = 0; r < rounds; r++ )
+      {
+        FT_Atlas_Reset( atlas );
+        FT_Atlas_Render_Glyphs( atlas, face, FT_LOAD_DEFAULT,
+                                NUM_CHARS, glyphs, NULL );
+      }
+      t = ( now() - t ) * 1e9 / ( rounds * NUM_CHARS );
+      batch = t < batch ? t : batch;
+    }
+
+    printf( "%6d %14.0f %14.0f %7.2fx\n",
+            size, single, batch, single / batch );
+  }
+
+
+  int
+  main( int     argc,
+        char**  argv )
+  {
+    static const int  sizes[] = { 12, 16, 24, 48 };
+
+    const char*  testdata_dir = getenv( "FREETYPE_TESTS_DATA_DIR" );
+    char         filepath[FILENAME_MAX];
+    FT_Library   library;
+    FT_Bitmap    target;
+    FT_Atlas     atlas;
+    size_t       i;
+
+
+    if ( argc > 1 )
+      snprintf( filepath, sizeof ( filepath ), "%s", argv[1] );
+    else
+      snprintf( filepath, sizeof ( filepath ), "%s/%s",
+                testdata_dir ? testdata_dir : "../tests/data",
+                "As.I.Lay.Dying.ttf" );
+
+    FT_Init_FreeType( &library );
+
+    if ( FT_New_Face( library, filepath, 0, &face ) )
+    {
+      fprintf( stderr, "Could not open file: %s\n", filepath );
+      return 1;
+    }
+
+    FT_Bitmap_Init( &target );
+    target.width      = ATLAS_SIZE;
+    target.rows       = ATLAS_SIZE;
+    target.pitch      = ATLAS_SIZE;
+    target.pixel_mode = FT_PIXEL_MODE_GRAY;
+    target.num_grays  = 256;
+    target.buffer     = pixels;
+
+    if ( FT_Atlas_New( library, &target, PADDING, &atlas ) )
+    {
+      fprintf( stderr, "cannot create the atlas\n" );
+      return 1;
+    }
+
+    printf( "%6s %14s %14s %8s\n",
+            "size", "single(ns)", "batch(ns)", "speedup" );
+    for ( i = 0; i < sizeof ( sizes ) / sizeof ( *sizes ); i++ )
+      bench( atlas, sizes[i] );
+
+    FT_Atlas_Done( atlas );
+    FT_Done_FreeType( library );
+
+    return 0;
+  }
+
+/* EOF */
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+#include <freetype/ftbitmap.h>
+#include <freetype/ftoutln.h>
+#include <freetype/ftrender.h>
+#include <freetype/ftmodapi.h>
+
+
+  /*
+   * Time the optional code paths of the `smooth' rasterizer against its
+   * default ones: the dense accumulation buffer against cell lists for
+   * small glyphs, and a heap cell pool against the bands of the fixed
+   * pool for large ones.  `tests/grays' checks that they agree.
+   *
+   * Usage: grays [font-file]
+   *
+   * Without a font file, `As.I.Lay.Dying.ttf' from the test data is used.
+   */
+
+  /* see `FT_GRAY_DENSE_RENDER' and `FT_GRAY_POOL_LIMIT' */
+  /* in `src/smooth/ftgrays.h'                            */
+#define DENSE_RENDER  FT_MAKE_TAG( 'd', 'e', 'n', 's' )
+#define POOL_LIMIT    FT_MAKE_TAG( 'p', 'o', 'o', 'l' )
+
+
+  static FT_Library  library;
+  static FT_Outline  outlines[16];
+  static int         num_outlines;
+
+
+  static void
+  set_mode( unsigned long  tag,
+            unsigned long  value )
+  {
+    FT_Renderer   renderer = (FT_Renderer)FT_Get_Module( library, "smooth" );
+    FT_Parameter  param;
+    int           on       = (int)value;
+
+
+    param.tag  = tag;
+    param.data = tag == DENSE_RENDER ? (void*)&on : (void*)&value;
+
+    if ( !renderer || FT_Set_Renderer( library, renderer, 1, &param ) )
+    {
+      fprintf( stderr, "cannot configure the smooth renderer\n" );
+      exit( 1 );
+    }
+  }
+
+
+  static void
+  add_glyphs( FT_Face  face,
+              int      size )
+  {
+    const char*  chars = "agWM@&%8e1";
+    const char*  p;
+
+
+    FT_Set_Pixel_Sizes( face, 0, (FT_UInt)size );
+
+    for ( p = chars; *p; p++ )
+    {
+      FT_Outline*  outline = &outlines[num_outlines];
+
+
+      if ( FT_Load_Char( face, (FT_ULong)*p, FT_LOAD_NO_BITMAP ) ||
+           face->glyph->format != FT_GLYPH_FORMAT_OUTLINE         )
+        continue;
+
+      FT_Outline_New( library,
+                      (FT_UInt)face->glyph->outline.n_points,
+                      face->glyph->outline.n_contours,
+                      outline );
+      FT_Outline_Copy( &face->glyph->outline, outline );
+      num_outlines++;
+    }
+  }
+
+
+  /* Render an outline to a bitmap covering its control box. */
+  static void
+  render( FT_Outline*  outline )
+  {
+    FT_BBox           cbox;
+    FT_Bitmap         bitmap;
+    FT_Raster_Params  params;
+
+
+    FT_Outline_Get_CBox( outline, &cbox );
+    cbox.xMin &= ~63;
+    cbox.yMin &= ~63;
+    cbox.xMax  = ( cbox.xMax + 63 ) & ~63;
+    cbox.yMax  = ( cbox.yMax + 63 ) & ~63;
+
+    FT_Bitmap_Init( &bitmap );
+    bitmap.width      = (unsigned int)( ( cbox.xMax - cbox.xMin ) >> 6 );
+    bitmap.rows       = (unsigned int)( ( cbox.yMax - cbox.yMin ) >> 6 );
+    bitmap.pitch      = (int)bitmap.width;
+    bitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+    bitmap.num_grays  = 256;
+    bitmap.buffer     = calloc( bitmap.rows, bitmap.width );
+
+    FT_Outline_Translate( outline, -cbox.xMin, -cbox.yMin );
+
+    params.target = &bitmap;
+    params.source = outline;
+    params.flags  = FT_RASTER_FLAG_AA;
+
+    FT_Outline_Render( library, outline, &params );
+
+    FT_Outline_Translate( outline, cbox.xMin, cbox.yMin );
+    free( bitmap.buffer );
+  }
+
+
+  /* Return the time per outline in nanoseconds. */
+  static double
+  bench( unsigned long  tag,
+         unsigned long  value )
+  {
+    clock_t  start;
+    int      rounds = 0;
+    int      i;
+
+
+    set_mode( tag, value );
+
+    start = clock();
+    do
+    {
+      for ( i = 0; i < num_outlines; i++ )
+        render( &outlines[i] );
+      rounds++;
+    } while ( clock() - start < CLOCKS_PER_SEC / 10 );
+
+    return (double)( clock() - start ) / CLOCKS_PER_SEC * 1e9 /
+             ( (double)rounds * num_outlines );
+  }
+
+
+  /* Print the best time of the default and the optional code path. */
+  static void
+  compare( FT_Face        face,
+           int            size,
+           unsigned long  tag,
+           unsigned long  off,
+           unsigned long  on )
+  {
+    double  a = 1e30;
+    double  b = 1e30;
+    int     i, k;
+
+
+    add_glyphs( face, size );
+
+    /* interleave short runs and keep the best, to reduce noise */
+    for ( k = 0; k < 5; k++ )
+    {
+      double  t;
+
+
+      t = bench( tag, off );
+      a = t < a ? t : a;
+      t = bench( tag, on );
+      b = t < b ? t : b;
+    }
+
+    /* leave the default behaviour for the next comparison */
+    set_mode( tag, tag == DENSE_RENDER ? 1 : 0 );
+
+    printf( "%6d %8d %14.0f %14.0f %7.2fx\n",
+            size, num_outlines, a, b, a / b );
+
+    for ( i = 0; i < num_outlines; i++ )
+      FT_Outline_Done( library, &outlines[i] );
+    num_outlines = 0;
+  }
+
+
+  int
+  main( int     argc,
+        char**  argv )
+  {
+    static const int  small[] = { 6, 12, 16, 24, 48, 100 };
+    static const int  large[] = { 100, 200, 500, 1000 };
+
+    const char*  testdata_dir = getenv( "FREETYPE_TESTS_DATA_DIR" );
+    char         filepath[FILENAME_MAX];
+    FT_Face      face;
+    size_t       i;
+
+
+    if ( argc > 1 )
+      snprintf( filepath, sizeof ( filepath ), "%s", argv[1] );
+    else
+      snprintf( filepath, sizeof ( filepath ), "%s/%s",
+                testdata_dir ? testdata_dir : "../tests/data",
+                "As.I.Lay.Dying.ttf" );
+
+    FT_Init_FreeType( &library );
+
+    if ( FT_New_Face( library, filepath, 0, &face ) )
+    {
+      fprintf( stderr, "Could not open file: %s\n", filepath );
+      return 1;
+    }
+
+    printf( "%6s %8s %14s %14s %8s\n",
+            "size", "glyphs", "cells(ns)", "dense(ns)", "speedup" );
+    for ( i = 0; i < sizeof ( small ) / sizeof ( *small ); i++ )
+      compare( face, small[i], DENSE_RENDER, 0, 1 );
+
+    printf( "\n%6s %8s %14s %14s %8s\n",
+            "size", "glyphs", "bands(ns)", "heap(ns)", "speedup" );
+    for ( i = 0; i < sizeof ( large ) / sizeof ( *large ); i++ )
+      compare( face, large[i], POOL_LIMIT, 0, 64 << 20 );
+
+    FT_Done_Face( face );
+    FT_Done_FreeType( library );
+
+    return 0;
+  }
+
+/* EOF */
@@ -0,0 +1,258 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+#include <freetype/ftmodapi.h>
+#include <freetype/ftrender.h>
+
+
+  /*
+   * Load and render glyphs from several threads, each with its own face
+   * handle (see `FT_New_Face_Handle') of a single parent face, and check
+   * that every thread gets the same bitmaps as the parent alone.  The
+   * largest size overflows the stack cell pool of the `smooth' renderer,
+   * so that the threads also grow heap pools at the same time.  Timings
+   * are in `tests/bench/face-handles.c'.
+   *
+   * Usage: face-handles [font-file]
+   *
+   * Without a font file, `As.I.Lay.Dying.ttf' from the test data is used.
+   */
+
+#define NUM_THREADS  8
+#define NUM_CHARS    ( 127 - 33 )
+
+  /* see `FT_GRAY_POOL_LIMIT' in `src/smooth/ftgrays.h' */
+#define POOL_LIMIT  FT_MAKE_TAG( 'p', 'o', 'o', 'l' )
+
+
+  static const int  sizes[] = { 9, 12, 16, 24, 36, 150 };
+
+#define NUM_SIZES  (int)( sizeof ( sizes ) / sizeof ( *sizes ) )
+
+
+  static FT_Library       library;
+  static FT_Face          parent;
+  static unsigned long    expected[NUM_SIZES][NUM_CHARS];
+  static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+  typedef struct  Worker_
+  {
+    pthread_t  thread;
+    FT_Face    face;
+    int        rounds;
+    int        failed;
+
+  } Worker;
+
+
+  /* A hash of the rendered bitmap, its position, and the advance. */
+  static unsigned long
+  checksum( FT_GlyphSlot  slot )
+  {
+    unsigned long  h = 5381;
+    unsigned int   x, y;
+
+
+    h = h * 33 + (unsigned long)slot->bitmap_left;
+    h = h * 33 + (unsigned long)slot->bitmap_top;
+    h = h * 33 + (unsigned long)slot->advance.x;
+
+    for ( y = 0; y < slot->bitmap.rows; y++ )
+      for ( x = 0; x < slot->bitmap.width; x++ )
+        h = h * 33 + slot->bitmap.buffer[y * slot->bitmap.pitch + (int)x];
+
+    return h;
+  }
+
+
+  /* Render all glyphs of `face'; store the checksums in `sums'. */
+  static int
+  render_all( FT_Face        face,
+              unsigned long  sums[NUM_SIZES][NUM_CHARS] )
+  {
+    int  i, c;
+
+
+    for ( i = 0; i < NUM_SIZES; i++ )
+    {
+      if ( FT_Set_Pixel_Sizes( face, 0, (FT_UInt)sizes[i] ) )
+        return 1;
+
+      for ( c = 0; c < NUM_CHARS; c++ )
+      {
+        FT_UInt  gindex = FT_Get_Char_Index( face, (FT_ULong)( c + 33 ) );
+
+
+        if ( FT_Load_Glyph( face, gindex, FT_LOAD_RENDER ) )
+          return 1;
+
+        sums[i][c] = checksum( face->glyph );
+      }
+    }
+
+    return 0;
+  }
+
+
+  static void*
+  work( void*  arg )
+  {
+    Worker*  worker = (Worker*)arg;
+    int      k;
+
+
+    for ( k = 0; k < worker->rounds; k++ )
+    {
+      unsigned long  sums[NUM_SIZES][NUM_CHARS];
+
+
+      if ( render_all( worker->face, sums ) ||
+           memcmp( sums, expected, sizeof ( sums ) ) )
+      {
+        worker->failed = 1;
+        break;
+      }
+    }
+
+    return NULL;
+  }
+
+
+  /* Run `n' threads for `rounds' rounds; return 1 if one failed. */
+  static int
+  run_threads( int  n,
+               int  rounds )
+  {
+    Worker  workers[NUM_THREADS];
+    int     failed = 0;
+    int     i;
+
+
+    for ( i = 0; i < n; i++ )
+    {
+      /* creating handles must be serialized like `FT_New_Face' */
+      pthread_mutex_lock( &lock );
+      if ( FT_New_Face_Handle( parent, &workers[i].face ) )
+      {
+        fprintf( stderr, "cannot create a face handle\n" );
+        exit( 1 );
+      }
+      pthread_mutex_unlock( &lock );
+
+      workers[i].rounds = rounds;
+      workers[i].failed = 0;
+    }
+
+    for ( i = 0; i < n; i++ )
+      pthread_create( &workers[i].thread, NULL, work, &workers[i] );
+    for ( i = 0; i < n; i++ )
+      pthread_join( workers[i].thread, NULL );
+
+    for ( i = 0; i < n; i++ )
+    {
+      if ( workers[i].failed )
+      {
+        printf( "thread %d: bitmaps differ\n", i );
+        failed = 1;
+      }
+      FT_Done_Face( workers[i].face );
+    }
+
+    return failed;
+  }
+
+
+  int
+  main( int     argc,
+        char**  argv )
+  {
+    const char*  testdata_dir = getenv( "FREETYPE_TESTS_DATA_DIR" );
+    char         filepath[FILENAME_MAX];
+    FILE*        file;
+    FT_Byte*     data;
+    long         size;
+    int          failed;
+
+
+    if ( argc > 1 )
+      snprintf( filepath, sizeof ( filepath ), "%s", argv[1] );
+    else
+      snprintf( filepath, sizeof ( filepath ), "%s/%s",
+                testdata_dir ? testdata_dir : "../tests/data",
+                "As.I.Lay.Dying.ttf" );
+
+    /* load the file ourselves, since handles need the bytes in memory */
+    file = fopen( filepath, "rb" );
+    if ( !file )
+    {
+      fprintf( stderr, "Could not open file: %s\n", filepath );
+      return 1;
+    }
+    fseek( file, 0, SEEK_END );
+    size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+    data = malloc( (size_t)size );
+    if ( fread( data, 1, (size_t)size, file ) != (size_t)size )
+      size = 0;
+    fclose( file );
+
+    FT_Init_FreeType( &library );
+
+    {
+      FT_Renderer    renderer = (FT_Renderer)FT_Get_Module( library,
+                                                            "smooth" );
+      unsigned long  limit    = 1 << 20;
+      FT_Parameter   param;
+
+
+      param.tag  = POOL_LIMIT;
+      param.data = &limit;
+
+      if ( !renderer || FT_Set_Renderer( library, renderer, 1, &param ) )
+      {
+        fprintf( stderr, "cannot configure the smooth renderer\n" );
+        return 1;
+      }
+    }
+
+    if ( FT_New_Memory_Face( library, data, size, 0, &parent ) )
+    {
+      fprintf( stderr, "Could not open file: %s\n", filepath );
+      return 1;
+    }
+
+    if ( render_all( parent, expected ) )
+    {
+      fprintf( stderr, "cannot render the glyphs of %s\n", filepath );
+      return 1;
+    }
+
+    failed = run_threads( NUM_THREADS, 4 );
+
+    /* the parent may go first; its handles keep it alive */
+    {
+      FT_Face  handle;
+
+
+      if ( FT_New_Face_Handle( parent, &handle ) )
+        failed = 1;
+      else
+      {
+        FT_Done_Face( parent );
+        parent = handle;
+      }
+    }
+
+    FT_Done_Face( parent );
+    FT_Done_FreeType( library );
+    free( data );
+
+    return failed;
+  }
+
+/* EOF */
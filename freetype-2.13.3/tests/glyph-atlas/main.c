@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+#include <freetype/ftatlas.h>
+#include <freetype/ftbitmap.h>
+#include <freetype/ftoutln.h>
+
+
+  /*
+   * Render glyphs into an atlas with `FT_Atlas_Render_Glyphs' and check
+   * that every glyph image is the same as the one of `FT_Render_Glyph',
+   * that no two glyphs overlap, that glyphs fill an atlas up to its edges,
+   * and that a full atlas is reported.  Timings are in
+   * `tests/bench/glyph-atlas.c'.
+   *
+   * Usage: glyph-atlas [font-file]
+   *
+   * Without a font file, `As.I.Lay.Dying.ttf' from the test data is used.
+   */
+
+#define ATLAS_SIZE  1024
+#define PADDING     1
+#define NUM_CHARS   ( 127 - 33 )
+
+
+  static FT_Library     library;
+  static FT_Face        face;
+  static unsigned char  pixels[ATLAS_SIZE * ATLAS_SIZE];
+  static FT_Bitmap      target;
+
+
+  /* Fill `glyphs' with the printable ASCII characters, shifted by */
+  /* subpixel offsets that depend on `seed'.                       */
+  static void
+  make_glyphs( FT_Atlas_GlyphRec*  glyphs,
+               int                 seed )
+  {
+    int  c;
+
+
+    for ( c = 0; c < NUM_CHARS; c++ )
+    {
+      glyphs[c].glyph_index = FT_Get_Char_Index( face, (FT_ULong)( c + 33 ) );
+      glyphs[c].origin.x    = ( c * 21 + seed * 7 ) & 63;
+      glyphs[c].origin.y    = seed & 1 ? ( c * 13 ) & 63 : 0;
+    }
+  }
+
+
+  /* Compare a glyph in the atlas with `FT_Render_Glyph'. */
+  static int
+  check_glyph( FT_Atlas_GlyphRec*  glyph,
+               FT_Int32            load_flags,
+               int                 size )
+  {
+    FT_Bitmap*     bitmap = &face->glyph->bitmap;
+    unsigned char  max;
+    unsigned int   i, j;
+
+
+    if ( FT_Load_Glyph( face, glyph->glyph_index,
+                        load_flags & ~FT_LOAD_RENDER ) )
+      return 1;
+
+    if ( face->glyph->format == FT_GLYPH_FORMAT_OUTLINE )
+      FT_Outline_Translate( &face->glyph->outline,
+                            glyph->origin.x,
+                            glyph->origin.y );
+
+    if ( FT_Render_Glyph( face->glyph,
+                          ( load_flags & FT_LOAD_MONOCHROME )
+                            ? FT_RENDER_MODE_MONO
+                            : FT_LOAD_TARGET_MODE( load_flags ) ) )
+      return 1;
+
+    if ( glyph->width       != bitmap->width           ||
+         glyph->rows        != bitmap->rows            ||
+         glyph->bitmap_left != face->glyph->bitmap_left ||
+         glyph->bitmap_top  != face->glyph->bitmap_top  ||
+         glyph->advance.x   != face->glyph->advance.x   )
+    {
+      printf( "size %d, glyph %u: metrics differ\n",
+              size, glyph->glyph_index );
+      return 1;
+    }
+
+    max = bitmap->pixel_mode == FT_PIXEL_MODE_MONO ? 1 : 255;
+
+    for ( i = 0; i < bitmap->rows; i++ )
+    {
+      unsigned char*  row = pixels + ( glyph->y + (int)i ) * ATLAS_SIZE +
+                            glyph->x;
+
+
+      for ( j = 0; j < bitmap->width; j++ )
+      {
+        unsigned char  expected;
+
+
+        if ( bitmap->pixel_mode == FT_PIXEL_MODE_MONO )
+          expected = ( bitmap->buffer[i * (unsigned int)bitmap->pitch +
+                                      j / 8] >> ( 7 - j % 8 ) ) & 1;
+        else
+          expected = bitmap->buffer[i * (unsigned int)bitmap->pitch + j];
+
+        if ( row[j] != expected * 255 / max )
+        {
+          printf( "size %d, glyph %u: pixel (%u, %u) is %d, expected %d\n",
+                  size, glyph->glyph_index, j, i,
+                  row[j], expected * 255 / max );
+          return 1;
+        }
+      }
+    }
+
+    return 0;
+  }
+
+
+  static int
+  overlap( FT_Atlas_GlyphRec*  a,
+           FT_Atlas_GlyphRec*  b )
+  {
+    return a->x < b->x + (int)b->width + PADDING &&
+           b->x < a->x + (int)a->width + PADDING &&
+           a->y < b->y + (int)b->rows + PADDING  &&
+           b->y < a->y + (int)a->rows + PADDING;
+  }
+
+
+  /* Render the batch into an empty atlas at every size and check it. */
+  static int
+  test_flags( FT_Atlas  atlas,
+              FT_Int32  load_flags )
+  {
+    static const int  sizes[] = { 9, 12, 16, 24, 36, 48, 72, 144 };
+
+    FT_Atlas_GlyphRec  glyphs[NUM_CHARS];
+    size_t             s;
+    int                failed = 0;
+
+
+    for ( s = 0; s < sizeof ( sizes ) / sizeof ( *sizes ); s++ )
+    {
+      FT_UInt  num_done;
+      int      i, j;
+
+
+      FT_Set_Pixel_Sizes( face, 0, (FT_UInt)sizes[s] );
+      make_glyphs( glyphs, (int)s );
+
+      FT_Atlas_Reset( atlas );
+      memset( pixels, 0xAA, sizeof ( pixels ) );
+
+      if ( FT_Atlas_Render_Glyphs( atlas, face, load_flags,
+                                   NUM_CHARS, glyphs, &num_done ) ||
+           num_done != NUM_CHARS                                   )
+      {
+        printf( "size %d: the atlas is too small\n", sizes[s] );
+        return 1;
+      }
+
+      for ( i = 0; i < NUM_CHARS; i++ )
+      {
+        if ( glyphs[i].error || !glyphs[i].width || !glyphs[i].rows )
+          continue;
+
+        failed |= check_glyph( &glyphs[i], load_flags, sizes[s] );
+
+        for ( j = 0; j < i; j++ )
+        {
+          if ( !glyphs[j].error && glyphs[j].width && glyphs[j].rows &&
+               overlap( &glyphs[i], &glyphs[j] )                     )
+          {
+            printf( "size %d: glyphs %d and %d overlap\n", sizes[s], i, j );
+            failed = 1;
+          }
+        }
+      }
+    }
+
+    return failed;
+  }
+
+
+  /* Fill the atlas with large glyphs until it is full. */
+  static int
+  test_full( FT_Atlas  atlas )
+  {
+    FT_Atlas_GlyphRec  glyphs[NUM_CHARS];
+    FT_UInt            num_done;
+    FT_Error           error;
+
+
+    FT_Set_Pixel_Sizes( face, 0, 400 );
+    make_glyphs( glyphs, 0 );
+    FT_Atlas_Reset( atlas );
+
+    error = FT_Atlas_Render_Glyphs( atlas, face, FT_LOAD_DEFAULT,
+                                    NUM_CHARS, glyphs, &num_done );
+    if ( error != FT_Err_Raster_Overflow  ||
+         num_done == 0 || num_done >= NUM_CHARS )
+    {
+      printf( "full atlas: error 0x%x after %u glyphs\n", error, num_done );
+      return 1;
+    }
+
+    /* the rest fits after a reset */
+    FT_Atlas_Reset( atlas );
+    error = FT_Atlas_Render_Glyphs( atlas, face, FT_LOAD_DEFAULT,
+                                    1, glyphs + num_done, NULL );
+    if ( error )
+    {
+      printf( "full atlas: error 0x%x after a reset\n", error );
+      return 1;
+    }
+
+    return 0;
+  }
+
+
+  /* Pack a 2 x 2 grid of one glyph into an atlas that is just large */
+  /* enough for it, since padding is only needed between glyphs.     */
+  static int
+  test_exact( void )
+  {
+    FT_Atlas_GlyphRec  glyphs[5];
+    FT_Bitmap          exact;
+    FT_Atlas           atlas;
+    FT_UInt            num_done;
+    FT_Error           error;
+    int                i, failed = 0;
+
+
+    FT_Set_Pixel_Sizes( face, 0, 48 );
+    if ( FT_Load_Char( face, 'M', FT_LOAD_RENDER ) )
+      return 1;
+
+    FT_Bitmap_Init( &exact );
+    exact.width      = 2 * face->glyph->bitmap.width + PADDING;
+    exact.rows       = 2 * face->glyph->bitmap.rows + PADDING;
+    exact.pitch      = (int)exact.width;
+    exact.pixel_mode = FT_PIXEL_MODE_GRAY;
+    exact.num_grays  = 256;
+    exact.buffer     = malloc( exact.rows * exact.width );
+
+    if ( FT_Atlas_New( library, &exact, PADDING, &atlas ) )
+      return 1;
+
+    memset( glyphs, 0, sizeof ( glyphs ) );
+    for ( i = 0; i < 5; i++ )
+      glyphs[i].glyph_index = FT_Get_Char_Index( face, 'M' );
+
+    error = FT_Atlas_Render_Glyphs( atlas, face, FT_LOAD_DEFAULT,
+                                    5, glyphs, &num_done );
+    if ( error != FT_Err_Raster_Overflow || num_done != 4 )
+    {
+      printf( "exact atlas: error 0x%x after %u glyphs\n", error, num_done );
+      failed = 1;
+    }
+    else if ( glyphs[3].x + glyphs[3].width != exact.width ||
+              glyphs[3].y + glyphs[3].rows  != exact.rows  )
+    {
+      printf( "exact atlas: last glyph at (%d, %d)\n",
+              glyphs[3].x, glyphs[3].y );
+      failed = 1;
+    }
+
+    FT_Atlas_Done( atlas );
+    free( exact.buffer );
+
+    return failed;
+  }
+
+
+  int
+  main( int     argc,
+        char**  argv )
+  {
+    const char*  testdata_dir = getenv( "FREETYPE_TESTS_DATA_DIR" );
+    char         filepath[FILENAME_MAX];
+    FT_Atlas     atlas;
+    int          failed = 0;
+
+
+    if ( argc > 1 )
+      snprintf( filepath, sizeof ( filepath ), "%s", argv[1] );
+    else
+      snprintf( filepath, sizeof ( filepath ), "%s/%s",
+                testdata_dir ? testdata_dir : "../tests/data",
+                "As.I.Lay.Dying.ttf" );
+
+    FT_Init_FreeType( &library );
+
+    if ( FT_New_Face( library, filepath, 0, &face ) )
+    {
+      fprintf( stderr, "Could not open file: %s\n", filepath );
+      return 1;
+    }
+
+    FT_Bitmap_Init( &target );
+    target.width      = ATLAS_SIZE;
+    target.rows       = ATLAS_SIZE;
+    target.pitch      = ATLAS_SIZE;
+    target.pixel_mode = FT_PIXEL_MODE_GRAY;
+    target.num_grays  = 256;
+    target.buffer     = pixels;
+
+    if ( FT_Atlas_New( library, &target, PADDING, &atlas ) )
+    {
+      fprintf( stderr, "cannot create the atlas\n" );
+      return 1;
+    }
+
+    failed |= test_flags( atlas, FT_LOAD_DEFAULT );
+    failed |= test_flags( atlas, FT_LOAD_TARGET_LIGHT );
+    failed |= test_flags( atlas, FT_LOAD_NO_HINTING );
+    failed |= test_flags( atlas, FT_LOAD_TARGET_MONO );
+    failed |= test_full( atlas );
+    failed |= test_exact();
+
+    FT_Atlas_Done( atlas );
+    FT_Done_FreeType( library );
+
+    return failed;
+  }
+
+/* EOF */
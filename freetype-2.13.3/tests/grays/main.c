@@ -0,0 +1,587 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ft2build.h>
+#include <freetype/freetype.h>
+#include <freetype/ftbitmap.h>
+#include <freetype/ftoutln.h>
+#include <freetype/ftrender.h>
+#include <freetype/ftmodapi.h>
+
+
+  /*
+   * Check the optional code paths of the `smooth' rasterizer against its
+   * default ones.
+   *
+   * - Small outlines rendered with the dense accumulation buffer must
+   *   have the same coverage as with cell lists (we allow a difference of
+   *   one level).
+   *
+   * - Large outlines rendered with a heap cell pool must give the same
+   *   bitmap as with the bands of the fixed pool.  In direct mode,
+   *   growing the pool after a band has been split must not make the
+   *   rasterizer emit any span twice.
+   *
+   * Timings are in `tests/bench/grays.c'.
+   */
+
+  /* see `FT_GRAY_DENSE_RENDER' and `FT_GRAY_POOL_LIMIT' */
+  /* in `src/smooth/ftgrays.h'                            */
+#define DENSE_RENDER  FT_MAKE_TAG( 'd', 'e', 'n', 's' )
+#define POOL_LIMIT    FT_MAKE_TAG( 'p', 'o', 'o', 'l' )
+
+  /* a limit that lets the pool grow, but not enough to avoid bands */
+#define SMALL_POOL_LIMIT  ( 3 * FT_RENDER_POOL_SIZE )
+
+
+  static FT_Library  library;
+  static FT_Library  flaky;         /* fails the first pool allocation   */
+  static int         flaky_count;   /* pool allocations so far           */
+  static FT_Outline  outlines[16];
+  static int         num_outlines;
+
+
+  static void*
+  flaky_alloc( FT_Memory  memory,
+               long       size )
+  {
+    FT_UNUSED( memory );
+
+
+    if ( size > FT_RENDER_POOL_SIZE && flaky_count++ == 0 )
+      return NULL;
+
+    return malloc( (size_t)size );
+  }
+
+
+  static void
+  flaky_free( FT_Memory  memory,
+              void*      block )
+  {
+    FT_UNUSED( memory );
+
+    free( block );
+  }
+
+
+  static void*
+  flaky_realloc( FT_Memory  memory,
+                 long       cur_size,
+                 long       new_size,
+                 void*      block )
+  {
+    FT_UNUSED( memory );
+    FT_UNUSED( cur_size );
+
+    return realloc( block, (size_t)new_size );
+  }
+
+
+  static struct FT_MemoryRec_  flaky_memory =
+  {
+    NULL, flaky_alloc, flaky_free, flaky_realloc
+  };
+
+
+  static void
+  set_mode( FT_Library     lib,
+            unsigned long  tag,
+            void*          data )
+  {
+    FT_Renderer   renderer = (FT_Renderer)FT_Get_Module( lib, "smooth" );
+    FT_Parameter  param;
+
+
+    param.tag  = tag;
+    param.data = data;
+
+    if ( !renderer || FT_Set_Renderer( lib, renderer, 1, &param ) )
+    {
+      fprintf( stderr, "cannot configure the smooth renderer\n" );
+      exit( 1 );
+    }
+  }
+
+
+  static void
+  set_dense( int  on )
+  {
+    set_mode( library, DENSE_RENDER, &on );
+  }
+
+
+  static void
+  set_pool_limit( FT_Library     lib,
+                  unsigned long  limit )
+  {
+    set_mode( lib, POOL_LIMIT, &limit );
+  }
+
+
+  static unsigned int  rand_state = 1;
+
+  static int
+  next_rand( int  n )
+  {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return (int)( rand_state % (unsigned int)n );
+  }
+
+
+  /* Build an outline of `size' pixels from a list of points in a 0..64 */
+  /* design grid; `tags' holds one character per point: `l' for an on   */
+  /* point, `q' for a conic and `c' for a cubic control point, and `|'  */
+  /* to end a contour.                                                  */
+  static void
+  add_outline( const char*  tags,
+               const int*   xy,
+               int          size,
+               int          flags )
+  {
+    FT_Outline*  outline = &outlines[num_outlines++];
+    int          n_points = 0, n_contours = 0;
+    const char*  p;
+
+
+    for ( p = tags; *p; p++ )
+    {
+      if ( *p == '|' )
+        n_contours++;
+      else
+        n_points++;
+    }
+
+    FT_Outline_New( library,
+                    (FT_UInt)n_points,
+                    n_contours,
+                    outline );
+    outline->n_points   = 0;
+    outline->n_contours = 0;
+    outline->flags     |= flags;
+
+    for ( p = tags; *p; p++ )
+    {
+      short  n = outline->n_points;
+
+
+      if ( *p == '|' )
+      {
+        outline->contours[outline->n_contours++] = (short)( n - 1 );
+        continue;
+      }
+
+      /* 26.6 coordinates plus a random subpixel offset */
+      outline->points[n].x = *xy++ * size + next_rand( 64 );
+      outline->points[n].y = *xy++ * size + next_rand( 64 );
+      outline->tags[n]     = *p == 'l' ? FT_CURVE_TAG_ON
+                           : *p == 'q' ? FT_CURVE_TAG_CONIC
+                                       : FT_CURVE_TAG_CUBIC;
+      outline->n_points++;
+    }
+  }
+
+
+  /* Lines, conics, cubics, and self-intersections. */
+  static void
+  add_shapes( int  size )
+  {
+    /* a ring of conics */
+    static const int  ring[] =
+    {
+      32,  0, 64,  0, 64, 32, 64, 64, 32, 64,  0, 64,  0, 32,  0,  0,
+      32, 16, 16, 16, 16, 32, 16, 48, 32, 48, 48, 48, 48, 32, 48, 16,
+    };
+    /* a blob of cubics */
+    static const int  blob[] =
+    {
+       0, 32,  0, 64, 40, 60, 64, 40, 70, 20, 40, -4, 20,  8,
+    };
+    /* a pentagram, whose centre depends on the fill rule */
+    static const int  star[] =
+    {
+      32, 64, 13,  2, 63, 40,  1, 40, 51,  2,
+    };
+    int  random_xy[24];
+    int  i;
+
+
+    add_outline( "lqlqlqlq|lqlqlqlq|", ring, size, 0 );
+    add_outline( "lcclccl|", blob, size, 0 );
+    add_outline( "lllll|", star, size, 0 );
+    add_outline( "lllll|", star, size, FT_OUTLINE_EVEN_ODD_FILL );
+
+    for ( i = 0; i < 24; i++ )
+      random_xy[i] = next_rand( 65 );
+    add_outline( "llllllllllll|", random_xy, size, 0 );
+    add_outline( "lqlqlqlqlqlq|", random_xy, size, FT_OUTLINE_EVEN_ODD_FILL );
+  }
+
+
+  /* Append a grid of `n' x `n' rings of conics, `size' pixels wide, */
+  /* starting `x' pixels to the right of the origin.                 */
+  static void
+  put_rings( FT_Outline*  outline,
+             int          x,
+             int          size,
+             int          n )
+  {
+    FT_Pos  step = size * 64 / n;
+    int     i, j, k;
+
+
+    for ( i = 0; i < n; i++ )
+    {
+      for ( j = 0; j < n; j++ )
+      {
+        /* outer contour clockwise, inner one counter-clockwise */
+        static const int  ring[2][16] =
+        {
+          { 4, 0, 8, 0, 8, 4, 8, 8, 4, 8, 0, 8, 0, 4, 0, 0 },
+          { 4, 2, 2, 2, 2, 4, 2, 6, 4, 6, 6, 6, 6, 4, 6, 2 },
+        };
+
+
+        for ( k = 0; k < 16; k++ )
+        {
+          int         c = k / 8;
+          short       p = outline->n_points++;
+          FT_Vector*  v = &outline->points[p];
+
+
+          v->x = x * 64 + i * step + ring[c][( k % 8 ) * 2] * step / 8 + 13;
+          v->y = j * step + ring[c][( k % 8 ) * 2 + 1] * step / 8 + 27;
+
+          outline->tags[p] = ( k % 2 ) ? FT_CURVE_TAG_CONIC
+                                       : FT_CURVE_TAG_ON;
+
+          if ( k % 8 == 7 )
+            outline->contours[outline->n_contours++] = p;
+        }
+      }
+    }
+  }
+
+
+  /* A grid of rings, so that there are many cells on every scanline. */
+  static void
+  add_rings( int  size,
+             int  n )
+  {
+    FT_Outline*  outline = &outlines[num_outlines++];
+
+
+    FT_Outline_New( library,
+                    (FT_UInt)( n * n * 16 ),
+                    n * n * 2,
+                    outline );
+    outline->n_points   = 0;
+    outline->n_contours = 0;
+
+    put_rings( outline, 0, size, n );
+  }
+
+
+  /* A bar on the left and a grid of rings on the right, so that the */
+  /* right half of a band needs many more cells than the left half.  */
+  static void
+  add_lopsided( int  size )
+  {
+    FT_Outline*  outline = &outlines[num_outlines++];
+    int          n       = 12;
+    int          k;
+
+
+    FT_Outline_New( library,
+                    (FT_UInt)( n * n * 16 + 4 ),
+                    n * n * 2 + 1,
+                    outline );
+    outline->n_points   = 4;
+    outline->n_contours = 1;
+
+    for ( k = 0; k < 4; k++ )
+    {
+      outline->points[k].x = ( k == 1 || k == 2 ) ? size * 16 : 64;
+      outline->points[k].y = ( k >= 2 ) ? size * 64 : 0;
+      outline->tags[k]     = FT_CURVE_TAG_ON;
+    }
+    outline->contours[0] = 3;
+
+    put_rings( outline, size / 2, size / 2, n );
+  }
+
+
+  static void
+  done_outlines( void )
+  {
+    int  i;
+
+
+    for ( i = 0; i < num_outlines; i++ )
+      FT_Outline_Done( library, &outlines[i] );
+    num_outlines = 0;
+  }
+
+
+  /* Render an outline to a fresh bitmap covering its control box. */
+  static unsigned char*
+  render( FT_Outline*  outline,
+          FT_Bitmap*   bitmap )
+  {
+    FT_BBox           cbox;
+    FT_Raster_Params  params;
+
+
+    FT_Outline_Get_CBox( outline, &cbox );
+    cbox.xMin &= ~63;
+    cbox.yMin &= ~63;
+    cbox.xMax  = ( cbox.xMax + 63 ) & ~63;
+    cbox.yMax  = ( cbox.yMax + 63 ) & ~63;
+
+    FT_Bitmap_Init( bitmap );
+    bitmap->width      = (unsigned int)( ( cbox.xMax - cbox.xMin ) >> 6 );
+    bitmap->rows       = (unsigned int)( ( cbox.yMax - cbox.yMin ) >> 6 );
+    bitmap->pitch      = (int)bitmap->width;
+    bitmap->pixel_mode = FT_PIXEL_MODE_GRAY;
+    bitmap->num_grays  = 256;
+    bitmap->buffer     = calloc( bitmap->rows, bitmap->width );
+
+    FT_Outline_Translate( outline, -cbox.xMin, -cbox.yMin );
+
+    params.target = bitmap;
+    params.source = outline;
+    params.flags  = FT_RASTER_FLAG_AA;
+
+    if ( FT_Outline_Render( library, outline, &params ) )
+    {
+      fprintf( stderr, "rendering failed\n" );
+      exit( 1 );
+    }
+
+    FT_Outline_Translate( outline, cbox.xMin, cbox.yMin );
+
+    return bitmap->buffer;
+  }
+
+
+  typedef struct  Spans_
+  {
+    unsigned char*  buffer;   /* coverage, row by row        */
+    unsigned char*  seen;     /* pixels that got a span      */
+    unsigned int    width;
+    long            count;    /* number of spans             */
+    int             overlap;  /* a pixel got more than one   */
+
+  } Spans;
+
+
+  static void
+  record_spans( int             y,
+                int             count,
+                const FT_Span*  spans,
+                void*           user )
+  {
+    Spans*  s = (Spans*)user;
+    int     i, x;
+
+
+    for ( i = 0; i < count; i++ )
+    {
+      for ( x = spans[i].x; x < spans[i].x + spans[i].len; x++ )
+      {
+        size_t  pos = (size_t)y * s->width + (size_t)x;
+
+
+        s->overlap    |= s->seen[pos];
+        s->seen[pos]   = 1;
+        s->buffer[pos] = spans[i].coverage;
+      }
+      s->count++;
+    }
+  }
+
+
+  /* Render an outline in direct mode and record its spans. */
+  static void
+  render_direct( FT_Library   lib,
+                 FT_Outline*  outline,
+                 Spans*       spans )
+  {
+    FT_BBox           cbox;
+    FT_Raster_Params  params;
+    unsigned int      rows;
+
+
+    FT_Outline_Get_CBox( outline, &cbox );
+    cbox.xMin >>= 6;
+    cbox.yMin >>= 6;
+    cbox.xMax  = ( cbox.xMax + 63 ) >> 6;
+    cbox.yMax  = ( cbox.yMax + 63 ) >> 6;
+
+    spans->width   = (unsigned int)( cbox.xMax - cbox.xMin );
+    rows           = (unsigned int)( cbox.yMax - cbox.yMin );
+    spans->buffer  = calloc( rows, spans->width );
+    spans->seen    = calloc( rows, spans->width );
+    spans->count   = 0;
+    spans->overlap = 0;
+
+    FT_Outline_Translate( outline, -cbox.xMin * 64, -cbox.yMin * 64 );
+
+    params.source     = outline;
+    params.flags      = FT_RASTER_FLAG_AA | FT_RASTER_FLAG_DIRECT |
+                        FT_RASTER_FLAG_CLIP;
+    params.gray_spans = record_spans;
+    params.user       = spans;
+
+    params.clip_box.xMin = 0;
+    params.clip_box.yMin = 0;
+    params.clip_box.xMax = (FT_Pos)spans->width;
+    params.clip_box.yMax = (FT_Pos)rows;
+
+    if ( FT_Outline_Render( lib, outline, &params ) )
+    {
+      fprintf( stderr, "rendering failed\n" );
+      exit( 1 );
+    }
+
+    FT_Outline_Translate( outline, cbox.xMin * 64, cbox.yMin * 64 );
+  }
+
+
+  static int
+  test_dense( void )
+  {
+    static const int  sizes[] = { 6, 10, 12, 16, 24, 32, 48, 64, 100 };
+
+    size_t  s;
+    int     i, failed = 0;
+
+
+    for ( s = 0; s < sizeof ( sizes ) / sizeof ( *sizes ); s++ )
+    {
+      add_shapes( sizes[s] );
+
+      for ( i = 0; i < num_outlines; i++ )
+      {
+        FT_Bitmap       a, b;
+        unsigned char*  pa;
+        unsigned char*  pb;
+        unsigned int    j;
+
+
+        set_dense( 1 );
+        pa = render( &outlines[i], &a );
+        set_dense( 0 );
+        pb = render( &outlines[i], &b );
+
+        for ( j = 0; j < a.rows * a.width; j++ )
+        {
+          if ( abs( pa[j] - pb[j] ) > 1 )
+          {
+            printf( "dense, size %d, outline %d: pixel (%u, %u) is %d,"
+                    " expected %d\n",
+                    sizes[s], i, j % a.width, j / a.width, pa[j], pb[j] );
+            failed = 1;
+            break;
+          }
+        }
+
+        free( pa );
+        free( pb );
+      }
+
+      done_outlines();
+    }
+
+    return failed;
+  }
+
+
+  static int
+  test_pool( void )
+  {
+    static const int  sizes[] = { 100, 200, 500, 1000 };
+
+    size_t  s;
+    int     i, failed = 0;
+
+
+    for ( s = 0; s < sizeof ( sizes ) / sizeof ( *sizes ); s++ )
+    {
+      add_rings( sizes[s], 1 );
+      add_rings( sizes[s], 4 );
+      add_rings( sizes[s], 12 );
+      add_lopsided( sizes[s] );
+
+      for ( i = 0; i < num_outlines; i++ )
+      {
+        FT_Bitmap       a, b;
+        unsigned char*  pa;
+        unsigned char*  pb;
+        Spans           sa, sb;
+
+
+        set_pool_limit( library, 64 << 20 );
+        pa = render( &outlines[i], &a );
+        set_pool_limit( library, 0 );
+        pb = render( &outlines[i], &b );
+
+        if ( memcmp( pa, pb, a.rows * a.width ) )
+        {
+          printf( "pool, size %d, outline %d: bitmaps differ\n",
+                  sizes[s], i );
+          failed = 1;
+        }
+
+        flaky_count = 0;
+        render_direct( flaky, &outlines[i], &sa );
+        render_direct( library, &outlines[i], &sb );
+
+        if ( sa.overlap || memcmp( sa.buffer, sb.buffer, a.rows * a.width ) )
+        {
+          printf( "pool, size %d, outline %d: %ld spans%s,"
+                  " %ld without heap pool\n",
+                  sizes[s], i, sa.count, sa.overlap ? " (overlapping)" : "",
+                  sb.count );
+          failed = 1;
+        }
+
+        free( pa );
+        free( pb );
+        free( sa.buffer );
+        free( sa.seen );
+        free( sb.buffer );
+        free( sb.seen );
+      }
+
+      done_outlines();
+    }
+
+    return failed;
+  }
+
+
+  int
+  main( void )
+  {
+    int  failed = 0;
+
+
+    FT_Init_FreeType( &library );
+    FT_New_Library( &flaky_memory, &flaky );
+    FT_Add_Default_Modules( flaky );
+    set_pool_limit( flaky, SMALL_POOL_LIMIT );
+
+    failed |= test_dense();
+    failed |= test_pool();
+
+    FT_Done_Library( flaky );
+    FT_Done_FreeType( library );
+
+    return failed;
+  }
+
+/* EOF */